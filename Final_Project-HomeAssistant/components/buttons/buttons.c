@@ -1,3 +1,5 @@
+#include "hal/gpio_ll.h"
+
 #include "buttons.h"
 
 static const char *TAG = "BUTTONS";
@@ -21,6 +23,10 @@ static void IRAM_ATTR gpio_isr_handler(void* arg) {
     event.event = gpio_get_level(gpio_num);
     event.timestamp = esp_timer_get_time();
 
+    // Level interrupts, so the pins can wake the chip from light sleep. Waiting for the
+    // opposite level next gives one interrupt per change, like an edge interrupt.
+    gpio_ll_set_intr_type(GPIO_LL_GET_HW(GPIO_PORT_0), gpio_num, event.event ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+
     xQueueSendFromISR(button_queue, &event, NULL);
 }
 
@@ -29,7 +35,7 @@ void buttons_init() {
         .mode = GPIO_MODE_INPUT,
         .pull_up_en = GPIO_PULLUP_ENABLE,
         .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type = GPIO_INTR_ANYEDGE
+        .intr_type = GPIO_INTR_DISABLE // armed per pin below, for the level it does not have yet
     };
     #if CONFIG_POTENTIOMETER_ACTIVE
         gpioConfigIn.pin_bit_mask = (1 << BUTTON_GPIO);
@@ -44,6 +50,12 @@ void buttons_init() {
         gpioConfigIn.pull_down_en = GPIO_PULLDOWN_ENABLE;
     #endif
     gpio_config(&gpioConfigIn);
+    for (gpio_num_t gpio = 0; gpio < GPIO_NUM_MAX; gpio++) {
+        if (gpioConfigIn.pin_bit_mask & (1ULL << gpio)) {
+            gpio_set_intr_type(gpio, gpio_get_level(gpio) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+            gpio_intr_enable(gpio);
+        }
+    }
 
     gpio_install_isr_service(0);
     esp_err_t err;
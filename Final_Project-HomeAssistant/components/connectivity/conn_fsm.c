@@ -0,0 +1,117 @@
+#include "conn_fsm.h"
+
+#define CONN_MAX_BACKOFF_SHIFT  16
+
+static uint32_t enter_connecting(conn_fsm_t* pFsm) {
+    pFsm->state = CONN_STATE_CONNECTING;
+    pFsm->timeout_ms = pFsm->config.connect_timeout_ms;
+    return pFsm->wifiUp ? CONN_ACTION_CONNECT_MQTT : CONN_ACTION_CONNECT_WIFI;
+}
+
+static uint32_t enter_backoff(conn_fsm_t* pFsm, uint32_t random) {
+    pFsm->state = CONN_STATE_BACKOFF;
+    pFsm->timeout_ms = conn_fsm_backoff_ms(&pFsm->config, pFsm->attempt, random);
+    if (pFsm->attempt < UINT8_MAX) {
+        pFsm->attempt++;
+    }
+    return CONN_ACTION_NONE;
+}
+
+void conn_fsm_init(conn_fsm_t* pFsm, const conn_fsm_config_t* pConfig) {
+    pFsm->config = *pConfig;
+    pFsm->state = CONN_STATE_IDLE;
+    pFsm->wifiUp = false;
+    pFsm->mqttUp = false;
+    pFsm->attempt = 0;
+    pFsm->timeout_ms = 0;
+    pFsm->reconnects = 0;
+}
+
+/*
+ * @brief Exponential backoff with jitter
+ *
+ *  The delay doubles with every failed attempt up to the maximum, then a random value
+ *  between half and the full delay is taken, so devices do not reconnect in lockstep.
+ */
+uint32_t conn_fsm_backoff_ms(const conn_fsm_config_t* pConfig, uint8_t attempt, uint32_t random) {
+    uint8_t shift = (attempt < CONN_MAX_BACKOFF_SHIFT) ? attempt : CONN_MAX_BACKOFF_SHIFT;
+    uint64_t delay_ms = (uint64_t)pConfig->backoff_base_ms << shift;
+    if (delay_ms > pConfig->backoff_max_ms) {
+        delay_ms = pConfig->backoff_max_ms;
+    }
+    uint32_t half_ms = (uint32_t)delay_ms / 2;
+    return half_ms + random % ((uint32_t)delay_ms - half_ms + 1);
+}
+
+/*
+ * @brief Feeds one event into the state machine
+ *
+ * @param random random value for the backoff jitter
+ * @return CONN_ACTION_* bits to execute, afterwards pFsm->timeout_ms tells which timer to start.
+ *         The timer only matters in CONNECTING and BACKOFF, 0 keeps the running one.
+ */
+uint32_t conn_fsm_handle(conn_fsm_t* pFsm, conn_event_t event, uint32_t random) {
+    pFsm->timeout_ms = 0;
+
+    // The link flags are tracked in every state, they decide where the next attempt starts
+    switch (event) {
+    case CONN_EVENT_WIFI_UP:    pFsm->wifiUp = true; break;
+    case CONN_EVENT_WIFI_DOWN:  pFsm->wifiUp = false; pFsm->mqttUp = false; break;
+    case CONN_EVENT_MQTT_UP:    pFsm->mqttUp = true; break;
+    case CONN_EVENT_MQTT_DOWN:  pFsm->mqttUp = false; break;
+    default: break;
+    }
+
+    switch (pFsm->state) {
+    case CONN_STATE_IDLE:
+        if (event == CONN_EVENT_START) {
+            return enter_connecting(pFsm);
+        }
+        break;
+
+    case CONN_STATE_CONNECTING:
+        switch (event) {
+        case CONN_EVENT_WIFI_UP:
+            return enter_connecting(pFsm); // continue with the broker, with a fresh timeout
+        case CONN_EVENT_MQTT_UP:
+            pFsm->state = CONN_STATE_ONLINE;
+            pFsm->attempt = 0;
+            break;
+        case CONN_EVENT_WIFI_DOWN:
+        case CONN_EVENT_MQTT_DOWN:
+        case CONN_EVENT_TIMEOUT:
+            return enter_backoff(pFsm, random);
+        default:
+            break;
+        }
+        break;
+
+    case CONN_STATE_ONLINE:
+        if (event == CONN_EVENT_WIFI_DOWN || event == CONN_EVENT_MQTT_DOWN) {
+            pFsm->reconnects++;
+            return enter_backoff(pFsm, random);
+        }
+        break;
+
+    case CONN_STATE_BACKOFF:
+        if (event == CONN_EVENT_TIMEOUT) {
+            return enter_connecting(pFsm);
+        }
+        if (event == CONN_EVENT_MQTT_UP) {
+            pFsm->state = CONN_STATE_ONLINE;
+            pFsm->attempt = 0;
+        }
+        break;
+    }
+    return CONN_ACTION_NONE;
+}
+
+const char* conn_fsm_state_name(conn_state_t state) {
+    switch (state) {
+    case CONN_STATE_IDLE:       return "IDLE";
+    case CONN_STATE_CONNECTING: return "CONNECTING";
+    case CONN_STATE_ONLINE:     return "ONLINE";
+    case CONN_STATE_BACKOFF:    return "BACKOFF";
+    }
+    return "UNKNOWN";
+}
@@ -0,0 +1,182 @@
+#include "esp_event.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include "connectivity.h"
+#include "wifi_station.h"
+#include "mqtt_impl.h"
+
+static const char *TAG = "CONNECTIVITY";
+
+static conn_fsm_t gFsm; // only touched by the connectivity task
+static QueueHandle_t gEventQueue = NULL;
+static EventGroupHandle_t gEventGroup = NULL;
+
+static portMUX_TYPE gMetricsLock = portMUX_INITIALIZER_UNLOCKED;
+static connectivity_metrics_t gMetrics = { 0 };
+
+static void post_event(conn_event_t event);
+static void on_network_event(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+static void on_mqtt_connection(bool connected);
+static void execute_actions(uint32_t actions);
+static void update_status(void);
+static void connectivity_task(void* arg);
+
+// ----- implementation -----
+
+void post_event(conn_event_t event) {
+    if (xQueueSend(gEventQueue, &event, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Event queue full, event %d dropped", event);
+    }
+}
+
+void on_network_event(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        post_event(CONN_EVENT_WIFI_DOWN);
+    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+        post_event(CONN_EVENT_WIFI_UP);
+    }
+}
+
+void on_mqtt_connection(bool connected) {
+    post_event(connected ? CONN_EVENT_MQTT_UP : CONN_EVENT_MQTT_DOWN);
+}
+
+void execute_actions(uint32_t actions) {
+    if (actions & CONN_ACTION_CONNECT_WIFI) {
+        staticwifi_connect();
+    }
+    if (actions & CONN_ACTION_CONNECT_MQTT) {
+        mqtt_start();
+    }
+}
+
+void update_status(void) {
+    const EventBits_t all = CONNECTIVITY_WIFI_BIT | CONNECTIVITY_MQTT_BIT | CONNECTIVITY_ONLINE_BIT;
+    EventBits_t bits = 0;
+    if (gFsm.wifiUp) {
+        bits |= CONNECTIVITY_WIFI_BIT;
+    }
+    if (gFsm.mqttUp) {
+        bits |= CONNECTIVITY_MQTT_BIT;
+    }
+    if (gFsm.state == CONN_STATE_ONLINE) {
+        bits |= CONNECTIVITY_ONLINE_BIT;
+    }
+    xEventGroupClearBits(gEventGroup, all & ~bits);
+    xEventGroupSetBits(gEventGroup, bits);
+
+    int64_t now_us = esp_timer_get_time();
+    taskENTER_CRITICAL(&gMetricsLock);
+    gMetrics.state = gFsm.state;
+    gMetrics.reconnects = gFsm.reconnects;
+    if (gFsm.wifiUp && gMetrics.boot_to_wifi_us == 0) {
+        gMetrics.boot_to_wifi_us = now_us;
+    }
+    if (gFsm.state == CONN_STATE_ONLINE && gMetrics.boot_to_online_us == 0) {
+        gMetrics.boot_to_online_us = now_us;
+    }
+    taskEXIT_CRITICAL(&gMetricsLock);
+}
+
+/*
+ * @brief Runs the state machine on Wi-Fi and MQTT events and on its own timer
+ *
+ *  All connection attempts start here, neither the Wi-Fi driver nor the MQTT client
+ *  reconnect on their own.
+ */
+void connectivity_task(void* arg) {
+    int64_t deadline_us = 0;
+
+    while (true) {
+        TickType_t wait = portMAX_DELAY;
+        if (deadline_us != 0) {
+            int64_t remaining_us = deadline_us - esp_timer_get_time();
+            // One tick more, pdMS_TO_TICKS rounds down and the timeout must not fire early
+            wait = (remaining_us > 0) ? pdMS_TO_TICKS((remaining_us + 999) / 1000) + 1 : 0;
+        }
+
+        conn_event_t event;
+        if (xQueueReceive(gEventQueue, &event, wait) != pdTRUE) {
+            event = CONN_EVENT_TIMEOUT;
+            deadline_us = 0;
+        }
+
+        conn_state_t previous = gFsm.state;
+        uint32_t actions = conn_fsm_handle(&gFsm, event, esp_random());
+        if (gFsm.timeout_ms != 0) {
+            deadline_us = esp_timer_get_time() + (int64_t)gFsm.timeout_ms * 1000;
+        } else if (gFsm.state == CONN_STATE_ONLINE || gFsm.state == CONN_STATE_IDLE) {
+            deadline_us = 0;
+        }
+
+        if (gFsm.state != previous) {
+            if (gFsm.state == CONN_STATE_BACKOFF) {
+                ESP_LOGW(TAG, "%s -> BACKOFF, next attempt in %" PRIu32 " ms", conn_fsm_state_name(previous), gFsm.timeout_ms);
+            } else {
+                ESP_LOGI(TAG, "%s -> %s", conn_fsm_state_name(previous), conn_fsm_state_name(gFsm.state));
+            }
+        }
+        execute_actions(actions);
+        update_status();
+    }
+}
+
+/*
+ * @brief Brings up Wi-Fi and MQTT in the background
+ *
+ *  Returns right away, tasks may publish before the device is online. Their messages
+ *  wait in the MQTT outbox until the broker is reachable.
+ */
+esp_err_t connectivity_start(void) {
+    gEventQueue = xQueueCreate(CONNECTIVITY_EVENT_QUEUE_LENGTH, sizeof(conn_event_t));
+    gEventGroup = xEventGroupCreate();
+    if (gEventQueue == NULL || gEventGroup == NULL) {
+        ESP_LOGE(TAG, "Failed to create event queue");
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = staticwifi_start();
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = mqtt_init();
+    if (err != ESP_OK) {
+        return err;
+    }
+    mqtt_set_connection_callback(on_mqtt_connection);
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &on_network_event, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &on_network_event, NULL));
+
+    const conn_fsm_config_t config = {
+        .backoff_base_ms = CONNECTIVITY_BACKOFF_BASE_MS,
+        .backoff_max_ms = CONNECTIVITY_BACKOFF_MAX_MS,
+        .connect_timeout_ms = CONNECTIVITY_CONNECT_TIMEOUT_MS,
+    };
+    conn_fsm_init(&gFsm, &config);
+    if (xTaskCreate(connectivity_task, "connectivity", CONNECTIVITY_TASK_STACKSIZE, NULL, CONNECTIVITY_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create connectivity task");
+        return ESP_ERR_NO_MEM;
+    }
+    post_event(CONN_EVENT_START);
+    return ESP_OK;
+}
+
+EventGroupHandle_t connectivity_get_event_group(void) {
+    return gEventGroup;
+}
+
+bool connectivity_wait_online(TickType_t timeout) {
+    EventBits_t bits = xEventGroupWaitBits(gEventGroup, CONNECTIVITY_ONLINE_BIT, pdFALSE, pdTRUE, timeout);
+    return (bits & CONNECTIVITY_ONLINE_BIT) != 0;
+}
+
+void connectivity_get_metrics(connectivity_metrics_t* pMetrics) {
+    taskENTER_CRITICAL(&gMetricsLock);
+    *pMetrics = gMetrics;
+    taskEXIT_CRITICAL(&gMetricsLock);
+    pMetrics->boot_to_first_publish_us = mqtt_get_first_publish_us();
+}
@@ -0,0 +1,142 @@
+#include <string.h>
+
+#include "host_test.h"
+#include "conn_fsm.h"
+
+// Transitions of the connection state machine, driven with simulated events
+
+#define BASE_MS     1000
+#define MAX_MS      60000
+#define TIMEOUT_MS  15000
+
+static const conn_fsm_config_t gConfig = {
+    .backoff_base_ms = BASE_MS,
+    .backoff_max_ms = MAX_MS,
+    .connect_timeout_ms = TIMEOUT_MS,
+};
+
+typedef struct {
+    conn_state_t from;
+    bool wifiUp;
+    conn_event_t event;
+    conn_state_t to;
+    uint32_t actions;
+    uint32_t timeout_ms;    // 0 = no new timer, UINT32_MAX = a backoff delay
+} transition_t;
+
+#define BACKOFF     UINT32_MAX
+
+// Every state with every event, with and without Wi-Fi before the event
+static const transition_t gTransitions[] = {
+    { CONN_STATE_IDLE, false, CONN_EVENT_START,     CONN_STATE_CONNECTING, CONN_ACTION_CONNECT_WIFI, TIMEOUT_MS },
+    { CONN_STATE_IDLE, true,  CONN_EVENT_START,     CONN_STATE_CONNECTING, CONN_ACTION_CONNECT_MQTT, TIMEOUT_MS },
+    { CONN_STATE_IDLE, false, CONN_EVENT_WIFI_UP,   CONN_STATE_IDLE, CONN_ACTION_NONE, 0 },
+    { CONN_STATE_IDLE, true,  CONN_EVENT_WIFI_DOWN, CONN_STATE_IDLE, CONN_ACTION_NONE, 0 },
+    { CONN_STATE_IDLE, true,  CONN_EVENT_MQTT_UP,   CONN_STATE_IDLE, CONN_ACTION_NONE, 0 },
+    { CONN_STATE_IDLE, true,  CONN_EVENT_MQTT_DOWN, CONN_STATE_IDLE, CONN_ACTION_NONE, 0 },
+    { CONN_STATE_IDLE, false, CONN_EVENT_TIMEOUT,   CONN_STATE_IDLE, CONN_ACTION_NONE, 0 },
+
+    { CONN_STATE_CONNECTING, false, CONN_EVENT_START,     CONN_STATE_CONNECTING, CONN_ACTION_NONE, 0 },
+    { CONN_STATE_CONNECTING, false, CONN_EVENT_WIFI_UP,   CONN_STATE_CONNECTING, CONN_ACTION_CONNECT_MQTT, TIMEOUT_MS },
+    { CONN_STATE_CONNECTING, true,  CONN_EVENT_WIFI_DOWN, CONN_STATE_BACKOFF, CONN_ACTION_NONE, BACKOFF },
+    { CONN_STATE_CONNECTING, true,  CONN_EVENT_MQTT_UP,   CONN_STATE_ONLINE, CONN_ACTION_NONE, 0 },
+    { CONN_STATE_CONNECTING, true,  CONN_EVENT_MQTT_DOWN, CONN_STATE_BACKOFF, CONN_ACTION_NONE, BACKOFF },
+    { CONN_STATE_CONNECTING, false, CONN_EVENT_TIMEOUT,   CONN_STATE_BACKOFF, CONN_ACTION_NONE, BACKOFF },
+    { CONN_STATE_CONNECTING, true,  CONN_EVENT_TIMEOUT,   CONN_STATE_BACKOFF, CONN_ACTION_NONE, BACKOFF },
+
+    { CONN_STATE_ONLINE, true, CONN_EVENT_START,     CONN_STATE_ONLINE, CONN_ACTION_NONE, 0 },
+    { CONN_STATE_ONLINE, true, CONN_EVENT_WIFI_UP,   CONN_STATE_ONLINE, CONN_ACTION_NONE, 0 },
+    { CONN_STATE_ONLINE, true, CONN_EVENT_WIFI_DOWN, CONN_STATE_BACKOFF, CONN_ACTION_NONE, BACKOFF },
+    { CONN_STATE_ONLINE, true, CONN_EVENT_MQTT_UP,   CONN_STATE_ONLINE, CONN_ACTION_NONE, 0 },
+    { CONN_STATE_ONLINE, true, CONN_EVENT_MQTT_DOWN, CONN_STATE_BACKOFF, CONN_ACTION_NONE, BACKOFF },
+    { CONN_STATE_ONLINE, true, CONN_EVENT_TIMEOUT,   CONN_STATE_ONLINE, CONN_ACTION_NONE, 0 },
+
+    { CONN_STATE_BACKOFF, false, CONN_EVENT_START,     CONN_STATE_BACKOFF, CONN_ACTION_NONE, 0 },
+    { CONN_STATE_BACKOFF, false, CONN_EVENT_WIFI_UP,   CONN_STATE_BACKOFF, CONN_ACTION_NONE, 0 },
+    { CONN_STATE_BACKOFF, true,  CONN_EVENT_WIFI_DOWN, CONN_STATE_BACKOFF, CONN_ACTION_NONE, 0 },
+    { CONN_STATE_BACKOFF, true,  CONN_EVENT_MQTT_UP,   CONN_STATE_ONLINE, CONN_ACTION_NONE, 0 },
+    { CONN_STATE_BACKOFF, true,  CONN_EVENT_MQTT_DOWN, CONN_STATE_BACKOFF, CONN_ACTION_NONE, 0 },
+    { CONN_STATE_BACKOFF, false, CONN_EVENT_TIMEOUT,   CONN_STATE_CONNECTING, CONN_ACTION_CONNECT_WIFI, TIMEOUT_MS },
+    { CONN_STATE_BACKOFF, true,  CONN_EVENT_TIMEOUT,   CONN_STATE_CONNECTING, CONN_ACTION_CONNECT_MQTT, TIMEOUT_MS },
+};
+
+static void test_transition_table(void) {
+    for (size_t i = 0; i < sizeof(gTransitions) / sizeof(gTransitions[0]); i++) {
+        const transition_t* pTransition = &gTransitions[i];
+        conn_fsm_t fsm;
+        conn_fsm_init(&fsm, &gConfig);
+        fsm.state = pTransition->from;
+        fsm.wifiUp = pTransition->wifiUp;
+
+        uint32_t actions = conn_fsm_handle(&fsm, pTransition->event, 0);
+        if (fsm.state != pTransition->to || actions != pTransition->actions) {
+            fprintf(stderr, "transition %u: %s -> %s with actions 0x%x, expected %s with 0x%x\n", (unsigned)i,
+                    conn_fsm_state_name(pTransition->from), conn_fsm_state_name(fsm.state), (unsigned)actions,
+                    conn_fsm_state_name(pTransition->to), (unsigned)pTransition->actions);
+        }
+        CHECK_EQ(fsm.state, pTransition->to);
+        CHECK_EQ(actions, pTransition->actions);
+        if (pTransition->timeout_ms == BACKOFF) {
+            CHECK(fsm.timeout_ms >= BASE_MS / 2 && fsm.timeout_ms <= BASE_MS);
+        } else {
+            CHECK_EQ(fsm.timeout_ms, pTransition->timeout_ms);
+        }
+    }
+}
+
+static void test_backoff(void) {
+    // Doubles per attempt, capped, with the jitter between half and the full delay
+    CHECK_EQ(conn_fsm_backoff_ms(&gConfig, 0, 0), BASE_MS / 2);
+    CHECK_EQ(conn_fsm_backoff_ms(&gConfig, 0, BASE_MS / 2), BASE_MS);
+    CHECK_EQ(conn_fsm_backoff_ms(&gConfig, 3, UINT32_MAX), 4 * BASE_MS + UINT32_MAX % (4 * BASE_MS + 1));
+    CHECK_EQ(conn_fsm_backoff_ms(&gConfig, 6, 0), MAX_MS / 2);
+    CHECK_EQ(conn_fsm_backoff_ms(&gConfig, UINT8_MAX, MAX_MS / 2), MAX_MS);
+    for (uint32_t random = 0; random < 100000; random += 7) {
+        uint32_t delay_ms = conn_fsm_backoff_ms(&gConfig, 2, random * 2654435761u);
+        CHECK(delay_ms >= 2 * BASE_MS && delay_ms <= 4 * BASE_MS);
+    }
+}
+
+// A whole outage: failed attempts back off further each time, going online resets the count
+static void test_outage(void) {
+    conn_fsm_t fsm;
+    conn_fsm_init(&fsm, &gConfig);
+    CHECK_EQ(conn_fsm_handle(&fsm, CONN_EVENT_START, 0), CONN_ACTION_CONNECT_WIFI);
+    CHECK_EQ(conn_fsm_handle(&fsm, CONN_EVENT_WIFI_UP, 0), CONN_ACTION_CONNECT_MQTT);
+    CHECK_EQ(conn_fsm_handle(&fsm, CONN_EVENT_MQTT_UP, 0), CONN_ACTION_NONE);
+    CHECK_EQ(fsm.state, CONN_STATE_ONLINE);
+
+    conn_fsm_handle(&fsm, CONN_EVENT_WIFI_DOWN, 0);
+    CHECK_EQ(fsm.reconnects, 1);
+    CHECK(!fsm.wifiUp && !fsm.mqttUp);
+    for (uint8_t attempt = 1; attempt < 10; attempt++) {
+        CHECK_EQ(fsm.state, CONN_STATE_BACKOFF);
+        CHECK_EQ(fsm.attempt, attempt);
+        CHECK_EQ(conn_fsm_handle(&fsm, CONN_EVENT_TIMEOUT, 0), CONN_ACTION_CONNECT_WIFI);
+        conn_fsm_handle(&fsm, CONN_EVENT_TIMEOUT, 0);
+        CHECK_EQ(fsm.timeout_ms, conn_fsm_backoff_ms(&gConfig, attempt, 0));
+    }
+
+    // Wi-Fi returns during the backoff, the next attempt goes straight to the broker
+    conn_fsm_handle(&fsm, CONN_EVENT_WIFI_UP, 0);
+    CHECK_EQ(fsm.state, CONN_STATE_BACKOFF);
+    CHECK_EQ(conn_fsm_handle(&fsm, CONN_EVENT_TIMEOUT, 0), CONN_ACTION_CONNECT_MQTT);
+    conn_fsm_handle(&fsm, CONN_EVENT_MQTT_UP, 0);
+    CHECK_EQ(fsm.state, CONN_STATE_ONLINE);
+    CHECK_EQ(fsm.attempt, 0);
+    CHECK_EQ(fsm.reconnects, 1);
+
+    // The attempt counter saturates instead of wrapping to the shortest delay
+    fsm.attempt = UINT8_MAX;
+    fsm.state = CONN_STATE_CONNECTING;
+    conn_fsm_handle(&fsm, CONN_EVENT_TIMEOUT, 0);
+    CHECK_EQ(fsm.attempt, UINT8_MAX);
+    CHECK_EQ(fsm.timeout_ms, MAX_MS / 2);
+}
+
+int main(void) {
+    RUN_TEST(test_transition_table);
+    RUN_TEST(test_backoff);
+    RUN_TEST(test_outage);
+    return host_test_result();
+}
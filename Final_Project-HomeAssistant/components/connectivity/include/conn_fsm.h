@@ -0,0 +1,51 @@
+#ifndef CONN_FSM_H
+#define CONN_FSM_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Wi-Fi and MQTT bring-up as an explicit state machine. Free of ESP-IDF includes,
+// so it can be driven with simulated events on the host.
+
+#define CONN_ACTION_NONE            0x00
+#define CONN_ACTION_CONNECT_WIFI    0x01
+#define CONN_ACTION_CONNECT_MQTT    0x02
+
+typedef enum {
+    CONN_STATE_IDLE,
+    CONN_STATE_CONNECTING,  // Wi-Fi and then the broker
+    CONN_STATE_ONLINE,
+    CONN_STATE_BACKOFF,     // waiting before the next attempt
+} conn_state_t;
+
+typedef enum {
+    CONN_EVENT_START,
+    CONN_EVENT_WIFI_UP,     // got an IP address
+    CONN_EVENT_WIFI_DOWN,
+    CONN_EVENT_MQTT_UP,
+    CONN_EVENT_MQTT_DOWN,
+    CONN_EVENT_TIMEOUT,     // the timer requested by the last transition expired
+} conn_event_t;
+
+typedef struct {
+    uint32_t backoff_base_ms;
+    uint32_t backoff_max_ms;
+    uint32_t connect_timeout_ms;
+} conn_fsm_config_t;
+
+typedef struct {
+    conn_fsm_config_t config;
+    conn_state_t state;
+    bool wifiUp;
+    bool mqttUp;
+    uint8_t attempt;        // failed attempts since the last time online
+    uint32_t timeout_ms;    // timer to start after the last event, 0 = keep the running one
+    uint32_t reconnects;    // connection losses while online
+} conn_fsm_t;
+
+void conn_fsm_init(conn_fsm_t* pFsm, const conn_fsm_config_t* pConfig);
+uint32_t conn_fsm_handle(conn_fsm_t* pFsm, conn_event_t event, uint32_t random);
+uint32_t conn_fsm_backoff_ms(const conn_fsm_config_t* pConfig, uint8_t attempt, uint32_t random);
+const char* conn_fsm_state_name(conn_state_t state);
+
+#endif // CONN_FSM_H
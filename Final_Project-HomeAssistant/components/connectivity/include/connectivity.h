@@ -0,0 +1,36 @@
+#ifndef CONNECTIVITY_H
+#define CONNECTIVITY_H
+
+#include <inttypes.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+
+#include "conn_fsm.h"
+
+#define CONNECTIVITY_BACKOFF_BASE_MS        CONFIG_CONNECTIVITY_BACKOFF_BASE_MS
+#define CONNECTIVITY_BACKOFF_MAX_MS         CONFIG_CONNECTIVITY_BACKOFF_MAX_MS
+#define CONNECTIVITY_CONNECT_TIMEOUT_MS     CONFIG_CONNECTIVITY_CONNECT_TIMEOUT_MS
+#define CONNECTIVITY_TASK_STACKSIZE         4096
+#define CONNECTIVITY_TASK_PRIORITY          5
+#define CONNECTIVITY_EVENT_QUEUE_LENGTH     8
+
+// Bits of the event group returned by connectivity_get_event_group()
+#define CONNECTIVITY_WIFI_BIT       BIT0
+#define CONNECTIVITY_MQTT_BIT       BIT1
+#define CONNECTIVITY_ONLINE_BIT     BIT2
+
+typedef struct {
+    conn_state_t state;
+    uint32_t reconnects;
+    int64_t boot_to_wifi_us;            // 0 = not reached yet
+    int64_t boot_to_online_us;
+    int64_t boot_to_first_publish_us;
+} connectivity_metrics_t;
+
+esp_err_t connectivity_start(void);
+EventGroupHandle_t connectivity_get_event_group(void);
+bool connectivity_wait_online(TickType_t timeout);
+void connectivity_get_metrics(connectivity_metrics_t* pMetrics);
+
+#endif // CONNECTIVITY_H
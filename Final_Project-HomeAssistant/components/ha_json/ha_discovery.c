@@ -0,0 +1,98 @@
+#include <stdio.h>
+
+#include "ha_discovery.h"
+
+static const char* component_name(ha_entity_type_t type) {
+    switch (type) {
+    case HA_ENTITY_EVENT:   return "event";
+    case HA_ENTITY_SENSOR:  return "sensor";
+    case HA_ENTITY_LIGHT:   return "light";
+    }
+    return "sensor";
+}
+
+static void add_optional_string(json_writer_t* pWriter, const char* key, const char* value) {
+    if (value != NULL) {
+        json_writer_add_string(pWriter, key, value);
+    }
+}
+
+// homeassistant/event/esp32_home_assistant/button/config
+int ha_discovery_write_topic(char* buf, size_t size, const char* discoveryPrefix, const ha_device_t* pDevice, const ha_entity_t* pEntity) {
+    int len = snprintf(buf, size, "%s/%s/%s/%s/config", discoveryPrefix, component_name(pEntity->type), pDevice->identifier, pEntity->objectId);
+    if (len < 0 || (size_t)len >= size) {
+        return -1;
+    }
+    return len;
+}
+
+/*
+ * @brief Writes the discovery config of an entity
+ *
+ *  {"name":"ESP32 Button","unique_id":"esp32_home_assistant_button","state_topic":"ESP32/button",
+ *   "event_types":["press","release"],"device_class":"button","device":{...}}
+ *
+ * @return length of the config, -1 if it does not fit into the buffer
+ */
+int ha_discovery_write_config(char* buf, size_t size, const ha_device_t* pDevice, const ha_entity_t* pEntity) {
+    char uniqueId[HA_DISCOVERY_MAX_TOPIC_SIZE];
+    int len = snprintf(uniqueId, sizeof(uniqueId), "%s_%s", pDevice->identifier, pEntity->objectId);
+    if (len < 0 || (size_t)len >= sizeof(uniqueId)) {
+        return -1;
+    }
+
+    json_writer_t writer;
+    json_writer_init(&writer, buf, size);
+    json_writer_begin_object(&writer, NULL);
+    json_writer_add_string(&writer, "name", pEntity->name);
+    json_writer_add_string(&writer, "unique_id", uniqueId);
+    add_optional_string(&writer, "object_id", pEntity->entityId);
+    json_writer_add_string(&writer, "state_topic", pEntity->stateTopic);
+
+    switch (pEntity->type) {
+    case HA_ENTITY_EVENT:
+        json_writer_begin_array(&writer, "event_types");
+        for (uint8_t i = 0; i < pEntity->eventTypeCount; i++) {
+            json_writer_add_string(&writer, NULL, pEntity->eventTypes[i]);
+        }
+        json_writer_end_array(&writer);
+        break;
+    case HA_ENTITY_SENSOR:
+        add_optional_string(&writer, "unit_of_measurement", pEntity->unit);
+        break;
+    case HA_ENTITY_LIGHT:
+        json_writer_add_string(&writer, "schema", "json");
+        add_optional_string(&writer, "command_topic", pEntity->commandTopic);
+        json_writer_begin_array(&writer, "supported_color_modes");
+        json_writer_add_string(&writer, NULL, "rgb");
+        json_writer_end_array(&writer);
+        json_writer_add_bool(&writer, "brightness", true);
+        break;
+    }
+    add_optional_string(&writer, "device_class", pEntity->deviceClass);
+    add_optional_string(&writer, "value_template", pEntity->valueTemplate);
+
+    json_writer_begin_object(&writer, "device");
+    json_writer_begin_array(&writer, "identifiers");
+    json_writer_add_string(&writer, NULL, pDevice->identifier);
+    json_writer_end_array(&writer);
+    json_writer_add_string(&writer, "name", pDevice->name);
+    json_writer_add_string(&writer, "manufacturer", pDevice->manufacturer);
+    json_writer_add_string(&writer, "model", pDevice->model);
+    json_writer_end_object(&writer);
+
+    json_writer_end_object(&writer);
+    return json_writer_finish(&writer);
+}
+
+// FNV-1a, chained over all topics and configs to detect a changed registry
+uint32_t ha_discovery_hash(uint32_t hash, const char* data, size_t len) {
+    if (hash == 0) {
+        hash = 2166136261u;
+    }
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
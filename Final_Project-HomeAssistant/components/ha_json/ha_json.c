@@ -0,0 +1,86 @@
+#include "ha_json.h"
+
+static const json_field_t gLightColorFields[] = {
+    { .key = "r", .type = JSON_FIELD_INT, .offset = offsetof(ha_light_command_t, r), .flag = HA_LIGHT_COMMAND_COLOR_R },
+    { .key = "g", .type = JSON_FIELD_INT, .offset = offsetof(ha_light_command_t, g), .flag = HA_LIGHT_COMMAND_COLOR_G },
+    { .key = "b", .type = JSON_FIELD_INT, .offset = offsetof(ha_light_command_t, b), .flag = HA_LIGHT_COMMAND_COLOR_B },
+};
+
+static const json_field_t gLightCommandFields[] = {
+    { .key = "state", .type = JSON_FIELD_STRING, .offset = offsetof(ha_light_command_t, state), .flag = HA_LIGHT_COMMAND_STATE },
+    { .key = "brightness", .type = JSON_FIELD_INT, .offset = offsetof(ha_light_command_t, brightness), .flag = HA_LIGHT_COMMAND_BRIGHTNESS },
+    { .key = "transition", .type = JSON_FIELD_FLOAT, .offset = offsetof(ha_light_command_t, transition), .flag = HA_LIGHT_COMMAND_TRANSITION },
+    { .key = "color", .type = JSON_FIELD_OBJECT, .fields = gLightColorFields, .fieldCount = sizeof(gLightColorFields) / sizeof(gLightColorFields[0]) },
+};
+
+static bool is_channel(int32_t value) {
+    return value >= 0 && value <= 255;
+}
+
+// {"state":"ON","brightness":255,"color":{"r":255,"g":180,"b":200},"transition":2.5}
+// Brightness and color outside 0..255 reject the whole command with JSON_ERROR_RANGE.
+int ha_json_parse_light_command(const char* json, size_t len, ha_light_command_t* pCommand, uint32_t* pPresent) {
+    int ret = json_parse(json, len, gLightCommandFields, sizeof(gLightCommandFields) / sizeof(gLightCommandFields[0]), pCommand, pPresent);
+    if (ret != JSON_SUCCESS) {
+        return ret;
+    }
+    if (((*pPresent & HA_LIGHT_COMMAND_BRIGHTNESS) && !is_channel(pCommand->brightness))
+        || ((*pPresent & HA_LIGHT_COMMAND_COLOR_R) && !is_channel(pCommand->r))
+        || ((*pPresent & HA_LIGHT_COMMAND_COLOR_G) && !is_channel(pCommand->g))
+        || ((*pPresent & HA_LIGHT_COMMAND_COLOR_B) && !is_channel(pCommand->b))) {
+        return JSON_ERROR_RANGE;
+    }
+    return JSON_SUCCESS;
+}
+
+// {"state":"ON","brightness":255,"color":{"r":255,"g":180,"b":200}}
+int ha_json_write_light_state(char* buf, size_t size, const ha_light_state_t* pState) {
+    json_writer_t writer;
+    json_writer_init(&writer, buf, size);
+    json_writer_begin_object(&writer, NULL);
+    json_writer_add_string(&writer, "state", pState->state ? "ON" : "OFF");
+    json_writer_add_int(&writer, "brightness", pState->brightness);
+    json_writer_begin_object(&writer, "color");
+    json_writer_add_int(&writer, "r", pState->r);
+    json_writer_add_int(&writer, "g", pState->g);
+    json_writer_add_int(&writer, "b", pState->b);
+    json_writer_end_object(&writer);
+    json_writer_end_object(&writer);
+    return json_writer_finish(&writer);
+}
+
+// {"gpio":9,"event_type":"press"}
+int ha_json_write_button_event(char* buf, size_t size, uint8_t gpio, bool pressed) {
+    json_writer_t writer;
+    json_writer_init(&writer, buf, size);
+    json_writer_begin_object(&writer, NULL);
+    json_writer_add_int(&writer, "gpio", gpio);
+    json_writer_add_string(&writer, "event_type", pressed ? "press" : "release");
+    json_writer_end_object(&writer);
+    return json_writer_finish(&writer);
+}
+
+// {"value":142}
+int ha_json_write_sensor_value(char* buf, size_t size, int32_t value) {
+    json_writer_t writer;
+    json_writer_init(&writer, buf, size);
+    json_writer_begin_object(&writer, NULL);
+    json_writer_add_int(&writer, "value", value);
+    json_writer_end_object(&writer);
+    return json_writer_finish(&writer);
+}
+
+// {"period_ms":500,"values":[12,13,15]}, oldest value first
+int ha_json_write_sensor_batch(char* buf, size_t size, const uint8_t* values, size_t count, uint32_t period_ms) {
+    json_writer_t writer;
+    json_writer_init(&writer, buf, size);
+    json_writer_begin_object(&writer, NULL);
+    json_writer_add_int(&writer, "period_ms", period_ms);
+    json_writer_begin_array(&writer, "values");
+    for (size_t i = 0; i < count; i++) {
+        json_writer_add_int(&writer, NULL, values[i]);
+    }
+    json_writer_end_array(&writer);
+    json_writer_end_object(&writer);
+    return json_writer_finish(&writer);
+}
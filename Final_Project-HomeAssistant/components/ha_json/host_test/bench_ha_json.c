@@ -0,0 +1,146 @@
+#include <getopt.h>
+#include <string.h>
+
+#include "host_bench.h"
+#include "ha_json.h"
+#ifdef HAVE_CJSON
+#include "cJSON.h"
+#endif
+
+// Messages per second and heap use of the device's JSON messages, the ha_json writer and reader
+// against cJSON as main.c used it before: a tree on the heap, printed and freed per message.
+
+static const char* gLightCommand = "{\"state\":\"ON\",\"brightness\":180,\"color\":{\"r\":255,\"g\":120,\"b\":40},\"transition\":2.5}";
+
+typedef int (*bench_fn_t)(void);
+
+static int write_light_state(void) {
+    char buf[HA_JSON_MAX_MESSAGE_SIZE];
+    const ha_light_state_t state = { .state = true, .brightness = 180, .r = 255, .g = 120, .b = 40 };
+    return ha_json_write_light_state(buf, sizeof(buf), &state);
+}
+
+static int write_button_event(void) {
+    char buf[HA_JSON_MAX_MESSAGE_SIZE];
+    return ha_json_write_button_event(buf, sizeof(buf), 9, true);
+}
+
+static int write_sensor_value(void) {
+    char buf[HA_JSON_MAX_MESSAGE_SIZE];
+    return ha_json_write_sensor_value(buf, sizeof(buf), 142);
+}
+
+static int parse_light_command(void) {
+    ha_light_command_t command;
+    uint32_t present;
+    if (ha_json_parse_light_command(gLightCommand, strlen(gLightCommand), &command, &present) != JSON_SUCCESS) {
+        return -1;
+    }
+    return command.r + command.g + command.b;
+}
+
+#ifdef HAVE_CJSON
+static int print_and_free(cJSON* root) {
+    char* json = cJSON_PrintUnformatted(root);
+    int len = (json != NULL) ? (int)strlen(json) : -1;
+    free(json);
+    cJSON_Delete(root);
+    return len;
+}
+
+static int cjson_light_state(void) {
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "state", "ON");
+    cJSON_AddNumberToObject(root, "brightness", 180);
+    cJSON* color = cJSON_CreateObject();
+    cJSON_AddNumberToObject(color, "r", 255);
+    cJSON_AddNumberToObject(color, "g", 120);
+    cJSON_AddNumberToObject(color, "b", 40);
+    cJSON_AddItemToObject(root, "color", color);
+    return print_and_free(root);
+}
+
+static int cjson_button_event(void) {
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "gpio", 9);
+    cJSON_AddStringToObject(root, "event_type", "press");
+    return print_and_free(root);
+}
+
+static int cjson_sensor_value(void) {
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "value", 142);
+    return print_and_free(root);
+}
+
+static int cjson_light_command(void) {
+    cJSON* root = cJSON_Parse(gLightCommand);
+    if (root == NULL) {
+        return -1;
+    }
+    int sum = 0;
+    cJSON* color = cJSON_GetObjectItem(root, "color");
+    if (color != NULL) {
+        const char* keys[] = { "r", "g", "b" };
+        for (int i = 0; i < 3; i++) {
+            cJSON* item = cJSON_GetObjectItem(color, keys[i]);
+            if (item != NULL && cJSON_IsNumber(item)) {
+                sum += item->valueint;
+            }
+        }
+    }
+    cJSON_GetObjectItem(root, "brightness");
+    cJSON_GetObjectItem(root, "state");
+    cJSON_Delete(root);
+    return sum;
+}
+#endif
+
+static void run(const char* message, const char* library, bench_fn_t fn, long iterations) {
+    int len = fn();
+    if (len < 0) {
+        fprintf(stderr, "%s with %s failed\n", message, library);
+        exit(EXIT_FAILURE);
+    }
+    bench_allocs_t start = gBenchAllocs;
+    double t0 = bench_now_s();
+    for (long i = 0; i < iterations; i++) {
+        gBenchSink += (uint32_t)fn();
+    }
+    double elapsed = bench_now_s() - t0;
+    bench_allocs_t allocs = bench_allocs_since(start);
+    printf("| %-14s | %-7s | %7.1f | %10.0f | %6.1f | %8.1f |\n", message, library, elapsed * 1e9 / iterations,
+           iterations / elapsed, (double)allocs.count / iterations, (double)allocs.bytes / iterations);
+}
+
+int main(int argc, char* argv[]) {
+    long iterations = 1000000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') {
+            iterations = strtol(optarg, NULL, 10);
+        } else {
+            fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (iterations <= 0) {
+        iterations = 1;
+    }
+
+    printf("| %-14s | %-7s | %7s | %10s | %6s | %8s |\n", "message", "library", "ns/msg", "msgs/s", "allocs", "heap B");
+    printf("|----------------|---------|---------|------------|--------|----------|\n");
+    run("light state", "ha_json", write_light_state, iterations);
+    run("button event", "ha_json", write_button_event, iterations);
+    run("sensor value", "ha_json", write_sensor_value, iterations);
+    run("light command", "ha_json", parse_light_command, iterations);
+#ifdef HAVE_CJSON
+    run("light state", "cJSON", cjson_light_state, iterations);
+    run("button event", "cJSON", cjson_button_event, iterations);
+    run("sensor value", "cJSON", cjson_sensor_value, iterations);
+    run("light command", "cJSON", cjson_light_command, iterations);
+#else
+    printf("cJSON not built in, set CJSON_DIR or IDF_PATH for the comparison\n");
+#endif
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,127 @@
+#include <string.h>
+
+#include "host_test.h"
+#include "ha_discovery.h"
+
+// Golden discovery configs of the entities main.c registers, with the default Kconfig values.
+// A change here changes what Home Assistant receives, check it against the MQTT discovery docs.
+
+static const ha_device_t gDevice = {
+    .identifier = "esp32_home_assistant",
+    .name = "ESP32 Home Assistant Device",
+    .manufacturer = "lossphilipp",
+    .model = "esp32",
+};
+
+static const char* const gButtonEventTypes[] = { "press", "release" };
+
+typedef struct {
+    ha_entity_t entity;
+    const char* topic;
+    const char* config;
+} golden_t;
+
+static const golden_t gGolden[] = {
+    {
+        { .type = HA_ENTITY_LIGHT, .objectId = "light", .name = "ESP32 Light", .entityId = "esp32_light",
+          .stateTopic = "ESP32/test/led/state", .commandTopic = "ESP32/test/led/set" },
+        "homeassistant/light/esp32_home_assistant/light/config",
+        "{\"name\":\"ESP32 Light\",\"unique_id\":\"esp32_home_assistant_light\",\"object_id\":\"esp32_light\","
+        "\"state_topic\":\"ESP32/test/led/state\",\"schema\":\"json\",\"command_topic\":\"ESP32/test/led/set\","
+        "\"supported_color_modes\":[\"rgb\"],\"brightness\":true,"
+        "\"device\":{\"identifiers\":[\"esp32_home_assistant\"],\"name\":\"ESP32 Home Assistant Device\","
+        "\"manufacturer\":\"lossphilipp\",\"model\":\"esp32\"}}",
+    },
+    {
+        { .type = HA_ENTITY_EVENT, .objectId = "button", .name = "ESP32 Button", .entityId = "esp32_button",
+          .stateTopic = "ESP32/test/button", .deviceClass = "button", .eventTypes = gButtonEventTypes, .eventTypeCount = 2 },
+        "homeassistant/event/esp32_home_assistant/button/config",
+        "{\"name\":\"ESP32 Button\",\"unique_id\":\"esp32_home_assistant_button\",\"object_id\":\"esp32_button\","
+        "\"state_topic\":\"ESP32/test/button\",\"event_types\":[\"press\",\"release\"],\"device_class\":\"button\","
+        "\"device\":{\"identifiers\":[\"esp32_home_assistant\"],\"name\":\"ESP32 Home Assistant Device\","
+        "\"manufacturer\":\"lossphilipp\",\"model\":\"esp32\"}}",
+    },
+    {
+        { .type = HA_ENTITY_SENSOR, .objectId = "potentiometer", .name = "ESP32 Potentiometer", .entityId = "esp32_potentiometer",
+          .stateTopic = "ESP32/test/potentiometer", .valueTemplate = "{{ value_json.value }}" },
+        "homeassistant/sensor/esp32_home_assistant/potentiometer/config",
+        "{\"name\":\"ESP32 Potentiometer\",\"unique_id\":\"esp32_home_assistant_potentiometer\",\"object_id\":\"esp32_potentiometer\","
+        "\"state_topic\":\"ESP32/test/potentiometer\",\"value_template\":\"{{ value_json.value }}\","
+        "\"device\":{\"identifiers\":[\"esp32_home_assistant\"],\"name\":\"ESP32 Home Assistant Device\","
+        "\"manufacturer\":\"lossphilipp\",\"model\":\"esp32\"}}",
+    },
+};
+
+#define GOLDEN_COUNT    (sizeof(gGolden) / sizeof(gGolden[0]))
+
+static void test_golden(void) {
+    for (size_t i = 0; i < GOLDEN_COUNT; i++) {
+        char topic[HA_DISCOVERY_MAX_TOPIC_SIZE];
+        char config[HA_DISCOVERY_MAX_CONFIG_SIZE];
+        CHECK_EQ(ha_discovery_write_topic(topic, sizeof(topic), "homeassistant", &gDevice, &gGolden[i].entity), strlen(gGolden[i].topic));
+        CHECK(strcmp(topic, gGolden[i].topic) == 0);
+        CHECK_EQ(ha_discovery_write_config(config, sizeof(config), &gDevice, &gGolden[i].entity), strlen(gGolden[i].config));
+        if (strcmp(config, gGolden[i].config) != 0) {
+            fprintf(stderr, "config of %s:\n  %s\nexpected:\n  %s\n", gGolden[i].entity.objectId, config, gGolden[i].config);
+            CHECK(false);
+        }
+    }
+}
+
+// Every buffer too small by even one byte is reported, and nothing is written past its end
+static void test_truncation(void) {
+    for (size_t i = 0; i < GOLDEN_COUNT; i++) {
+        size_t len = strlen(gGolden[i].config);
+        for (size_t size = 0; size <= len; size++) {
+            char* buf = malloc(size);
+            CHECK_EQ(ha_discovery_write_config(buf, size, &gDevice, &gGolden[i].entity), -1);
+            free(buf);
+        }
+        char* buf = malloc(len + 1);
+        CHECK_EQ(ha_discovery_write_config(buf, len + 1, &gDevice, &gGolden[i].entity), len);
+        free(buf);
+
+        size_t topicLen = strlen(gGolden[i].topic);
+        char topic[HA_DISCOVERY_MAX_TOPIC_SIZE];
+        CHECK_EQ(ha_discovery_write_topic(topic, topicLen, "homeassistant", &gDevice, &gGolden[i].entity), -1);
+    }
+}
+
+static void test_escaping(void) {
+    ha_entity_t entity = gGolden[2].entity;
+    entity.name = "Pot \"A\"\\1";
+    char config[HA_DISCOVERY_MAX_CONFIG_SIZE];
+    CHECK(ha_discovery_write_config(config, sizeof(config), &gDevice, &entity) > 0);
+    CHECK(strstr(config, "\"name\":\"Pot \\\"A\\\"\\\\1\",") != NULL);
+}
+
+// The hash chained over all topics and configs changes with any of them
+static void test_hash(void) {
+    uint32_t hash = 0;
+    for (size_t i = 0; i < GOLDEN_COUNT; i++) {
+        hash = ha_discovery_hash(hash, gGolden[i].topic, strlen(gGolden[i].topic));
+        hash = ha_discovery_hash(hash, gGolden[i].config, strlen(gGolden[i].config));
+    }
+    CHECK(hash != 0);
+
+    char config[HA_DISCOVERY_MAX_CONFIG_SIZE];
+    ha_entity_t entity = gGolden[0].entity;
+    entity.name = "ESP32 Lamp";
+    int len = ha_discovery_write_config(config, sizeof(config), &gDevice, &entity);
+    uint32_t changed = 0;
+    changed = ha_discovery_hash(changed, gGolden[0].topic, strlen(gGolden[0].topic));
+    changed = ha_discovery_hash(changed, config, len);
+    for (size_t i = 1; i < GOLDEN_COUNT; i++) {
+        changed = ha_discovery_hash(changed, gGolden[i].topic, strlen(gGolden[i].topic));
+        changed = ha_discovery_hash(changed, gGolden[i].config, strlen(gGolden[i].config));
+    }
+    CHECK(changed != hash);
+}
+
+int main(void) {
+    RUN_TEST(test_golden);
+    RUN_TEST(test_truncation);
+    RUN_TEST(test_escaping);
+    RUN_TEST(test_hash);
+    return host_test_result();
+}
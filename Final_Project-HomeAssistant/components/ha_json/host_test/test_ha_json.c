@@ -0,0 +1,111 @@
+#include <string.h>
+
+#include "host_test.h"
+#include "ha_json.h"
+
+static int parse(const char* json, ha_light_command_t* pCommand, uint32_t* pPresent) {
+    memset(pCommand, 0, sizeof(*pCommand));
+    return ha_json_parse_light_command(json, strlen(json), pCommand, pPresent);
+}
+
+static void test_light_command(void) {
+    ha_light_command_t command;
+    uint32_t present;
+    CHECK_EQ(parse("{\"state\":\"ON\",\"brightness\":255,\"color\":{\"r\":255,\"g\":180,\"b\":0},\"transition\":2.5}", &command, &present), JSON_SUCCESS);
+    CHECK_EQ(present, HA_LIGHT_COMMAND_STATE | HA_LIGHT_COMMAND_BRIGHTNESS | HA_LIGHT_COMMAND_COLOR | HA_LIGHT_COMMAND_TRANSITION);
+    CHECK(json_string_equals(command.state, "ON"));
+    CHECK_EQ(command.brightness, 255);
+    CHECK_EQ(command.r, 255);
+    CHECK_EQ(command.g, 180);
+    CHECK_EQ(command.b, 0);
+    CHECK(command.transition > 2.49f && command.transition < 2.51f);
+
+    // Unknown members are skipped, whatever they hold
+    CHECK_EQ(parse(" { \"effect\" : [1, {\"a\": null}, \"x\"], \"state\" : \"OFF\" } ", &command, &present), JSON_SUCCESS);
+    CHECK_EQ(present, HA_LIGHT_COMMAND_STATE);
+    CHECK(json_string_equals(command.state, "OFF"));
+}
+
+static void test_malformed(void) {
+    ha_light_command_t command;
+    uint32_t present;
+    CHECK_EQ(parse("", &command, &present), JSON_ERROR_SYNTAX);
+    CHECK_EQ(parse("{\"state\":\"ON\"", &command, &present), JSON_ERROR_SYNTAX);
+    CHECK_EQ(parse("{\"state\":\"ON}", &command, &present), JSON_ERROR_SYNTAX);
+    CHECK_EQ(parse("{\"state\":\"ON\"} x", &command, &present), JSON_ERROR_SYNTAX);
+    CHECK_EQ(parse("{\"brightness\":\"high\"}", &command, &present), JSON_ERROR_TYPE);
+    CHECK_EQ(parse("{\"color\":5}", &command, &present), JSON_ERROR_TYPE);
+    CHECK_EQ(parse("{\"a\":[[[[[[[[[[1]]]]]]]]]]}", &command, &present), JSON_ERROR_DEPTH);
+}
+
+// Out of range values must be rejected, not wrapped into uint8 by the caller
+static void test_range(void) {
+    ha_light_command_t command;
+    uint32_t present;
+    CHECK_EQ(parse("{\"brightness\":0}", &command, &present), JSON_SUCCESS);
+    CHECK_EQ(parse("{\"brightness\":256}", &command, &present), JSON_ERROR_RANGE);
+    CHECK_EQ(parse("{\"brightness\":-1}", &command, &present), JSON_ERROR_RANGE);
+    CHECK_EQ(parse("{\"color\":{\"r\":0,\"g\":300,\"b\":0}}", &command, &present), JSON_ERROR_RANGE);
+    // Beyond int32, the cast alone would be undefined
+    CHECK_EQ(parse("{\"brightness\":3000000000}", &command, &present), JSON_ERROR_RANGE);
+    CHECK_EQ(parse("{\"brightness\":-1e30}", &command, &present), JSON_ERROR_RANGE);
+    CHECK_EQ(parse("{\"brightness\":99999999999999999999999999999999999999999999999}", &command, &present), JSON_ERROR_RANGE);
+    CHECK_EQ(parse("{\"brightness\":1e38}", &command, &present), JSON_ERROR_RANGE);
+}
+
+static void test_writer(void) {
+    char buf[HA_JSON_MAX_MESSAGE_SIZE];
+    const ha_light_state_t state = { .state = true, .brightness = 200, .r = 1, .g = 2, .b = 3 };
+    int len = ha_json_write_light_state(buf, sizeof(buf), &state);
+    CHECK_EQ(len, (int)strlen("{\"state\":\"ON\",\"brightness\":200,\"color\":{\"r\":1,\"g\":2,\"b\":3}}"));
+    CHECK(strcmp(buf, "{\"state\":\"ON\",\"brightness\":200,\"color\":{\"r\":1,\"g\":2,\"b\":3}}") == 0);
+
+    // What the device writes, it reads back
+    ha_light_command_t command;
+    uint32_t present;
+    CHECK_EQ(ha_json_parse_light_command(buf, len, &command, &present), JSON_SUCCESS);
+    CHECK_EQ(command.brightness, 200);
+    CHECK_EQ(command.b, 3);
+
+    CHECK(ha_json_write_button_event(buf, sizeof(buf), 9, false) > 0);
+    CHECK(strcmp(buf, "{\"gpio\":9,\"event_type\":\"release\"}") == 0);
+    CHECK(ha_json_write_sensor_value(buf, sizeof(buf), -2147483647 - 1) > 0);
+    CHECK(strcmp(buf, "{\"value\":-2147483648}") == 0);
+    const uint8_t values[] = { 12, 0, 255 };
+    CHECK(ha_json_write_sensor_batch(buf, sizeof(buf), values, 3, 500) > 0);
+    CHECK(strcmp(buf, "{\"period_ms\":500,\"values\":[12,0,255]}") == 0);
+
+    // Too small: every size up to the full length fails, and never writes past the buffer
+    for (size_t size = 0; size <= strlen("{\"period_ms\":500,\"values\":[12,0,255]}"); size++) {
+        char small[64];
+        memset(small, 'x', sizeof(small));
+        CHECK_EQ(ha_json_write_sensor_batch(small, size, values, 3, 500), -1);
+        CHECK(size == sizeof(small) || small[size] == 'x');
+    }
+}
+
+static void test_writer_escapes(void) {
+    char buf[64];
+    json_writer_t writer;
+    json_writer_init(&writer, buf, sizeof(buf));
+    json_writer_begin_object(&writer, NULL);
+    json_writer_add_string(&writer, "k", "a\"b\\c\n\x01");
+    json_writer_add_bool(&writer, "t", true);
+    json_writer_end_object(&writer);
+    CHECK(json_writer_finish(&writer) > 0);
+    CHECK(strcmp(buf, "{\"k\":\"a\\\"b\\\\c\\n\\u0001\",\"t\":true}") == 0);
+
+    // Unbalanced containers fail
+    json_writer_init(&writer, buf, sizeof(buf));
+    json_writer_begin_object(&writer, NULL);
+    CHECK_EQ(json_writer_finish(&writer), -1);
+}
+
+int main(void) {
+    RUN_TEST(test_light_command);
+    RUN_TEST(test_malformed);
+    RUN_TEST(test_range);
+    RUN_TEST(test_writer);
+    RUN_TEST(test_writer_escapes);
+    return host_test_result();
+}
@@ -0,0 +1,47 @@
+#ifndef HA_DISCOVERY_H
+#define HA_DISCOVERY_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "json_writer.h"
+
+// Home Assistant MQTT discovery configs, generated from the entities the firmware registers.
+// https://www.home-assistant.io/integrations/mqtt/#mqtt-discovery
+
+#define HA_DISCOVERY_MAX_TOPIC_SIZE     128
+#define HA_DISCOVERY_MAX_CONFIG_SIZE    512
+
+typedef enum {
+    HA_ENTITY_EVENT,    // e.g. a button, with its event types
+    HA_ENTITY_SENSOR,
+    HA_ENTITY_LIGHT,    // JSON schema light with RGB color and brightness
+} ha_entity_type_t;
+
+typedef struct {
+    const char* identifier; // also the node id of the discovery topics
+    const char* name;
+    const char* manufacturer;
+    const char* model;
+} ha_device_t;
+
+typedef struct {
+    ha_entity_type_t type;
+    const char* objectId;       // unique within the device
+    const char* name;
+    const char* entityId;       // optional, entity id suggested to Home Assistant, e.g. "esp32_light"
+    const char* stateTopic;     // full topics, including the prefix
+    const char* commandTopic;   // lights only
+    const char* deviceClass;    // optional
+    const char* unit;           // optional, sensors only
+    const char* valueTemplate;  // optional
+    const char* const* eventTypes; // events only
+    uint8_t eventTypeCount;
+} ha_entity_t;
+
+int ha_discovery_write_topic(char* buf, size_t size, const char* discoveryPrefix, const ha_device_t* pDevice, const ha_entity_t* pEntity);
+int ha_discovery_write_config(char* buf, size_t size, const ha_device_t* pDevice, const ha_entity_t* pEntity);
+uint32_t ha_discovery_hash(uint32_t hash, const char* data, size_t len);
+
+#endif // HA_DISCOVERY_H
@@ -0,0 +1,47 @@
+#ifndef HA_JSON_H
+#define HA_JSON_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "json_reader.h"
+#include "json_writer.h"
+
+// Fixed Home Assistant schemas of this device, encoded and decoded without heap allocation.
+// The schemas are documented in main.c and the README.
+
+#define HA_JSON_MAX_MESSAGE_SIZE        128
+
+#define HA_LIGHT_COMMAND_STATE          0x01
+#define HA_LIGHT_COMMAND_BRIGHTNESS     0x02
+#define HA_LIGHT_COMMAND_COLOR_R        0x04
+#define HA_LIGHT_COMMAND_COLOR_G        0x08
+#define HA_LIGHT_COMMAND_COLOR_B        0x10
+#define HA_LIGHT_COMMAND_COLOR          (HA_LIGHT_COMMAND_COLOR_R | HA_LIGHT_COMMAND_COLOR_G | HA_LIGHT_COMMAND_COLOR_B)
+#define HA_LIGHT_COMMAND_TRANSITION     0x20
+
+typedef struct {
+    json_string_t state; // "ON" or "OFF"
+    int32_t brightness;
+    int32_t r;
+    int32_t g;
+    int32_t b;
+    float transition;    // seconds
+} ha_light_command_t;
+
+typedef struct {
+    bool state;
+    uint8_t brightness;
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+} ha_light_state_t;
+
+int ha_json_parse_light_command(const char* json, size_t len, ha_light_command_t* pCommand, uint32_t* pPresent);
+int ha_json_write_light_state(char* buf, size_t size, const ha_light_state_t* pState);
+int ha_json_write_button_event(char* buf, size_t size, uint8_t gpio, bool pressed);
+int ha_json_write_sensor_value(char* buf, size_t size, int32_t value);
+int ha_json_write_sensor_batch(char* buf, size_t size, const uint8_t* values, size_t count, uint32_t period_ms);
+
+#endif // HA_JSON_H
@@ -0,0 +1,44 @@
+#ifndef JSON_READER_H
+#define JSON_READER_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Schema driven JSON reader. The input is tokenized in place: nothing is allocated or copied,
+// string values point into the input buffer. Members not listed in the schema are skipped.
+
+#define JSON_SUCCESS         0
+#define JSON_ERROR_SYNTAX   -1
+#define JSON_ERROR_TYPE     -2
+#define JSON_ERROR_DEPTH    -3
+#define JSON_ERROR_RANGE    -4  // a number does not fit the field
+
+#define JSON_READER_MAX_DEPTH    8
+
+typedef struct {
+    const char* ptr; // not null-terminated, escape sequences are left as they are
+    size_t len;
+} json_string_t;
+
+typedef enum {
+    JSON_FIELD_INT,     // int32_t, the fraction is cut off
+    JSON_FIELD_FLOAT,   // float
+    JSON_FIELD_BOOL,    // bool
+    JSON_FIELD_STRING,  // json_string_t
+    JSON_FIELD_OBJECT,  // nested members described by fields/fieldCount
+} json_field_type_t;
+
+typedef struct _JsonField_ {
+    const char* key;
+    json_field_type_t type;
+    size_t offset;                      // offset of the value in the output struct
+    uint32_t flag;                      // set in *pPresent if the member was found
+    const struct _JsonField_* fields;   // only for JSON_FIELD_OBJECT
+    size_t fieldCount;
+} json_field_t;
+
+int json_parse(const char* json, size_t len, const json_field_t* fields, size_t fieldCount, void* pOut, uint32_t* pPresent);
+bool json_string_equals(json_string_t str, const char* value);
+
+#endif // JSON_READER_H
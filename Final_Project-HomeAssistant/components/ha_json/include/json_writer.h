@@ -0,0 +1,32 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Streaming JSON writer into a caller provided buffer, nothing is allocated.
+// Errors are sticky: once the buffer overflows every further call is ignored and json_writer_finish() fails.
+
+#define JSON_WRITER_MAX_DEPTH    8
+
+typedef struct {
+    char* buf;
+    size_t size;
+    size_t len;
+    uint8_t depth;
+    uint8_t needsComma; // bit n: the object or array at depth n already has a member
+    bool overflow;
+} json_writer_t;
+
+void json_writer_init(json_writer_t* pWriter, char* buf, size_t size);
+void json_writer_begin_object(json_writer_t* pWriter, const char* key);
+void json_writer_end_object(json_writer_t* pWriter);
+void json_writer_begin_array(json_writer_t* pWriter, const char* key);
+void json_writer_end_array(json_writer_t* pWriter);
+void json_writer_add_int(json_writer_t* pWriter, const char* key, int32_t value);
+void json_writer_add_string(json_writer_t* pWriter, const char* key, const char* value);
+void json_writer_add_bool(json_writer_t* pWriter, const char* key, bool value);
+int json_writer_finish(json_writer_t* pWriter);
+
+#endif // JSON_WRITER_H
@@ -0,0 +1,282 @@
+#include <string.h>
+
+#include "json_reader.h"
+
+typedef struct {
+    const char* pos;
+    const char* end;
+} JsonReader;
+
+static int parse_object(JsonReader* pReader, const json_field_t* fields, size_t fieldCount, void* pOut, uint32_t* pPresent, uint8_t depth);
+static int skip_value(JsonReader* pReader, uint8_t depth);
+
+static void skip_whitespace(JsonReader* pReader) {
+    while (pReader->pos < pReader->end &&
+           (*pReader->pos == ' ' || *pReader->pos == '\t' || *pReader->pos == '\n' || *pReader->pos == '\r')) {
+        pReader->pos++;
+    }
+}
+
+static bool consume(JsonReader* pReader, char c) {
+    skip_whitespace(pReader);
+    if (pReader->pos < pReader->end && *pReader->pos == c) {
+        pReader->pos++;
+        return true;
+    }
+    return false;
+}
+
+static bool consume_literal(JsonReader* pReader, const char* literal) {
+    size_t len = strlen(literal);
+    if ((size_t)(pReader->end - pReader->pos) < len || memcmp(pReader->pos, literal, len) != 0) {
+        return false;
+    }
+    pReader->pos += len;
+    return true;
+}
+
+static int parse_string(JsonReader* pReader, json_string_t* pString) {
+    if (!consume(pReader, '"')) {
+        return JSON_ERROR_SYNTAX;
+    }
+    const char* start = pReader->pos;
+    while (pReader->pos < pReader->end && *pReader->pos != '"') {
+        if (*pReader->pos == '\\') {
+            pReader->pos++; // the escaped character may be a quote
+        }
+        pReader->pos++;
+    }
+    if (pReader->pos >= pReader->end) {
+        return JSON_ERROR_SYNTAX;
+    }
+    pString->ptr = start;
+    pString->len = pReader->pos - start;
+    pReader->pos++; // closing quote
+    return JSON_SUCCESS;
+}
+
+static int parse_number(JsonReader* pReader, float* pValue) {
+    skip_whitespace(pReader);
+    bool negative = false;
+    bool digits = false;
+    float value = 0.0f;
+
+    if (pReader->pos < pReader->end && *pReader->pos == '-') {
+        negative = true;
+        pReader->pos++;
+    }
+    while (pReader->pos < pReader->end && *pReader->pos >= '0' && *pReader->pos <= '9') {
+        value = value * 10.0f + (*pReader->pos - '0');
+        digits = true;
+        pReader->pos++;
+    }
+    if (pReader->pos < pReader->end && *pReader->pos == '.') {
+        pReader->pos++;
+        float scale = 0.1f;
+        while (pReader->pos < pReader->end && *pReader->pos >= '0' && *pReader->pos <= '9') {
+            value += (*pReader->pos - '0') * scale;
+            scale *= 0.1f;
+            digits = true;
+            pReader->pos++;
+        }
+    }
+    if (!digits) {
+        return JSON_ERROR_SYNTAX;
+    }
+    if (pReader->pos < pReader->end && (*pReader->pos == 'e' || *pReader->pos == 'E')) {
+        pReader->pos++;
+        bool negativeExponent = false;
+        int exponent = 0;
+        if (pReader->pos < pReader->end && (*pReader->pos == '-' || *pReader->pos == '+')) {
+            negativeExponent = (*pReader->pos == '-');
+            pReader->pos++;
+        }
+        while (pReader->pos < pReader->end && *pReader->pos >= '0' && *pReader->pos <= '9') {
+            exponent = exponent * 10 + (*pReader->pos - '0');
+            if (exponent > 38) {
+                return JSON_ERROR_SYNTAX;
+            }
+            pReader->pos++;
+        }
+        while (exponent-- > 0) {
+            value = negativeExponent ? value / 10.0f : value * 10.0f;
+        }
+    }
+    *pValue = negative ? -value : value;
+    return JSON_SUCCESS;
+}
+
+static int parse_bool(JsonReader* pReader, bool* pValue) {
+    skip_whitespace(pReader);
+    if (consume_literal(pReader, "true")) {
+        *pValue = true;
+        return JSON_SUCCESS;
+    }
+    if (consume_literal(pReader, "false")) {
+        *pValue = false;
+        return JSON_SUCCESS;
+    }
+    return JSON_ERROR_TYPE;
+}
+
+static int skip_array(JsonReader* pReader, uint8_t depth) {
+    if (!consume(pReader, '[')) {
+        return JSON_ERROR_SYNTAX;
+    }
+    if (consume(pReader, ']')) {
+        return JSON_SUCCESS;
+    }
+    do {
+        int ret = skip_value(pReader, depth + 1);
+        if (ret != JSON_SUCCESS) {
+            return ret;
+        }
+    } while (consume(pReader, ','));
+    return consume(pReader, ']') ? JSON_SUCCESS : JSON_ERROR_SYNTAX;
+}
+
+static int skip_value(JsonReader* pReader, uint8_t depth) {
+    if (depth >= JSON_READER_MAX_DEPTH) {
+        return JSON_ERROR_DEPTH;
+    }
+    skip_whitespace(pReader);
+    if (pReader->pos >= pReader->end) {
+        return JSON_ERROR_SYNTAX;
+    }
+
+    json_string_t string;
+    float number;
+    switch (*pReader->pos) {
+    case '"':
+        return parse_string(pReader, &string);
+    case '{':
+        return parse_object(pReader, NULL, 0, NULL, NULL, depth + 1);
+    case '[':
+        return skip_array(pReader, depth);
+    case 't':
+        return consume_literal(pReader, "true") ? JSON_SUCCESS : JSON_ERROR_SYNTAX;
+    case 'f':
+        return consume_literal(pReader, "false") ? JSON_SUCCESS : JSON_ERROR_SYNTAX;
+    case 'n':
+        return consume_literal(pReader, "null") ? JSON_SUCCESS : JSON_ERROR_SYNTAX;
+    default:
+        return parse_number(pReader, &number);
+    }
+}
+
+static const json_field_t* find_field(const json_field_t* fields, size_t fieldCount, json_string_t key) {
+    for (size_t i = 0; i < fieldCount; i++) {
+        if (json_string_equals(key, fields[i].key)) {
+            return &fields[i];
+        }
+    }
+    return NULL;
+}
+
+static int parse_field(JsonReader* pReader, const json_field_t* pField, void* pOut, uint32_t* pPresent, uint8_t depth) {
+    void* pValue = (uint8_t*)pOut + pField->offset;
+    float number;
+    int ret;
+
+    skip_whitespace(pReader);
+    switch (pField->type) {
+    case JSON_FIELD_INT:
+        if ((ret = parse_number(pReader, &number)) != JSON_SUCCESS) {
+            return JSON_ERROR_TYPE;
+        }
+        // The cast is undefined outside the int32 range, also false for NaN
+        if (!(number >= -2147483648.0f && number < 2147483648.0f)) {
+            return JSON_ERROR_RANGE;
+        }
+        *(int32_t*)pValue = (int32_t)number;
+        break;
+    case JSON_FIELD_FLOAT:
+        if ((ret = parse_number(pReader, &number)) != JSON_SUCCESS) {
+            return JSON_ERROR_TYPE;
+        }
+        *(float*)pValue = number;
+        break;
+    case JSON_FIELD_BOOL:
+        if ((ret = parse_bool(pReader, (bool*)pValue)) != JSON_SUCCESS) {
+            return ret;
+        }
+        break;
+    case JSON_FIELD_STRING:
+        if (pReader->pos >= pReader->end || *pReader->pos != '"') {
+            return JSON_ERROR_TYPE;
+        }
+        if ((ret = parse_string(pReader, (json_string_t*)pValue)) != JSON_SUCCESS) {
+            return ret;
+        }
+        break;
+    case JSON_FIELD_OBJECT:
+        if (pReader->pos >= pReader->end || *pReader->pos != '{') {
+            return JSON_ERROR_TYPE;
+        }
+        if ((ret = parse_object(pReader, pField->fields, pField->fieldCount, pOut, pPresent, depth + 1)) != JSON_SUCCESS) {
+            return ret;
+        }
+        break;
+    }
+    *pPresent |= pField->flag;
+    return JSON_SUCCESS;
+}
+
+static int parse_object(JsonReader* pReader, const json_field_t* fields, size_t fieldCount, void* pOut, uint32_t* pPresent, uint8_t depth) {
+    if (depth >= JSON_READER_MAX_DEPTH) {
+        return JSON_ERROR_DEPTH;
+    }
+    if (!consume(pReader, '{')) {
+        return JSON_ERROR_SYNTAX;
+    }
+    if (consume(pReader, '}')) {
+        return JSON_SUCCESS;
+    }
+
+    do {
+        json_string_t key;
+        int ret = parse_string(pReader, &key);
+        if (ret != JSON_SUCCESS) {
+            return ret;
+        }
+        if (!consume(pReader, ':')) {
+            return JSON_ERROR_SYNTAX;
+        }
+
+        const json_field_t* pField = find_field(fields, fieldCount, key);
+        if (pField != NULL) {
+            ret = parse_field(pReader, pField, pOut, pPresent, depth);
+        } else {
+            ret = skip_value(pReader, depth);
+        }
+        if (ret != JSON_SUCCESS) {
+            return ret;
+        }
+    } while (consume(pReader, ','));
+
+    return consume(pReader, '}') ? JSON_SUCCESS : JSON_ERROR_SYNTAX;
+}
+
+// Parses a JSON object into pOut as described by the fields; pPresent collects the flags of the members found
+int json_parse(const char* json, size_t len, const json_field_t* fields, size_t fieldCount, void* pOut, uint32_t* pPresent) {
+    if (json == NULL) {
+        return JSON_ERROR_SYNTAX;
+    }
+    JsonReader reader = {
+        .pos = json,
+        .end = json + len,
+    };
+    *pPresent = 0;
+
+    int ret = parse_object(&reader, fields, fieldCount, pOut, pPresent, 0);
+    if (ret != JSON_SUCCESS) {
+        return ret;
+    }
+    skip_whitespace(&reader);
+    return (reader.pos == reader.end || *reader.pos == '\0') ? JSON_SUCCESS : JSON_ERROR_SYNTAX;
+}
+
+bool json_string_equals(json_string_t str, const char* value) {
+    size_t len = strlen(value);
+    return (str.len == len) && (memcmp(str.ptr, value, len) == 0);
+}
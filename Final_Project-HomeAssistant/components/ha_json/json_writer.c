@@ -0,0 +1,145 @@
+#include <string.h>
+
+#include "json_writer.h"
+
+static void put_char(json_writer_t* pWriter, char c) {
+    // Always keep one byte for the terminating zero
+    if (pWriter->overflow || pWriter->len + 1 >= pWriter->size) {
+        pWriter->overflow = true;
+        return;
+    }
+    pWriter->buf[pWriter->len++] = c;
+}
+
+static void put_raw(json_writer_t* pWriter, const char* str, size_t len) {
+    if (pWriter->overflow || pWriter->len + len >= pWriter->size) {
+        pWriter->overflow = true;
+        return;
+    }
+    memcpy(&pWriter->buf[pWriter->len], str, len);
+    pWriter->len += len;
+}
+
+static void put_escaped(json_writer_t* pWriter, const char* str) {
+    static const char hex[] = "0123456789abcdef";
+
+    put_char(pWriter, '"');
+    for (const char* c = str; *c != '\0'; c++) {
+        switch (*c) {
+        case '"':  put_raw(pWriter, "\\\"", 2); break;
+        case '\\': put_raw(pWriter, "\\\\", 2); break;
+        case '\n': put_raw(pWriter, "\\n", 2); break;
+        case '\r': put_raw(pWriter, "\\r", 2); break;
+        case '\t': put_raw(pWriter, "\\t", 2); break;
+        default:
+            if ((unsigned char)*c < 0x20) {
+                char escape[6] = { '\\', 'u', '0', '0', hex[(*c >> 4) & 0x0F], hex[*c & 0x0F] };
+                put_raw(pWriter, escape, sizeof(escape));
+            } else {
+                put_char(pWriter, *c);
+            }
+            break;
+        }
+    }
+    put_char(pWriter, '"');
+}
+
+// Writes the separator and the key of the next member
+static void put_key(json_writer_t* pWriter, const char* key) {
+    uint8_t bit = 1 << pWriter->depth;
+    if (pWriter->needsComma & bit) {
+        put_char(pWriter, ',');
+    }
+    pWriter->needsComma |= bit;
+
+    if (key != NULL) {
+        put_escaped(pWriter, key);
+        put_char(pWriter, ':');
+    }
+}
+
+void json_writer_init(json_writer_t* pWriter, char* buf, size_t size) {
+    pWriter->buf = buf;
+    pWriter->size = size;
+    pWriter->len = 0;
+    pWriter->depth = 0;
+    pWriter->needsComma = 0;
+    pWriter->overflow = (buf == NULL || size == 0);
+}
+
+static void begin_container(json_writer_t* pWriter, const char* key, char open) {
+    if (pWriter->depth + 1 >= JSON_WRITER_MAX_DEPTH) {
+        pWriter->overflow = true;
+        return;
+    }
+    put_key(pWriter, key);
+    put_char(pWriter, open);
+    pWriter->depth++;
+    pWriter->needsComma &= ~(1 << pWriter->depth);
+}
+
+static void end_container(json_writer_t* pWriter, char close) {
+    if (pWriter->depth == 0) {
+        pWriter->overflow = true;
+        return;
+    }
+    pWriter->depth--;
+    put_char(pWriter, close);
+}
+
+void json_writer_begin_object(json_writer_t* pWriter, const char* key) {
+    begin_container(pWriter, key, '{');
+}
+
+void json_writer_end_object(json_writer_t* pWriter) {
+    end_container(pWriter, '}');
+}
+
+// Members of an array are added with a NULL key
+void json_writer_begin_array(json_writer_t* pWriter, const char* key) {
+    begin_container(pWriter, key, '[');
+}
+
+void json_writer_end_array(json_writer_t* pWriter) {
+    end_container(pWriter, ']');
+}
+
+void json_writer_add_int(json_writer_t* pWriter, const char* key, int32_t value) {
+    char digits[12];
+    size_t pos = sizeof(digits);
+    uint32_t magnitude = (value < 0) ? (uint32_t)(-(int64_t)value) : (uint32_t)value;
+
+    do {
+        digits[--pos] = '0' + (magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) {
+        digits[--pos] = '-';
+    }
+
+    put_key(pWriter, key);
+    put_raw(pWriter, &digits[pos], sizeof(digits) - pos);
+}
+
+void json_writer_add_string(json_writer_t* pWriter, const char* key, const char* value) {
+    put_key(pWriter, key);
+    put_escaped(pWriter, value);
+}
+
+void json_writer_add_bool(json_writer_t* pWriter, const char* key, bool value) {
+    put_key(pWriter, key);
+    if (value) {
+        put_raw(pWriter, "true", 4);
+    } else {
+        put_raw(pWriter, "false", 5);
+    }
+}
+
+// Terminates the string, returns its length or -1 if it did not fit or objects are still open
+int json_writer_finish(json_writer_t* pWriter) {
+    if (pWriter->overflow || pWriter->depth != 0) {
+        return -1;
+    }
+    pWriter->buf[pWriter->len] = '\0';
+    return (int)pWriter->len;
+}
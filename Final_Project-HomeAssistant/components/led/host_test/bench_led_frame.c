@@ -0,0 +1,165 @@
+#include <getopt.h>
+#include <string.h>
+
+#include "host_bench.h"
+#include "ha_json.h"
+#include "led_frame.h"
+#ifdef HAVE_CJSON
+#include "cJSON.h"
+#endif
+
+// Time to decode and apply one update of the 5x5 matrix: the binary frames of the led/pixels
+// topic against the JSON light command, which can only set one color for all pixels. Apply is
+// the brightness scaling the LED task does before writing the strip.
+
+#define BENCH_PIXELS        25
+#define BENCH_BRIGHTNESS    180
+
+static const char* gLightCommand = "{\"state\":\"ON\",\"brightness\":180,\"color\":{\"r\":255,\"g\":120,\"b\":40},\"transition\":0}";
+
+static uint8_t gPixels[BENCH_PIXELS * 3];
+static uint8_t gStrip[BENCH_PIXELS * 3];
+
+typedef int (*bench_fn_t)(void);
+
+// As render_pixels() in led.c
+static void apply_pixels(uint8_t brightness) {
+    for (int i = 0; i < BENCH_PIXELS * 3; i++) {
+        gStrip[i] = (gPixels[i] * brightness) / 255;
+    }
+}
+
+static void fill_pixels(uint8_t r, uint8_t g, uint8_t b) {
+    for (int i = 0; i < BENCH_PIXELS; i++) {
+        gPixels[i * 3] = r;
+        gPixels[i * 3 + 1] = g;
+        gPixels[i * 3 + 2] = b;
+    }
+}
+
+static uint8_t gFullFrame[1 + BENCH_PIXELS * 3];
+static uint8_t gDeltaFrame[1 + 5 * LED_FRAME_DELTA_RECORD_SIZE];
+static const uint8_t gSegmentFrame[] = { LED_FRAME_TYPE_SEGMENT, 5, 10, 255, 120, 40 };
+
+static void build_frames(void) {
+    gFullFrame[0] = LED_FRAME_TYPE_FULL;
+    for (int i = 0; i < BENCH_PIXELS * 3; i++) {
+        gFullFrame[1 + i] = (uint8_t)(i * 7);
+    }
+    gDeltaFrame[0] = LED_FRAME_TYPE_DELTA;
+    for (int i = 0; i < 5; i++) {
+        uint8_t* record = &gDeltaFrame[1 + i * LED_FRAME_DELTA_RECORD_SIZE];
+        record[0] = (uint8_t)(i * 6);
+        record[1] = 255;
+        record[2] = (uint8_t)(i * 40);
+        record[3] = 0;
+    }
+}
+
+static int run_full(void) {
+    int ret = led_frame_decode(gFullFrame, sizeof(gFullFrame), gPixels, BENCH_PIXELS);
+    apply_pixels(BENCH_BRIGHTNESS);
+    return ret;
+}
+
+static int run_delta(void) {
+    int ret = led_frame_decode(gDeltaFrame, sizeof(gDeltaFrame), gPixels, BENCH_PIXELS);
+    apply_pixels(BENCH_BRIGHTNESS);
+    return ret;
+}
+
+static int run_segment(void) {
+    int ret = led_frame_decode(gSegmentFrame, sizeof(gSegmentFrame), gPixels, BENCH_PIXELS);
+    apply_pixels(BENCH_BRIGHTNESS);
+    return ret;
+}
+
+// The light command as mqtt_led_control_callback() handles it now
+static int run_ha_json(void) {
+    ha_light_command_t command;
+    uint32_t present;
+    if (ha_json_parse_light_command(gLightCommand, strlen(gLightCommand), &command, &present) != JSON_SUCCESS) {
+        return -1;
+    }
+    fill_pixels((uint8_t)command.r, (uint8_t)command.g, (uint8_t)command.b);
+    apply_pixels((uint8_t)command.brightness);
+    return BENCH_PIXELS;
+}
+
+#ifdef HAVE_CJSON
+// The light command as the callback handled it with cJSON
+static int run_cjson(void) {
+    cJSON* root = cJSON_Parse(gLightCommand);
+    if (root == NULL) {
+        return -1;
+    }
+    uint8_t rgb[3] = { 0 };
+    cJSON* color = cJSON_GetObjectItem(root, "color");
+    if (color != NULL) {
+        const char* keys[] = { "r", "g", "b" };
+        for (int i = 0; i < 3; i++) {
+            cJSON* item = cJSON_GetObjectItem(color, keys[i]);
+            if (item != NULL && cJSON_IsNumber(item)) {
+                rgb[i] = (uint8_t)item->valueint;
+            }
+        }
+    }
+    uint8_t brightness = 255;
+    cJSON* item = cJSON_GetObjectItem(root, "brightness");
+    if (item != NULL && cJSON_IsNumber(item)) {
+        brightness = (uint8_t)item->valueint;
+    }
+    item = cJSON_GetObjectItem(root, "state");
+    bool on = (item == NULL || !cJSON_IsString(item) || strcmp(item->valuestring, "OFF") != 0);
+    cJSON_Delete(root);
+    fill_pixels(rgb[0], rgb[1], rgb[2]);
+    apply_pixels(on ? brightness : 0);
+    return BENCH_PIXELS;
+}
+#endif
+
+static void run(const char* name, size_t bytes, bench_fn_t fn, long iterations) {
+    if (fn() < 0) {
+        fprintf(stderr, "%s: decode failed\n", name);
+        exit(EXIT_FAILURE);
+    }
+    bench_allocs_t start = gBenchAllocs;
+    double t0 = bench_now_s();
+    for (long i = 0; i < iterations; i++) {
+        gBenchSink += (uint32_t)fn();
+    }
+    double elapsed = bench_now_s() - t0;
+    bench_allocs_t allocs = bench_allocs_since(start);
+    printf("| %-14s | %5zu | %8.1f | %10.0f | %6.1f | %8.1f |\n", name, bytes, elapsed * 1e9 / iterations,
+           iterations / elapsed, (double)allocs.count / iterations, (double)allocs.bytes / iterations);
+}
+
+int main(int argc, char* argv[]) {
+    long iterations = 1000000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') {
+            iterations = strtol(optarg, NULL, 10);
+        } else {
+            fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (iterations <= 0) {
+        iterations = 1;
+    }
+    build_frames();
+
+    printf("| %-14s | %5s | %8s | %10s | %6s | %8s |\n", "path", "bytes", "ns/frame", "frames/s", "allocs", "heap B");
+    printf("|----------------|-------|----------|------------|--------|----------|\n");
+    run("binary full", sizeof(gFullFrame), run_full, iterations);
+    run("binary delta 5", sizeof(gDeltaFrame), run_delta, iterations);
+    run("binary segment", sizeof(gSegmentFrame), run_segment, iterations);
+    run("ha_json", strlen(gLightCommand), run_ha_json, iterations);
+#ifdef HAVE_CJSON
+    run("cJSON", strlen(gLightCommand), run_cjson, iterations);
+#else
+    printf("cJSON not built in, set CJSON_DIR or IDF_PATH for the comparison\n");
+#endif
+    return EXIT_SUCCESS;
+}
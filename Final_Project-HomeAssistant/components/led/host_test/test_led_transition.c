@@ -0,0 +1,66 @@
+#include <stdint.h>
+
+#include "host_test.h"
+#include "led_transition.h"
+
+static const led_frame_t BLACK = { .r = 0, .g = 0, .b = 0, .brightness = 0 };
+static const led_frame_t WHITE = { .r = 255, .g = 255, .b = 255, .brightness = 255 };
+
+static void test_end_points(void) {
+    led_frame_t frame = led_transition_interpolate(BLACK, WHITE, 0, 1000);
+    CHECK_EQ(frame.r, 0);
+    CHECK_EQ(frame.brightness, 0);
+    frame = led_transition_interpolate(BLACK, WHITE, 1000, 1000);
+    CHECK_EQ(frame.r, 255);
+    CHECK_EQ(frame.brightness, 255);
+    frame = led_transition_interpolate(WHITE, BLACK, 5000, 1000);
+    CHECK_EQ(frame.g, 0);
+    frame = led_transition_interpolate(WHITE, BLACK, 0, 0);
+    CHECK_EQ(frame.b, 0);
+}
+
+static void test_midpoint(void) {
+    led_frame_t frame = led_transition_interpolate(BLACK, WHITE, 500, 1000);
+    CHECK_EQ(frame.r, 127);
+    frame = led_transition_interpolate(WHITE, BLACK, 500, 1000);
+    CHECK_EQ(frame.r, 128);
+}
+
+// Products of delta and elapsed time above INT32_MAX, UBSan aborts on an overflow
+static void test_long_durations(void) {
+    const uint32_t duration_ms = UINT32_MAX - 1;
+    led_frame_t frame = led_transition_interpolate(BLACK, WHITE, duration_ms / 2, duration_ms);
+    CHECK_EQ(frame.r, 127);
+    frame = led_transition_interpolate(WHITE, BLACK, duration_ms - 1, duration_ms);
+    CHECK_EQ(frame.r, 1);
+
+    uint8_t last = 0;
+    for (uint32_t elapsed_ms = 0; elapsed_ms < LED_TRANSITION_MAX_MS; elapsed_ms += LED_TRANSITION_MAX_MS / 64) {
+        frame = led_transition_interpolate(BLACK, WHITE, elapsed_ms, LED_TRANSITION_MAX_MS);
+        CHECK(frame.r >= last);
+        last = frame.r;
+    }
+}
+
+static void test_step_clamps_duration(void) {
+    led_transition_t transition;
+    led_transition_begin(&transition, BLACK, WHITE, 1000, UINT32_MAX);
+    CHECK_EQ(transition.duration_ms, LED_TRANSITION_MAX_MS);
+
+    led_frame_t frame;
+    CHECK(!led_transition_step(&transition, 1000 + (uint64_t)LED_TRANSITION_MAX_MS * 500, &frame));
+    CHECK_EQ(frame.brightness, 127);
+    CHECK(led_transition_step(&transition, 1000 + (uint64_t)LED_TRANSITION_MAX_MS * 1000, &frame));
+    CHECK_EQ(frame.brightness, 255);
+    // A clock before the start counts as no time elapsed
+    CHECK(!led_transition_step(&transition, 0, &frame));
+    CHECK_EQ(frame.brightness, 0);
+}
+
+int main(void) {
+    RUN_TEST(test_end_points);
+    RUN_TEST(test_midpoint);
+    RUN_TEST(test_long_durations);
+    RUN_TEST(test_step_clamps_duration);
+    return host_test_result();
+}
@@ -2,14 +2,28 @@
 #define LED_H
 
 #include <inttypes.h>
+#include <string.h>
 #include "esp_log.h"
 #include "driver/gpio.h"
 #include "led_strip.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
 #include "sdkconfig.h"
 
+#include "led_transition.h"
+#include "led_frame.h"
+
 #define BLINK_GPIO CONFIG_BLINK_GPIO
 #define BLINK_PERIOD CONFIG_BLINK_PERIOD
 
+#define LED_STRIP_PIXEL_COUNT    25 // 5x5 matrix
+
+#define LED_TRANSITION_FRAME_PERIOD_MS    CONFIG_LED_TRANSITION_FRAME_PERIOD_MS
+#define LED_TRANSITION_TASK_PRIORITY      CONFIG_LED_TRANSITION_TASK_PRIORITY
+#define LED_TRANSITION_TASK_STACKSIZE     2048
+
 typedef struct {
     uint8_t r;
     uint8_t g;
@@ -32,6 +46,11 @@ typedef struct {
 
 extern const colorValues_t color_values[];
 
+void led_set_state(current_led_state_t target, uint32_t transition_ms);
+void led_set_pixel(uint8_t index, uint8_t r, uint8_t g, uint8_t b);
+void led_fill_segment(uint8_t start, uint8_t count, uint8_t r, uint8_t g, uint8_t b);
+void led_show_pixels(void);
+esp_err_t led_apply_frame(const uint8_t* frame, size_t frameLen);
 void adjust_led_brightness(uint8_t brightness);
 void fill_led_strip(uint8_t r, uint8_t g, uint8_t b);
 void fill_led_strip_with_colorValues(colorValues_t colorValues);
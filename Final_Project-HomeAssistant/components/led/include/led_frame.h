@@ -0,0 +1,27 @@
+#ifndef LED_FRAME_H
+#define LED_FRAME_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+// Binary pixel frames received on the led/pixels topic. The first byte selects the encoding:
+//   LED_FRAME_TYPE_FULL:    r,g,b for pixel 0..n-1 (n may be smaller than the strip)
+//   LED_FRAME_TYPE_DELTA:   records of index,r,g,b; only the listed pixels change
+//   LED_FRAME_TYPE_SEGMENT: start,count,r,g,b; fills a run of pixels with one color
+// Kept free of ESP-IDF includes, so the decoder can be compiled and checked on the host.
+
+#define LED_FRAME_TYPE_FULL         0x00
+#define LED_FRAME_TYPE_DELTA        0x01
+#define LED_FRAME_TYPE_SEGMENT      0x02
+
+#define LED_FRAME_DELTA_RECORD_SIZE 4
+#define LED_FRAME_SEGMENT_SIZE      5
+
+#define LED_FRAME_ERROR_EMPTY       -1
+#define LED_FRAME_ERROR_TYPE        -2
+#define LED_FRAME_ERROR_LENGTH      -3
+#define LED_FRAME_ERROR_RANGE       -4
+
+int led_frame_decode(const uint8_t* frame, size_t frameLen, uint8_t* rgb, size_t pixelCount);
+
+#endif // LED_FRAME_H
@@ -0,0 +1,30 @@
+#ifndef LED_TRANSITION_H
+#define LED_TRANSITION_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Kept free of ESP-IDF includes, so the interpolation can be compiled and checked on the host.
+
+#define LED_TRANSITION_MAX_MS   (60 * 60 * 1000) // longer fades are cut to an hour
+
+typedef struct {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    uint8_t brightness; // 0 = off
+} led_frame_t;
+
+typedef struct {
+    led_frame_t from;
+    led_frame_t to;
+    uint64_t start_us;
+    uint32_t duration_ms;
+} led_transition_t;
+
+led_frame_t led_transition_interpolate(led_frame_t from, led_frame_t to, uint32_t elapsed_ms, uint32_t duration_ms);
+void led_transition_begin(led_transition_t* pTransition, led_frame_t from, led_frame_t to, uint64_t now_us, uint32_t duration_ms);
+bool led_transition_step(const led_transition_t* pTransition, uint64_t now_us, led_frame_t* pFrame);
+void led_frame_scale(led_frame_t frame, uint8_t* r, uint8_t* g, uint8_t* b);
+
+#endif // LED_TRANSITION_H
@@ -19,11 +19,170 @@ current_led_state_t current_led_state = {
 /* Private variables */
 led_strip_handle_t led_strip;
 
+static SemaphoreHandle_t gLedMutex = NULL;
+static esp_timer_handle_t gTransitionTimer = NULL;
+static TaskHandle_t gTransitionTask_handle = NULL;
+static led_transition_t gTransition;
+static led_frame_t gShownFrame = { 0 }; // Frame currently visible on the strip
+static uint8_t gPixels[LED_STRIP_PIXEL_COUNT * 3] = { 0 };
+static bool gPixelMode = false; // Render gPixels instead of the uniform color of the frame
+
+/* Private functions */
+static led_frame_t frame_from_state(current_led_state_t state) {
+    led_frame_t frame = {
+        .r = state.color.r,
+        .g = state.color.g,
+        .b = state.color.b,
+        .brightness = state.state ? state.brightness : 0,
+    };
+    return frame;
+}
+
+static void render_frame(led_frame_t frame) {
+    uint8_t r, g, b;
+    led_frame_scale(frame, &r, &g, &b);
+    ESP_LOGV(TAG, "Brightness adjusted color: R=%d, G=%d, B=%d\n", r, g, b);
+
+    for (uint8_t i = 0; i < LED_STRIP_PIXEL_COUNT; i++) {
+        led_strip_set_pixel(led_strip, i, r, g, b);
+    }
+    led_strip_refresh(led_strip);
+}
+
+static void render_pixels(const uint8_t* rgb, uint8_t brightness) {
+    for (uint8_t i = 0; i < LED_STRIP_PIXEL_COUNT; i++) {
+        const uint8_t* pixel = &rgb[i * 3];
+        led_strip_set_pixel(led_strip, i, (pixel[0] * brightness) / 255, (pixel[1] * brightness) / 255, (pixel[2] * brightness) / 255);
+    }
+    led_strip_refresh(led_strip);
+}
+
+static void transition_timer_callback(void* arg) {
+    xTaskNotifyGive(gTransitionTask_handle);
+}
+
+// Only this task writes to the strip; it is woken by the timer for every frame of a running transition
+static void transition_task(void* arg) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        led_frame_t frame;
+        uint8_t pixels[sizeof(gPixels)];
+        xSemaphoreTake(gLedMutex, portMAX_DELAY);
+        bool finished = led_transition_step(&gTransition, esp_timer_get_time(), &frame);
+        gShownFrame = frame;
+        if (finished && esp_timer_is_active(gTransitionTimer)) {
+            esp_timer_stop(gTransitionTimer);
+            ESP_LOGD(TAG, "Transition finished");
+        }
+        bool pixelMode = gPixelMode;
+        if (pixelMode) {
+            memcpy(pixels, gPixels, sizeof(pixels));
+        }
+        xSemaphoreGive(gLedMutex);
+
+        if (pixelMode) {
+            render_pixels(pixels, frame.brightness);
+        } else {
+            render_frame(frame);
+        }
+    }
+}
+
 /* Public functions */
+void led_set_state(current_led_state_t target, uint32_t transition_ms) {
+    if (led_strip == NULL) {
+        ESP_LOGE(TAG, "LED strip not initialized");
+        return;
+    }
+    ESP_LOGD(TAG, "New state: %s, R=%d, G=%d, B=%d, brightness=%d, transition=%" PRIu32 " ms",
+             target.state ? "ON" : "OFF", target.color.r, target.color.g, target.color.b, target.brightness, transition_ms);
+
+    xSemaphoreTake(gLedMutex, portMAX_DELAY);
+    if (target.color.r != current_led_state.color.r || target.color.g != current_led_state.color.g || target.color.b != current_led_state.color.b) {
+        // A new uniform color replaces the per-pixel content, brightness and state apply on top of it
+        gPixelMode = false;
+    }
+    current_led_state = target;
+
+    led_frame_t to = frame_from_state(target);
+    led_frame_t from = gShownFrame;
+    if (from.brightness == 0) {
+        // Fading in from off, only the brightness should change
+        from.r = to.r;
+        from.g = to.g;
+        from.b = to.b;
+    }
+    led_transition_begin(&gTransition, from, to, esp_timer_get_time(), transition_ms);
+
+    if (transition_ms > 0 && !esp_timer_is_active(gTransitionTimer)) {
+        esp_timer_start_periodic(gTransitionTimer, LED_TRANSITION_FRAME_PERIOD_MS * 1000);
+    }
+    xSemaphoreGive(gLedMutex);
+
+    // Render the first frame right away
+    xTaskNotifyGive(gTransitionTask_handle);
+}
+
+void led_set_pixel(uint8_t index, uint8_t r, uint8_t g, uint8_t b) {
+    led_fill_segment(index, 1, r, g, b);
+}
+
+void led_fill_segment(uint8_t start, uint8_t count, uint8_t r, uint8_t g, uint8_t b) {
+    if (led_strip == NULL) {
+        ESP_LOGE(TAG, "LED strip not initialized");
+        return;
+    }
+    if (start + count > LED_STRIP_PIXEL_COUNT) {
+        ESP_LOGE(TAG, "Segment %d+%d out of range", start, count);
+        return;
+    }
+    xSemaphoreTake(gLedMutex, portMAX_DELAY);
+    for (uint8_t i = start; i < start + count; i++) {
+        gPixels[i * 3] = r;
+        gPixels[i * 3 + 1] = g;
+        gPixels[i * 3 + 2] = b;
+    }
+    xSemaphoreGive(gLedMutex);
+}
+
+void led_show_pixels(void) {
+    if (led_strip == NULL) {
+        ESP_LOGE(TAG, "LED strip not initialized");
+        return;
+    }
+    xSemaphoreTake(gLedMutex, portMAX_DELAY);
+    gPixelMode = true;
+    xSemaphoreGive(gLedMutex);
+    xTaskNotifyGive(gTransitionTask_handle);
+}
+
+esp_err_t led_apply_frame(const uint8_t* frame, size_t frameLen) {
+    if (led_strip == NULL) {
+        ESP_LOGE(TAG, "LED strip not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(gLedMutex, portMAX_DELAY);
+    int pixels = led_frame_decode(frame, frameLen, gPixels, LED_STRIP_PIXEL_COUNT);
+    if (pixels >= 0) {
+        gPixelMode = true;
+    }
+    xSemaphoreGive(gLedMutex);
+
+    if (pixels < 0) {
+        ESP_LOGW(TAG, "Invalid pixel frame (%d), length %u", pixels, (unsigned)frameLen);
+        return ESP_ERR_INVALID_ARG;
+    }
+    ESP_LOGV(TAG, "Pixel frame applied, %d pixels changed", pixels);
+    xTaskNotifyGive(gTransitionTask_handle);
+    return ESP_OK;
+}
+
 void adjust_led_brightness(uint8_t brightness) {
     ESP_LOGI(TAG, "Adjusting LED brightness to %d", brightness);
-    current_led_state.brightness = brightness;
-    fill_led_strip_with_colorValues(current_led_state.color);
+    current_led_state_t state = get_current_led_state();
+    state.brightness = brightness;
+    led_set_state(state, 0);
 }
 
 void fill_led_strip(uint8_t r, uint8_t g, uint8_t b) {
@@ -41,23 +200,11 @@ void fill_led_strip(uint8_t r, uint8_t g, uint8_t b) {
     ESP_LOGV(TAG, "Original color: R=%d, G=%d, B=%d\n", r, g, b);
 
     // Set current color to the new values
-    current_led_state.color.r = r;
-    current_led_state.color.g = g;
-    current_led_state.color.b = b;
-
-    // Adjust the color values based on the current brightness
-    r = (r * current_led_state.brightness) / 255;
-    g = (g * current_led_state.brightness) / 255;
-    b = (b * current_led_state.brightness) / 255;
-
-    ESP_LOGV(TAG, "Brightness adjusted color: R=%d, G=%d, B=%d\n", r, g, b);
-    led_strip_clear(led_strip);
-
-    for (uint8_t i = 0; i < 25; i++) {
-        led_strip_set_pixel(led_strip, i, r, g, b);
-    }
-
-    led_strip_refresh(led_strip);
+    current_led_state_t state = get_current_led_state();
+    state.color.r = r;
+    state.color.g = g;
+    state.color.b = b;
+    led_set_state(state, 0);
 }
 
 void fill_led_strip_with_colorValues(colorValues_t colorValues) {
@@ -76,14 +223,10 @@ void toogle_led(bool state) {
     }
     ESP_LOGI(TAG, "Toggling LED state");
 
-    current_led_state.state = state;
-    if (state) {
-        ESP_LOGD(TAG, "Turning on LED strip");
-        fill_led_strip_with_colorValues(current_led_state.color);
-    } else {
-        ESP_LOGD(TAG, "Turning off LED strip");
-        led_strip_clear(led_strip);
-    }
+    ESP_LOGD(TAG, "Turning %s LED strip", state ? "on" : "off");
+    current_led_state_t new_state = get_current_led_state();
+    new_state.state = state;
+    led_set_state(new_state, 0);
 }
 
 current_led_state_t get_current_led_state(void) {
@@ -95,7 +238,7 @@ void led_init(void) {
     /* LED strip initialization with the GPIO and pixels number*/
     led_strip_config_t strip_config = {
         .strip_gpio_num = BLINK_GPIO,
-        .max_leds = 25,
+        .max_leds = LED_STRIP_PIXEL_COUNT,
     };
 #if CONFIG_BLINK_LED_STRIP_BACKEND_RMT
     led_strip_rmt_config_t rmt_config = {
@@ -118,6 +261,20 @@ void led_init(void) {
 #endif
     /* Set all LED off to clear all pixels */
     led_strip_clear(led_strip);
+
+    gLedMutex = xSemaphoreCreateMutex();
+    if (gLedMutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create LED mutex");
+        return;
+    }
+
+    const esp_timer_create_args_t timerArgs = {
+        .callback = transition_timer_callback,
+        .name = "led_transition",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timerArgs, &gTransitionTimer));
+    xTaskCreate(transition_task, "led_transition", LED_TRANSITION_TASK_STACKSIZE, NULL, LED_TRANSITION_TASK_PRIORITY, &gTransitionTask_handle);
+
     ESP_LOGI(TAG, "LEDs initialized\n");
 }
 
@@ -0,0 +1,66 @@
+#include <string.h>
+
+#include "led_frame.h"
+
+static int decode_full(const uint8_t* data, size_t len, uint8_t* rgb, size_t pixelCount) {
+    if (len % 3 != 0) {
+        return LED_FRAME_ERROR_LENGTH;
+    }
+    size_t pixels = len / 3;
+    if (pixels > pixelCount) {
+        return LED_FRAME_ERROR_RANGE;
+    }
+    memcpy(rgb, data, len);
+    return (int)pixels;
+}
+
+static int decode_delta(const uint8_t* data, size_t len, uint8_t* rgb, size_t pixelCount) {
+    if (len % LED_FRAME_DELTA_RECORD_SIZE != 0) {
+        return LED_FRAME_ERROR_LENGTH;
+    }
+    // Validate first, a broken frame must not be applied halfway
+    for (size_t i = 0; i < len; i += LED_FRAME_DELTA_RECORD_SIZE) {
+        if (data[i] >= pixelCount) {
+            return LED_FRAME_ERROR_RANGE;
+        }
+    }
+    for (size_t i = 0; i < len; i += LED_FRAME_DELTA_RECORD_SIZE) {
+        memcpy(&rgb[data[i] * 3], &data[i + 1], 3);
+    }
+    return (int)(len / LED_FRAME_DELTA_RECORD_SIZE);
+}
+
+static int decode_segment(const uint8_t* data, size_t len, uint8_t* rgb, size_t pixelCount) {
+    if (len != LED_FRAME_SEGMENT_SIZE) {
+        return LED_FRAME_ERROR_LENGTH;
+    }
+    size_t start = data[0];
+    size_t count = data[1];
+    if (start + count > pixelCount) {
+        return LED_FRAME_ERROR_RANGE;
+    }
+    for (size_t i = start; i < start + count; i++) {
+        memcpy(&rgb[i * 3], &data[2], 3);
+    }
+    return (int)count;
+}
+
+// Applies the frame to the rgb buffer (3 bytes per pixel), returns the number of pixels written or a LED_FRAME_ERROR_*
+int led_frame_decode(const uint8_t* frame, size_t frameLen, uint8_t* rgb, size_t pixelCount) {
+    if (frame == NULL || frameLen < 1) {
+        return LED_FRAME_ERROR_EMPTY;
+    }
+
+    const uint8_t* data = frame + 1;
+    size_t len = frameLen - 1;
+    switch (frame[0]) {
+    case LED_FRAME_TYPE_FULL:
+        return decode_full(data, len, rgb, pixelCount);
+    case LED_FRAME_TYPE_DELTA:
+        return decode_delta(data, len, rgb, pixelCount);
+    case LED_FRAME_TYPE_SEGMENT:
+        return decode_segment(data, len, rgb, pixelCount);
+    default:
+        return LED_FRAME_ERROR_TYPE;
+    }
+}
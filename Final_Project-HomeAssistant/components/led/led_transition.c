@@ -0,0 +1,45 @@
+#include "led_transition.h"
+
+// elapsed_ms < duration_ms, the product needs 64 bit for durations above about 8.4e6 ms
+static uint8_t lerp_channel(uint8_t from, uint8_t to, uint32_t elapsed_ms, uint32_t duration_ms) {
+    int64_t delta = (int64_t)to - (int64_t)from;
+    return (uint8_t)((int64_t)from + (delta * (int64_t)elapsed_ms) / (int64_t)duration_ms);
+}
+
+led_frame_t led_transition_interpolate(led_frame_t from, led_frame_t to, uint32_t elapsed_ms, uint32_t duration_ms) {
+    if (duration_ms == 0 || elapsed_ms >= duration_ms) {
+        return to;
+    }
+
+    led_frame_t frame = {
+        .r = lerp_channel(from.r, to.r, elapsed_ms, duration_ms),
+        .g = lerp_channel(from.g, to.g, elapsed_ms, duration_ms),
+        .b = lerp_channel(from.b, to.b, elapsed_ms, duration_ms),
+        .brightness = lerp_channel(from.brightness, to.brightness, elapsed_ms, duration_ms),
+    };
+    return frame;
+}
+
+void led_transition_begin(led_transition_t* pTransition, led_frame_t from, led_frame_t to, uint64_t now_us, uint32_t duration_ms) {
+    pTransition->from = from;
+    pTransition->to = to;
+    pTransition->start_us = now_us;
+    pTransition->duration_ms = (duration_ms > LED_TRANSITION_MAX_MS) ? LED_TRANSITION_MAX_MS : duration_ms;
+}
+
+// Writes the frame for the given time, returns true once the target has been reached
+bool led_transition_step(const led_transition_t* pTransition, uint64_t now_us, led_frame_t* pFrame) {
+    uint64_t elapsed_ms = (now_us > pTransition->start_us) ? (now_us - pTransition->start_us) / 1000 : 0;
+    if (elapsed_ms >= pTransition->duration_ms) {
+        *pFrame = pTransition->to;
+        return true;
+    }
+    *pFrame = led_transition_interpolate(pTransition->from, pTransition->to, (uint32_t)elapsed_ms, pTransition->duration_ms);
+    return false;
+}
+
+void led_frame_scale(led_frame_t frame, uint8_t* r, uint8_t* g, uint8_t* b) {
+    *r = (frame.r * frame.brightness) / 255;
+    *g = (frame.g * frame.brightness) / 255;
+    *b = (frame.b * frame.brightness) / 255;
+}
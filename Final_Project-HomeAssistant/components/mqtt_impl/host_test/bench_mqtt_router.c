@@ -0,0 +1,166 @@
+#include <getopt.h>
+#include <string.h>
+
+#include "host_bench.h"
+#include "mqtt_router.h"
+
+// Routing an incoming topic through 1000 subscriptions: the router against the linear strncmp
+// scan over fixed topic strings it replaced, which only knew exact topics. -w adds that many
+// home/+/wideN filters, a wide fan-out below a single level.
+
+#define BENCH_TOPIC_SIZE    128
+#define BENCH_TOPICS        4096
+
+typedef struct {
+    char topic[BENCH_TOPIC_SIZE];
+    void* pValue;
+} linear_entry_t;
+
+static linear_entry_t* gLinear;
+static size_t gLinearCount;
+static char gTopics[BENCH_TOPICS][BENCH_TOPIC_SIZE];
+static size_t gTopicLens[BENCH_TOPICS];
+
+static uint64_t gRandom = 88172645463325252ull;
+
+static uint32_t next_random(uint32_t limit) {
+    gRandom ^= gRandom << 13;
+    gRandom ^= gRandom >> 7;
+    gRandom ^= gRandom << 17;
+    return (uint32_t)(gRandom % limit);
+}
+
+static void count_match(void* pValue, void* pArg) {
+    (*(size_t*)pArg)++;
+}
+
+// As the MQTT_EVENT_DATA handler did before the router
+static size_t linear_match(const char* topic, size_t topicLen) {
+    for (size_t i = 0; i < gLinearCount; i++) {
+        if (strncmp(gLinear[i].topic, topic, topicLen) == 0 && strlen(gLinear[i].topic) == topicLen) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// devices x sensors exact filters, plus one '+' filter per sensor and one '#' filter per device
+static MqttRouter* build(size_t devices, size_t sensors, size_t wide, size_t* pRoutes) {
+    size_t routes = devices * sensors + sensors + devices + wide;
+    MqttRouter* pRouter = mqtt_router_create(routes);
+    gLinear = calloc(devices * sensors, sizeof(linear_entry_t));
+    gLinearCount = 0;
+    char filter[BENCH_TOPIC_SIZE];
+    uintptr_t value = 1;
+    for (size_t d = 0; d < devices; d++) {
+        for (size_t s = 0; s < sensors; s++) {
+            snprintf(filter, sizeof(filter), "home/device%zu/sensor%zu/set", d, s);
+            mqtt_router_add(pRouter, filter, (void*)value++);
+            strcpy(gLinear[gLinearCount++].topic, filter);
+        }
+        snprintf(filter, sizeof(filter), "home/device%zu/config/#", d);
+        mqtt_router_add(pRouter, filter, (void*)value++);
+    }
+    for (size_t s = 0; s < sensors; s++) {
+        snprintf(filter, sizeof(filter), "home/+/sensor%zu/get", s);
+        mqtt_router_add(pRouter, filter, (void*)value++);
+    }
+    for (size_t w = 0; w < wide; w++) {
+        snprintf(filter, sizeof(filter), "home/+/wide%zu", w);
+        mqtt_router_add(pRouter, filter, (void*)value++);
+    }
+    *pRoutes = routes;
+    return pRouter;
+}
+
+// Mostly subscribed topics, some wildcard hits and some misses
+static void build_topics(size_t devices, size_t sensors, size_t wide) {
+    for (size_t i = 0; i < BENCH_TOPICS; i++) {
+        size_t d = next_random(devices);
+        size_t s = next_random(sensors);
+        if (wide > 0 && next_random(4) == 0) {
+            snprintf(gTopics[i], BENCH_TOPIC_SIZE, "home/device%zu/wide%u", d, (unsigned)next_random(wide));
+            gTopicLens[i] = strlen(gTopics[i]);
+            continue;
+        }
+        switch (next_random(8)) {
+        case 0:
+            snprintf(gTopics[i], BENCH_TOPIC_SIZE, "home/device%zu/sensor%zu/get", d, s);
+            break;
+        case 1:
+            snprintf(gTopics[i], BENCH_TOPIC_SIZE, "home/device%zu/config/interval", d);
+            break;
+        case 2:
+            snprintf(gTopics[i], BENCH_TOPIC_SIZE, "home/device%zu/unknown", d);
+            break;
+        default:
+            snprintf(gTopics[i], BENCH_TOPIC_SIZE, "home/device%zu/sensor%zu/set", d, s);
+            break;
+        }
+        gTopicLens[i] = strlen(gTopics[i]);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    long iterations = 1000000;
+    size_t devices = 100;
+    size_t sensors = 9;
+    size_t wide = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:s:w:")) != -1) {
+        switch (opt) {
+        case 'n': iterations = strtol(optarg, NULL, 10); break;
+        case 'd': devices = strtoul(optarg, NULL, 10); break;
+        case 's': sensors = strtoul(optarg, NULL, 10); break;
+        case 'w': wide = strtoul(optarg, NULL, 10); break;
+        default:
+            fprintf(stderr, "usage: %s [-n iterations] [-d devices] [-s sensors per device] [-w wide filters]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (iterations <= 0 || devices == 0 || sensors == 0) {
+        fprintf(stderr, "iterations, devices and sensors must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t routes;
+    bench_allocs_t start = gBenchAllocs;
+    double t0 = bench_now_s();
+    MqttRouter* pRouter = build(devices, sensors, wide, &routes);
+    double buildTime = bench_now_s() - t0;
+    bench_allocs_t allocs = bench_allocs_since(start);
+    if (pRouter == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+    build_topics(devices, sensors, wide);
+    printf("%zu subscriptions, %zu of them wildcards, built in %.2f ms with %llu allocations\n", routes,
+           devices + sensors + wide, buildTime * 1e3, (unsigned long long)allocs.count);
+
+    size_t routerMatches = 0;
+    t0 = bench_now_s();
+    for (long i = 0; i < iterations; i++) {
+        size_t n = i % BENCH_TOPICS;
+        mqtt_router_match(pRouter, gTopics[n], gTopicLens[n], count_match, &routerMatches);
+    }
+    double routerTime = bench_now_s() - t0;
+
+    size_t linearMatches = 0;
+    t0 = bench_now_s();
+    for (long i = 0; i < iterations; i++) {
+        size_t n = i % BENCH_TOPICS;
+        linearMatches += linear_match(gTopics[n], gTopicLens[n]);
+    }
+    double linearTime = bench_now_s() - t0;
+    gBenchSink += (uint32_t)(routerMatches + linearMatches);
+
+    printf("| %-12s | %9s | %10s | %8s |\n", "matcher", "ns/topic", "topics/s", "matches");
+    printf("|--------------|-----------|------------|----------|\n");
+    printf("| %-12s | %9.1f | %10.0f | %8zu |\n", "router", routerTime * 1e9 / iterations, iterations / routerTime, routerMatches);
+    printf("| %-12s | %9.1f | %10.0f | %8zu |\n", "linear exact", linearTime * 1e9 / iterations, iterations / linearTime, linearMatches);
+    printf("The linear scan finds the exact subscriptions only.\n");
+
+    mqtt_router_destroy(pRouter);
+    free(gLinear);
+    return EXIT_SUCCESS;
+}
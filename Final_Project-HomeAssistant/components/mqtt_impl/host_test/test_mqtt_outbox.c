@@ -0,0 +1,339 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "host_test.h"
+#include "esp_partition.h"
+#include "mqtt_outbox.h"
+#include "mqtt_spill.h"
+
+// Offline queueing against a fake broker: the RAM ring, the flash spill on a RAM flash with
+// NOR semantics, replay order, failed publishes, reboots and sector reuse.
+
+#define SECTOR_SIZE     4096
+#define SECTOR_COUNT    4
+#define MAX_PAYLOAD     256
+#define RING_SIZE       4
+#define MAX_RECEIVED    512
+
+static uint8_t gFlash[SECTOR_SIZE * SECTOR_COUNT];
+static uint32_t gErases[SECTOR_COUNT];
+static esp_partition_t gPartition = {
+    .type = ESP_PARTITION_TYPE_DATA,
+    .size = sizeof(gFlash),
+    .erase_size = SECTOR_SIZE,
+    .label = CONFIG_MQTT_OUTBOX_PARTITION_LABEL,
+};
+
+typedef struct {
+    uint32_t received[MAX_RECEIVED]; // message numbers in arrival order
+    size_t count;
+    int failAfter;      // publishes accepted before the next one fails, -1 = never
+} fake_broker_t;
+
+static fake_broker_t gBroker;
+static MqttOutbox* gOutbox = NULL;
+static mqtt_outbox_entry_t* gDrainEntry = NULL;
+static uint32_t gLost = 0;
+
+// ----- RAM flash, programming only clears bits -----
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label) {
+    return (strcmp(label, gPartition.label) == 0) ? &gPartition : NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size) {
+    CHECK(src_offset + size <= partition->size);
+    memcpy(dst, &gFlash[src_offset], size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size) {
+    CHECK(dst_offset + size <= partition->size);
+    const uint8_t* data = src;
+    for (size_t i = 0; i < size; i++) {
+        gFlash[dst_offset + i] &= data[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+    CHECK(offset % SECTOR_SIZE == 0 && size % SECTOR_SIZE == 0);
+    memset(&gFlash[offset], 0xff, size);
+    for (size_t sector = offset / SECTOR_SIZE; sector < (offset + size) / SECTOR_SIZE; sector++) {
+        gErases[sector]++;
+    }
+    return ESP_OK;
+}
+
+// Header of three words, then the entry, as laid out by mqtt_spill.c
+static size_t slot_size(void) {
+    return (3 * sizeof(uint32_t) + mqtt_outbox_entry_size(MAX_PAYLOAD) + 3) & ~(size_t)3;
+}
+
+static uint32_t total_erases(void) {
+    uint32_t total = 0;
+    for (size_t i = 0; i < SECTOR_COUNT; i++) {
+        total += gErases[i];
+    }
+    return total;
+}
+
+// ----- publishing side, as in mqtt_publish.c -----
+
+static void spill_evicted(const mqtt_outbox_entry_t* pEntry, void* pArg) {
+    if (!mqtt_spill_write(pEntry)) {
+        gLost++;
+    }
+}
+
+static void boot(void) {
+    mqtt_outbox_destroy(gOutbox);
+    gOutbox = mqtt_outbox_create(RING_SIZE, MAX_PAYLOAD, spill_evicted, NULL);
+    CHECK(gOutbox != NULL);
+    CHECK_EQ(mqtt_spill_init(MAX_PAYLOAD), ESP_OK);
+}
+
+static void erase_flash(void) {
+    memset(gFlash, 0xff, sizeof(gFlash));
+    memset(gErases, 0, sizeof(gErases));
+}
+
+static void queue(uint32_t number, uint32_t ttl_ms, int64_t now_us) {
+    mqtt_outbox_options_t options = { .qos = 1, .ttl_ms = ttl_ms };
+    CHECK_EQ(mqtt_outbox_push(gOutbox, "home/sensor", (const uint8_t*)&number, sizeof(number), &options, now_us), MQTT_OUTBOX_STORED);
+}
+
+static bool broker_publish(const mqtt_outbox_entry_t* pEntry) {
+    if (gBroker.failAfter == 0) {
+        return false;
+    }
+    if (gBroker.failAfter > 0) {
+        gBroker.failAfter--;
+    }
+    uint32_t number;
+    CHECK_EQ(pEntry->len, sizeof(number));
+    memcpy(&number, pEntry->payload, sizeof(number));
+    if (gBroker.count < MAX_RECEIVED) {
+        gBroker.received[gBroker.count++] = number;
+    }
+    return true;
+}
+
+// One pass of drain_task: flash first since it holds the older messages, stops at a failed publish
+static size_t drain(int64_t now_us) {
+    size_t replayed = 0;
+    while (true) {
+        bool fromSpill = false;
+        bool found = false;
+        while (mqtt_spill_peek(gDrainEntry)) {
+            if (gDrainEntry->expires_us == 0 || now_us < gDrainEntry->expires_us) {
+                fromSpill = true;
+                found = true;
+                break;
+            }
+            mqtt_spill_pop();
+        }
+        if (!found) {
+            const mqtt_outbox_entry_t* pEntry = mqtt_outbox_peek(gOutbox, now_us);
+            if (pEntry == NULL) {
+                return replayed;
+            }
+            memcpy(gDrainEntry, pEntry, sizeof(mqtt_outbox_entry_t) + pEntry->len);
+        }
+        if (!broker_publish(gDrainEntry)) {
+            return replayed;
+        }
+        if (fromSpill) {
+            mqtt_spill_pop();
+        } else {
+            CHECK(mqtt_outbox_pop(gOutbox, gDrainEntry->seq));
+        }
+        replayed++;
+    }
+}
+
+static void reset_broker(void) {
+    memset(&gBroker, 0, sizeof(gBroker));
+    gBroker.failAfter = -1;
+}
+
+static void check_received(uint32_t first, size_t count) {
+    CHECK_EQ(gBroker.count, count);
+    for (size_t i = 0; i < gBroker.count && i < count; i++) {
+        CHECK_EQ(gBroker.received[i], first + i);
+    }
+}
+
+// ----- tests -----
+
+static void test_ring_only(void) {
+    erase_flash();
+    boot();
+    reset_broker();
+
+    mqtt_outbox_options_t state = { .coalesce = true };
+    uint32_t value = 1;
+    CHECK_EQ(mqtt_outbox_push(gOutbox, "home/state", (const uint8_t*)&value, sizeof(value), &state, 0), MQTT_OUTBOX_STORED);
+    queue(2, 0, 0);
+    value = 3;
+    CHECK_EQ(mqtt_outbox_push(gOutbox, "home/state", (const uint8_t*)&value, sizeof(value), &state, 0), MQTT_OUTBOX_COALESCED);
+    queue(4, 100, 0);
+
+    // The coalesced state keeps the position of the first one, the message with TTL expired
+    CHECK_EQ(drain(200 * 1000), 2);
+    CHECK_EQ(gBroker.count, 2);
+    CHECK_EQ(gBroker.received[0], 3);
+    CHECK_EQ(gBroker.received[1], 2);
+    CHECK_EQ(total_erases(), 0);
+}
+
+static void test_spill_order(void) {
+    erase_flash();
+    boot();
+    reset_broker();
+
+    for (uint32_t i = 0; i < 20; i++) {
+        queue(i, 0, 0);
+    }
+    CHECK_EQ(mqtt_outbox_count(gOutbox), RING_SIZE);
+    CHECK_EQ(mqtt_spill_count(), 20 - RING_SIZE);
+    CHECK_EQ(gLost, 0);
+
+    CHECK_EQ(drain(0), 20);
+    check_received(0, 20);
+    CHECK_EQ(mqtt_spill_count(), 0);
+    // Draining to zero leaves the sector alone, it is erased when it is written again
+    CHECK_EQ(total_erases(), 2);
+}
+
+static void test_failed_publish(void) {
+    erase_flash();
+    boot();
+    reset_broker();
+
+    for (uint32_t i = 0; i < 12; i++) {
+        queue(i, 0, 0);
+    }
+    gBroker.failAfter = 5;
+    CHECK_EQ(drain(0), 5);
+    CHECK_EQ(mqtt_spill_count() + mqtt_outbox_count(gOutbox), 7);
+
+    // The retry continues with the message that failed, new ones queue behind it
+    queue(12, 0, 0);
+    gBroker.failAfter = -1;
+    CHECK_EQ(drain(0), 8);
+    check_received(0, 13);
+}
+
+static void test_reboot(void) {
+    erase_flash();
+    boot();
+    reset_broker();
+
+    for (uint32_t i = 0; i < 10 + RING_SIZE; i++) {
+        queue(i, (i == 5) ? 60000 : 0, 0);
+    }
+    gBroker.failAfter = 3;
+    CHECK_EQ(drain(0), 3);
+
+    // The RAM ring is lost, flash keeps 3..9 except 5, whose age is unknown after the reboot
+    boot();
+    CHECK_EQ(mqtt_spill_count(), 6);
+    for (uint32_t i = 100; i < 100 + RING_SIZE + 2; i++) {
+        queue(i, 0, 0);
+    }
+    reset_broker();
+    CHECK_EQ(drain(0), 12);
+    static const uint32_t expected[] = { 3, 4, 6, 7, 8, 9, 100, 101, 102, 103, 104, 105 };
+    CHECK_EQ(gBroker.count, 12);
+    for (size_t i = 0; i < gBroker.count && i < 12; i++) {
+        CHECK_EQ(gBroker.received[i], expected[i]);
+    }
+}
+
+static void test_interrupted_write(void) {
+    erase_flash();
+    boot();
+    reset_broker();
+
+    for (uint32_t i = 0; i < 3 + RING_SIZE; i++) {
+        queue(i, 0, 0);
+    }
+    CHECK_EQ(mqtt_spill_count(), 3);
+    // A reset hit the next record after its entry was written, before its header
+    uint8_t garbage[32];
+    memset(garbage, 0x5a, sizeof(garbage));
+    esp_partition_write(&gPartition, 3 * slot_size() + 3 * sizeof(uint32_t), garbage, sizeof(garbage));
+
+    boot();
+    CHECK_EQ(mqtt_spill_count(), 3);
+    for (uint32_t i = 100; i < 102 + RING_SIZE; i++) {
+        queue(i, 0, 0);
+    }
+    CHECK_EQ(mqtt_spill_count(), 5);
+    CHECK_EQ(drain(0), 3 + 2 + RING_SIZE);
+    CHECK_EQ(gBroker.received[2], 2);
+    CHECK_EQ(gBroker.received[3], 100);
+}
+
+static void test_sector_reuse(void) {
+    erase_flash();
+    boot();
+    reset_broker();
+
+    // Many short outages, each spilling a few messages: the sectors are erased in turn
+    uint32_t number = 0;
+    for (int outage = 0; outage < 200; outage++) {
+        for (int i = 0; i < RING_SIZE + 3; i++) {
+            queue(number++, 0, 0);
+        }
+        drain(0);
+    }
+    check_received(0, (size_t)number < MAX_RECEIVED ? number : MAX_RECEIVED);
+    CHECK_EQ(gLost, 0);
+    uint32_t written = 200 * 3;
+    uint32_t slotsPerSector = SECTOR_SIZE / slot_size();
+    // One erase per sector filled, not one per outage
+    uint32_t erases = total_erases();
+    CHECK(erases <= written / slotsPerSector + 1);
+    CHECK(erases >= written / slotsPerSector);
+    for (size_t i = 1; i < SECTOR_COUNT; i++) {
+        CHECK(gErases[i] + 1 >= gErases[0] && gErases[i] <= gErases[0]);
+    }
+}
+
+static void test_log_full(void) {
+    erase_flash();
+    boot();
+    reset_broker();
+
+    // Without a broker the log fills up until the write position reaches the oldest record
+    for (uint32_t i = 0; i < 400; i++) {
+        queue(i, 0, 0);
+    }
+    uint32_t spilled = mqtt_spill_count();
+    CHECK(spilled > 0);
+    CHECK_EQ(spilled + gLost + RING_SIZE, 400);
+    CHECK(total_erases() <= SECTOR_COUNT);
+
+    // The oldest messages survive, what did not fit is lost
+    CHECK_EQ(drain(0), spilled + RING_SIZE);
+    for (size_t i = 0; i < spilled; i++) {
+        CHECK_EQ(gBroker.received[i], i);
+    }
+    gLost = 0;
+}
+
+int main(void) {
+    gDrainEntry = malloc(mqtt_outbox_entry_size(MAX_PAYLOAD));
+    RUN_TEST(test_ring_only);
+    RUN_TEST(test_spill_order);
+    RUN_TEST(test_failed_publish);
+    RUN_TEST(test_reboot);
+    RUN_TEST(test_interrupted_write);
+    RUN_TEST(test_sector_reuse);
+    RUN_TEST(test_log_full);
+    mqtt_outbox_destroy(gOutbox);
+    free(gDrainEntry);
+    return host_test_result();
+}
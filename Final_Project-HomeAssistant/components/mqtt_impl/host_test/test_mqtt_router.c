@@ -0,0 +1,260 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "host_test.h"
+#include "mqtt_router.h"
+
+// Conformance with the topic matching rules of MQTT 3.1.1, section 4.7, and a differential test
+// against a direct implementation of those rules.
+
+#define MAX_FILTERS     64
+
+typedef struct {
+    uint64_t matched;   // bit n: filter n matched
+    size_t calls;
+} match_set_t;
+
+static void collect(void* pValue, void* pArg) {
+    match_set_t* pSet = pArg;
+    pSet->matched |= 1ull << ((uintptr_t)pValue - 1);
+    pSet->calls++;
+}
+
+// Values start at 1, the router does not take NULL
+static void* value_of(size_t index) {
+    return (void*)(uintptr_t)(index + 1);
+}
+
+// The rules as written, one level at a time
+static bool reference_match(const char* filter, const char* topic) {
+    if (topic[0] == '$' && (filter[0] == '+' || filter[0] == '#')) {
+        return false;
+    }
+    while (true) {
+        const char* filterEnd = strchr(filter, '/');
+        const char* topicEnd = strchr(topic, '/');
+        size_t filterLen = filterEnd ? (size_t)(filterEnd - filter) : strlen(filter);
+        size_t topicLen = topicEnd ? (size_t)(topicEnd - topic) : strlen(topic);
+
+        if (filterLen == 1 && filter[0] == '#') {
+            return true;
+        }
+        if (!(filterLen == 1 && filter[0] == '+') && (filterLen != topicLen || memcmp(filter, topic, filterLen) != 0)) {
+            return false;
+        }
+        if (filterEnd == NULL || topicEnd == NULL) {
+            // Both end here, or the filter goes on with "/#" only, which matches the parent level
+            return (filterEnd == NULL && topicEnd == NULL) || (topicEnd == NULL && strcmp(filterEnd, "/#") == 0);
+        }
+        filter = filterEnd + 1;
+        topic = topicEnd + 1;
+    }
+}
+
+static match_set_t route(const MqttRouter* pRouter, const char* topic) {
+    match_set_t set = { 0 };
+    size_t matches = mqtt_router_match(pRouter, topic, strlen(topic), collect, &set);
+    CHECK_EQ(matches, set.calls);
+    return set;
+}
+
+static void test_valid_filters(void) {
+    const char* valid[] = { "#", "+", "a/#", "a/+/b", "+/+", "/+", "a//b", "$SYS/#", "a/b/c", "/" };
+    const char* invalid[] = { "", "a#", "a/#/b", "a/b#", "a+", "a/+b", "+a/b", "##", "a/++" };
+    for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+        CHECK(mqtt_router_is_valid_filter(valid[i]));
+    }
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        CHECK(!mqtt_router_is_valid_filter(invalid[i]));
+    }
+    CHECK(!mqtt_router_is_valid_filter(NULL));
+
+    MqttRouter* pRouter = mqtt_router_create(4);
+    CHECK_EQ(mqtt_router_add(pRouter, "a/#/b", value_of(0)), MQTT_ROUTER_ERROR_INVALID);
+    CHECK_EQ(mqtt_router_add(pRouter, "a/b", NULL), MQTT_ROUTER_ERROR_INVALID);
+    mqtt_router_destroy(pRouter);
+}
+
+// The examples of the specification
+static void test_spec_examples(void) {
+    const char* filters[] = {
+        "sport/tennis/player1/#",   // 0
+        "sport/#",                  // 1
+        "#",                        // 2
+        "sport/tennis/+",           // 3
+        "sport/+",                  // 4
+        "+/+",                      // 5
+        "/+",                       // 6
+        "+",                        // 7
+        "+/monitor/Clients",        // 8
+        "$SYS/#",                   // 9
+        "$SYS/monitor/+",           // 10
+        "sport/tennis/player1",     // 11
+    };
+    const size_t count = sizeof(filters) / sizeof(filters[0]);
+    MqttRouter* pRouter = mqtt_router_create(count);
+    for (size_t i = 0; i < count; i++) {
+        CHECK_EQ(mqtt_router_add(pRouter, filters[i], value_of(i)), MQTT_ROUTER_SUCCESS);
+    }
+
+    struct {
+        const char* topic;
+        uint64_t expected;
+    } cases[] = {
+        { "sport/tennis/player1", (1u << 0) | (1u << 1) | (1u << 2) | (1u << 3) | (1u << 11) },
+        { "sport/tennis/player1/ranking", (1u << 0) | (1u << 1) | (1u << 2) },
+        { "sport/tennis/player1/score/wimbledon", (1u << 0) | (1u << 1) | (1u << 2) },
+        { "sport", (1u << 1) | (1u << 2) | (1u << 7) },
+        { "sport/", (1u << 1) | (1u << 2) | (1u << 4) | (1u << 5) },
+        { "/finance", (1u << 2) | (1u << 5) | (1u << 6) },
+        { "$SYS/monitor/Clients", (1u << 9) | (1u << 10) },
+        { "AWS/monitor/Clients", (1u << 2) | (1u << 8) },
+        { "$SYS", (1u << 9) },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        match_set_t set = route(pRouter, cases[i].topic);
+        if (set.matched != cases[i].expected) {
+            fprintf(stderr, "  %s matched 0x%llx\n", cases[i].topic, (unsigned long long)set.matched);
+        }
+        CHECK_EQ(set.matched, cases[i].expected);
+    }
+    mqtt_router_destroy(pRouter);
+}
+
+static void test_find_and_limits(void) {
+    MqttRouter* pRouter = mqtt_router_create(3);
+    CHECK_EQ(mqtt_router_add(pRouter, "a/b", value_of(0)), MQTT_ROUTER_SUCCESS);
+    CHECK_EQ(mqtt_router_add(pRouter, "a/+", value_of(1)), MQTT_ROUTER_SUCCESS);
+    CHECK_EQ(mqtt_router_add(pRouter, "a/b", value_of(2)), MQTT_ROUTER_ERROR_DUPLICATE);
+    CHECK_EQ(mqtt_router_add(pRouter, "a/+", value_of(2)), MQTT_ROUTER_ERROR_DUPLICATE);
+    CHECK_EQ(mqtt_router_add(pRouter, "a/#", value_of(2)), MQTT_ROUTER_SUCCESS);
+    CHECK_EQ(mqtt_router_add(pRouter, "c", value_of(3)), MQTT_ROUTER_ERROR_FULL);
+
+    // Wildcards are compared literally
+    CHECK(mqtt_router_find(pRouter, "a/b") == value_of(0));
+    CHECK(mqtt_router_find(pRouter, "a/+") == value_of(1));
+    CHECK(mqtt_router_find(pRouter, "a/#") == value_of(2));
+    CHECK(mqtt_router_find(pRouter, "+/b") == NULL);
+    CHECK(mqtt_router_find(pRouter, "a/c") == NULL);
+
+    // The length counts, the topic does not have to be terminated
+    match_set_t set = { 0 };
+    CHECK_EQ(mqtt_router_match(pRouter, "a/bc", 3, collect, &set), 3);
+    CHECK_EQ(mqtt_router_match(pRouter, "", 0, collect, &set), 0);
+    mqtt_router_destroy(pRouter);
+}
+
+static void store_value(void* pValue, void* pArg) {
+    *(void**)pArg = pValue;
+}
+
+// Many children below one level, and the same level names below many parents, grow the child table
+static void test_wide_fan_out(void) {
+    const size_t count = 1000;
+    MqttRouter* pRouter = mqtt_router_create(2 * count);
+    char filter[32];
+    for (size_t i = 0; i < count; i++) {
+        snprintf(filter, sizeof(filter), "home/+/wide%zu", i);
+        CHECK_EQ(mqtt_router_add(pRouter, filter, value_of(i)), MQTT_ROUTER_SUCCESS);
+        snprintf(filter, sizeof(filter), "node%zu/+/wide", i);
+        CHECK_EQ(mqtt_router_add(pRouter, filter, value_of(count + i)), MQTT_ROUTER_SUCCESS);
+    }
+    for (size_t i = 0; i < count; i++) {
+        char topic[32];
+        void* pValue = NULL;
+        int len = snprintf(topic, sizeof(topic), "home/x/wide%zu", i);
+        CHECK_EQ(mqtt_router_match(pRouter, topic, len, store_value, &pValue), 1);
+        CHECK(pValue == value_of(i));
+        len = snprintf(topic, sizeof(topic), "node%zu/y/wide", i);
+        CHECK_EQ(mqtt_router_match(pRouter, topic, len, store_value, &pValue), 1);
+        CHECK(pValue == value_of(count + i));
+        snprintf(filter, sizeof(filter), "home/+/wide%zu", i);
+        CHECK(mqtt_router_find(pRouter, filter) == value_of(i));
+    }
+    CHECK_EQ(mqtt_router_match(pRouter, "home/x/wide", 11, store_value, NULL), 0);
+    CHECK_EQ(mqtt_router_match(pRouter, "node1000/y/wide", 15, store_value, NULL), 0);
+    mqtt_router_destroy(pRouter);
+}
+
+static uint64_t gRandom = 88172645463325252ull;
+
+static uint32_t next_random(uint32_t limit) {
+    gRandom ^= gRandom << 13;
+    gRandom ^= gRandom >> 7;
+    gRandom ^= gRandom << 17;
+    return (uint32_t)(gRandom % limit);
+}
+
+// Few level names, so filters and topics meet often, including empty levels and '$'
+static void random_path(char* buf, bool filter) {
+    static const char* levels[] = { "a", "b", "c", "", "$s" };
+    size_t count = 1 + next_random(4);
+    buf[0] = '\0';
+    for (size_t i = 0; i < count; i++) {
+        const char* level = levels[next_random(5)];
+        if (level[0] == '$' && i > 0) {
+            level = "d";
+        }
+        if (filter) {
+            uint32_t pick = next_random(10);
+            if (pick < 2) {
+                level = "+";
+            } else if (pick == 2) {
+                strcat(buf, (i == 0) ? "#" : "/#");
+                return;
+            }
+        }
+        if (i > 0) {
+            strcat(buf, "/");
+        }
+        strcat(buf, level);
+    }
+    if (buf[0] == '\0') {
+        strcpy(buf, "a"); // neither topics nor filters may be empty
+    }
+}
+
+static void test_differential(void) {
+    for (int round = 0; round < 300; round++) {
+        char filters[MAX_FILTERS][64];
+        size_t count = 0;
+        MqttRouter* pRouter = mqtt_router_create(MAX_FILTERS);
+        while (count < MAX_FILTERS) {
+            random_path(filters[count], true);
+            int ret = mqtt_router_add(pRouter, filters[count], value_of(count));
+            CHECK(ret == MQTT_ROUTER_SUCCESS || ret == MQTT_ROUTER_ERROR_DUPLICATE);
+            if (ret == MQTT_ROUTER_SUCCESS) {
+                count++;
+            } else if (next_random(4) == 0) {
+                break;
+            }
+        }
+        for (int t = 0; t < 200; t++) {
+            char topic[64];
+            random_path(topic, false);
+            uint64_t expected = 0;
+            for (size_t i = 0; i < count; i++) {
+                if (reference_match(filters[i], topic)) {
+                    expected |= 1ull << i;
+                }
+            }
+            match_set_t set = route(pRouter, topic);
+            if (set.matched != expected) {
+                fprintf(stderr, "  topic '%s': 0x%llx, expected 0x%llx\n", topic,
+                        (unsigned long long)set.matched, (unsigned long long)expected);
+            }
+            CHECK_EQ(set.matched, expected);
+            CHECK_EQ(set.calls, __builtin_popcountll(expected));
+        }
+        mqtt_router_destroy(pRouter);
+    }
+}
+
+int main(void) {
+    RUN_TEST(test_valid_filters);
+    RUN_TEST(test_spec_examples);
+    RUN_TEST(test_find_and_limits);
+    RUN_TEST(test_wide_fan_out);
+    RUN_TEST(test_differential);
+    return host_test_result();
+}
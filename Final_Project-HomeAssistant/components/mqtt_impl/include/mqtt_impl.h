@@ -11,19 +11,118 @@
 #define CONFIG_MQTT_TOPIC_PREFIX ""
 #endif
 
+#define MQTT_DISPATCH_WORKERS           CONFIG_MQTT_DISPATCH_WORKERS
+#define MQTT_DISPATCH_POOL_SIZE         CONFIG_MQTT_DISPATCH_POOL_SIZE
+#define MQTT_DISPATCH_MESSAGE_SIZE      CONFIG_MQTT_DISPATCH_MESSAGE_SIZE
+#define MQTT_DISPATCH_LARGE_POOL_SIZE   CONFIG_MQTT_DISPATCH_LARGE_POOL_SIZE
+#define MQTT_MAX_PAYLOAD_SIZE           CONFIG_MQTT_MAX_PAYLOAD_SIZE
+#define MQTT_DISPATCH_BLOCK_MS          CONFIG_MQTT_DISPATCH_BLOCK_MS
+#define MQTT_DISPATCH_TASK_PRIORITY     CONFIG_MQTT_DISPATCH_TASK_PRIORITY
+#define MQTT_DISPATCH_TASK_STACKSIZE    4096
+#define MQTT_DISPATCH_TOPIC_SIZE        128
+#define MQTT_OUTBOX_SIZE                CONFIG_MQTT_OUTBOX_SIZE
+#define MQTT_OUTBOX_MESSAGE_SIZE        CONFIG_MQTT_OUTBOX_MESSAGE_SIZE
+#define MQTT_OUTBOX_DRAIN_RATE          CONFIG_MQTT_OUTBOX_DRAIN_RATE
+#define MQTT_MAX_PUBLISHERS             CONFIG_MQTT_MAX_PUBLISHERS
+#define MQTT_REASSEMBLY_SLOTS           4
+
+// Called from the MQTT event task whenever the broker connection comes up or goes down
+typedef void (*mqtt_connection_callback_t)(bool connected);
+// Called from the MQTT event task when the broker acknowledged a QoS 1 or 2 publish
+typedef void (*mqtt_published_callback_t)(int msgId);
 typedef void (*mqtt_message_callback_t)(const char* topic, const char* payload);
+// For binary payloads, which are not null-terminated and may contain zero bytes
+typedef void (*mqtt_binary_callback_t)(const char* topic, const uint8_t* payload, size_t payloadLen);
+/*
+ * Called once per fragment, directly in the MQTT event task and on the receive buffer of the client.
+ * The topic is not null-terminated, payloads are complete when offset + payloadLen == totalLen.
+ */
+typedef void (*mqtt_fragment_callback_t)(const char* topic, size_t topicLen, const uint8_t* payload, size_t payloadLen, size_t offset, size_t totalLen);
+
+typedef enum {
+    MQTT_PRIORITY_NORMAL,
+    MQTT_PRIORITY_HIGH,     // handled before any queued normal message
+    MQTT_PRIORITY_COUNT
+} mqtt_priority_t;
+
+typedef enum {
+    MQTT_OVERFLOW_DROP_OLDEST,  // replace the oldest queued message of the same priority
+    MQTT_OVERFLOW_DROP_NEWEST,  // discard the incoming message
+    MQTT_OVERFLOW_BLOCK,        // stall the MQTT event task for up to MQTT_DISPATCH_BLOCK_MS, then discard
+} mqtt_overflow_policy_t;
 
 typedef struct {
-    char topic[128];
+    const char* topic; // full topic filter, may contain '+' and '#'
     mqtt_message_callback_t callback;
+    mqtt_binary_callback_t binary_callback;
+    mqtt_fragment_callback_t fragment_callback; // bypasses the workers
+    mqtt_priority_t priority;
+    mqtt_overflow_policy_t overflow_policy;
 } topic_callback_t;
 
+typedef struct {
+    uint32_t received;
+    uint32_t dispatched;
+    uint32_t dropped;
+    uint32_t oversized;             // longer than MQTT_MAX_PAYLOAD_SIZE
+    uint32_t queue_depth;           // messages waiting right now
+    uint32_t max_queue_depth;
+    uint32_t max_queue_latency_us;  // time from reception until the handler started
+    uint32_t avg_handler_latency_us;
+    uint32_t max_handler_latency_us;
+} mqtt_dispatch_metrics_t;
+
+typedef struct {
+    uint8_t qos;
+    bool retain;
+    bool coalesce;      // while offline, keep only the latest message of the topic
+    uint32_t ttl_ms;    // discard if still queued after this time, 0 = never
+} mqtt_publish_options_t;
 
+typedef enum {
+    MQTT_BATCH_NONE,        // a newer message replaces the held back one
+    MQTT_BATCH_JSON_ARRAY,  // held back JSON messages are sent as one array
+    MQTT_BATCH_BINARY,      // held back messages are concatenated, for fixed size records
+} mqtt_batch_format_t;
+
+typedef struct {
+    mqtt_publish_options_t options;
+    uint32_t coalesce_window_ms;    // hold a message back this long, for batches the collection time
+    uint32_t min_interval_ms;       // rate limit, messages in between are held back
+    mqtt_batch_format_t batch_format;
+    uint8_t batch_max;              // send a batch early once it holds this many messages, 0 = when full
+} mqtt_publish_policy_t;
+
+typedef struct _MqttPublisher_ MqttPublisher;
+
+typedef struct {
+    uint32_t queued;    // waiting in RAM right now
+    uint32_t spilled;   // waiting in flash right now
+    uint32_t coalesced;
+    uint32_t evicted;   // moved out of the full RAM ring
+    uint32_t expired;
+    uint32_t lost;      // evicted without room left in flash
+    uint32_t replayed;
+} mqtt_outbox_metrics_t;
 
 esp_err_t mqtt_init(void);
+esp_err_t mqtt_start(void);
+void mqtt_set_connection_callback(mqtt_connection_callback_t callback);
+void mqtt_set_published_callback(mqtt_published_callback_t callback);
 void mqtt_get_full_topic(const char* topic, char* out_buf, size_t buf_size);
 void mqtt_subscribe(const char* topic);
 void mqtt_subscribe_callback(const char* topic, mqtt_message_callback_t callback);
+void mqtt_subscribe_binary_callback(const char* topic, mqtt_binary_callback_t callback);
+void mqtt_subscribe_zerocopy_callback(const char* topic, mqtt_fragment_callback_t callback);
+void mqtt_subscribe_full_topic_callback(const char* full_topic, mqtt_message_callback_t callback);
+void mqtt_set_topic_dispatch(const char* topic, mqtt_priority_t priority, mqtt_overflow_policy_t policy);
+void mqtt_get_dispatch_metrics(mqtt_dispatch_metrics_t* pMetrics);
+esp_err_t mqtt_publish(const char* topic, const uint8_t* payload, size_t payloadLen, const mqtt_publish_options_t* pOptions);
+esp_err_t mqtt_publish_full_topic(const char* fullTopic, const uint8_t* payload, size_t payloadLen, const mqtt_publish_options_t* pOptions);
+void mqtt_get_outbox_metrics(mqtt_outbox_metrics_t* pMetrics);
+int64_t mqtt_get_first_publish_us(void);
+MqttPublisher* mqtt_publisher_register(const char* topic, const mqtt_publish_policy_t* pPolicy);
+esp_err_t mqtt_publisher_send(MqttPublisher* pPublisher, const uint8_t* payload, size_t payloadLen);
 
 #if USE_DEFAULT_TOPIC
 void mqtt_sendpayload(uint8_t* payload, uint16_t payloadLen);
@@ -0,0 +1,298 @@
+#include <sys/param.h>
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+
+#include "mqtt_internal.h"
+
+static const char *TAG = "MQTT_DISPATCH";
+
+typedef struct {
+    const topic_callback_t* pEntry;
+    QueueHandle_t pool;     // free list the message returns to
+    char topic[MQTT_DISPATCH_TOPIC_SIZE];
+    size_t len;
+    size_t capacity;
+    int64_t enqueued_us;
+    char* data;             // capacity + 1 bytes, for the terminating zero of text payloads
+} mqtt_message_t;
+
+// A message delivered in several MQTT_EVENT_DATA events, collected in one pooled buffer
+typedef struct {
+    const topic_callback_t* pEntry;
+    mqtt_message_t* pMessage;
+    size_t totalLen;
+} reassembly_t;
+
+_Static_assert(MQTT_MAX_PAYLOAD_SIZE >= MQTT_DISPATCH_MESSAGE_SIZE,
+               "CONFIG_MQTT_MAX_PAYLOAD_SIZE must not be smaller than CONFIG_MQTT_DISPATCH_MESSAGE_SIZE");
+
+// Two size classes: most messages fit the small buffers, the few large ones do not block them
+static char gSmallBuffers[MQTT_DISPATCH_POOL_SIZE][MQTT_DISPATCH_MESSAGE_SIZE + 1];
+static char gLargeBuffers[MQTT_DISPATCH_LARGE_POOL_SIZE][MQTT_MAX_PAYLOAD_SIZE + 1];
+static mqtt_message_t gMessages[MQTT_DISPATCH_POOL_SIZE + MQTT_DISPATCH_LARGE_POOL_SIZE];
+static QueueHandle_t gSmallPool = NULL;
+static QueueHandle_t gLargePool = NULL;
+
+static QueueHandle_t gQueues[MQTT_PRIORITY_COUNT] = { NULL };
+static SemaphoreHandle_t gPending = NULL; // counts queued messages, wakes the workers
+
+// Only touched from the MQTT event task
+static reassembly_t gReassembly[MQTT_REASSEMBLY_SLOTS] = { 0 };
+
+static portMUX_TYPE gMetricsLock = portMUX_INITIALIZER_UNLOCKED;
+static mqtt_dispatch_metrics_t gMetrics = { 0 };
+static uint64_t gHandlerLatencySum_us = 0;
+
+static void dispatch_worker(void* arg);
+
+// ----- implementation -----
+
+static void count_metric(uint32_t* pCounter) {
+    taskENTER_CRITICAL(&gMetricsLock);
+    (*pCounter)++;
+    taskEXIT_CRITICAL(&gMetricsLock);
+}
+
+static void release_message(mqtt_message_t* pMessage) {
+    xQueueSend(pMessage->pool, &pMessage, 0); // cannot fail, each pool queue holds all its messages
+}
+
+/*
+ * @brief Takes a buffer large enough for len bytes from the pools
+ *
+ *  If none is free, the overflow policy of the topic decides: wait a bounded time,
+ *  reuse the oldest queued message of the same priority, or give up.
+ */
+static mqtt_message_t* alloc_message(const topic_callback_t* pEntry, size_t len) {
+    mqtt_message_t* pMessage = NULL;
+    TickType_t wait = (pEntry->overflow_policy == MQTT_OVERFLOW_BLOCK) ? pdMS_TO_TICKS(MQTT_DISPATCH_BLOCK_MS) : 0;
+
+    if (len <= MQTT_DISPATCH_MESSAGE_SIZE) {
+        // Small messages may borrow a large buffer, but never wait for one
+        if (xQueueReceive(gSmallPool, &pMessage, 0) == pdTRUE ||
+            xQueueReceive(gLargePool, &pMessage, 0) == pdTRUE ||
+            xQueueReceive(gSmallPool, &pMessage, wait) == pdTRUE) {
+            return pMessage;
+        }
+    } else if (xQueueReceive(gLargePool, &pMessage, wait) == pdTRUE) {
+        return pMessage;
+    }
+
+    if (pEntry->overflow_policy == MQTT_OVERFLOW_DROP_OLDEST && xQueueReceive(gQueues[pEntry->priority], &pMessage, 0) == pdTRUE) {
+        if (pMessage->capacity >= len) {
+            ESP_LOGD(TAG, "No free message buffer, replaced oldest queued message");
+            count_metric(&gMetrics.dropped);
+            return pMessage;
+        }
+        xQueueSendToFront(gQueues[pEntry->priority], &pMessage, 0);
+    }
+    return NULL;
+}
+
+static void enqueue_message(mqtt_message_t* pMessage) {
+    pMessage->data[pMessage->len] = '\0';
+    pMessage->enqueued_us = esp_timer_get_time();
+
+    QueueHandle_t queue = gQueues[pMessage->pEntry->priority];
+    xQueueSend(queue, &pMessage, 0); // cannot fail, the queue holds the whole pool
+    xSemaphoreGive(gPending);
+
+    uint32_t depth = uxQueueMessagesWaiting(gQueues[MQTT_PRIORITY_HIGH]) + uxQueueMessagesWaiting(gQueues[MQTT_PRIORITY_NORMAL]);
+    taskENTER_CRITICAL(&gMetricsLock);
+    gMetrics.max_queue_depth = MAX(gMetrics.max_queue_depth, depth);
+    taskEXIT_CRITICAL(&gMetricsLock);
+}
+
+static void init_pool(QueueHandle_t pool, mqtt_message_t* pMessages, char* buffers, size_t count, size_t capacity) {
+    for (size_t i = 0; i < count; i++) {
+        mqtt_message_t* pMessage = &pMessages[i];
+        pMessage->pool = pool;
+        pMessage->capacity = capacity;
+        pMessage->data = &buffers[i * (capacity + 1)];
+        xQueueSend(pool, &pMessage, 0);
+    }
+}
+
+esp_err_t mqtt_dispatch_init(void) {
+    const int messageCount = MQTT_DISPATCH_POOL_SIZE + MQTT_DISPATCH_LARGE_POOL_SIZE;
+
+    gSmallPool = xQueueCreate(MQTT_DISPATCH_POOL_SIZE, sizeof(mqtt_message_t*));
+    gLargePool = xQueueCreate(MQTT_DISPATCH_LARGE_POOL_SIZE, sizeof(mqtt_message_t*));
+    gPending = xSemaphoreCreateCounting(2 * messageCount, 0);
+    for (int i = 0; i < MQTT_PRIORITY_COUNT; i++) {
+        gQueues[i] = xQueueCreate(messageCount, sizeof(mqtt_message_t*));
+        if (gQueues[i] == NULL) {
+            ESP_LOGE(TAG, "Failed to create dispatch queue");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (gSmallPool == NULL || gLargePool == NULL || gPending == NULL) {
+        ESP_LOGE(TAG, "Failed to create message pool");
+        return ESP_ERR_NO_MEM;
+    }
+
+    init_pool(gSmallPool, &gMessages[0], &gSmallBuffers[0][0], MQTT_DISPATCH_POOL_SIZE, MQTT_DISPATCH_MESSAGE_SIZE);
+    init_pool(gLargePool, &gMessages[MQTT_DISPATCH_POOL_SIZE], &gLargeBuffers[0][0], MQTT_DISPATCH_LARGE_POOL_SIZE, MQTT_MAX_PAYLOAD_SIZE);
+
+    for (int i = 0; i < MQTT_DISPATCH_WORKERS; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "mqtt_worker%d", i);
+        if (xTaskCreate(dispatch_worker, name, MQTT_DISPATCH_TASK_STACKSIZE, NULL, MQTT_DISPATCH_TASK_PRIORITY, NULL) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create worker %d", i);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    ESP_LOGI(TAG, "Dispatch started with %d worker(s), %d buffers of %d bytes, %d of %d bytes", MQTT_DISPATCH_WORKERS,
+             MQTT_DISPATCH_POOL_SIZE, MQTT_DISPATCH_MESSAGE_SIZE, MQTT_DISPATCH_LARGE_POOL_SIZE, MQTT_MAX_PAYLOAD_SIZE);
+    return ESP_OK;
+}
+
+/*
+ * @brief Copies a complete received message into a pooled buffer and queues it for the workers
+ *
+ *  Called from the MQTT event task, so it must never run user code.
+ */
+void mqtt_dispatch_message(const topic_callback_t* pEntry, const char* topic, size_t topicLen, const char* data, size_t dataLen) {
+    count_metric(&gMetrics.received);
+    if (dataLen > MQTT_MAX_PAYLOAD_SIZE) {
+        ESP_LOGW(TAG, "Payload of %u bytes on %s exceeds %d bytes, dropped", (unsigned)dataLen, pEntry->topic, MQTT_MAX_PAYLOAD_SIZE);
+        count_metric(&gMetrics.oversized);
+        return;
+    }
+
+    mqtt_message_t* pMessage = alloc_message(pEntry, dataLen);
+    if (pMessage == NULL) {
+        ESP_LOGW(TAG, "No free message buffer, dropped message on %s", pEntry->topic);
+        count_metric(&gMetrics.dropped);
+        return;
+    }
+
+    // The topic is copied as well, for wildcard subscriptions it differs from the filter
+    pMessage->pEntry = pEntry;
+    snprintf(pMessage->topic, sizeof(pMessage->topic), "%.*s", (int)topicLen, topic);
+    memcpy(pMessage->data, data, dataLen);
+    pMessage->len = dataLen;
+    enqueue_message(pMessage);
+}
+
+/*
+ * @brief Collects one fragment of a message the MQTT client delivers in several events
+ *
+ *  The fragments of a message arrive in order and are never interleaved with another message.
+ *  The buffer is queued as soon as the last fragment arrived.
+ */
+void mqtt_dispatch_fragment(const topic_callback_t* pEntry, const char* topic, size_t topicLen, const char* data, size_t dataLen, size_t offset, size_t totalLen) {
+    reassembly_t* pSlot = NULL;
+
+    if (offset == 0) {
+        count_metric(&gMetrics.received);
+        if (totalLen > MQTT_MAX_PAYLOAD_SIZE) {
+            ESP_LOGW(TAG, "Payload of %u bytes on %s exceeds %d bytes, dropped", (unsigned)totalLen, pEntry->topic, MQTT_MAX_PAYLOAD_SIZE);
+            count_metric(&gMetrics.oversized);
+            return;
+        }
+        for (int i = 0; i < MQTT_REASSEMBLY_SLOTS && pSlot == NULL; i++) {
+            if (gReassembly[i].pMessage == NULL) {
+                pSlot = &gReassembly[i];
+            }
+        }
+        mqtt_message_t* pMessage = (pSlot != NULL) ? alloc_message(pEntry, totalLen) : NULL;
+        if (pMessage == NULL) {
+            ESP_LOGW(TAG, "No buffer to reassemble %u bytes, dropped message on %s", (unsigned)totalLen, pEntry->topic);
+            count_metric(&gMetrics.dropped);
+            return;
+        }
+        pMessage->pEntry = pEntry;
+        snprintf(pMessage->topic, sizeof(pMessage->topic), "%.*s", (int)topicLen, topic);
+        pMessage->len = 0;
+        pSlot->pEntry = pEntry;
+        pSlot->pMessage = pMessage;
+        pSlot->totalLen = totalLen;
+    } else {
+        for (int i = 0; i < MQTT_REASSEMBLY_SLOTS && pSlot == NULL; i++) {
+            if (gReassembly[i].pMessage != NULL && gReassembly[i].pEntry == pEntry) {
+                pSlot = &gReassembly[i];
+            }
+        }
+        if (pSlot == NULL) {
+            return; // the start of the message was dropped already
+        }
+    }
+
+    mqtt_message_t* pMessage = pSlot->pMessage;
+    if (offset != pMessage->len || offset + dataLen > pSlot->totalLen) {
+        ESP_LOGW(TAG, "Unexpected fragment at offset %u on %s, dropped message", (unsigned)offset, pEntry->topic);
+        count_metric(&gMetrics.dropped);
+        release_message(pMessage);
+        pSlot->pMessage = NULL;
+        return;
+    }
+    memcpy(&pMessage->data[offset], data, dataLen);
+    pMessage->len += dataLen;
+
+    if (pMessage->len == pSlot->totalLen) {
+        ESP_LOGD(TAG, "Reassembled %u bytes on %s", (unsigned)pMessage->len, pMessage->topic);
+        pSlot->pMessage = NULL;
+        enqueue_message(pMessage);
+    }
+}
+
+// Drops incomplete messages, e.g. when the connection was lost in the middle of one
+void mqtt_dispatch_reset_reassembly(void) {
+    for (int i = 0; i < MQTT_REASSEMBLY_SLOTS; i++) {
+        if (gReassembly[i].pMessage != NULL) {
+            ESP_LOGW(TAG, "Incomplete message on %s dropped", gReassembly[i].pEntry->topic);
+            count_metric(&gMetrics.dropped);
+            release_message(gReassembly[i].pMessage);
+            gReassembly[i].pMessage = NULL;
+        }
+    }
+}
+
+void dispatch_worker(void* arg) {
+    while (true) {
+        xSemaphoreTake(gPending, portMAX_DELAY);
+
+        mqtt_message_t* pMessage;
+        if (xQueueReceive(gQueues[MQTT_PRIORITY_HIGH], &pMessage, 0) != pdTRUE &&
+            xQueueReceive(gQueues[MQTT_PRIORITY_NORMAL], &pMessage, 0) != pdTRUE) {
+            continue; // the message was replaced by a newer one
+        }
+
+        const topic_callback_t* pEntry = pMessage->pEntry;
+        int64_t start_us = esp_timer_get_time();
+        if (pEntry->binary_callback) {
+            pEntry->binary_callback(pMessage->topic, (const uint8_t*)pMessage->data, pMessage->len);
+        } else if (pEntry->callback) {
+            pEntry->callback(pMessage->topic, pMessage->data);
+        }
+        int64_t end_us = esp_timer_get_time();
+
+        uint32_t queue_latency_us = start_us - pMessage->enqueued_us;
+        uint32_t handler_latency_us = end_us - start_us;
+        ESP_LOGV(TAG, "Handled %s, queued %" PRIu32 " us, handler %" PRIu32 " us", pMessage->topic, queue_latency_us, handler_latency_us);
+        release_message(pMessage);
+
+        taskENTER_CRITICAL(&gMetricsLock);
+        gMetrics.dispatched++;
+        gMetrics.max_queue_latency_us = MAX(gMetrics.max_queue_latency_us, queue_latency_us);
+        gMetrics.max_handler_latency_us = MAX(gMetrics.max_handler_latency_us, handler_latency_us);
+        gHandlerLatencySum_us += handler_latency_us;
+        taskEXIT_CRITICAL(&gMetricsLock);
+    }
+}
+
+void mqtt_get_dispatch_metrics(mqtt_dispatch_metrics_t* pMetrics) {
+    taskENTER_CRITICAL(&gMetricsLock);
+    *pMetrics = gMetrics;
+    pMetrics->avg_handler_latency_us = (gMetrics.dispatched > 0) ? (gHandlerLatencySum_us / gMetrics.dispatched) : 0;
+    taskEXIT_CRITICAL(&gMetricsLock);
+
+    pMetrics->queue_depth = 0;
+    for (int i = 0; i < MQTT_PRIORITY_COUNT; i++) {
+        if (gQueues[i] != NULL) {
+            pMetrics->queue_depth += uxQueueMessagesWaiting(gQueues[i]);
+        }
+    }
+}
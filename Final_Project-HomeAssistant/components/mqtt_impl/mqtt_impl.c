@@ -1,16 +1,41 @@
-#include "mqtt_impl.h"
+#include "mqtt_internal.h"
+#include "mqtt_router.h"
 
 static const char *TAG = "MQTT";
 
 static esp_mqtt_client_handle_t gClient = NULL;
-uint8_t current_subscriptions = 0;
+static bool gStarted = false;
+static volatile bool gConnected = false;
+static mqtt_connection_callback_t gConnectionCallback = NULL;
+static mqtt_published_callback_t gPublishedCallback = NULL;
+
+// Every subscribed filter, the session is clean so they are renewed after each reconnect
+static const char* gSubscriptions[CONFIG_MQTT_MAX_SUBSCRIPTIONS];
+uint16_t current_subscriptions = 0;
 
 static topic_callback_t topic_callbacks[CONFIG_MQTT_MAX_SUBSCRIPTIONS];
-static uint8_t callback_count = 0;
+static uint16_t callback_count = 0;
+static MqttRouter* gRouter = NULL;
+static SemaphoreHandle_t gRouterLock = NULL; // registration may run while messages arrive
+
+// Continuation fragments of a long message carry no topic, the one of the first fragment is kept
+static char gCurrentTopic[MQTT_DISPATCH_TOPIC_SIZE];
+static size_t gCurrentTopicLen = 0;
+
+typedef struct {
+    esp_mqtt_event_handle_t event;
+    const char* topic;
+    size_t topicLen;
+} data_event_t;
 
 static void log_error_if_nonzero(const char *message, int error_code);
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data);
-static TaskHandle_t mqtt_notify_task = NULL;
+static void subscribe_full_topic(const char* full_topic);
+static void send_subscribe(const char* full_topic);
+static void resubscribe_all(void);
+static void register_callback(const char* full_topic, mqtt_message_callback_t callback, mqtt_binary_callback_t binary_callback, mqtt_fragment_callback_t fragment_callback);
+static void dispatch_match(void* pValue, void* pArg);
+static void handle_data_event(esp_mqtt_event_handle_t event);
 
 // ----- implementation -----
 
@@ -20,6 +45,60 @@ void log_error_if_nonzero(const char *message, int error_code) {
     }
 }
 
+// Called by the router for every subscription matching the topic of a received message
+void dispatch_match(void* pValue, void* pArg) {
+    const topic_callback_t* pEntry = pValue;
+    const data_event_t* pData = pArg;
+    esp_mqtt_event_handle_t event = pData->event;
+
+    if (pEntry->fragment_callback) {
+        // Zero-copy, runs right here on the receive buffer of the client
+        pEntry->fragment_callback(pData->topic, pData->topicLen, (const uint8_t*)event->data, event->data_len,
+                                  event->current_data_offset, event->total_data_len);
+    } else if (event->data_len == event->total_data_len) {
+        // The callback runs on a dispatch worker, never in the MQTT event task
+        mqtt_dispatch_message(pEntry, pData->topic, pData->topicLen, event->data, event->data_len);
+    } else {
+        mqtt_dispatch_fragment(pEntry, pData->topic, pData->topicLen, event->data, event->data_len,
+                               event->current_data_offset, event->total_data_len);
+    }
+}
+
+/*
+ * @brief Routes a received message, or one fragment of it, to the matching subscriptions
+ *
+ *  Payloads longer than the receive buffer of the client arrive in several events,
+ *  only the first one carries the topic.
+ */
+void handle_data_event(esp_mqtt_event_handle_t event) {
+    if (event->current_data_offset == 0) {
+        // Messages are never interleaved, whatever is still being reassembled will not complete
+        mqtt_dispatch_reset_reassembly();
+        if ((size_t)event->topic_len >= sizeof(gCurrentTopic)) {
+            ESP_LOGW(TAG, "Topic %.*s too long, message dropped", event->topic_len, event->topic);
+            gCurrentTopicLen = 0;
+            return;
+        }
+        memcpy(gCurrentTopic, event->topic, event->topic_len);
+        gCurrentTopic[event->topic_len] = '\0';
+        gCurrentTopicLen = event->topic_len;
+        ESP_LOGD(TAG, "GOT EVENT\n\tTOPIC: %s\n\tDATA: %.*s", gCurrentTopic, event->data_len, event->data);
+    } else if (gCurrentTopicLen == 0) {
+        return; // the first fragment was dropped
+    }
+
+    if (gRouter == NULL) {
+        return;
+    }
+    data_event_t data = { .event = event, .topic = gCurrentTopic, .topicLen = gCurrentTopicLen };
+    xSemaphoreTake(gRouterLock, portMAX_DELAY);
+    size_t matches = mqtt_router_match(gRouter, gCurrentTopic, gCurrentTopicLen, dispatch_match, &data);
+    xSemaphoreGive(gRouterLock);
+    if (matches == 0 && event->current_data_offset == 0) {
+        ESP_LOGD(TAG, "No callback for topic %s", gCurrentTopic);
+    }
+}
+
 /*
  * @brief Event handler registered to receive MQTT events
  *
@@ -32,17 +111,26 @@ void log_error_if_nonzero(const char *message, int error_code) {
  */
 void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
     esp_mqtt_event_handle_t event = event_data;
-    gClient = event->client;
     ESP_LOGD(TAG, "Event dispatched from event loop\nbase=%s, event_id=%ld, client=%p", base, event_id, gClient);
     switch ((esp_mqtt_event_id_t)event_id) {
     case MQTT_EVENT_CONNECTED:
         ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
-        if (mqtt_notify_task) {
-            xTaskNotifyGive(mqtt_notify_task);
+        gConnected = true;
+        resubscribe_all();
+        mqtt_publish_set_connected(true);
+        if (gConnectionCallback) {
+            gConnectionCallback(true);
         }
         break;
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+        gConnected = false;
+        mqtt_publish_set_connected(false);
+        mqtt_dispatch_reset_reassembly();
+        gCurrentTopicLen = 0;
+        if (gConnectionCallback) {
+            gConnectionCallback(false);
+        }
         break;
 
     case MQTT_EVENT_SUBSCRIBED:
@@ -52,29 +140,15 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
         ESP_LOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
         break;
     case MQTT_EVENT_PUBLISHED:
-        ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+        ESP_LOGD(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+        if (gPublishedCallback) {
+            gPublishedCallback(event->msg_id);
+        }
         break;
     case MQTT_EVENT_DATA:
         ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-        ESP_LOGD(TAG, "GOT EVENT\n\tTOPIC: %.*s\n\tDATA: %.*s", event->topic_len, event->topic, event->data_len, event->data);
-        
-        // Handle topic-specific callbacks
-        for (int i = 0; i < callback_count; i++) {
-            if (strncmp(topic_callbacks[i].topic, event->topic, event->topic_len) == 0 && 
-                strlen(topic_callbacks[i].topic) == event->topic_len) {
-                if (topic_callbacks[i].callback) {
-                    // Create null-terminated strings for the callback
-                    char topic_str[128];
-                    char data_str[256];
-                    
-                    snprintf(topic_str, sizeof(topic_str), "%.*s", event->topic_len, event->topic);
-                    snprintf(data_str, sizeof(data_str), "%.*s", event->data_len, event->data);
-                    
-                    topic_callbacks[i].callback(topic_str, data_str);
-                }
-                break;
-            }
-        }
+        // Handle topic-specific callbacks, wildcard subscriptions may match as well
+        handle_data_event(event);
         break;
     case MQTT_EVENT_ERROR:
         ESP_LOGE(TAG, "MQTT_EVENT_ERROR");
@@ -92,26 +166,63 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
     }
 }
 
+/*
+ * @brief Creates the MQTT client without connecting
+ *
+ *  Subscriptions and publishes are accepted right away, they are sent once the broker
+ *  is reachable. The client does not reconnect on its own, see mqtt_start().
+ */
 esp_err_t mqtt_init() {
-    mqtt_notify_task = xTaskGetCurrentTaskHandle();
+    if (mqtt_dispatch_init() != ESP_OK) {
+        return ESP_FAIL;
+    }
+
     const esp_mqtt_client_config_t config = {
         .broker.address.uri = CONFIG_MQTT_BROKER_URL,
         .credentials.username = CONFIG_MQTT_BROKER_USERNAME,
         .credentials.authentication.password = CONFIG_MQTT_BROKER_PASSWORD,
+        .network.disable_auto_reconnect = true,
     };
     esp_mqtt_client_handle_t client = esp_mqtt_client_init(&config);
+    if (client == NULL) {
+        ESP_LOGE(TAG, "Failed to create MQTT client");
+        return ESP_FAIL;
+    }
+    if (mqtt_publish_init(client) != ESP_OK || mqtt_publisher_init() != ESP_OK) {
+        return ESP_FAIL;
+    }
+    gClient = client;
     // The last argument may be used to pass data to the event handler, in this example mqtt_event_handler
     esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
-    esp_mqtt_client_start(client);
-    // Wait for connection (timeout 10 seconds)
-    uint32_t notified = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10000));
-    if (notified == 0) {
-        ESP_LOGE(TAG, "MQTT connection timeout");
-        return ESP_FAIL;
+    ESP_LOGI(TAG, "MQTT client initialized\n");
+    return ESP_OK;
+}
+
+// Starts one connection attempt, the result is reported to the connection callback
+esp_err_t mqtt_start() {
+    if (gClient == NULL) {
+        ESP_LOGE(TAG, "MQTT client not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err;
+    if (!gStarted) {
+        err = esp_mqtt_client_start(gClient);
+        gStarted = (err == ESP_OK);
     } else {
-        ESP_LOGI(TAG, "MQTT client initialized and connected successfully\n");
-        return ESP_OK;
+        err = esp_mqtt_client_reconnect(gClient);
     }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to connect to the broker: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+void mqtt_set_connection_callback(mqtt_connection_callback_t callback) {
+    gConnectionCallback = callback;
+}
+
+void mqtt_set_published_callback(mqtt_published_callback_t callback) {
+    gPublishedCallback = callback;
 }
 
 void mqtt_get_full_topic(const char* topic, char* out_buf, size_t buf_size) {
@@ -135,20 +246,47 @@ void mqtt_get_full_topic(const char* topic, char* out_buf, size_t buf_size) {
 }
 
 void mqtt_subscribe(const char* topic) {
-    if (gClient == NULL || topic == NULL) {
-        ESP_LOGE(TAG, "MQTT client not initialized or topic is NULL");
+    if (topic == NULL) {
+        ESP_LOGE(TAG, "Topic is NULL");
         return;
     }
+    char full_topic[128];
+    mqtt_get_full_topic(topic, full_topic, sizeof(full_topic));
+    subscribe_full_topic(full_topic);
+}
 
+void subscribe_full_topic(const char* full_topic) {
+    if (gClient == NULL) {
+        ESP_LOGE(TAG, "MQTT client not initialized");
+        return;
+    }
+
+    // A filter given to mqtt_subscribe() and again with a callback is subscribed once
+    for (uint16_t i = 0; i < current_subscriptions; i++) {
+        if (strcmp(gSubscriptions[i], full_topic) == 0) {
+            ESP_LOGD(TAG, "Already subscribed to topic: %s", full_topic);
+            return;
+        }
+    }
     if (current_subscriptions >= CONFIG_MQTT_MAX_SUBSCRIPTIONS) {
         ESP_LOGE(TAG, "Maximum number of MQTT subscriptions reached: %d", CONFIG_MQTT_MAX_SUBSCRIPTIONS);
         return;
     }
+    const char* topic = strdup(full_topic);
+    if (topic == NULL) {
+        ESP_LOGE(TAG, "Out of memory for topic: %s", full_topic);
+        return;
+    }
+    gSubscriptions[current_subscriptions] = topic; // set before the count, the event task may be iterating
     current_subscriptions++;
 
-    char full_topic[128];
-    mqtt_get_full_topic(topic, full_topic, sizeof(full_topic));
+    // While offline the subscription is sent with all others once connected
+    if (gConnected) {
+        send_subscribe(topic);
+    }
+}
 
+void send_subscribe(const char* full_topic) {
     int msgId = esp_mqtt_client_subscribe(gClient, full_topic, 0);
     if (msgId < 0) {
         ESP_LOGE(TAG, "Failed to subscribe to topic: %s", full_topic);
@@ -157,51 +295,128 @@ void mqtt_subscribe(const char* topic) {
     ESP_LOGI(TAG, "Subscribed to topic: %s, msg_id=%d", full_topic, msgId);
 }
 
+// Runs in the MQTT event task, a registration in between is sent twice at worst
+void resubscribe_all(void) {
+    for (uint16_t i = 0; i < current_subscriptions; i++) {
+        send_subscribe(gSubscriptions[i]);
+    }
+}
+
 void mqtt_subscribe_callback(const char* topic, mqtt_message_callback_t callback) {
     if (topic == NULL || callback == NULL) {
         ESP_LOGE(TAG, "Topic or callback is NULL");
         return;
     }
-    
-    if (callback_count >= CONFIG_MQTT_MAX_SUBSCRIPTIONS) {
-        ESP_LOGE(TAG, "Maximum number of topic callbacks reached: %d", CONFIG_MQTT_MAX_SUBSCRIPTIONS);
+    char full_topic[128];
+    mqtt_get_full_topic(topic, full_topic, sizeof(full_topic));
+    register_callback(full_topic, callback, NULL, NULL);
+}
+
+void mqtt_subscribe_binary_callback(const char* topic, mqtt_binary_callback_t callback) {
+    if (topic == NULL || callback == NULL) {
+        ESP_LOGE(TAG, "Topic or callback is NULL");
         return;
     }
-    
-    // Subscribe to the topic
-    mqtt_subscribe(topic);
-    
-    // Store the callback mapping
     char full_topic[128];
     mqtt_get_full_topic(topic, full_topic, sizeof(full_topic));
-    
-    strncpy(topic_callbacks[callback_count].topic, full_topic, sizeof(topic_callbacks[callback_count].topic) - 1);
-    topic_callbacks[callback_count].topic[sizeof(topic_callbacks[callback_count].topic) - 1] = '\0';
-    topic_callbacks[callback_count].callback = callback;
-    callback_count++;
-    
-    ESP_LOGI(TAG, "Registered callback for topic: %s", full_topic);
+    register_callback(full_topic, NULL, callback, NULL);
 }
 
-#if USE_DEFAULT_TOPIC
-void mqtt_sendpayload(uint8_t* payload, uint16_t payloadLen) {
-    if (gClient == NULL) {
+void mqtt_subscribe_zerocopy_callback(const char* topic, mqtt_fragment_callback_t callback) {
+    if (topic == NULL || callback == NULL) {
+        ESP_LOGE(TAG, "Topic or callback is NULL");
         return;
     }
-    int msgId = esp_mqtt_client_publish(gClient, CONFIG_MQTT_TOPIC, (char*)payload, payloadLen, 1, 0);
-    ESP_LOGD(TAG, "Sent publish successful\n\payload: %.*s\n\tmsg_id: %d", payloadLen, payload, msgId);
+    char full_topic[128];
+    mqtt_get_full_topic(topic, full_topic, sizeof(full_topic));
+    register_callback(full_topic, NULL, NULL, callback);
 }
-#else
-void mqtt_sendpayload(const char* topic, uint8_t* payload, uint16_t payloadLen) {
-    if (topic == NULL || gClient == NULL) {
-        ESP_LOGE(TAG, "MQTT client not initialized or topic is NULL");
+
+// For topics outside of the prefix, e.g. the status of Home Assistant
+void mqtt_subscribe_full_topic_callback(const char* full_topic, mqtt_message_callback_t callback) {
+    if (full_topic == NULL || callback == NULL) {
+        ESP_LOGE(TAG, "Topic or callback is NULL");
+        return;
+    }
+    register_callback(full_topic, callback, NULL, NULL);
+}
+
+void register_callback(const char* full_topic, mqtt_message_callback_t callback, mqtt_binary_callback_t binary_callback, mqtt_fragment_callback_t fragment_callback) {
+    if (callback_count >= CONFIG_MQTT_MAX_SUBSCRIPTIONS) {
+        ESP_LOGE(TAG, "Maximum number of topic callbacks reached: %d", CONFIG_MQTT_MAX_SUBSCRIPTIONS);
+        return;
+    }
+    if (gRouter == NULL) {
+        gRouterLock = xSemaphoreCreateMutex();
+        gRouter = mqtt_router_create(CONFIG_MQTT_MAX_SUBSCRIPTIONS);
+        if (gRouter == NULL || gRouterLock == NULL) {
+            ESP_LOGE(TAG, "Failed to create topic router");
+            return;
+        }
+    }
+
+    if (!mqtt_router_is_valid_filter(full_topic)) {
+        ESP_LOGE(TAG, "Invalid topic filter: %s", full_topic);
         return;
     }
 
+    // Store the callback mapping before subscribing, messages may arrive right away
+    topic_callback_t* pEntry = &topic_callbacks[callback_count];
+    pEntry->topic = strdup(full_topic);
+    if (pEntry->topic == NULL) {
+        ESP_LOGE(TAG, "Out of memory for topic: %s", full_topic);
+        return;
+    }
+    pEntry->callback = callback;
+    pEntry->binary_callback = binary_callback;
+    pEntry->fragment_callback = fragment_callback;
+    pEntry->priority = MQTT_PRIORITY_NORMAL;
+    pEntry->overflow_policy = MQTT_OVERFLOW_DROP_OLDEST;
+
+    xSemaphoreTake(gRouterLock, portMAX_DELAY);
+    int ret = mqtt_router_add(gRouter, full_topic, pEntry);
+    xSemaphoreGive(gRouterLock);
+    if (ret != MQTT_ROUTER_SUCCESS) {
+        ESP_LOGE(TAG, "Failed to register topic %s: %d", full_topic, ret);
+        free((char*)pEntry->topic);
+        return;
+    }
+    callback_count++;
+
+    // Subscribe to the topic
+    subscribe_full_topic(full_topic);
+    
+    ESP_LOGI(TAG, "Registered callback for topic: %s", full_topic);
+}
+
+void mqtt_set_topic_dispatch(const char* topic, mqtt_priority_t priority, mqtt_overflow_policy_t policy) {
     char full_topic[128];
     mqtt_get_full_topic(topic, full_topic, sizeof(full_topic));
 
-    int msgId = esp_mqtt_client_publish(gClient, full_topic, (char*)payload, payloadLen, 1, 0);
-    ESP_LOGD(TAG, "Sent publish successful\n\ttopic: %s\n\tpayload: %.*s\n\tmsg_id: %d", full_topic, payloadLen, payload, msgId);
+    if (gRouter == NULL) {
+        ESP_LOGE(TAG, "No callback registered for topic: %s", full_topic);
+        return;
+    }
+    xSemaphoreTake(gRouterLock, portMAX_DELAY);
+    topic_callback_t* pEntry = mqtt_router_find(gRouter, full_topic);
+    xSemaphoreGive(gRouterLock);
+    if (pEntry == NULL) {
+        ESP_LOGE(TAG, "No callback registered for topic: %s", full_topic);
+        return;
+    }
+    pEntry->priority = priority;
+    pEntry->overflow_policy = policy;
+}
+
+// Plain QoS 1 message, queued while offline
+#if USE_DEFAULT_TOPIC
+void mqtt_sendpayload(uint8_t* payload, uint16_t payloadLen) {
+    const mqtt_publish_options_t options = { .qos = 1 };
+    mqtt_publish(CONFIG_MQTT_TOPIC, payload, payloadLen, &options);
+}
+#else
+void mqtt_sendpayload(const char* topic, uint8_t* payload, uint16_t payloadLen) {
+    const mqtt_publish_options_t options = { .qos = 1 };
+    mqtt_publish(topic, payload, payloadLen, &options);
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "mqtt_outbox.h"
+
+struct _MqttOutbox_ {
+    uint8_t* slots;
+    size_t slotSize;
+    size_t capacity;
+    size_t maxPayload;
+    size_t head;        // oldest message
+    size_t count;
+    uint32_t nextSeq;
+    mqtt_outbox_evict_t evict;
+    void* pEvictArg;
+    mqtt_outbox_stats_t stats;
+};
+
+static mqtt_outbox_entry_t* get_entry(const MqttOutbox* pOutbox, size_t index) {
+    size_t slot = (pOutbox->head + index) % pOutbox->capacity;
+    return (mqtt_outbox_entry_t*)&pOutbox->slots[slot * pOutbox->slotSize];
+}
+
+static void drop_oldest(MqttOutbox* pOutbox) {
+    pOutbox->head = (pOutbox->head + 1) % pOutbox->capacity;
+    pOutbox->count--;
+}
+
+static bool is_expired(const mqtt_outbox_entry_t* pEntry, int64_t now_us) {
+    return pEntry->expires_us != 0 && now_us >= pEntry->expires_us;
+}
+
+static void fill_entry(MqttOutbox* pOutbox, mqtt_outbox_entry_t* pEntry, const uint8_t* payload, size_t len, const mqtt_outbox_options_t* pOptions, int64_t now_us) {
+    pEntry->options = *pOptions;
+    pEntry->expires_us = (pOptions->ttl_ms > 0) ? now_us + (int64_t)pOptions->ttl_ms * 1000 : 0;
+    pEntry->seq = pOutbox->nextSeq++;
+    pEntry->len = (uint16_t)len;
+    memcpy(pEntry->payload, payload, len);
+}
+
+size_t mqtt_outbox_entry_size(size_t maxPayload) {
+    // Keep every slot aligned for the 64 bit expiry time
+    return (sizeof(mqtt_outbox_entry_t) + maxPayload + 7) & ~(size_t)7;
+}
+
+MqttOutbox* mqtt_outbox_create(size_t capacity, size_t maxPayload, mqtt_outbox_evict_t evict, void* pArg) {
+    if (capacity == 0 || maxPayload > UINT16_MAX) {
+        return NULL;
+    }
+    MqttOutbox* pOutbox = calloc(1, sizeof(MqttOutbox));
+    if (pOutbox == NULL) {
+        return NULL;
+    }
+    pOutbox->slotSize = mqtt_outbox_entry_size(maxPayload);
+    pOutbox->slots = malloc(capacity * pOutbox->slotSize);
+    if (pOutbox->slots == NULL) {
+        free(pOutbox);
+        return NULL;
+    }
+    pOutbox->capacity = capacity;
+    pOutbox->maxPayload = maxPayload;
+    pOutbox->evict = evict;
+    pOutbox->pEvictArg = pArg;
+    return pOutbox;
+}
+
+void mqtt_outbox_destroy(MqttOutbox* pOutbox) {
+    if (pOutbox != NULL) {
+        free(pOutbox->slots);
+        free(pOutbox);
+    }
+}
+
+/*
+ * @brief Queues a message behind all others
+ *
+ *  A coalescing message replaces the queued one of the same topic in place, so it keeps its
+ *  position. If the ring is full, expired messages are dropped first, then the oldest one
+ *  is handed to the evict callback and overwritten.
+ */
+int mqtt_outbox_push(MqttOutbox* pOutbox, const char* topic, const uint8_t* payload, size_t len, const mqtt_outbox_options_t* pOptions, int64_t now_us) {
+    size_t topicLen = strlen(topic);
+    if (len > pOutbox->maxPayload || topicLen >= MQTT_OUTBOX_TOPIC_SIZE) {
+        return MQTT_OUTBOX_ERROR_TOO_LARGE;
+    }
+
+    if (pOptions->coalesce) {
+        for (size_t i = 0; i < pOutbox->count; i++) {
+            mqtt_outbox_entry_t* pEntry = get_entry(pOutbox, i);
+            if (pEntry->options.coalesce && strcmp(pEntry->topic, topic) == 0) {
+                fill_entry(pOutbox, pEntry, payload, len, pOptions, now_us);
+                pOutbox->stats.coalesced++;
+                return MQTT_OUTBOX_COALESCED;
+            }
+        }
+    }
+
+    while (pOutbox->count > 0 && is_expired(get_entry(pOutbox, 0), now_us)) {
+        drop_oldest(pOutbox);
+        pOutbox->stats.expired++;
+    }
+    if (pOutbox->count == pOutbox->capacity) {
+        if (pOutbox->evict != NULL) {
+            pOutbox->evict(get_entry(pOutbox, 0), pOutbox->pEvictArg);
+        }
+        drop_oldest(pOutbox);
+        pOutbox->stats.evicted++;
+    }
+
+    mqtt_outbox_entry_t* pEntry = get_entry(pOutbox, pOutbox->count);
+    memcpy(pEntry->topic, topic, topicLen + 1);
+    fill_entry(pOutbox, pEntry, payload, len, pOptions, now_us);
+    pOutbox->count++;
+    pOutbox->stats.stored++;
+    return MQTT_OUTBOX_STORED;
+}
+
+// Returns the oldest message that has not expired, or NULL if there is none
+const mqtt_outbox_entry_t* mqtt_outbox_peek(MqttOutbox* pOutbox, int64_t now_us) {
+    while (pOutbox->count > 0) {
+        mqtt_outbox_entry_t* pEntry = get_entry(pOutbox, 0);
+        if (!is_expired(pEntry, now_us)) {
+            return pEntry;
+        }
+        drop_oldest(pOutbox);
+        pOutbox->stats.expired++;
+    }
+    return NULL;
+}
+
+/*
+ * @brief Removes the oldest message after it was published
+ *
+ *  Only if it still is the one with the given sequence number, a message coalesced
+ *  while it was being published stays queued with its new content.
+ */
+bool mqtt_outbox_pop(MqttOutbox* pOutbox, uint32_t seq) {
+    if (pOutbox->count == 0 || get_entry(pOutbox, 0)->seq != seq) {
+        return false;
+    }
+    drop_oldest(pOutbox);
+    return true;
+}
+
+size_t mqtt_outbox_count(const MqttOutbox* pOutbox) {
+    return pOutbox->count;
+}
+
+void mqtt_outbox_get_stats(const MqttOutbox* pOutbox, mqtt_outbox_stats_t* pStats) {
+    *pStats = pOutbox->stats;
+}
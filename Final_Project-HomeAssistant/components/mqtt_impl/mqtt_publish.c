@@ -0,0 +1,221 @@
+#include "esp_timer.h"
+
+#include "mqtt_internal.h"
+#include "mqtt_outbox.h"
+#include "mqtt_spill.h"
+
+#define DRAIN_RETRY_MS  2000 // after a failed replay, e.g. while the client's own outbox is full
+
+static const char *TAG = "MQTT_PUBLISH";
+
+static esp_mqtt_client_handle_t gClient = NULL;
+static volatile bool gConnected = false;
+
+static MqttOutbox* gOutbox = NULL;
+static SemaphoreHandle_t gOutboxLock = NULL; // guards the outbox, the spill log and the counters below
+static mqtt_outbox_entry_t* gDrainEntry = NULL; // copy of the message being replayed
+static TaskHandle_t gDrainTask = NULL;
+static uint32_t gReplayed = 0;
+static uint32_t gLost = 0;
+static uint32_t gSpillExpired = 0;
+static int64_t gFirstPublishUs = 0; // time since boot of the first message handed to the client
+
+static void spill_evicted(const mqtt_outbox_entry_t* pEntry, void* pArg);
+static void record_publish(void);
+static bool has_backlog(void);
+static bool next_message(bool* pFromSpill);
+static void drain_task(void* arg);
+
+// ----- implementation -----
+
+// The RAM ring is full, move its oldest message to flash
+void spill_evicted(const mqtt_outbox_entry_t* pEntry, void* pArg) {
+    if (!mqtt_spill_write(pEntry)) {
+        ESP_LOGW(TAG, "Outbox full, dropped message on %s", pEntry->topic);
+        gLost++;
+    }
+}
+
+void record_publish(void) {
+    if (gFirstPublishUs == 0) {
+        gFirstPublishUs = esp_timer_get_time();
+    }
+}
+
+bool has_backlog(void) {
+    xSemaphoreTake(gOutboxLock, portMAX_DELAY);
+    bool backlog = mqtt_outbox_count(gOutbox) > 0 || mqtt_spill_count() > 0;
+    xSemaphoreGive(gOutboxLock);
+    return backlog;
+}
+
+// Copies the oldest waiting message to gDrainEntry, flash first since it holds the older ones
+bool next_message(bool* pFromSpill) {
+    int64_t now_us = esp_timer_get_time();
+    bool found = false;
+
+    xSemaphoreTake(gOutboxLock, portMAX_DELAY);
+    while (mqtt_spill_peek(gDrainEntry)) {
+        if (gDrainEntry->expires_us == 0 || now_us < gDrainEntry->expires_us) {
+            *pFromSpill = true;
+            found = true;
+            break;
+        }
+        mqtt_spill_pop();
+        gSpillExpired++;
+    }
+    if (!found) {
+        const mqtt_outbox_entry_t* pEntry = mqtt_outbox_peek(gOutbox, now_us);
+        if (pEntry != NULL) {
+            memcpy(gDrainEntry, pEntry, sizeof(mqtt_outbox_entry_t) + pEntry->len);
+            *pFromSpill = false;
+            found = true;
+        }
+    }
+    xSemaphoreGive(gOutboxLock);
+    return found;
+}
+
+/*
+ * @brief Replays the queued messages in order after a reconnect
+ *
+ *  Publishes at most MQTT_OUTBOX_DRAIN_RATE messages per second, so a long backlog
+ *  does not flood the broker or starve the live messages. After a failed publish the
+ *  message stays queued and the replay starts over after DRAIN_RETRY_MS.
+ */
+void drain_task(void* arg) {
+    bool retry = false;
+    while (true) {
+        // A notification for a reconnect or a new message ends the retry delay early
+        ulTaskNotifyTake(pdTRUE, retry ? pdMS_TO_TICKS(DRAIN_RETRY_MS) : portMAX_DELAY);
+
+        uint32_t replayed = 0;
+        bool fromSpill;
+        retry = false;
+        while (gConnected && next_message(&fromSpill)) {
+            int msgId = esp_mqtt_client_publish(gClient, gDrainEntry->topic, (const char*)gDrainEntry->payload, gDrainEntry->len,
+                                                gDrainEntry->options.qos, gDrainEntry->options.retain);
+            if (msgId < 0) {
+                retry = true;
+                break;
+            }
+            record_publish();
+
+            xSemaphoreTake(gOutboxLock, portMAX_DELAY);
+            if (fromSpill) {
+                mqtt_spill_pop();
+            } else {
+                mqtt_outbox_pop(gOutbox, gDrainEntry->seq);
+            }
+            gReplayed++;
+            xSemaphoreGive(gOutboxLock);
+
+            replayed++;
+            vTaskDelay(pdMS_TO_TICKS(1000 / MQTT_OUTBOX_DRAIN_RATE));
+        }
+        if (replayed > 0) {
+            ESP_LOGI(TAG, "Replayed %" PRIu32 " queued messages", replayed);
+        }
+    }
+}
+
+esp_err_t mqtt_publish_init(esp_mqtt_client_handle_t client) {
+    gClient = client;
+    gOutboxLock = xSemaphoreCreateMutex();
+    gOutbox = mqtt_outbox_create(MQTT_OUTBOX_SIZE, MQTT_OUTBOX_MESSAGE_SIZE, spill_evicted, NULL);
+    gDrainEntry = malloc(mqtt_outbox_entry_size(MQTT_OUTBOX_MESSAGE_SIZE));
+    if (gOutboxLock == NULL || gOutbox == NULL || gDrainEntry == NULL) {
+        ESP_LOGE(TAG, "Failed to create outbox");
+        return ESP_ERR_NO_MEM;
+    }
+    mqtt_spill_init(MQTT_OUTBOX_MESSAGE_SIZE); // runs without flash if the partition is missing
+
+    if (xTaskCreate(drain_task, "mqtt_drain", MQTT_DISPATCH_TASK_STACKSIZE, NULL, MQTT_DISPATCH_TASK_PRIORITY, &gDrainTask) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create drain task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void mqtt_publish_set_connected(bool connected) {
+    gConnected = connected;
+    if (connected && gDrainTask != NULL) {
+        xTaskNotifyGive(gDrainTask);
+    }
+}
+
+esp_err_t mqtt_publish(const char* topic, const uint8_t* payload, size_t payloadLen, const mqtt_publish_options_t* pOptions) {
+    if (topic == NULL || pOptions == NULL) {
+        ESP_LOGE(TAG, "Topic or options are NULL");
+        return ESP_ERR_INVALID_ARG;
+    }
+    char full_topic[MQTT_OUTBOX_TOPIC_SIZE];
+    mqtt_get_full_topic(topic, full_topic, sizeof(full_topic));
+    return mqtt_publish_full_topic(full_topic, payload, payloadLen, pOptions);
+}
+
+/*
+ * @brief Publishes a message, or queues it while the broker cannot be reached
+ *
+ *  Messages are sent directly only if nothing is queued, otherwise they would overtake
+ *  the backlog. Queued messages are replayed in order once the client reconnected.
+ *  The topic is used as is, without prefix.
+ */
+esp_err_t mqtt_publish_full_topic(const char* fullTopic, const uint8_t* payload, size_t payloadLen, const mqtt_publish_options_t* pOptions) {
+    if (gOutbox == NULL) {
+        ESP_LOGE(TAG, "MQTT client not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Messages too large for the outbox cannot wait behind the backlog
+    if (gConnected && (payloadLen > MQTT_OUTBOX_MESSAGE_SIZE || !has_backlog())) {
+        int msgId = esp_mqtt_client_publish(gClient, fullTopic, (const char*)payload, payloadLen, pOptions->qos, pOptions->retain);
+        if (msgId >= 0) {
+            record_publish();
+            ESP_LOGD(TAG, "Sent publish successful\n\ttopic: %s\n\tpayload: %.*s\n\tmsg_id: %d", fullTopic, (int)payloadLen, payload, msgId);
+            return ESP_OK;
+        }
+    }
+
+    mqtt_outbox_options_t options = {
+        .qos = pOptions->qos,
+        .retain = pOptions->retain,
+        .coalesce = pOptions->coalesce,
+        .ttl_ms = pOptions->ttl_ms,
+    };
+    xSemaphoreTake(gOutboxLock, portMAX_DELAY);
+    int ret = mqtt_outbox_push(gOutbox, fullTopic, payload, payloadLen, &options, esp_timer_get_time());
+    xSemaphoreGive(gOutboxLock);
+    if (ret == MQTT_OUTBOX_ERROR_TOO_LARGE) {
+        ESP_LOGE(TAG, "Message on %s does not fit into the outbox (%u bytes)", fullTopic, (unsigned)payloadLen);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    ESP_LOGD(TAG, "Queued message on %s%s", fullTopic, (ret == MQTT_OUTBOX_COALESCED) ? ", replaced older one" : "");
+
+    if (gConnected) {
+        xTaskNotifyGive(gDrainTask); // the direct publish failed or a backlog is being drained
+    }
+    return ESP_OK;
+}
+
+int64_t mqtt_get_first_publish_us(void) {
+    return gFirstPublishUs;
+}
+
+void mqtt_get_outbox_metrics(mqtt_outbox_metrics_t* pMetrics) {
+    memset(pMetrics, 0, sizeof(*pMetrics));
+    if (gOutbox == NULL) {
+        return;
+    }
+    mqtt_outbox_stats_t stats;
+    xSemaphoreTake(gOutboxLock, portMAX_DELAY);
+    mqtt_outbox_get_stats(gOutbox, &stats);
+    pMetrics->queued = mqtt_outbox_count(gOutbox);
+    pMetrics->spilled = mqtt_spill_count();
+    pMetrics->replayed = gReplayed;
+    pMetrics->lost = gLost;
+    pMetrics->expired = stats.expired + gSpillExpired;
+    xSemaphoreGive(gOutboxLock);
+    pMetrics->coalesced = stats.coalesced;
+    pMetrics->evicted = stats.evicted;
+}
@@ -0,0 +1,232 @@
+#include <sys/param.h>
+#include "esp_timer.h"
+
+#include "mqtt_internal.h"
+
+static const char *TAG = "MQTT_PUBLISHER";
+
+struct _MqttPublisher_ {
+    char fullTopic[MQTT_DISPATCH_TOPIC_SIZE];   // prefix added once at registration
+    mqtt_publish_policy_t policy;
+    uint8_t pending[MQTT_OUTBOX_MESSAGE_SIZE];  // latest message, or the batch collected so far
+    size_t pendingLen;
+    uint8_t pendingCount;
+    int64_t deadline_us;                        // 0 = nothing pending
+    int64_t lastPublish_us;
+};
+
+static MqttPublisher gPublishers[MQTT_MAX_PUBLISHERS];
+static uint8_t gPublisherCount = 0;
+static SemaphoreHandle_t gPublisherLock = NULL;
+static TaskHandle_t gFlushTask = NULL;
+
+static int64_t earliest_publish(const MqttPublisher* pPublisher, int64_t now_us);
+static bool append_pending(MqttPublisher* pPublisher, const uint8_t* payload, size_t len);
+static size_t take_pending(MqttPublisher* pPublisher, uint8_t* pOut, int64_t now_us);
+static void flush_task(void* arg);
+
+// ----- implementation -----
+
+int64_t earliest_publish(const MqttPublisher* pPublisher, int64_t now_us) {
+    if (pPublisher->lastPublish_us == 0) {
+        return now_us;
+    }
+    return MAX(now_us, pPublisher->lastPublish_us + (int64_t)pPublisher->policy.min_interval_ms * 1000);
+}
+
+// Adds a message to the pending buffer, returns false if it does not fit next to the pending ones
+bool append_pending(MqttPublisher* pPublisher, const uint8_t* payload, size_t len) {
+    switch (pPublisher->policy.batch_format) {
+    case MQTT_BATCH_JSON_ARRAY:
+        // "[a,b" is kept open, one byte stays free for the closing bracket
+        if (pPublisher->pendingLen + 1 + len + 1 > sizeof(pPublisher->pending)) {
+            return false;
+        }
+        pPublisher->pending[pPublisher->pendingLen++] = (pPublisher->pendingCount == 0) ? '[' : ',';
+        break;
+    case MQTT_BATCH_BINARY:
+        if (pPublisher->pendingLen + len > sizeof(pPublisher->pending)) {
+            return false;
+        }
+        break;
+    default:
+        // Not batched, a newer message replaces the pending one
+        if (len > sizeof(pPublisher->pending)) {
+            return false;
+        }
+        pPublisher->pendingLen = 0;
+        pPublisher->pendingCount = 0;
+        break;
+    }
+    memcpy(&pPublisher->pending[pPublisher->pendingLen], payload, len);
+    pPublisher->pendingLen += len;
+    pPublisher->pendingCount++;
+    return true;
+}
+
+// Moves the pending message to pOut, which must hold MQTT_OUTBOX_MESSAGE_SIZE bytes
+size_t take_pending(MqttPublisher* pPublisher, uint8_t* pOut, int64_t now_us) {
+    size_t len = pPublisher->pendingLen;
+    memcpy(pOut, pPublisher->pending, len);
+    if (pPublisher->policy.batch_format == MQTT_BATCH_JSON_ARRAY && len > 0) {
+        pOut[len++] = ']';
+    }
+    pPublisher->pendingLen = 0;
+    pPublisher->pendingCount = 0;
+    pPublisher->deadline_us = 0;
+    pPublisher->lastPublish_us = now_us;
+    return len;
+}
+
+/*
+ * @brief Publishes the messages held back by a coalescing window or a rate limit
+ *
+ *  Sleeps until the nearest deadline, new pending messages wake it up early.
+ */
+void flush_task(void* arg) {
+    static uint8_t buffer[MQTT_OUTBOX_MESSAGE_SIZE];
+
+    while (true) {
+        int64_t next_us = INT64_MAX;
+        xSemaphoreTake(gPublisherLock, portMAX_DELAY);
+        for (uint8_t i = 0; i < gPublisherCount; i++) {
+            if (gPublishers[i].deadline_us != 0) {
+                next_us = MIN(next_us, gPublishers[i].deadline_us);
+            }
+        }
+        xSemaphoreGive(gPublisherLock);
+
+        if (next_us == INT64_MAX) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        int64_t wait_us = next_us - esp_timer_get_time();
+        if (wait_us > 0) {
+            // Rounded down to ticks, a wait below one tick would be 0 and spin until the deadline
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS((wait_us + 999) / 1000) + 1);
+        }
+
+        for (uint8_t i = 0; i < gPublisherCount; i++) {
+            MqttPublisher* pPublisher = &gPublishers[i];
+            int64_t now_us = esp_timer_get_time();
+            size_t len = 0;
+            xSemaphoreTake(gPublisherLock, portMAX_DELAY);
+            if (pPublisher->deadline_us != 0 && pPublisher->deadline_us <= now_us) {
+                len = take_pending(pPublisher, buffer, now_us);
+            }
+            xSemaphoreGive(gPublisherLock);
+            if (len > 0) {
+                mqtt_publish_full_topic(pPublisher->fullTopic, buffer, len, &pPublisher->policy.options);
+            }
+        }
+    }
+}
+
+esp_err_t mqtt_publisher_init(void) {
+    gPublisherLock = xSemaphoreCreateMutex();
+    if (gPublisherLock == NULL) {
+        ESP_LOGE(TAG, "Failed to create publisher lock");
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(flush_task, "mqtt_flush", MQTT_DISPATCH_TASK_STACKSIZE, NULL, MQTT_DISPATCH_TASK_PRIORITY, &gFlushTask) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create flush task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+/*
+ * @brief Registers the publish policy of a topic
+ *
+ * @return handle for mqtt_publisher_send(), NULL if the table is full
+ */
+MqttPublisher* mqtt_publisher_register(const char* topic, const mqtt_publish_policy_t* pPolicy) {
+    if (topic == NULL || pPolicy == NULL) {
+        ESP_LOGE(TAG, "Topic or policy is NULL");
+        return NULL;
+    }
+    if (gPublisherLock == NULL) {
+        ESP_LOGE(TAG, "MQTT client not initialized");
+        return NULL;
+    }
+    if (gPublisherCount >= MQTT_MAX_PUBLISHERS) {
+        ESP_LOGE(TAG, "Maximum number of publishers reached: %d", MQTT_MAX_PUBLISHERS);
+        return NULL;
+    }
+
+    xSemaphoreTake(gPublisherLock, portMAX_DELAY);
+    MqttPublisher* pPublisher = &gPublishers[gPublisherCount];
+    memset(pPublisher, 0, sizeof(*pPublisher));
+    mqtt_get_full_topic(topic, pPublisher->fullTopic, sizeof(pPublisher->fullTopic));
+    pPublisher->policy = *pPolicy;
+    if (pPublisher->policy.batch_format != MQTT_BATCH_NONE && pPublisher->policy.batch_max == 0) {
+        pPublisher->policy.batch_max = UINT8_MAX; // limited by the buffer size only
+    }
+    gPublisherCount++;
+    xSemaphoreGive(gPublisherLock);
+
+    ESP_LOGI(TAG, "Registered publisher for topic: %s, qos=%d, retain=%d", pPublisher->fullTopic, pPolicy->options.qos, pPolicy->options.retain);
+    return pPublisher;
+}
+
+/*
+ * @brief Publishes a message according to the policy of its topic
+ *
+ *  Without coalescing window, rate limit or batching the message is published right away.
+ *  Otherwise it is held back, replaced by newer messages or collected into a batch, and
+ *  published by the flush task.
+ */
+esp_err_t mqtt_publisher_send(MqttPublisher* pPublisher, const uint8_t* payload, size_t payloadLen) {
+    if (pPublisher == NULL || payload == NULL) {
+        ESP_LOGE(TAG, "Publisher or payload is NULL");
+        return ESP_ERR_INVALID_ARG;
+    }
+    const mqtt_publish_policy_t* pPolicy = &pPublisher->policy;
+    int64_t now_us = esp_timer_get_time();
+
+    xSemaphoreTake(gPublisherLock, portMAX_DELAY);
+    int64_t due_us = MAX(now_us + (int64_t)pPolicy->coalesce_window_ms * 1000, earliest_publish(pPublisher, now_us));
+    if (due_us <= now_us && pPublisher->pendingCount == 0) {
+        // Fast path, nothing to hold back
+        pPublisher->lastPublish_us = now_us;
+        xSemaphoreGive(gPublisherLock);
+        return mqtt_publish_full_topic(pPublisher->fullTopic, payload, payloadLen, &pPolicy->options);
+    }
+
+    if (!append_pending(pPublisher, payload, payloadLen)) {
+        if (pPublisher->pendingCount == 0) {
+            xSemaphoreGive(gPublisherLock);
+            ESP_LOGE(TAG, "Message on %s does not fit into %d bytes", pPublisher->fullTopic, MQTT_OUTBOX_MESSAGE_SIZE);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        // The batch is full, send it and start the next one with this message
+        uint8_t batch[MQTT_OUTBOX_MESSAGE_SIZE];
+        size_t len = take_pending(pPublisher, batch, now_us);
+        bool held = append_pending(pPublisher, payload, payloadLen);
+        if (held) {
+            pPublisher->deadline_us = MAX(now_us + (int64_t)pPolicy->coalesce_window_ms * 1000, earliest_publish(pPublisher, now_us));
+        }
+        xSemaphoreGive(gPublisherLock);
+        if (held) {
+            xTaskNotifyGive(gFlushTask);
+        }
+        esp_err_t err = mqtt_publish_full_topic(pPublisher->fullTopic, batch, len, &pPolicy->options);
+        if (!held) {
+            // Even an empty batch has no room for it, e.g. with the brackets of a JSON array
+            ESP_LOGE(TAG, "Message on %s does not fit into %d bytes", pPublisher->fullTopic, MQTT_OUTBOX_MESSAGE_SIZE);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        return err;
+    }
+
+    if (pPolicy->batch_format != MQTT_BATCH_NONE && pPublisher->pendingCount >= pPolicy->batch_max) {
+        due_us = earliest_publish(pPublisher, now_us);
+    } else if (pPublisher->deadline_us != 0) {
+        due_us = pPublisher->deadline_us; // the window started with the first pending message
+    }
+    pPublisher->deadline_us = due_us;
+    xSemaphoreGive(gPublisherLock);
+
+    xTaskNotifyGive(gFlushTask);
+    return ESP_OK;
+}
@@ -0,0 +1,395 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "mqtt_router.h"
+
+typedef struct {
+    uint32_t hash;
+    const char* filter; // NULL marks a free slot
+    size_t len;
+    void* pValue;
+} ExactRoute;
+
+typedef struct _TrieNode_ {
+    const char* level;              // points into the stored filter, not null-terminated
+    size_t levelLen;
+    uint32_t levelHash;
+    struct _TrieNode_* pChildren;   // exact level children, only walked to free them
+    struct _TrieNode_* pSibling;
+    struct _TrieNode_* pPlus;       // '+' child
+    void* pValue;                   // filter ends at this node
+    void* pHashValue;               // filter continues with '#' after this node
+} TrieNode;
+
+// Exact level children of all trie nodes, keyed by parent and level, so each level is one probe
+typedef struct {
+    const TrieNode* pParent;    // NULL marks a free slot
+    TrieNode* pChild;
+} ChildSlot;
+
+typedef struct _StoredFilter_ {
+    struct _StoredFilter_* pNext;
+    char text[];
+} StoredFilter;
+
+struct _MqttRouter_ {
+    StoredFilter* pFilters; // copies of all filters, referenced by the hash table and the trie
+    ExactRoute* exact;
+    size_t exactCapacity;   // power of two
+    size_t maxRoutes;
+    size_t routeCount;
+    size_t wildcardCount;
+    ChildSlot* children;
+    size_t childCapacity;   // power of two
+    size_t childCount;
+    TrieNode root;
+};
+
+// FNV-1a
+static uint32_t hash_topic(const char* topic, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)topic[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static const ExactRoute* find_exact(const MqttRouter* pRouter, const char* topic, size_t len, uint32_t hash) {
+    size_t mask = pRouter->exactCapacity - 1;
+    for (size_t i = hash & mask; pRouter->exact[i].filter != NULL; i = (i + 1) & mask) {
+        const ExactRoute* pRoute = &pRouter->exact[i];
+        if (pRoute->hash == hash && pRoute->len == len && memcmp(pRoute->filter, topic, len) == 0) {
+            return pRoute;
+        }
+    }
+    return NULL;
+}
+
+static size_t child_slot(const TrieNode* pParent, uint32_t levelHash, size_t mask) {
+    uint32_t key = levelHash ^ (uint32_t)((uintptr_t)pParent * 2654435761u);
+    return key & mask;
+}
+
+static TrieNode* find_child(const MqttRouter* pRouter, const TrieNode* pParent, const char* level, size_t levelLen, uint32_t levelHash) {
+    size_t mask = pRouter->childCapacity - 1;
+    for (size_t i = child_slot(pParent, levelHash, mask); pRouter->children[i].pParent != NULL; i = (i + 1) & mask) {
+        TrieNode* pChild = pRouter->children[i].pChild;
+        if (pRouter->children[i].pParent == pParent && pChild->levelHash == levelHash
+            && pChild->levelLen == levelLen && memcmp(pChild->level, level, levelLen) == 0) {
+            return pChild;
+        }
+    }
+    return NULL;
+}
+
+static void insert_child(ChildSlot* children, size_t capacity, const TrieNode* pParent, TrieNode* pChild) {
+    size_t mask = capacity - 1;
+    size_t i = child_slot(pParent, pChild->levelHash, mask);
+    while (children[i].pParent != NULL) {
+        i = (i + 1) & mask;
+    }
+    children[i].pParent = pParent;
+    children[i].pChild = pChild;
+}
+
+// Doubles the child table once it would be more than half full
+static bool reserve_child(MqttRouter* pRouter) {
+    if (2 * (pRouter->childCount + 1) <= pRouter->childCapacity) {
+        return true;
+    }
+    size_t capacity = 2 * pRouter->childCapacity;
+    ChildSlot* children = calloc(capacity, sizeof(ChildSlot));
+    if (children == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < pRouter->childCapacity; i++) {
+        if (pRouter->children[i].pParent != NULL) {
+            insert_child(children, capacity, pRouter->children[i].pParent, pRouter->children[i].pChild);
+        }
+    }
+    free(pRouter->children);
+    pRouter->children = children;
+    pRouter->childCapacity = capacity;
+    return true;
+}
+
+static void destroy_node(TrieNode* pNode) {
+    TrieNode* pChild = pNode->pChildren;
+    while (pChild != NULL) {
+        TrieNode* pNext = pChild->pSibling;
+        destroy_node(pChild);
+        free(pChild);
+        pChild = pNext;
+    }
+    if (pNode->pPlus != NULL) {
+        destroy_node(pNode->pPlus);
+        free(pNode->pPlus);
+    }
+}
+
+static TrieNode* get_child(MqttRouter* pRouter, TrieNode* pNode, const char* level, size_t levelLen) {
+    if (levelLen == 1 && level[0] == '+') {
+        if (pNode->pPlus == NULL) {
+            pNode->pPlus = calloc(1, sizeof(TrieNode));
+        }
+        return pNode->pPlus;
+    }
+
+    uint32_t levelHash = hash_topic(level, levelLen);
+    TrieNode* pChild = find_child(pRouter, pNode, level, levelLen, levelHash);
+    if (pChild != NULL) {
+        return pChild;
+    }
+    if (!reserve_child(pRouter)) {
+        return NULL;
+    }
+    pChild = calloc(1, sizeof(TrieNode));
+    if (pChild == NULL) {
+        return NULL;
+    }
+    pChild->level = level;
+    pChild->levelLen = levelLen;
+    pChild->levelHash = levelHash;
+    pChild->pSibling = pNode->pChildren;
+    pNode->pChildren = pChild;
+    insert_child(pRouter->children, pRouter->childCapacity, pNode, pChild);
+    pRouter->childCount++;
+    return pChild;
+}
+
+static int add_wildcard(MqttRouter* pRouter, const char* filter, void* pValue) {
+    TrieNode* pNode = &pRouter->root;
+    const char* level = filter;
+
+    while (true) {
+        const char* slash = strchr(level, '/');
+        size_t levelLen = (slash != NULL) ? (size_t)(slash - level) : strlen(level);
+
+        if (levelLen == 1 && level[0] == '#') {
+            if (pNode->pHashValue != NULL) {
+                return MQTT_ROUTER_ERROR_DUPLICATE;
+            }
+            pNode->pHashValue = pValue;
+            return MQTT_ROUTER_SUCCESS;
+        }
+
+        pNode = get_child(pRouter, pNode, level, levelLen);
+        if (pNode == NULL) {
+            return MQTT_ROUTER_ERROR_OUTOFMEMORY;
+        }
+        if (slash == NULL) {
+            break;
+        }
+        level = slash + 1;
+    }
+
+    if (pNode->pValue != NULL) {
+        return MQTT_ROUTER_ERROR_DUPLICATE;
+    }
+    pNode->pValue = pValue;
+    return MQTT_ROUTER_SUCCESS;
+}
+
+static size_t match_node(const MqttRouter* pRouter, const TrieNode* pNode, const char* level, const char* end, bool atEnd,
+                         mqtt_router_match_t match, void* pArg) {
+    size_t matches = 0;
+
+    // '#' also matches the parent level itself, "a/#" matches "a"
+    if (pNode->pHashValue != NULL) {
+        match(pNode->pHashValue, pArg);
+        matches++;
+    }
+    if (atEnd) {
+        if (pNode->pValue != NULL) {
+            match(pNode->pValue, pArg);
+            matches++;
+        }
+        return matches;
+    }
+
+    const char* slash = memchr(level, '/', end - level);
+    size_t levelLen = (slash != NULL) ? (size_t)(slash - level) : (size_t)(end - level);
+    const char* next = (slash != NULL) ? slash + 1 : end;
+    bool nextAtEnd = (slash == NULL);
+
+    if (pNode->pChildren != NULL) {
+        const TrieNode* pChild = find_child(pRouter, pNode, level, levelLen, hash_topic(level, levelLen));
+        if (pChild != NULL) {
+            matches += match_node(pRouter, pChild, next, end, nextAtEnd, match, pArg);
+        }
+    }
+    if (pNode->pPlus != NULL) {
+        matches += match_node(pRouter, pNode->pPlus, next, end, nextAtEnd, match, pArg);
+    }
+    return matches;
+}
+
+MqttRouter* mqtt_router_create(size_t maxRoutes) {
+    MqttRouter* pRouter = calloc(1, sizeof(MqttRouter));
+    if (pRouter == NULL) {
+        return NULL;
+    }
+    // Keep the load factor of the hash table at 50% at most
+    pRouter->exactCapacity = 1;
+    while (pRouter->exactCapacity < 2 * maxRoutes) {
+        pRouter->exactCapacity <<= 1;
+    }
+    pRouter->exact = calloc(pRouter->exactCapacity, sizeof(ExactRoute));
+    // Grows with the trie, a filter adds as many children as it has levels
+    pRouter->childCapacity = pRouter->exactCapacity;
+    pRouter->children = calloc(pRouter->childCapacity, sizeof(ChildSlot));
+    if (pRouter->exact == NULL || pRouter->children == NULL) {
+        free(pRouter->exact);
+        free(pRouter->children);
+        free(pRouter);
+        return NULL;
+    }
+    pRouter->maxRoutes = maxRoutes;
+    return pRouter;
+}
+
+void mqtt_router_destroy(MqttRouter* pRouter) {
+    if (pRouter == NULL) {
+        return;
+    }
+    destroy_node(&pRouter->root);
+    free(pRouter->exact);
+    free(pRouter->children);
+    while (pRouter->pFilters != NULL) {
+        StoredFilter* pNext = pRouter->pFilters->pNext;
+        free(pRouter->pFilters);
+        pRouter->pFilters = pNext;
+    }
+    free(pRouter);
+}
+
+bool mqtt_router_is_valid_filter(const char* filter) {
+    if (filter == NULL || filter[0] == '\0') {
+        return false;
+    }
+    for (const char* c = filter; *c != '\0'; c++) {
+        bool levelStart = (c == filter) || (c[-1] == '/');
+        bool levelEnd = (c[1] == '\0') || (c[1] == '/');
+        if (*c == '+' && !(levelStart && levelEnd)) {
+            return false;
+        }
+        // '#' must be the last character and occupy a whole level
+        if (*c == '#' && !(levelStart && c[1] == '\0')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int mqtt_router_add(MqttRouter* pRouter, const char* filter, void* pValue) {
+    if (pValue == NULL || !mqtt_router_is_valid_filter(filter)) {
+        return MQTT_ROUTER_ERROR_INVALID;
+    }
+    if (pRouter->routeCount >= pRouter->maxRoutes) {
+        return MQTT_ROUTER_ERROR_FULL;
+    }
+
+    size_t len = strlen(filter);
+    bool wildcard = (strpbrk(filter, "+#") != NULL);
+    uint32_t hash = hash_topic(filter, len);
+    if (!wildcard && find_exact(pRouter, filter, len, hash) != NULL) {
+        return MQTT_ROUTER_ERROR_DUPLICATE;
+    }
+
+    StoredFilter* pStored = malloc(sizeof(StoredFilter) + len + 1);
+    if (pStored == NULL) {
+        return MQTT_ROUTER_ERROR_OUTOFMEMORY;
+    }
+    memcpy(pStored->text, filter, len + 1);
+    // Linked in before use, trie nodes created on the way point into it even if adding fails
+    pStored->pNext = pRouter->pFilters;
+    pRouter->pFilters = pStored;
+    const char* copy = pStored->text;
+
+    if (wildcard) {
+        int ret = add_wildcard(pRouter, copy, pValue);
+        if (ret != MQTT_ROUTER_SUCCESS) {
+            return ret;
+        }
+        pRouter->wildcardCount++;
+        pRouter->routeCount++;
+        return MQTT_ROUTER_SUCCESS;
+    }
+
+    size_t mask = pRouter->exactCapacity - 1;
+    size_t i = hash & mask;
+    while (pRouter->exact[i].filter != NULL) {
+        i = (i + 1) & mask;
+    }
+    pRouter->exact[i].hash = hash;
+    pRouter->exact[i].filter = copy;
+    pRouter->exact[i].len = len;
+    pRouter->exact[i].pValue = pValue;
+    pRouter->routeCount++;
+    return MQTT_ROUTER_SUCCESS;
+}
+
+static void* find_wildcard(const MqttRouter* pRouter, const char* filter) {
+    const TrieNode* pNode = &pRouter->root;
+    const char* level = filter;
+
+    while (pNode != NULL) {
+        const char* slash = strchr(level, '/');
+        size_t levelLen = (slash != NULL) ? (size_t)(slash - level) : strlen(level);
+
+        if (levelLen == 1 && level[0] == '#') {
+            return pNode->pHashValue;
+        }
+        if (levelLen == 1 && level[0] == '+') {
+            pNode = pNode->pPlus;
+        } else {
+            pNode = find_child(pRouter, pNode, level, levelLen, hash_topic(level, levelLen));
+        }
+        if (slash == NULL) {
+            return (pNode != NULL) ? pNode->pValue : NULL;
+        }
+        level = slash + 1;
+    }
+    return NULL;
+}
+
+// Returns the value registered for exactly this filter, wildcards are compared literally
+void* mqtt_router_find(const MqttRouter* pRouter, const char* filter) {
+    if (strpbrk(filter, "+#") != NULL) {
+        return find_wildcard(pRouter, filter);
+    }
+    size_t len = strlen(filter);
+    const ExactRoute* pRoute = find_exact(pRouter, filter, len, hash_topic(filter, len));
+    return (pRoute != NULL) ? pRoute->pValue : NULL;
+}
+
+/*
+ * Calls match for every filter matching the topic, returns the number of matches.
+ * Topics starting with '$' are not matched by filters starting with a wildcard.
+ */
+size_t mqtt_router_match(const MqttRouter* pRouter, const char* topic, size_t topicLen, mqtt_router_match_t match, void* pArg) {
+    size_t matches = 0;
+
+    const ExactRoute* pRoute = find_exact(pRouter, topic, topicLen, hash_topic(topic, topicLen));
+    if (pRoute != NULL) {
+        match(pRoute->pValue, pArg);
+        matches++;
+    }
+    if (pRouter->wildcardCount == 0 || topicLen == 0) {
+        return matches;
+    }
+
+    if (topic[0] == '$') {
+        // Only exact first levels may match system topics
+        const char* end = topic + topicLen;
+        const char* slash = memchr(topic, '/', topicLen);
+        size_t levelLen = (slash != NULL) ? (size_t)(slash - topic) : topicLen;
+        const TrieNode* pChild = find_child(pRouter, &pRouter->root, topic, levelLen, hash_topic(topic, levelLen));
+        if (pChild == NULL) {
+            return matches;
+        }
+        return matches + match_node(pRouter, pChild, (slash != NULL) ? slash + 1 : end, end, slash == NULL, match, pArg);
+    }
+    return matches + match_node(pRouter, &pRouter->root, topic, topic + topicLen, false, match, pArg);
+}
@@ -0,0 +1,231 @@
+#include "mqtt_spill.h"
+
+#if CONFIG_MQTT_OUTBOX_FLASH_SPILL
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+
+#define SPILL_MAGIC         0x4d514f42  // "MQOB"
+#define SPILL_PENDING       0xffffffff  // erased flash, the record is waiting
+#define SPILL_SENT          0x00000000  // programmed once the record was published
+
+static const char *TAG = "MQTT_SPILL";
+
+// Every record takes a fixed slot: header, then the outbox entry. Slots never cross a sector.
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;       // increases with every record, orders the log after a reboot
+    uint32_t state;
+} spill_header_t;
+
+/*
+ * The partition is a ring of sectors. Records are appended at gWriteSlot and read at gReadSlot,
+ * a sector is only erased when the write position enters it again. The log is full when that
+ * sector still holds the oldest pending record.
+ */
+static const esp_partition_t* gPartition = NULL;
+static size_t gEntrySize = 0;
+static size_t gSlotSize = 0;
+static size_t gSectorSize = 0;
+static uint32_t gSlotsPerSector = 0;
+static uint32_t gSlotCount = 0;
+static uint32_t gReadSlot = 0;  // oldest record that may still be pending
+static uint32_t gWriteSlot = 0; // next slot to write
+static uint32_t gNextSeq = 0;
+static uint32_t gPending = 0;
+
+static size_t slot_offset(uint32_t slot);
+static bool is_blank(uint32_t slot);
+static void mark_sent(uint32_t slot);
+static bool open_sector(uint32_t slot);
+
+// ----- implementation -----
+
+size_t slot_offset(uint32_t slot) {
+    return (slot / gSlotsPerSector) * gSectorSize + (slot % gSlotsPerSector) * gSlotSize;
+}
+
+// True if neither the header nor the start of the entry were written since the last erase
+bool is_blank(uint32_t slot) {
+    uint32_t words[sizeof(spill_header_t) / sizeof(uint32_t) + 1];
+    esp_partition_read(gPartition, slot_offset(slot), words, sizeof(words));
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        if (words[i] != 0xffffffff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void mark_sent(uint32_t slot) {
+    // Programming bits from 1 to 0 needs no erase
+    uint32_t state = SPILL_SENT;
+    esp_partition_write(gPartition, slot_offset(slot) + offsetof(spill_header_t, state), &state, sizeof(state));
+}
+
+// Erases the sector starting at slot, unless it still holds pending records
+bool open_sector(uint32_t slot) {
+    if (gPending > 0 && gReadSlot / gSlotsPerSector == slot / gSlotsPerSector) {
+        return false;
+    }
+    esp_err_t err = esp_partition_erase_range(gPartition, slot_offset(slot), gSectorSize);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to erase sector at slot %" PRIu32 ": %s", slot, esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+/*
+ * @brief Finds the spill partition and the records left from the last boot
+ *
+ *  The write position continues behind the newest record, the read position at the oldest
+ *  pending one. Records with a time to live are discarded, their age is unknown after a reboot.
+ */
+esp_err_t mqtt_spill_init(size_t maxPayload) {
+    gPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, CONFIG_MQTT_OUTBOX_PARTITION_LABEL);
+    if (gPartition == NULL) {
+        ESP_LOGE(TAG, "Partition %s not found, flash spill disabled", CONFIG_MQTT_OUTBOX_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+    gEntrySize = mqtt_outbox_entry_size(maxPayload);
+    gSlotSize = (sizeof(spill_header_t) + gEntrySize + 3) & ~(size_t)3;
+    gSectorSize = gPartition->erase_size;
+    gSlotsPerSector = gSectorSize / gSlotSize;
+    // One sector is always being written, at least one more is needed to erase anything
+    if (gSlotsPerSector == 0 || gPartition->size / gSectorSize < 2) {
+        ESP_LOGE(TAG, "Partition %s too small for the flash spill", CONFIG_MQTT_OUTBOX_PARTITION_LABEL);
+        gPartition = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+    gSlotCount = (gPartition->size / gSectorSize) * gSlotsPerSector;
+
+    bool found = false;
+    uint32_t newestSlot = 0;
+    uint32_t newestSeq = 0;
+    uint32_t oldestSeq = 0;
+    gPending = 0;
+    for (uint32_t slot = 0; slot < gSlotCount; slot++) {
+        spill_header_t header;
+        esp_partition_read(gPartition, slot_offset(slot), &header, sizeof(header));
+        if (header.magic != SPILL_MAGIC) {
+            continue; // erased, interrupted or corrupted, the sector is erased once reused
+        }
+        if (!found || (int32_t)(header.seq - newestSeq) > 0) {
+            newestSlot = slot;
+            newestSeq = header.seq;
+        }
+        found = true;
+        if (header.state != SPILL_PENDING) {
+            continue;
+        }
+        mqtt_outbox_entry_t entry;
+        esp_partition_read(gPartition, slot_offset(slot) + sizeof(header), &entry, sizeof(entry));
+        if (entry.expires_us != 0) {
+            mark_sent(slot);
+            continue;
+        }
+        if (gPending == 0 || (int32_t)(header.seq - oldestSeq) < 0) {
+            gReadSlot = slot;
+            oldestSeq = header.seq;
+        }
+        gPending++;
+    }
+
+    gWriteSlot = 0;
+    gNextSeq = 0;
+    if (found) {
+        gWriteSlot = (newestSlot + 1) % gSlotCount;
+        gNextSeq = newestSeq + 1;
+        // Skip what an interrupted write left behind, a new sector is erased anyway
+        while (gWriteSlot % gSlotsPerSector != 0 && !is_blank(gWriteSlot)) {
+            gWriteSlot = (gWriteSlot + 1) % gSlotCount;
+        }
+    }
+    if (gPending == 0) {
+        gReadSlot = gWriteSlot;
+    }
+    ESP_LOGI(TAG, "%" PRIu32 " slots in %" PRIu32 " sectors, %" PRIu32 " messages pending",
+             gSlotCount, gSlotCount / gSlotsPerSector, gPending);
+    return ESP_OK;
+}
+
+bool mqtt_spill_write(const mqtt_outbox_entry_t* pEntry) {
+    if (gPartition == NULL) {
+        return false;
+    }
+    if (gWriteSlot % gSlotsPerSector == 0 && !open_sector(gWriteSlot)) {
+        return false;
+    }
+    // The header goes last, a record interrupted by a reset is never taken as valid
+    size_t offset = slot_offset(gWriteSlot);
+    spill_header_t header = { .magic = SPILL_MAGIC, .seq = gNextSeq, .state = SPILL_PENDING };
+    if (esp_partition_write(gPartition, offset + sizeof(header), pEntry, sizeof(mqtt_outbox_entry_t) + pEntry->len) != ESP_OK ||
+        esp_partition_write(gPartition, offset, &header, sizeof(header)) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write slot %" PRIu32, gWriteSlot);
+        gWriteSlot = (gWriteSlot + 1) % gSlotCount; // the slot may be partly programmed
+        return false;
+    }
+    if (gPending == 0) {
+        gReadSlot = gWriteSlot;
+    }
+    gWriteSlot = (gWriteSlot + 1) % gSlotCount;
+    gNextSeq++;
+    gPending++;
+    return true;
+}
+
+// Reads the oldest pending record, pEntry must hold mqtt_outbox_entry_size() bytes
+bool mqtt_spill_peek(mqtt_outbox_entry_t* pEntry) {
+    if (gPartition == NULL || gPending == 0) {
+        return false;
+    }
+    // Bounded by the slot count rather than gWriteSlot, both are equal once the log is full
+    for (uint32_t i = 0; i < gSlotCount; i++) {
+        spill_header_t header;
+        size_t offset = slot_offset(gReadSlot);
+        esp_partition_read(gPartition, offset, &header, sizeof(header));
+        if (header.magic == SPILL_MAGIC && header.state == SPILL_PENDING) {
+            return esp_partition_read(gPartition, offset + sizeof(header), pEntry, gEntrySize) == ESP_OK;
+        }
+        gReadSlot = (gReadSlot + 1) % gSlotCount;
+    }
+    return false;
+}
+
+void mqtt_spill_pop(void) {
+    if (gPartition == NULL || gPending == 0) {
+        return;
+    }
+    mark_sent(gReadSlot);
+    gReadSlot = (gReadSlot + 1) % gSlotCount;
+    gPending--;
+}
+
+uint32_t mqtt_spill_count(void) {
+    return gPending;
+}
+
+#else
+
+esp_err_t mqtt_spill_init(size_t maxPayload) {
+    return ESP_OK;
+}
+
+bool mqtt_spill_write(const mqtt_outbox_entry_t* pEntry) {
+    return false;
+}
+
+bool mqtt_spill_peek(mqtt_outbox_entry_t* pEntry) {
+    return false;
+}
+
+void mqtt_spill_pop(void) {
+}
+
+uint32_t mqtt_spill_count(void) {
+    return 0;
+}
+
+#endif
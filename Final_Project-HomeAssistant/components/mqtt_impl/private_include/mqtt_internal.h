@@ -0,0 +1,19 @@
+#ifndef MQTT_INTERNAL_H_
+#define MQTT_INTERNAL_H_
+
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/semphr.h"
+#include "mqtt_impl.h"
+
+// Shared between the source files of the mqtt_impl component, not part of its public interface
+
+esp_err_t mqtt_dispatch_init(void);
+void mqtt_dispatch_message(const topic_callback_t* pEntry, const char* topic, size_t topicLen, const char* data, size_t dataLen);
+void mqtt_dispatch_fragment(const topic_callback_t* pEntry, const char* topic, size_t topicLen, const char* data, size_t dataLen, size_t offset, size_t totalLen);
+void mqtt_dispatch_reset_reassembly(void);
+esp_err_t mqtt_publish_init(esp_mqtt_client_handle_t client);
+void mqtt_publish_set_connected(bool connected);
+esp_err_t mqtt_publisher_init(void);
+
+#endif /* MQTT_INTERNAL_H_ */
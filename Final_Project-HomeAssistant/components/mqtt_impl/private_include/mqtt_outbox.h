@@ -0,0 +1,54 @@
+#ifndef MQTT_OUTBOX_H_
+#define MQTT_OUTBOX_H_
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Ring of messages waiting to be published, oldest first. Free of ESP-IDF includes,
+// so replay order and coalescing can be checked on the host.
+
+#define MQTT_OUTBOX_TOPIC_SIZE          128
+
+#define MQTT_OUTBOX_STORED               0
+#define MQTT_OUTBOX_COALESCED            1  // replaced the queued message of the same topic
+#define MQTT_OUTBOX_ERROR_TOO_LARGE     -1
+
+typedef struct {
+    uint8_t qos;
+    bool retain;
+    bool coalesce;      // only the latest message of the topic matters, e.g. a state
+    uint32_t ttl_ms;    // 0 = never expires
+} mqtt_outbox_options_t;
+
+typedef struct {
+    char topic[MQTT_OUTBOX_TOPIC_SIZE];
+    mqtt_outbox_options_t options;
+    int64_t expires_us; // 0 = never
+    uint32_t seq;       // changes whenever the content changes
+    uint16_t len;
+    uint8_t payload[];
+} mqtt_outbox_entry_t;
+
+typedef struct {
+    uint32_t stored;
+    uint32_t coalesced;
+    uint32_t evicted;   // oldest message pushed out of the full ring
+    uint32_t expired;
+} mqtt_outbox_stats_t;
+
+typedef struct _MqttOutbox_ MqttOutbox;
+
+// Called with the oldest message before it is overwritten, e.g. to move it to flash
+typedef void (*mqtt_outbox_evict_t)(const mqtt_outbox_entry_t* pEntry, void* pArg);
+
+MqttOutbox* mqtt_outbox_create(size_t capacity, size_t maxPayload, mqtt_outbox_evict_t evict, void* pArg);
+void mqtt_outbox_destroy(MqttOutbox* pOutbox);
+size_t mqtt_outbox_entry_size(size_t maxPayload);
+int mqtt_outbox_push(MqttOutbox* pOutbox, const char* topic, const uint8_t* payload, size_t len, const mqtt_outbox_options_t* pOptions, int64_t now_us);
+const mqtt_outbox_entry_t* mqtt_outbox_peek(MqttOutbox* pOutbox, int64_t now_us);
+bool mqtt_outbox_pop(MqttOutbox* pOutbox, uint32_t seq);
+size_t mqtt_outbox_count(const MqttOutbox* pOutbox);
+void mqtt_outbox_get_stats(const MqttOutbox* pOutbox, mqtt_outbox_stats_t* pStats);
+
+#endif /* MQTT_OUTBOX_H_ */
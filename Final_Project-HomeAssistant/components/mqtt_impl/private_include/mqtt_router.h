@@ -0,0 +1,28 @@
+#ifndef MQTT_ROUTER_H_
+#define MQTT_ROUTER_H_
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Maps MQTT topic filters to values. Exact filters live in a hash table, filters with
+// '+' or '#' in a trie of topic levels. Free of ESP-IDF includes, so it can be checked on the host.
+
+#define MQTT_ROUTER_SUCCESS              0
+#define MQTT_ROUTER_ERROR_INVALID       -1
+#define MQTT_ROUTER_ERROR_FULL          -2
+#define MQTT_ROUTER_ERROR_DUPLICATE     -3
+#define MQTT_ROUTER_ERROR_OUTOFMEMORY   -4
+
+typedef struct _MqttRouter_ MqttRouter;
+
+typedef void (*mqtt_router_match_t)(void* pValue, void* pArg);
+
+MqttRouter* mqtt_router_create(size_t maxRoutes);
+void mqtt_router_destroy(MqttRouter* pRouter);
+int mqtt_router_add(MqttRouter* pRouter, const char* filter, void* pValue);
+void* mqtt_router_find(const MqttRouter* pRouter, const char* filter);
+size_t mqtt_router_match(const MqttRouter* pRouter, const char* topic, size_t topicLen, mqtt_router_match_t match, void* pArg);
+bool mqtt_router_is_valid_filter(const char* filter);
+
+#endif /* MQTT_ROUTER_H_ */
@@ -0,0 +1,17 @@
+#ifndef MQTT_SPILL_H_
+#define MQTT_SPILL_H_
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "mqtt_outbox.h"
+
+// Log of outbox messages in a flash partition, used once the RAM ring is full.
+// All functions must be called with the outbox lock held.
+
+esp_err_t mqtt_spill_init(size_t maxPayload);
+bool mqtt_spill_write(const mqtt_outbox_entry_t* pEntry);
+bool mqtt_spill_peek(mqtt_outbox_entry_t* pEntry);
+void mqtt_spill_pop(void);
+uint32_t mqtt_spill_count(void);
+
+#endif /* MQTT_SPILL_H_ */
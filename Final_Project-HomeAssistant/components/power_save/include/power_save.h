@@ -0,0 +1,36 @@
+#ifndef POWER_SAVE_H
+#define POWER_SAVE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "esp_log.h"
+#include "driver/gpio.h"
+#include "sdkconfig.h"
+
+#define POWER_SAVE_LISTEN_INTERVAL      CONFIG_POWER_SAVE_LISTEN_INTERVAL
+#define POWER_SAVE_SAMPLE_PERIOD_MS     CONFIG_POWER_SAVE_SAMPLE_PERIOD_MS
+#define POWER_SAVE_BATCH_SIZE           CONFIG_POWER_SAVE_BATCH_SIZE
+#define POWER_SAVE_BURST_TAIL_MS        300 // stay awake after the last acknowledgement, for the TCP ACKs
+#define POWER_SAVE_BURST_TIMEOUT_MS     5000 // ends a burst whose acknowledgement never arrives, e.g. offline
+#define POWER_SAVE_MIN_CPU_FREQ_MHZ     40  // XTAL frequency, the lowest clock without a PLL
+
+/*
+ * Energy proxies. Radio-on time counts only the bursts, in which modem sleep is shortened to
+ * every DTIM. The beacon wake-ups of WIFI_PS_MAX_MODEM in between are not included.
+ */
+typedef struct {
+    uint32_t bursts;
+    uint32_t wakes;         // sensor wake-ups, each may end a light sleep
+    int64_t radio_on_us;
+    int64_t uptime_us;
+    bool light_sleep;       // automatic light sleep is active
+} power_save_metrics_t;
+
+esp_err_t power_save_init(void);
+esp_err_t power_save_enable_gpio_wakeup(gpio_num_t gpio);
+void power_save_burst_begin(void);
+void power_save_burst_end(void);
+void power_save_count_wake(void);
+void power_save_get_metrics(power_save_metrics_t* pMetrics);
+
+#endif // POWER_SAVE_H
@@ -0,0 +1,151 @@
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "power_save.h"
+
+static const char *TAG = "POWER_SAVE";
+
+static SemaphoreHandle_t gLock = NULL; // guards the metrics and the burst state, also taken by the tail timer
+static power_save_metrics_t gMetrics = { 0 };
+static int64_t gBurstStart_us = 0;  // 0 = no burst running
+static esp_timer_handle_t gTailTimer = NULL;
+static esp_pm_lock_handle_t gNoSleepLock = NULL;
+
+static void configure_light_sleep(void);
+static void end_burst(void* arg);
+
+// ----- implementation -----
+
+void configure_light_sleep(void) {
+#if CONFIG_POWER_SAVE_LIGHT_SLEEP
+    const esp_pm_config_t config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = POWER_SAVE_MIN_CPU_FREQ_MHZ,
+        .light_sleep_enable = true,
+    };
+    esp_err_t err = esp_pm_configure(&config);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Light sleep not available: %s", esp_err_to_name(err));
+        return;
+    }
+    // Held during bursts, light sleep would stall the transmission
+    if (esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "burst", &gNoSleepLock) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to create power management lock");
+    }
+    gMetrics.light_sleep = true;
+#endif
+}
+
+// The tail after the last burst is over, back to sleeping through most beacons
+void end_burst(void* arg) {
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    if (gBurstStart_us != 0) {
+        esp_wifi_set_ps(WIFI_PS_MAX_MODEM);
+        if (gNoSleepLock != NULL) {
+            esp_pm_lock_release(gNoSleepLock);
+        }
+        gMetrics.radio_on_us += esp_timer_get_time() - gBurstStart_us;
+        gBurstStart_us = 0;
+    }
+    xSemaphoreGive(gLock);
+}
+
+/*
+ * @brief Puts the modem to sleep between bursts
+ *
+ *  The station only wakes for every POWER_SAVE_LISTEN_INTERVAL-th beacon. Messages from the
+ *  broker are delayed by up to that many beacon intervals, about 100 ms each.
+ *  Must be called after the Wi-Fi driver was started.
+ */
+esp_err_t power_save_init(void) {
+    gLock = xSemaphoreCreateMutex();
+    if (gLock == NULL) {
+        ESP_LOGE(TAG, "Failed to create lock");
+        return ESP_ERR_NO_MEM;
+    }
+    const esp_timer_create_args_t timerArgs = {
+        .callback = end_burst,
+        .name = "burst_tail",
+    };
+    if (esp_timer_create(&timerArgs, &gTailTimer) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create burst timer");
+        return ESP_FAIL;
+    }
+    configure_light_sleep();
+
+    esp_err_t err = esp_wifi_set_ps(WIFI_PS_MAX_MODEM);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to enable modem sleep: %s", esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG, "Power save enabled, listen interval %d, light sleep %s", POWER_SAVE_LISTEN_INTERVAL, gMetrics.light_sleep ? "on" : "off");
+    return ESP_OK;
+}
+
+/*
+ * @brief Lets a button wake the chip from light sleep
+ *
+ *  Only level interrupts wake from light sleep, and the wakeup shares the interrupt type of
+ *  the pin. The level opposite to the current one is armed here, the button ISR flips it on
+ *  every change, so both presses and releases wake the chip and a held button fires once.
+ */
+esp_err_t power_save_enable_gpio_wakeup(gpio_num_t gpio) {
+    esp_err_t err = gpio_wakeup_enable(gpio, gpio_get_level(gpio) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+    if (err == ESP_OK) {
+        err = esp_sleep_enable_gpio_wakeup();
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to enable wakeup on GPIO %d: %s", gpio, esp_err_to_name(err));
+    }
+    return err;
+}
+
+/*
+ * @brief Keeps the radio awake while a batch is sent
+ *
+ *  Bursts that follow each other before the tail ran out are merged. WIFI_PS_NONE is
+ *  not allowed while Bluetooth shares the radio, so bursts use WIFI_PS_MIN_MODEM.
+ *  The burst lasts until power_save_burst_end(), at most POWER_SAVE_BURST_TIMEOUT_MS.
+ */
+void power_save_burst_begin(void) {
+    esp_timer_stop(gTailTimer); // fails harmlessly if it is not running
+
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    if (gBurstStart_us == 0) {
+        if (gNoSleepLock != NULL) {
+            esp_pm_lock_acquire(gNoSleepLock);
+        }
+        esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
+        gBurstStart_us = esp_timer_get_time();
+    }
+    gMetrics.bursts++;
+    xSemaphoreGive(gLock);
+    esp_timer_start_once(gTailTimer, POWER_SAVE_BURST_TIMEOUT_MS * 1000);
+}
+
+// Call once the broker acknowledged the burst, each call starts the tail again
+void power_save_burst_end(void) {
+    esp_timer_stop(gTailTimer);
+    esp_timer_start_once(gTailTimer, POWER_SAVE_BURST_TAIL_MS * 1000);
+}
+
+void power_save_count_wake(void) {
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    gMetrics.wakes++;
+    xSemaphoreGive(gLock);
+}
+
+void power_save_get_metrics(power_save_metrics_t* pMetrics) {
+    int64_t now_us = esp_timer_get_time();
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    *pMetrics = gMetrics;
+    if (gBurstStart_us != 0) {
+        pMetrics->radio_on_us += now_us - gBurstStart_us;
+    }
+    xSemaphoreGive(gLock);
+    pMetrics->uptime_us = now_us;
+}
@@ -37,6 +37,20 @@
 #define WIFI_SCAN_AUTH_MODE_THRESHOLD WIFI_AUTH_WAPI_PSK
 #endif
 
-esp_err_t staticwifi_init(void);
+#define WIFI_CACHE_NAMESPACE    "wifi_cache"
+#define WIFI_CACHE_KEY          "ap"
+#define WIFI_CACHE_VERSION      1
+
+// Last successful connection, stored in NVS for fast reconnects
+typedef struct {
+    uint8_t version;
+    uint8_t channel;
+    uint8_t bssid[6];
+    esp_netif_ip_info_t ip_info;
+    esp_ip4_addr_t dns;
+} wifi_cache_t;
+
+esp_err_t staticwifi_start(void);
+esp_err_t staticwifi_connect(void);
 
 #endif /* MAIN_WIFISTATION_H_ */
\ No newline at end of file
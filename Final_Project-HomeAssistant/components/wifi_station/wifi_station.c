@@ -1,37 +1,73 @@
 #include "wifi_station.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "esp_timer.h"
+#include "nvs.h"
 
 static const char *TAG = "WIFI_STATION";
 
 static esp_ip4_addr_t gIPAddr;
 static esp_netif_t *gpNetIF = NULL;
-static TaskHandle_t wifi_notify_task = NULL;
+static int64_t gConnectStartUs = 0;
+
+#if CONFIG_WIFI_FAST_CONNECT
+static wifi_cache_t gCache;
+static bool gCacheValid = false;
+static bool gFastAttempt = false; // the running attempt goes to the cached access point
+#endif
 
 static void staticwifi_shutdown(void);
 static esp_netif_t *wifi_start(void);
 static void wifi_stop(void);
 static void on_wifi_disconnect(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
 static void on_got_ip(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+#if CONFIG_WIFI_FAST_CONNECT
+static void load_cache(void);
+static void store_cache(const esp_netif_ip_info_t *ip_info);
+static void forget_cache(void);
+static void apply_connect_config(void);
+#endif
 
-esp_err_t staticwifi_init() {
+/*
+ * @brief Starts the Wi-Fi driver without connecting
+ *
+ *  Connecting and reconnecting is left to the caller, see staticwifi_connect().
+ */
+esp_err_t staticwifi_start() {
     ESP_LOGI(TAG, "Setting up static WIFI");
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
-    wifi_notify_task = xTaskGetCurrentTaskHandle();
     gpNetIF = wifi_start();
     ESP_ERROR_CHECK(esp_register_shutdown_handler(&staticwifi_shutdown));
+#if CONFIG_WIFI_FAST_CONNECT
+    load_cache();
+#endif
+    return ESP_OK;
+}
 
-    // Wait for IP (timeout 10 seconds)
-    uint32_t notified = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10000));
-    if (notified == 0) {
-        ESP_LOGW(TAG, "WiFi connection timeout");
-        return ESP_FAIL;
+/*
+ * @brief Starts one connection attempt, the result arrives as IP_EVENT_STA_GOT_IP or WIFI_EVENT_STA_DISCONNECTED
+ *
+ *  With fast connect, the attempt goes straight to the access point and channel of the last
+ *  successful connection. If that attempt did not get an address, the cache is dropped and
+ *  this attempt scans all channels.
+ */
+esp_err_t staticwifi_connect() {
+#if CONFIG_WIFI_FAST_CONNECT
+    if (gFastAttempt) {
+        ESP_LOGW(TAG, "Cached access point not reachable, scanning all channels");
+        forget_cache();
     }
-
-    ESP_LOGI(TAG, "Static WIFI initialized\n");
-    return ESP_OK;
+    apply_connect_config();
+#endif
+    ESP_LOGI(TAG, "Connecting to %s...", WIFI_SSID);
+    gConnectStartUs = esp_timer_get_time();
+    esp_err_t err = esp_wifi_connect();
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to connect: %s", esp_err_to_name(err));
+    }
+    return err;
 }
 
 void staticwifi_shutdown() {
@@ -61,13 +97,14 @@ esp_netif_t *wifi_start() {
             .threshold.authmode = WIFI_SCAN_AUTH_MODE_THRESHOLD,
             .sae_pwe_h2e = WIFI_SAE_MODE,
             .sae_h2e_identifier = H2E_IDENTIFIER,
+#if CONFIG_POWER_SAVE_MODE
+            .listen_interval = CONFIG_POWER_SAVE_LISTEN_INTERVAL,
+#endif
         },
     };
-    ESP_LOGI(TAG, "Connecting to %s...", wifi_config.sta.ssid);
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
     ESP_ERROR_CHECK(esp_wifi_start());
-    esp_wifi_connect();
     return netif;
 }
 
@@ -88,20 +125,120 @@ static void wifi_stop(void) {
     gpNetIF = NULL;
 }
 
+// Reconnecting is up to the connectivity manager, which backs off between attempts
 void on_wifi_disconnect(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
-    ESP_LOGW(TAG, "Wi-Fi disconnected, trying to reconnect...");
-    esp_err_t err = esp_wifi_connect();
-    if (err == ESP_ERR_WIFI_NOT_STARTED) {
-        return;
-    }
-    ESP_ERROR_CHECK(err);
+    wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
+    ESP_LOGW(TAG, "Wi-Fi disconnected, reason %d", event->reason);
 }
 
 static void on_got_ip(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
     ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
     ESP_LOGI(TAG, "Got IPv4 event: Interface \"%s\" address: " IPSTR, esp_netif_get_desc(event->esp_netif), IP2STR(&event->ip_info.ip));
     memcpy(&gIPAddr, &event->ip_info.ip, sizeof(gIPAddr));
-    if (wifi_notify_task) {
-        xTaskNotifyGive(wifi_notify_task);
+
+    int64_t now_us = esp_timer_get_time();
+#if CONFIG_WIFI_FAST_CONNECT
+    const char *mode = gFastAttempt ? "cached access point" : "scan";
+    gFastAttempt = false;
+    store_cache(&event->ip_info);
+#else
+    const char *mode = "scan";
+#endif
+    ESP_LOGI(TAG, "Got IP %" PRId64 " ms after connecting (%s), %" PRId64 " ms after boot",
+             (now_us - gConnectStartUs) / 1000, mode, now_us / 1000);
+}
+
+#if CONFIG_WIFI_FAST_CONNECT
+void load_cache(void) {
+    nvs_handle_t handle;
+    if (nvs_open(WIFI_CACHE_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return; // nothing cached yet
     }
-}
\ No newline at end of file
+    size_t size = sizeof(gCache);
+    esp_err_t err = nvs_get_blob(handle, WIFI_CACHE_KEY, &gCache, &size);
+    nvs_close(handle);
+
+    gCacheValid = (err == ESP_OK && size == sizeof(gCache) && gCache.version == WIFI_CACHE_VERSION);
+    if (gCacheValid) {
+        ESP_LOGI(TAG, "Cached access point " MACSTR " on channel %d", MAC2STR(gCache.bssid), gCache.channel);
+    }
+}
+
+// Only written if something changed, a reconnect to the same access point costs no flash write
+void store_cache(const esp_netif_ip_info_t *ip_info) {
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+        return;
+    }
+    wifi_cache_t cache;
+    memset(&cache, 0, sizeof(cache));
+    cache.version = WIFI_CACHE_VERSION;
+    cache.channel = ap.primary;
+    memcpy(cache.bssid, ap.bssid, sizeof(cache.bssid));
+    cache.ip_info = *ip_info;
+    esp_netif_dns_info_t dns;
+    if (esp_netif_get_dns_info(gpNetIF, ESP_NETIF_DNS_MAIN, &dns) == ESP_OK) {
+        cache.dns = dns.ip.u_addr.ip4;
+    }
+    if (gCacheValid && memcmp(&cache, &gCache, sizeof(cache)) == 0) {
+        return;
+    }
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(WIFI_CACHE_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, WIFI_CACHE_KEY, &cache, sizeof(cache));
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to cache access point: %s", esp_err_to_name(err));
+        return;
+    }
+    gCache = cache;
+    gCacheValid = true;
+}
+
+void forget_cache(void) {
+    gCacheValid = false;
+    gFastAttempt = false;
+    nvs_handle_t handle;
+    if (nvs_open(WIFI_CACHE_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+        nvs_erase_key(handle, WIFI_CACHE_KEY);
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+}
+
+// Points the station config at the cached access point, or back at a scan of all channels
+void apply_connect_config(void) {
+    wifi_config_t wifi_config;
+    ESP_ERROR_CHECK(esp_wifi_get_config(WIFI_IF_STA, &wifi_config));
+    if (gCacheValid) {
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, gCache.bssid, sizeof(gCache.bssid));
+        wifi_config.sta.channel = gCache.channel;
+    } else {
+        wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+        wifi_config.sta.bssid_set = false;
+        wifi_config.sta.channel = 0;
+    }
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+    gFastAttempt = gCacheValid;
+
+#if CONFIG_WIFI_FAST_CONNECT_STATIC_IP
+    if (gCacheValid) {
+        // The address is reported as IP_EVENT_STA_GOT_IP as soon as the station is connected
+        esp_netif_dhcpc_stop(gpNetIF);
+        ESP_ERROR_CHECK(esp_netif_set_ip_info(gpNetIF, &gCache.ip_info));
+        esp_netif_dns_info_t dns = { .ip.type = ESP_IPADDR_TYPE_V4, .ip.u_addr.ip4 = gCache.dns };
+        esp_netif_set_dns_info(gpNetIF, ESP_NETIF_DNS_MAIN, &dns);
+    } else {
+        esp_netif_dhcpc_start(gpNetIF); // returns an error if it is running already
+    }
+#endif
+}
+#endif
\ No newline at end of file
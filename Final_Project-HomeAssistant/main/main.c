@@ -3,25 +3,61 @@
 #include <stdlib.h>
 #include <inttypes.h>
 #include <nvs_flash.h>
+#include <nvs.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "esp_log.h"
-#include "cJSON.h"
 
 #include "led.h"
-#include "wifi_station.h"
+#include "connectivity.h"
 #include "mqtt_impl.h"
 #include "buttons.h"
 #include "potentiometer.h"
+#include "ha_json.h"
+#include "ha_discovery.h"
+#include "ringbuffer.h"
+#include "power_save.h"
 
 #define TASKS_STACKSIZE        4096
 #define TASKS_PRIORITY            3
 
 #define MQTT_TOPIC_BUTTON           "button"
 #define MQTT_TOPIC_POTENTIOMETER    "potentiometer"
+#define MQTT_TOPIC_POTENTIOMETER_BATCH "potentiometer/batch"
 #define MQTT_TOPIC_LED_SET          "led/set"
 #define MQTT_TOPIC_LED_STATE        "led/state"
+#define MQTT_TOPIC_LED_PIXELS       "led/pixels"
+
+// Publish policy per topic, the full topics are built once at registration
+typedef struct {
+    const char* topic;
+    mqtt_publish_policy_t policy;
+    MqttPublisher* pPublisher;
+} topic_policy_t;
+
+enum {
+    PUBLISH_LED_STATE,
+    PUBLISH_BUTTON,
+    PUBLISH_POTENTIOMETER,
+#if CONFIG_POWER_SAVE_MODE
+    PUBLISH_POTENTIOMETER_BATCH,
+#endif
+    PUBLISH_COUNT
+};
+
+static topic_policy_t gPublishPolicies[PUBLISH_COUNT] = {
+    // Retained, so Home Assistant knows the state after a restart. Slider drags settle before publishing.
+    [PUBLISH_LED_STATE] = { MQTT_TOPIC_LED_STATE, { .options = { .qos = 1, .retain = true, .coalesce = true }, .coalesce_window_ms = 100 } },
+    // A button press replayed much later would trigger automations at the wrong time
+    [PUBLISH_BUTTON] = { MQTT_TOPIC_BUTTON, { .options = { .qos = 1, .ttl_ms = 30000 } } },
+    // The next reading follows shortly, a lost one needs no acknowledgement
+    [PUBLISH_POTENTIOMETER] = { MQTT_TOPIC_POTENTIOMETER, { .options = { .qos = 0, .coalesce = true }, .min_interval_ms = 250 } },
+#if CONFIG_POWER_SAVE_MODE
+    // Every batch holds different readings, none may replace another
+    [PUBLISH_POTENTIOMETER_BATCH] = { MQTT_TOPIC_POTENTIOMETER_BATCH, { .options = { .qos = 1 } } },
+#endif
+};
 
 TaskHandle_t gButtonTask_handle = NULL;
 TaskHandle_t gPotentiometerTask_handle = NULL;
@@ -34,66 +70,76 @@ TaskHandle_t gPotentiometerTask_handle = NULL;
 //     "g": 180,
 //     "b": 200
 //   },
+//   "brightness": 255,
+//   "transition": 2.5,
 //   "state": "ON"
 // }
 
+void publish_led_state(void) {
+    current_led_state_t current_state = get_current_led_state();
+    ha_light_state_t state = {
+        .state = current_state.state,
+        .brightness = current_state.brightness,
+        .r = current_state.color.r,
+        .g = current_state.color.g,
+        .b = current_state.color.b,
+    };
+
+    char json_str[HA_JSON_MAX_MESSAGE_SIZE];
+    int len = ha_json_write_light_state(json_str, sizeof(json_str), &state);
+    if (len < 0) {
+        ESP_LOGE("LED", "LED state does not fit into %d bytes", HA_JSON_MAX_MESSAGE_SIZE);
+        return;
+    }
+    mqtt_publisher_send(gPublishPolicies[PUBLISH_LED_STATE].pPublisher, (uint8_t*)json_str, len);
+}
+
 void mqtt_led_control_callback(const char *topic, const char *payload) {
-    cJSON *root = cJSON_Parse(payload);
-    if (!root) return;
+    ha_light_command_t command;
+    uint32_t present;
+    if (ha_json_parse_light_command(payload, strlen(payload), &command, &present) != JSON_SUCCESS) {
+        ESP_LOGW("LED", "Invalid LED command: %s", payload);
+        return;
+    }
+
+    current_led_state_t target = get_current_led_state();
 
     // Handle color
-    cJSON *color = cJSON_GetObjectItem(root, "color");
-    if (color) {
-        cJSON *r = cJSON_GetObjectItem(color, "r");
-        cJSON *g = cJSON_GetObjectItem(color, "g");
-        cJSON *b = cJSON_GetObjectItem(color, "b");
-        if (r && g && b) {
-            int led_r = r->valueint;
-            int led_g = g->valueint;
-            int led_b = b->valueint;
-            fill_led_strip(led_r, led_g, led_b);
-        }
+    if ((present & HA_LIGHT_COMMAND_COLOR) == HA_LIGHT_COMMAND_COLOR) {
+        target.color.r = command.r;
+        target.color.g = command.g;
+        target.color.b = command.b;
     }
 
     // Handle brightness
-    cJSON *brightness = cJSON_GetObjectItem(root, "brightness");
-    if (brightness) {
-        int led_brightness = brightness->valueint;
-        adjust_led_brightness(led_brightness);
+    if (present & HA_LIGHT_COMMAND_BRIGHTNESS) {
+        target.brightness = command.brightness;
     }
 
     // Handle state (ON/OFF)
-    cJSON *state = cJSON_GetObjectItem(root, "state");
-    if (state && cJSON_IsString(state)) {
-        char *state_str = strdup(state->valuestring);
-        if (strcmp(state_str, "OFF") == 0) {
-            toogle_led(false);
-        } else {
-            toogle_led(true);
-        }
+    if (present & HA_LIGHT_COMMAND_STATE) {
+        target.state = !json_string_equals(command.state, "OFF");
     }
 
-    cJSON_Delete(root);
-
-    // Publish new state back to MQTT
-    current_led_state_t current_state = get_current_led_state();
+    // Handle transition, Home Assistant sends it in seconds
+    uint32_t transition_ms = 0;
+    if ((present & HA_LIGHT_COMMAND_TRANSITION) && command.transition > 0) { // false for NaN as well
+        transition_ms = (command.transition < LED_TRANSITION_MAX_MS / 1000.0f)
+                        ? (uint32_t)(command.transition * 1000) : LED_TRANSITION_MAX_MS;
+    }
 
-    cJSON *root_obj = cJSON_CreateObject();
-    cJSON_AddStringToObject(root_obj, "state", current_state.state ? "ON" : "OFF");
-    cJSON_AddNumberToObject(root_obj, "brightness", current_state.brightness);
+    // The fade itself runs on the LED transition task
+    led_set_state(target, transition_ms);
 
-    cJSON *color_obj = cJSON_CreateObject();
-    cJSON_AddNumberToObject(color_obj, "r", current_state.color.r);
-    cJSON_AddNumberToObject(color_obj, "g", current_state.color.g);
-    cJSON_AddNumberToObject(color_obj, "b", current_state.color.b);
-    cJSON_AddItemToObject(root_obj, "color", color_obj);
+    // Publish new state back to MQTT
+    publish_led_state();
+}
 
-    char *led_state_str = cJSON_PrintUnformatted(root_obj);
-    mqtt_sendpayload(MQTT_TOPIC_LED_STATE, (uint8_t*)led_state_str, strlen(led_state_str));
+// Binary frame, see led_frame.h:
+// [type][payload...], type 0 = raw RGB array, 1 = index/RGB deltas, 2 = segment fill
 
-    // Clean up
-    free(led_state_str);
-    cJSON_Delete(root_obj);
+void mqtt_led_pixels_callback(const char *topic, const uint8_t *payload, size_t payloadLen) {
+    led_apply_frame(payload, payloadLen);
 }
 
 // ########## button ##########
@@ -104,13 +150,12 @@ void mqtt_led_control_callback(const char *topic, const char *payload) {
 // }
 
 void publish_button_event(uint8_t gpio_num, uint8_t event) {
-    cJSON *root = cJSON_CreateObject();
-    cJSON_AddNumberToObject(root, "gpio", gpio_num);
-    cJSON_AddStringToObject(root, "event_type", event == BUTTON_PRESSED ? "press" : "release");
-    char *json_str = cJSON_PrintUnformatted(root);
-    mqtt_sendpayload(MQTT_TOPIC_BUTTON, (uint8_t*)json_str, strlen(json_str));
-    free(json_str);
-    cJSON_Delete(root);
+    char json_str[HA_JSON_MAX_MESSAGE_SIZE];
+    int len = ha_json_write_button_event(json_str, sizeof(json_str), gpio_num, event == BUTTON_PRESSED);
+    if (len < 0) {
+        return;
+    }
+    mqtt_publisher_send(gPublishPolicies[PUBLISH_BUTTON].pPublisher, (uint8_t*)json_str, len);
 }
 
 void button_task(void *arguments) {
@@ -134,14 +179,65 @@ void button_task(void *arguments) {
 // }
 
 void publish_potentiometer_event(uint8_t brightness) {
-    cJSON *root = cJSON_CreateObject();
-    cJSON_AddNumberToObject(root, "value", brightness);
-    char *json_str = cJSON_PrintUnformatted(root);
-    mqtt_sendpayload(MQTT_TOPIC_POTENTIOMETER, (uint8_t*)json_str, strlen(json_str));
-    free(json_str);
-    cJSON_Delete(root);
+    char json_str[HA_JSON_MAX_MESSAGE_SIZE];
+    int len = ha_json_write_sensor_value(json_str, sizeof(json_str), brightness);
+    if (len < 0) {
+        return;
+    }
+    mqtt_publisher_send(gPublishPolicies[PUBLISH_POTENTIOMETER].pPublisher, (uint8_t*)json_str, len);
 }
 
+#if CONFIG_POWER_SAVE_MODE
+// {"period_ms":500,"values":[12,13,15]}
+void publish_potentiometer_batch(RingbufferHandle samples) {
+    uint8_t values[POWER_SAVE_BATCH_SIZE];
+    size_t count = 0;
+    while (count < POWER_SAVE_BATCH_SIZE && ringbuffer_get(samples, &values[count], count)) {
+        count++;
+    }
+    ringbuffer_clear(samples);
+
+    char json_str[MQTT_OUTBOX_MESSAGE_SIZE];
+    int len = ha_json_write_sensor_batch(json_str, sizeof(json_str), values, count, POWER_SAVE_SAMPLE_PERIOD_MS);
+    if (len < 0) {
+        return;
+    }
+    // Ends with the acknowledgement of the batch, mqtt_publisher_send() only hands it on
+    power_save_burst_begin();
+    mqtt_publisher_send(gPublishPolicies[PUBLISH_POTENTIOMETER_BATCH].pPublisher, (uint8_t*)json_str, len);
+    publish_potentiometer_event(values[count - 1]);
+
+    power_save_metrics_t metrics;
+    power_save_get_metrics(&metrics);
+    ESP_LOGD("POTENTIOMETER", "Burst %" PRIu32 ", %" PRIu32 " wakes, radio on %" PRId64 " of %" PRId64 " ms",
+             metrics.bursts, metrics.wakes, metrics.radio_on_us / 1000, metrics.uptime_us / 1000);
+}
+
+// The batch is the last QoS 1 message of a burst, any later acknowledgement only extends the tail
+void mqtt_published_callback(int msgId) {
+    power_save_burst_end();
+}
+
+// Readings collect in a ring buffer while the modem sleeps and are sent in one burst
+void potentiometer_task(void *arg) {
+    RingbufferHandle samples = ringbuffer_create(POWER_SAVE_BATCH_SIZE, sizeof(uint8_t));
+    if (samples < 0) {
+        ESP_LOGE("POTENTIOMETER", "Failed to create sample buffer");
+        vTaskDelete(NULL);
+        return;
+    }
+    TickType_t lastWake = xTaskGetTickCount();
+    while (true) {
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(POWER_SAVE_SAMPLE_PERIOD_MS));
+        power_save_count_wake();
+        uint8_t brightness = potentiometer_read_uint8();
+        ringbuffer_add(samples, &brightness);
+        if (ringbuffer_isFull(samples)) {
+            publish_potentiometer_batch(samples);
+        }
+    }
+}
+#else
 void potentiometer_task(void *arg) {
     while (true) {
         uint8_t brightness = potentiometer_read_uint8();
@@ -149,6 +245,125 @@ void potentiometer_task(void *arg) {
         vTaskDelay(pdMS_TO_TICKS(500));
     }
 }
+#endif
+
+// ########## discovery ##########
+// Entities of this device, the discovery configs are generated from this registry
+
+#if CONFIG_HA_DISCOVERY
+
+#define HA_STATUS_TOPIC     CONFIG_HA_DISCOVERY_PREFIX "/status"
+
+// The configs must fit an outbox slot, or they get lost whenever the broker is not reachable
+_Static_assert(MQTT_OUTBOX_MESSAGE_SIZE >= HA_DISCOVERY_MAX_CONFIG_SIZE, "CONFIG_MQTT_OUTBOX_MESSAGE_SIZE too small for the discovery configs");
+
+typedef struct {
+    ha_entity_t entity;             // topics without prefix
+    char topic[HA_DISCOVERY_MAX_TOPIC_SIZE];
+    char config[HA_DISCOVERY_MAX_CONFIG_SIZE];
+    int len;
+} discovery_entry_t;
+
+static const ha_device_t gDevice = {
+    .identifier = CONFIG_HA_DEVICE_ID,
+    .name = CONFIG_HA_DEVICE_NAME,
+    .manufacturer = "lossphilipp",
+    .model = CONFIG_IDF_TARGET,
+};
+
+static const char* const gButtonEventTypes[] = { "press", "release" };
+
+static discovery_entry_t gDiscovery[] = {
+    { .entity = { .type = HA_ENTITY_LIGHT, .objectId = "light", .name = "ESP32 Light", .entityId = "esp32_light",
+                  .stateTopic = MQTT_TOPIC_LED_STATE, .commandTopic = MQTT_TOPIC_LED_SET } },
+    { .entity = { .type = HA_ENTITY_EVENT, .objectId = "button", .name = "ESP32 Button", .entityId = "esp32_button", .stateTopic = MQTT_TOPIC_BUTTON,
+                  .deviceClass = "button", .eventTypes = gButtonEventTypes, .eventTypeCount = 2 } },
+#if CONFIG_POTENTIOMETER_ACTIVE
+    { .entity = { .type = HA_ENTITY_SENSOR, .objectId = "potentiometer", .name = "ESP32 Potentiometer", .entityId = "esp32_potentiometer",
+                  .stateTopic = MQTT_TOPIC_POTENTIOMETER, .valueTemplate = "{{ value_json.value }}" } },
+#endif
+};
+
+#define DISCOVERY_COUNT     (sizeof(gDiscovery) / sizeof(gDiscovery[0]))
+
+// Generates all discovery messages once, returns a hash over them to detect registry changes
+uint32_t build_discovery(void) {
+    uint32_t hash = 0;
+    for (size_t i = 0; i < DISCOVERY_COUNT; i++) {
+        discovery_entry_t* pEntry = &gDiscovery[i];
+        char stateTopic[HA_DISCOVERY_MAX_TOPIC_SIZE];
+        char commandTopic[HA_DISCOVERY_MAX_TOPIC_SIZE];
+        ha_entity_t entity = pEntry->entity;
+
+        mqtt_get_full_topic(entity.stateTopic, stateTopic, sizeof(stateTopic));
+        entity.stateTopic = stateTopic;
+        if (entity.commandTopic != NULL) {
+            mqtt_get_full_topic(entity.commandTopic, commandTopic, sizeof(commandTopic));
+            entity.commandTopic = commandTopic;
+        }
+
+        pEntry->len = ha_discovery_write_config(pEntry->config, sizeof(pEntry->config), &gDevice, &entity);
+        if (ha_discovery_write_topic(pEntry->topic, sizeof(pEntry->topic), CONFIG_HA_DISCOVERY_PREFIX, &gDevice, &entity) < 0 || pEntry->len < 0) {
+            ESP_LOGE("DISCOVERY", "Config of %s does not fit", entity.objectId);
+            pEntry->len = -1;
+            continue;
+        }
+        hash = ha_discovery_hash(hash, pEntry->topic, strlen(pEntry->topic));
+        hash = ha_discovery_hash(hash, pEntry->config, pEntry->len);
+    }
+    return hash;
+}
+
+bool publish_discovery(void) {
+    // Queued while offline, only the latest config of each entity is replayed
+    const mqtt_publish_options_t options = { .qos = 1, .retain = true, .coalesce = true };
+    bool success = true;
+    for (size_t i = 0; i < DISCOVERY_COUNT; i++) {
+        if (gDiscovery[i].len < 0 ||
+            mqtt_publish_full_topic(gDiscovery[i].topic, (uint8_t*)gDiscovery[i].config, gDiscovery[i].len, &options) != ESP_OK) {
+            success = false;
+        }
+    }
+    ESP_LOGI("DISCOVERY", "Published %d discovery configs", (int)DISCOVERY_COUNT);
+    return success;
+}
+
+// Home Assistant lost the retained configs if it comes online without them, e.g. after a broker restart
+void mqtt_ha_status_callback(const char *topic, const char *payload) {
+    if (strcmp(payload, "online") == 0) {
+        publish_discovery();
+    }
+}
+
+/*
+ * @brief Publishes the discovery configs if they changed since the last boot
+ *
+ *  The configs are retained by the broker, so unchanged ones are not sent again
+ *  on every boot or reconnect.
+ */
+void init_discovery(void) {
+    uint32_t hash = build_discovery();
+    uint32_t publishedHash = 0;
+    nvs_handle_t handle;
+    if (nvs_open("ha_discovery", NVS_READWRITE, &handle) != ESP_OK) {
+        ESP_LOGE("DISCOVERY", "Failed to open NVS");
+        publish_discovery();
+    } else {
+        nvs_get_u32(handle, "hash", &publishedHash);
+        if (publishedHash != hash) {
+            if (publish_discovery()) {
+                nvs_set_u32(handle, "hash", hash);
+                nvs_commit(handle);
+            }
+        } else {
+            ESP_LOGI("DISCOVERY", "Discovery configs unchanged");
+        }
+        nvs_close(handle);
+    }
+    mqtt_subscribe_full_topic_callback(HA_STATUS_TOPIC, mqtt_ha_status_callback);
+}
+
+#endif
 
 // ########## main ##########
 
@@ -166,19 +381,45 @@ void app_main(void)
 {
     init_nvs();
 
-    staticwifi_init();
+    // Wi-Fi and MQTT come up in the background, messages published until then wait in the outbox
+    ESP_ERROR_CHECK(connectivity_start());
     led_init();
     buttons_init();
+#if CONFIG_POWER_SAVE_MODE
+    ESP_ERROR_CHECK(power_save_init());
+    mqtt_set_published_callback(mqtt_published_callback);
+#if CONFIG_POTENTIOMETER_ACTIVE
+    power_save_enable_gpio_wakeup(BUTTON_GPIO);
+#else
+    power_save_enable_gpio_wakeup(BUTTON_GPIO_LEFT);
+    power_save_enable_gpio_wakeup(BUTTON_GPIO_RIGHT);
+#endif
+#endif
     potentiometer_init();
-    mqtt_init();
+    for (int i = 0; i < PUBLISH_COUNT; i++) {
+        gPublishPolicies[i].pPublisher = mqtt_publisher_register(gPublishPolicies[i].topic, &gPublishPolicies[i].policy);
+    }
 
     xTaskCreate(button_task, "button_task", TASKS_STACKSIZE, NULL, TASKS_PRIORITY, &gButtonTask_handle);
     xTaskCreate(potentiometer_task, "potentiometer_task", TASKS_STACKSIZE, NULL, TASKS_PRIORITY, &gPotentiometerTask_handle);
 
     mqtt_subscribe_callback(MQTT_TOPIC_LED_SET, mqtt_led_control_callback);
+    mqtt_subscribe_binary_callback(MQTT_TOPIC_LED_PIXELS, mqtt_led_pixels_callback);
+    // Commands from Home Assistant must not get lost, pixel frames are superseded by the next one anyway
+    mqtt_set_topic_dispatch(MQTT_TOPIC_LED_SET, MQTT_PRIORITY_HIGH, MQTT_OVERFLOW_BLOCK);
+    mqtt_set_topic_dispatch(MQTT_TOPIC_LED_PIXELS, MQTT_PRIORITY_NORMAL, MQTT_OVERFLOW_DROP_OLDEST);
 
     ESP_LOGI("CONFIGURATION", "Tasks created, start program...");
 
+    connectivity_wait_online(portMAX_DELAY);
+    connectivity_metrics_t metrics;
+    connectivity_get_metrics(&metrics);
+    ESP_LOGI("CONFIGURATION", "Online after %" PRId64 " ms, Wi-Fi after %" PRId64 " ms",
+             metrics.boot_to_online_us / 1000, metrics.boot_to_wifi_us / 1000);
+#if CONFIG_HA_DISCOVERY
+    init_discovery();
+#endif
+
     // Prevent app_main from exiting
     while (true) {
         vTaskDelay(portMAX_DELAY);
@@ -0,0 +1,365 @@
+#include <string.h>
+
+#include "ICM42688P.h"
+
+static const char *TAG = "ICM42688P";
+
+static const ICM42688P_transport_t* gTransport = NULL;
+static uint32_t gPeriod_us = 0;
+static size_t gPacketSize = ICM42688P_FIFO_ACCEL_PACKET;
+static uint8_t gFifoBuffer[ICM42688P_FIFO_BURST_SIZE];
+
+// Shadow of the bank 0 registers written so far, config changes need no read back
+static uint8_t gShadow[ICM42688P_SHADOW_SIZE];
+static uint8_t gShadowValid[ICM42688P_SHADOW_SIZE / 8];
+static uint8_t gBank = 0;
+
+static void wait_ms(uint32_t ms);
+static bool is_cacheable(uint8_t reg);
+static bool is_cached(uint8_t reg);
+static void shadow_store(uint8_t reg, uint8_t value);
+static bool read_who_am_i(void);
+static esp_err_t start_fifo(uint8_t odr, bool gyro);
+static size_t fifo_read_burst(size_t maxPackets);
+static size_t fifo_read_packets(size_t packets);
+
+// ----- implementation -----
+
+// vTaskDelay() rounds down to whole ticks, the extra tick makes sure at least ms pass
+void wait_ms(uint32_t ms) {
+    vTaskDelay(pdMS_TO_TICKS(ms) + 1);
+}
+
+// Self clearing registers and the other banks are never cached
+bool is_cacheable(uint8_t reg) {
+    return gBank == 0 && reg < ICM42688P_SHADOW_SIZE
+        && reg != ICM42688P_DEVICE_CONFIG && reg != ICM42688P_SIGNAL_PATH_RESET;
+}
+
+bool is_cached(uint8_t reg) {
+    return is_cacheable(reg) && (gShadowValid[reg / 8] & (1 << (reg % 8)));
+}
+
+void shadow_store(uint8_t reg, uint8_t value) {
+    if (reg == ICM42688P_REG_BANK_SEL) {
+        gBank = value & 0x07;
+    } else if (reg == ICM42688P_DEVICE_CONFIG && (value & ICM42688P_SOFT_RESET)) {
+        ICM42688P_invalidate_shadow();
+    } else if (is_cacheable(reg)) {
+        gShadow[reg] = value;
+        gShadowValid[reg / 8] |= 1 << (reg % 8);
+    }
+}
+
+void ICM42688P_invalidate_shadow(void) {
+    memset(gShadowValid, 0, sizeof(gShadowValid));
+    gBank = 0;
+}
+
+/*
+ * @brief Connects the driver to a bus and resets the sensor
+ *
+ * @return ESP_OK, or ESP_ERR_NOT_FOUND if the sensor does not identify itself
+ */
+esp_err_t ICM42688P_init(const ICM42688P_transport_t* pTransport) {
+    gTransport = pTransport;
+    ICM42688P_invalidate_shadow();
+    ICM42688P_reset();
+
+    ESP_LOGD(TAG, "Accelerometer configured, trying to read WHO AM I...");
+    return read_who_am_i() ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+bool read_who_am_i(void) {
+    uint8_t id = 0;
+    ICM42688P_read_data(ICM42688P_WHO_AM_I, &id, 1);
+
+    if (id == ICM42688P_WHO_AM_I_VALUE) {
+        ESP_LOGD(TAG, "gyro responds, ID ok");
+        return true;
+    } else {
+        ESP_LOGD(TAG, "gyro responds, but wrong ID! ID: %X", id);
+        return false;
+    }
+}
+
+esp_err_t ICM42688P_read_data(uint8_t start_reg, uint8_t* pData, size_t length) {
+    if (gTransport == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = gTransport->read(gTransport->ctx, start_reg, pData, length);
+    ESP_LOGV(TAG, "got data from ICM42688! start reg: %X", start_reg);
+    return err;
+}
+
+esp_err_t ICM42688P_write_data(uint16_t reg_value) {
+    if (gTransport == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint8_t reg = reg_value >> 8;
+    uint8_t value = reg_value & 0xFF;
+    esp_err_t err = gTransport->write(gTransport->ctx, reg, value);
+    if (err != ESP_OK) {
+        return err;
+    }
+    shadow_store(reg, value);
+
+    ESP_LOGD(TAG, "Wrote 0x%02X to register 0x%02X", value, reg);
+    return ESP_OK;
+}
+
+/*
+ * @brief Writes a sequence of registers in one bus submission, if the transport supports it
+ *
+ *  Values are (register << 8) | value.
+ */
+esp_err_t ICM42688P_write_batch(const uint16_t* regValues, size_t count) {
+    if (gTransport == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = gTransport->write_many(gTransport->ctx, regValues, count);
+    if (err != ESP_OK) {
+        ICM42688P_invalidate_shadow(); // unknown how many writes made it
+        return err;
+    }
+    for (size_t i = 0; i < count; i++) {
+        shadow_store(regValues[i] >> 8, regValues[i] & 0xFF);
+    }
+    ESP_LOGD(TAG, "Wrote %d registers", (int)count);
+    return ESP_OK;
+}
+
+/*
+ * @brief Changes the bits of mask in a register
+ *
+ *  Registers written before come from the shadow, only the write goes to the bus. The write is
+ *  skipped if nothing changes.
+ */
+esp_err_t ICM42688P_update_register(uint8_t reg, uint8_t mask, uint8_t value) {
+    uint8_t current;
+    if (is_cached(reg)) {
+        current = gShadow[reg];
+    } else {
+        esp_err_t err = ICM42688P_read_data(reg, &current, 1);
+        if (err != ESP_OK) {
+            return err;
+        }
+        shadow_store(reg, current);
+    }
+
+    uint8_t updated = (current & ~mask) | (value & mask);
+    if (updated == current && is_cacheable(reg)) {
+        return ESP_OK;
+    }
+    return ICM42688P_write_data((reg << 8) | updated);
+}
+
+void ICM42688P_reset() {
+    static const uint16_t config[] = {
+        ICM42688P_CONFIG_ODR,
+        ICM42688P_CONFIG_MODE,
+        ICM42688P_CONFIG_APEX,
+        ICM42688P_CONFIG_GYRO,
+        ICM42688P_CONFIG_DMP_RESET,
+    };
+    ICM42688P_write_data(ICM42688P_CONFIG_RESET);
+    wait_ms(1); // no register access for 1 ms after the soft reset
+    ICM42688P_write_batch(config, sizeof(config) / sizeof(config[0]));
+    wait_ms(1); // According to datasheet
+    ICM42688P_write_data(ICM42688P_CONFIG_DMP_INIT);
+    // ICM42688P_write_data(ICM42688P_CONFIG_BANK); // Would create interrupt on step
+}
+
+// Low byte first, unlike the sample registers
+uint16_t ICM42688P_read_steps() {
+    uint8_t data[2] = { 0 };
+    ICM42688P_read_data(ICM42688P_STEPS_OUT_L, data, 2);
+
+    return (uint16_t)((data[1] << 8) | data[0]);
+}
+
+// All six bytes in one transaction, so x, y and z belong to the same sample
+void ICM42688P_read_movement(measurement_t *measurement) {
+    uint8_t data[6];
+    if (ICM42688P_read_data(ICM42688P_ACCEL_XOUT_H, data, sizeof(data)) != ESP_OK) {
+        return;
+    }
+
+    measurement->movement.x = (int16_t)((data[0] << 8) | data[1]);
+    measurement->movement.y = (int16_t)((data[2] << 8) | data[3]);
+    measurement->movement.z = (int16_t)((data[4] << 8) | data[5]);
+}
+
+measurement_t ICM42688P_read_all() {
+    measurement_t measurement;
+
+    measurement.steps = ICM42688P_read_steps();
+    ICM42688P_read_movement(&measurement);
+
+    ESP_LOGV(TAG, "Read the following data:\nSteps: %d\nX: %d\nY: %d\nZ: %d", measurement.steps, measurement.movement.x, measurement.movement.y, measurement.movement.z);
+
+    return measurement;
+}
+
+void ICM42688P_start_measurement() {
+    ICM42688P_update_register(ICM42688P_APEX_CONFIG0, ICM42688P_PED_ENABLE, ICM42688P_PED_ENABLE);
+}
+
+void ICM42688P_stop_measurement() {
+    ICM42688P_update_register(ICM42688P_APEX_CONFIG0, ICM42688P_PED_ENABLE, 0);
+}
+
+// Both sensors run at the same rate, the FIFO then holds 16 byte packets with both samples
+esp_err_t start_fifo(uint8_t odr, bool gyro) {
+    const uint16_t power[] = {
+        (ICM42688P_ACCEL_CONFIG0 << 8) | ICM42688P_ACCEL_FS_4G | odr,
+        (ICM42688P_GYRO_CONFIG0 << 8) | ICM42688P_GYRO_FS_2000DPS | odr,
+        (ICM42688P_PWR_MGMT0 << 8) | ICM42688P_PWR_ACCEL_LN | (gyro ? ICM42688P_PWR_GYRO_LN : 0),
+    };
+    const uint16_t fifo[] = {
+        (ICM42688P_INTF_CONFIG0 << 8) | ICM42688P_INTF_BIG_ENDIAN,
+        (ICM42688P_FIFO_CONFIG1 << 8) | ICM42688P_FIFO_ACCEL_EN | (gyro ? ICM42688P_FIFO_GYRO_EN : 0),
+        (ICM42688P_FIFO_CONFIG << 8) | ICM42688P_FIFO_MODE_STREAM,
+        (ICM42688P_SIGNAL_PATH_RESET << 8) | ICM42688P_FIFO_FLUSH,
+    };
+    gPeriod_us = ICM42688P_odr_period_us(odr);
+    gPacketSize = gyro ? ICM42688P_FIFO_IMU_PACKET : ICM42688P_FIFO_ACCEL_PACKET;
+    esp_err_t err = ICM42688P_write_batch(power, sizeof(power) / sizeof(power[0]));
+    // no register writes for 200 us after a mode change, the gyroscope needs longer to start
+    wait_ms(gyro ? ICM42688P_GYRO_STARTUP_MS : 1);
+    err = (err == ESP_OK) ? ICM42688P_write_batch(fifo, sizeof(fifo) / sizeof(fifo[0])) : err;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start FIFO streaming");
+        return err;
+    }
+    ESP_LOGI(TAG, "FIFO streaming started%s", gyro ? " with gyroscope" : "");
+    return ESP_OK;
+}
+
+/*
+ * @brief Streams accelerometer samples through the hardware FIFO
+ *
+ *  The FIFO holds up to 256 samples, ICM42688P_fifo_read() has to be called before it overflows,
+ *  e.g. every 200 ms at 1 kHz.
+ */
+esp_err_t ICM42688P_fifo_start(uint8_t odr) {
+    return start_fifo(odr, false);
+}
+
+/*
+ * @brief Streams accelerometer and gyroscope samples through the hardware FIFO
+ *
+ *  The FIFO holds up to ICM42688P_FIFO_MAX_IMU_SAMPLES, e.g. 128 ms at 1 kHz. Read them with
+ *  ICM42688P_imu_read(), the accelerometer ring of ICM42688P_fifo_read() keeps working too.
+ */
+esp_err_t ICM42688P_imu_start(uint8_t odr) {
+    return start_fifo(odr, true);
+}
+
+esp_err_t ICM42688P_fifo_stop(void) {
+    return ICM42688P_write_data((ICM42688P_FIFO_CONFIG << 8) | ICM42688P_FIFO_MODE_BYPASS);
+}
+
+uint32_t ICM42688P_fifo_period_us(void) {
+    return gPeriod_us;
+}
+
+/*
+ * @brief Reads FIFO_COUNT
+ *
+ * @return number of complete packets waiting in the FIFO, -1 if the count could not be read
+ */
+int ICM42688P_fifo_count(void) {
+    uint8_t count[2];
+    if (ICM42688P_read_data(ICM42688P_FIFO_COUNTH, count, sizeof(count)) != ESP_OK) {
+        return -1;
+    }
+    size_t length = (count[0] << 8) | count[1];
+    return (int)(length / gPacketSize); // a partial packet is read again next time
+}
+
+// Reads up to maxPackets complete packets into gFifoBuffer, returns the number of bytes
+size_t fifo_read_burst(size_t maxPackets) {
+    int available = ICM42688P_fifo_count();
+    if (available <= 0) {
+        return 0;
+    }
+    return fifo_read_packets(((size_t)available < maxPackets) ? (size_t)available : maxPackets);
+}
+
+// Reads packets counted before into gFifoBuffer, returns the number of bytes
+size_t fifo_read_packets(size_t packets) {
+    size_t length = packets * gPacketSize;
+    if (length > ICM42688P_FIFO_BURST_SIZE) {
+        length = ICM42688P_FIFO_BURST_SIZE - ICM42688P_FIFO_BURST_SIZE % gPacketSize;
+    }
+    if (length == 0) {
+        return 0;
+    }
+
+    esp_err_t err = ICM42688P_read_data(ICM42688P_FIFO_DATA, gFifoBuffer, length);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "FIFO burst read failed: %d", err);
+        return 0;
+    }
+    ESP_LOG_BUFFER_HEX_LEVEL(TAG, gFifoBuffer, length, ESP_LOG_VERBOSE);
+    return length;
+}
+
+/*
+ * @brief Reads all complete packets in the FIFO with a single burst into the ring
+ *
+ *  The raw FIFO bytes are logged at verbose level, so dumps can be captured for the parser.
+ *  Only one task may drain the FIFO at a time.
+ *
+ * @return number of samples added
+ */
+int ICM42688P_fifo_drain(ICM42688P_ring_t* pRing, ICM42688P_fifo_stats_t* pStats, const ICM42688P_fifo_clock_t* pClock) {
+    int available = ICM42688P_fifo_count();
+    return (available > 0) ? ICM42688P_fifo_drain_packets(pRing, available, pStats, pClock) : 0;
+}
+
+/*
+ * @brief Reads packets counted with ICM42688P_fifo_count() with a single burst into the ring
+ *
+ *  For callers that need the count before they can date the packets.
+ *
+ * @return number of samples added
+ */
+int ICM42688P_fifo_drain_packets(ICM42688P_ring_t* pRing, size_t packets, ICM42688P_fifo_stats_t* pStats, const ICM42688P_fifo_clock_t* pClock) {
+    size_t length = fifo_read_packets(packets);
+    uint32_t samples = pStats->samples;
+    ICM42688P_fifo_parse(gFifoBuffer, length, pRing, pStats, pClock);
+    return (int)(pStats->samples - samples);
+}
+
+/*
+ * @brief Reads up to maxSamples accelerometer and gyroscope samples, started by ICM42688P_imu_start()
+ *
+ *  Samples beyond maxSamples stay in the FIFO for the next call.
+ *
+ * @return number of samples stored in pSamples
+ */
+int ICM42688P_fifo_drain_imu(ICM42688P_imu_sample_t* pSamples, size_t maxSamples, ICM42688P_fifo_stats_t* pStats, const ICM42688P_fifo_clock_t* pClock) {
+    size_t length = fifo_read_burst(maxSamples);
+    size_t count = 0;
+    ICM42688P_fifo_parse_imu(gFifoBuffer, length, pSamples, maxSamples, &count, pStats, pClock);
+    return (int)count;
+}
+
+// Accelerometer and gyroscope registers in one burst, timestamp_us is left at 0
+esp_err_t ICM42688P_read_imu(ICM42688P_imu_sample_t* pSample) {
+    uint8_t data[12];
+    esp_err_t err = ICM42688P_read_data(ICM42688P_ACCEL_XOUT_H, data, sizeof(data));
+    if (err != ESP_OK) {
+        return err;
+    }
+    pSample->accel.x = (int16_t)((data[0] << 8) | data[1]);
+    pSample->accel.y = (int16_t)((data[2] << 8) | data[3]);
+    pSample->accel.z = (int16_t)((data[4] << 8) | data[5]);
+    pSample->gyro.x = (int16_t)((data[6] << 8) | data[7]);
+    pSample->gyro.y = (int16_t)((data[8] << 8) | data[9]);
+    pSample->gyro.z = (int16_t)((data[10] << 8) | data[11]);
+    pSample->timestamp_us = 0;
+    return ESP_OK;
+}
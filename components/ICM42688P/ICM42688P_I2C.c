@@ -8,11 +8,32 @@ static const char *TAG = "ICM42688P";
 #define I2C_MASTER_SCL_IO CONFIG_I2C_MASTER_SCL_IO
 #define I2C_MASTER_BITRATE CONFIG_I2C_MASTER_BITRATE
 
-#define ICM42688P_I2C_ADDRESS               0x80   // This is most likely wrong
-
-i2c_port_t i2c_port = I2C_NUM_0;
-
-static void initI2C(i2c_port_t i2c_num) {
+#define ICM42688P_I2C_TIMEOUT_MS 20      // on top of the wire time, for clock stretching and the driver
+#define ICM42688P_I2C_CLOCKS_PER_BYTE 9  // 8 data bits and the acknowledge
+
+static i2c_port_t i2c_port = I2C_NUM_0;
+
+static TickType_t transfer_timeout(size_t bytes);
+static esp_err_t i2c_read(void* ctx, uint8_t reg, uint8_t* pData, size_t length);
+static esp_err_t i2c_write(void* ctx, uint8_t reg, uint8_t value);
+static esp_err_t i2c_write_many(void* ctx, const uint16_t* regValues, size_t count);
+
+static const ICM42688P_transport_t gI2cTransport = {
+    .ctx = NULL,
+    .read = i2c_read,
+    .write = i2c_write,
+    .write_many = i2c_write_many,
+};
+
+// ----- implementation -----
+
+/*
+ * @brief Sets up the I2C master the sensor is connected to
+ *
+ * @return the transport for ICM42688P_init(), NULL on failure
+ */
+const ICM42688P_transport_t* ICM42688P_i2c_init(int i2cPort) {
+    i2c_port = i2cPort;
     i2c_config_t conf = {
         .mode = I2C_MODE_MASTER,
         .sda_io_num = I2C_MASTER_SDA_IO,
@@ -22,96 +43,75 @@ static void initI2C(i2c_port_t i2c_num) {
         .master.clk_speed = I2C_MASTER_BITRATE
     };
 
-    i2c_param_config(i2c_num, &conf);
-    ESP_ERROR_CHECK(i2c_driver_install(i2c_num, conf.mode, 0, 0, 0));
+    i2c_param_config(i2c_port, &conf);
+    esp_err_t err = i2c_driver_install(i2c_port, conf.mode, 0, 0, 0);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to install I2C driver: %s", esp_err_to_name(err));
+        return NULL;
+    }
+
+    ESP_LOGD(TAG, "I2C connection initialized");
+    return &gI2cTransport;
+}
 
-    ESP_LOGD(TAG, "I2C connection initialized"); 
+/*
+ * @brief Timeout of a transaction with bytes on the wire, including the address bytes
+ *
+ *  A full FIFO burst takes 46 ms at 400 kHz and 184 ms at 100 kHz, a fixed timeout either cuts
+ *  it off or waits far too long for a single register.
+ */
+TickType_t transfer_timeout(size_t bytes) {
+    uint64_t wire_ms = ((uint64_t)bytes * ICM42688P_I2C_CLOCKS_PER_BYTE * 1000 + I2C_MASTER_BITRATE - 1) / I2C_MASTER_BITRATE;
+    return pdMS_TO_TICKS(ICM42688P_I2C_TIMEOUT_MS + 2 * wire_ms) + 1;
 }
 
-static void ICM42688P_writeRegister(uint16_t command) {
-    uint8_t writeCmd[2] = {command >> 8, command & 0xFF};
-    //ESP_ERROR_CHECK(i2c_master_write_to_device(i2c_port, ICM42688P_I2C_ADDRESS, writeCmd, 2, pdMS_TO_TICKS(50)));
-    esp_err_t err = i2c_master_write_to_device(i2c_port, ICM42688P_I2C_ADDRESS, writeCmd, 2, pdMS_TO_TICKS(50));
+// Register address and data in one transaction, with a repeated start in between
+esp_err_t i2c_read(void* ctx, uint8_t reg, uint8_t* pData, size_t length) {
+    esp_err_t err = i2c_master_write_read_device(i2c_port, ICM42688P_I2C_ADDRESS, &reg, 1, pData, length, transfer_timeout(length + 3));
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to write to register: %s", esp_err_to_name(err));
+        ESP_LOGE(TAG, "Failed to read from register: %s", esp_err_to_name(err));
     }
+    return err;
 }
 
-static void ICM42688P_readRegister(uint8_t readBuffer[6]) {
-    //ESP_ERROR_CHECK(i2c_master_read_from_device(i2c_port, ICM42688P_I2C_ADDRESS, readBuffer, 6, pdMS_TO_TICKS(50)));
-    esp_err_t err = i2c_master_read_from_device(i2c_port, ICM42688P_I2C_ADDRESS, readBuffer, 6, pdMS_TO_TICKS(50));
+esp_err_t i2c_write(void* ctx, uint8_t reg, uint8_t value) {
+    uint8_t writeCmd[2] = { reg, value };
+    esp_err_t err = i2c_master_write_to_device(i2c_port, ICM42688P_I2C_ADDRESS, writeCmd, 2, transfer_timeout(3));
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to read from register: %s", esp_err_to_name(err));
+        ESP_LOGE(TAG, "Failed to write to register: %s", esp_err_to_name(err));
     }
+    return err;
 }
 
-void ICM42688P_reset() {
-    ICM42688P_writeRegister(ICM42688P_CONFIG_RESET);
-    ICM42688P_writeRegister(ICM42688P_CONFIG_ODR);
-    ICM42688P_writeRegister(ICM42688P_CONFIG_MODE);
-    ICM42688P_writeRegister(ICM42688P_CONFIG_APEX);
-    ICM42688P_writeRegister(ICM42688P_CONFIG_DMP_RESET);
-    vTaskDelay(1 / portTICK_PERIOD_MS); // According to datasheet
-    ICM42688P_writeRegister(ICM42688P_CONFIG_DMP_INIT);
-    // ICM42688P_writeRegister(ICM42688P_CONFIG_BANK); // Would create interrupt on step
+// All writes go into one command link, the driver runs them without returning in between
+esp_err_t i2c_write_many(void* ctx, const uint16_t* regValues, size_t count) {
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    if (cmd == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (size_t i = 0; i < count; i++) {
+        i2c_master_start(cmd);
+        i2c_master_write_byte(cmd, (ICM42688P_I2C_ADDRESS << 1) | I2C_MASTER_WRITE, true);
+        i2c_master_write_byte(cmd, regValues[i] >> 8, true);
+        i2c_master_write_byte(cmd, regValues[i] & 0xFF, true);
+    }
+    i2c_master_stop(cmd);
+    esp_err_t err = i2c_master_cmd_begin(i2c_port, cmd, transfer_timeout(count * 3));
+    i2c_cmd_link_delete(cmd);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write %d registers: %s", (int)count, esp_err_to_name(err));
+    }
+    return err;
 }
 
+#if CONFIG_ICM42688P_INTERFACE_I2C
 void configure_accelerometer() {
-    initI2C(i2c_port);
-    ICM42688P_reset();
+    const ICM42688P_transport_t* pTransport = ICM42688P_i2c_init(I2C_NUM_0);
+    if (pTransport == NULL || ICM42688P_init(pTransport) != ESP_OK) {
+        ESP_LOGE(TAG, "Gyroscope configuration failed, exiting...");
+        return;
+    }
 
     ESP_LOGD(TAG, "Accelerometer configured");
 }
-
-uint16_t ICM42688P_read_steps() {
-    uint8_t readBuffer[6];
-    ICM42688P_writeRegister(ICM42688P_STEPS_OUT_L);
-    ICM42688P_readRegister(readBuffer);
-    return (readBuffer[0] << 8) | readBuffer[1];
-}
-
-uint16_t ICM42688P_read_movementX() {
-    uint8_t readBuffer[6];
-    ICM42688P_writeRegister(ICM42688P_ACCEL_XOUT_H);
-    ICM42688P_readRegister(readBuffer);
-    return (readBuffer[0] << 8) | readBuffer[1];
-}
-
-uint16_t ICM42688P_read_movementY() {
-    uint8_t readBuffer[6];
-    ICM42688P_writeRegister(ICM42688P_ACCEL_YOUT_H);
-    ICM42688P_readRegister(readBuffer);
-    return (readBuffer[0] << 8) | readBuffer[1];
-}
-
-uint16_t ICM42688P_read_movementZ() {
-    uint8_t readBuffer[6];
-    ICM42688P_writeRegister(ICM42688P_ACCEL_ZOUT_H);
-    ICM42688P_readRegister(readBuffer);
-    return (readBuffer[0] << 8) | readBuffer[1];
-}
-
-void ICM42688P_read_movement(measurement_t *measurement) {
-    measurement->movement.x = ICM42688P_read_movementX();
-    measurement->movement.y = ICM42688P_read_movementY();
-    measurement->movement.z = ICM42688P_read_movementZ();
-}
-
-measurement_t ICM42688P_read_all() {
-    measurement_t measurement;
-    
-    measurement.steps = ICM42688P_read_steps();
-    ICM42688P_read_movement(&measurement);
-
-    ESP_LOGD(TAG, "\nSteps: %d\nX: %d\nY: %d\nZ: %d", measurement.steps, measurement.movement.x, measurement.movement.y, measurement.movement.z); 
-
-    return measurement;
-}
-
-void ICM42688P_start_measurement() {
-    ICM42688P_writeRegister(ICM42688P_PEDOMETER_ENABLE);
-}
-
-void ICM42688P_stop_measurement() {
-    ICM42688P_writeRegister(ICM42688P_PEDOMETER_DISABLE);
-}
\ No newline at end of file
+#endif
@@ -1,5 +1,8 @@
+#include <string.h>
 #include "driver/gpio.h"
 #include "driver/spi_master.h"
+#include "esp_heap_caps.h"
+#include "freertos/semphr.h"
 
 #include "ICM42688P.h"
 
@@ -8,23 +11,49 @@ static const char *TAG = "ICM42688P";
 #define ICM42688P_SPI_ADDRESS     0x80
 #define ICM42688P_SPI_MSB_CLEAR   0x7F
 
-spi_device_interface_config_t spiDeviceConfig = { 0 };
-spi_device_handle_t spiDeviceHandle;
+static spi_device_interface_config_t spiDeviceConfig = { 0 };
+static spi_device_handle_t spiDeviceHandle;
 
-void initSPI(spi_host_device_t spiHost) {
+// Serializes bus accesses, so queued batches from different tasks do not collect each other's results
+static SemaphoreHandle_t gSpiLock = NULL;
+
+// DMA capable buffers for FIFO bursts, command byte plus a full FIFO
+static uint8_t* gBurstTx = NULL;
+static uint8_t* gBurstRx = NULL;
+
+static esp_err_t transmit_single(spi_transaction_t* pTransaction);
+static esp_err_t spi_read(void* ctx, uint8_t reg, uint8_t* pData, size_t length);
+static esp_err_t spi_write(void* ctx, uint8_t reg, uint8_t value);
+static esp_err_t spi_write_many(void* ctx, const uint16_t* regValues, size_t count);
+
+static const ICM42688P_transport_t gSpiTransport = {
+    .ctx = NULL,
+    .read = spi_read,
+    .write = spi_write,
+    .write_many = spi_write_many,
+};
+
+// ----- implementation -----
+
+/*
+ * @brief Sets up the SPI bus and the sensor device on it
+ *
+ * @return the transport for ICM42688P_init(), NULL on failure
+ */
+const ICM42688P_transport_t* ICM42688P_spi_init(int spiHost) {
     printf("init SPI\n");
     spi_bus_config_t bus_cfg = {
-        .mosi_io_num = 4,
-        .miso_io_num = 7,
-        .sclk_io_num = 10,
+        .mosi_io_num = CONFIG_ICM42688P_SPI_MOSI_IO,
+        .miso_io_num = CONFIG_ICM42688P_SPI_MISO_IO,
+        .sclk_io_num = CONFIG_ICM42688P_SPI_SCLK_IO,
         .quadwp_io_num = GPIO_NUM_NC,
         .quadhd_io_num = GPIO_NUM_NC,
-        .max_transfer_sz = 0 // DMA default
+        .max_transfer_sz = 1 + ICM42688P_FIFO_BURST_SIZE
     };
     esp_err_t res = spi_bus_initialize(spiHost, &bus_cfg, SPI_DMA_CH_AUTO);
     if (res != ESP_OK) {
         ESP_LOGE(TAG, "spi_bus_initialize() FAILED: %d!", res);
-        return;
+        return NULL;
     } else {
         ESP_LOGD(TAG, "spi_bus_initialize() OK");
     }
@@ -35,175 +64,151 @@ void initSPI(spi_host_device_t spiHost) {
     spiDeviceConfig.duty_cycle_pos = 128;
     spiDeviceConfig.mode = 0; // CPOL = 0, CPHA = 0
     spiDeviceConfig.clock_source = SPI_CLK_SRC_DEFAULT;
-    spiDeviceConfig.clock_speed_hz = 500000; // 500 kbit/s
-    spiDeviceConfig.spics_io_num = GPIO_NUM_1;
+    spiDeviceConfig.clock_speed_hz = CONFIG_ICM42688P_SPI_CLOCK_HZ;
+    spiDeviceConfig.spics_io_num = CONFIG_ICM42688P_SPI_CS_IO;
     spiDeviceConfig.flags = 0; //SPI_DEVICE_HALFDUPLEX | SPI_DEVICE_NO_DUMMY;
-    spiDeviceConfig.queue_size = 3;
+    spiDeviceConfig.queue_size = ICM42688P_SPI_QUEUE_SIZE;
     spiDeviceConfig.cs_ena_posttrans = 3;
-    spi_bus_add_device(spiHost, &spiDeviceConfig, &spiDeviceHandle);
-}
-
-uint8_t ICM42688P_read_single_reg(uint8_t reg) {
-    spi_transaction_t spiTransaction = { 0 };
-
-    uint8_t cmd[2];
-    cmd[0] = reg | ICM42688P_SPI_ADDRESS;
-    cmd[1] = 0xFF; // second byte, for response transmit
-
-    uint8_t rcv[2];
-
-    rcv[0] = 0xCC;
-    rcv[1] = 0xCC;
-
-    spiTransaction.length = 8 * 2; // 8 bit send, 8 bit receive, only the register
-    spiTransaction.rxlength = 0;
-    spiTransaction.flags = 0; // SPI_TRANS_CS_KEEP_ACTIVE;
-    spiTransaction.tx_buffer = &cmd;
-    spiTransaction.rx_buffer = &rcv;
-
-    esp_err_t ret = spi_device_transmit(spiDeviceHandle, &spiTransaction);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "SPI transmission failed: %d", ret);
-        return ESP_FAIL;
+    res = spi_bus_add_device(spiHost, &spiDeviceConfig, &spiDeviceHandle);
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "spi_bus_add_device() FAILED: %d!", res);
+        return NULL;
     }
 
-    ESP_LOGV(TAG, "got data from ICM42688: %X %X", rcv[0], rcv[1]);
-    return rcv[1];
+    gSpiLock = xSemaphoreCreateMutex();
+    gBurstTx = heap_caps_calloc(1, 1 + ICM42688P_FIFO_BURST_SIZE, MALLOC_CAP_DMA);
+    gBurstRx = heap_caps_calloc(1, 1 + ICM42688P_FIFO_BURST_SIZE, MALLOC_CAP_DMA);
+    if (gSpiLock == NULL || gBurstTx == NULL || gBurstRx == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate SPI buffers");
+        return NULL;
+    }
+    ESP_LOGI(TAG, "SPI clock %d Hz", CONFIG_ICM42688P_SPI_CLOCK_HZ);
+    return &gSpiTransport;
 }
 
-bool read_who_am_i(){
-    uint8_t ret = ICM42688P_read_single_reg(0x75);
-
-    if (ret == 0x47) { // see datasheet
-        ESP_LOGD(TAG, "gyro responds, ID ok");
-        return true;
-    } else {
-        ESP_LOGD(TAG, "gyro responds, but wrong ID! ID: %X", ret);
-        return false;
+/*
+ * @brief Runs a short register access
+ *
+ *  Polled instead of interrupt driven, for a few bytes the busy wait is shorter than the
+ *  interrupt and the task switch.
+ */
+esp_err_t transmit_single(spi_transaction_t* pTransaction) {
+    xSemaphoreTake(gSpiLock, portMAX_DELAY);
+    esp_err_t ret = spi_device_polling_transmit(spiDeviceHandle, pTransaction);
+    xSemaphoreGive(gSpiLock);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "SPI transmission failed: %d", ret);
     }
+    return ret;
 }
 
-esp_err_t ICM42688P_read_data(uint8_t start_reg, uint8_t* pData, size_t length) {
+/*
+ * @brief Reads length consecutive registers in one transaction
+ *
+ *  The sensor clocks out the first register while receiving the second byte, the byte received
+ *  during the command is dropped. Long reads such as FIFO bursts go through the DMA buffers and
+ *  are interrupt driven, a full FIFO takes milliseconds at low clocks.
+ */
+esp_err_t spi_read(void* ctx, uint8_t reg, uint8_t* pData, size_t length) {
     spi_transaction_t spiTransaction = { 0 };
-
-    uint8_t cmd[2];
-    cmd[0] = start_reg | ICM42688P_SPI_ADDRESS;
-    cmd[1] = 0xFF; // second byte, for response transmit
-
     spiTransaction.length = 8 * (1 + length); // 8 bits for command + 8 bits for each byte to read
     spiTransaction.rxlength = 0; // 0 defaults to the length parameter
-    spiTransaction.flags = 0; // SPI_TRANS_CS_KEEP_ACTIVE;
-    spiTransaction.tx_buffer = &cmd;
-    spiTransaction.rx_buffer = pData;
 
+    if (length <= ICM42688P_MAX_REGISTER_READ) {
+        uint8_t cmd[1 + ICM42688P_MAX_REGISTER_READ];
+        memset(cmd, 0xFF, sizeof(cmd));
+        cmd[0] = reg | ICM42688P_SPI_ADDRESS;
+        uint8_t rcv[1 + ICM42688P_MAX_REGISTER_READ];
+        spiTransaction.tx_buffer = cmd;
+        spiTransaction.rx_buffer = rcv;
+        if (transmit_single(&spiTransaction) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        memcpy(pData, &rcv[1], length);
+        return ESP_OK;
+    }
+
+    if (length > ICM42688P_FIFO_BURST_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    xSemaphoreTake(gSpiLock, portMAX_DELAY);
+    gBurstTx[0] = reg | ICM42688P_SPI_ADDRESS;
+    spiTransaction.tx_buffer = gBurstTx;
+    spiTransaction.rx_buffer = gBurstRx;
     esp_err_t ret = spi_device_transmit(spiDeviceHandle, &spiTransaction);
+    if (ret == ESP_OK) {
+        memcpy(pData, &gBurstRx[1], length);
+    }
+    xSemaphoreGive(gSpiLock);
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "SPI transmission failed: %d", ret);
+        ESP_LOGE(TAG, "SPI burst read failed: %d", ret);
         return ESP_FAIL;
     }
-
-    ESP_LOGV(TAG, "got data from ICM42688! start reg: %X", start_reg);
     return ESP_OK;
 }
 
-esp_err_t ICM42688P_write_data(uint16_t reg_value) {
+esp_err_t spi_write(void* ctx, uint8_t reg, uint8_t value) {
     spi_transaction_t spiTransaction = { 0 };
+    spiTransaction.flags = SPI_TRANS_USE_TXDATA;
+    spiTransaction.length = 8 * 2;          // Two bytes: 1 address, 1 data
+    spiTransaction.tx_data[0] = reg & ICM42688P_SPI_MSB_CLEAR;
+    spiTransaction.tx_data[1] = value;
+    return (transmit_single(&spiTransaction) == ESP_OK) ? ESP_OK : ESP_FAIL;
+}
 
-    uint8_t cmd[2];
-    cmd[0] = (reg_value >> 8) & ICM42688P_SPI_MSB_CLEAR;
-    cmd[1] = reg_value & 0xFF;
-
-    spiTransaction.length = 8 * 2;         // Two bytes: 1 address, 1 data
-    spiTransaction.tx_buffer = cmd;        // Send the command and data buffer
-    spiTransaction.rx_buffer = NULL;       // No data expected to be received
+/*
+ * @brief Writes a sequence of registers with queued transactions
+ *
+ *  Up to ICM42688P_SPI_QUEUE_SIZE writes are in the queue at once and run back to back from the
+ *  SPI interrupt, the caller only collects the results.
+ */
+esp_err_t spi_write_many(void* ctx, const uint16_t* regValues, size_t count) {
+    static spi_transaction_t transactions[ICM42688P_SPI_QUEUE_SIZE]; // in use until collected
+    esp_err_t err = ESP_OK;
+    size_t queued = 0;
+    size_t done = 0;
+
+    xSemaphoreTake(gSpiLock, portMAX_DELAY);
+    while (done < count) {
+        while (err == ESP_OK && queued < count && queued - done < ICM42688P_SPI_QUEUE_SIZE) {
+            spi_transaction_t* pTransaction = &transactions[queued % ICM42688P_SPI_QUEUE_SIZE];
+            memset(pTransaction, 0, sizeof(spi_transaction_t));
+            pTransaction->flags = SPI_TRANS_USE_TXDATA;
+            pTransaction->length = 8 * 2;
+            pTransaction->tx_data[0] = (regValues[queued] >> 8) & ICM42688P_SPI_MSB_CLEAR;
+            pTransaction->tx_data[1] = regValues[queued] & 0xFF;
+            err = spi_device_queue_trans(spiDeviceHandle, pTransaction, portMAX_DELAY);
+            if (err == ESP_OK) {
+                queued++;
+            }
+        }
+        if (done == queued) {
+            break; // queueing failed, nothing left to collect
+        }
+        spi_transaction_t* pDone;
+        esp_err_t ret = spi_device_get_trans_result(spiDeviceHandle, &pDone, portMAX_DELAY);
+        if (ret != ESP_OK && err == ESP_OK) {
+            err = ret;
+        }
+        done++;
+    }
+    xSemaphoreGive(gSpiLock);
 
-    esp_err_t ret = spi_device_transmit(spiDeviceHandle, &spiTransaction);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "SPI transmission failed: %d", ret);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "SPI batch failed after %d of %d writes: %d", (int)done, (int)count, err);
         return ESP_FAIL;
     }
-
-    ESP_LOGD(TAG, "Wrote 0x%02X to register 0x%02X", (reg_value & 0xFF), (reg_value >> 8));
     return ESP_OK;
 }
 
-void ICM42688P_reset() {
-    ICM42688P_write_data(ICM42688P_CONFIG_RESET);
-    ICM42688P_write_data(ICM42688P_CONFIG_ODR);
-    ICM42688P_write_data(ICM42688P_CONFIG_MODE);
-    ICM42688P_write_data(ICM42688P_CONFIG_APEX);
-    ICM42688P_write_data(ICM42688P_CONFIG_GYRO);
-    ICM42688P_write_data(ICM42688P_CONFIG_DMP_RESET);
-    vTaskDelay(1 / portTICK_PERIOD_MS); // According to datasheet
-    ICM42688P_write_data(ICM42688P_CONFIG_DMP_INIT);
-    // ICM42688P_write_data(ICM42688P_CONFIG_BANK); // Would create interrupt on step
-}
-
+#if CONFIG_ICM42688P_INTERFACE_SPI
 void configure_accelerometer() {
-    initSPI(SPI2_HOST);
-    ICM42688P_reset();
-
-    ESP_LOGD(TAG, "Accelerometer configured, trying to read WHO AM I...");
-
-    bool gyroscopeWorking = read_who_am_i();
-    if (!gyroscopeWorking) {
+    const ICM42688P_transport_t* pTransport = ICM42688P_spi_init(SPI2_HOST);
+    if (pTransport == NULL || ICM42688P_init(pTransport) != ESP_OK) {
         ESP_LOGE(TAG, "Gyroscope configuration failed, exiting...");
         return;
     }
 
     ESP_LOGI(TAG, "Accelerometer successfully configured!");
 }
-
-uint16_t ICM42688P_read_steps() {
-    uint8_t data[2];
-    ICM42688P_read_data(ICM42688P_STEPS_OUT_L, data, 2);
-
-    return ((data[0] << 8) | data[1]);
-}
-
-void ICM42688P_read_movement(measurement_t *measurement) {
-    uint8_t upper_x = ICM42688P_read_single_reg(ICM42688P_ACCEL_XOUT_H);
-    uint8_t lower_x = ICM42688P_read_single_reg(ICM42688P_ACCEL_XOUT_L);
-    measurement->movement.x = (int16_t)((upper_x << 8) | lower_x);
-
-    uint8_t upper_y = ICM42688P_read_single_reg(ICM42688P_ACCEL_YOUT_H);
-    uint8_t lower_y = ICM42688P_read_single_reg(ICM42688P_ACCEL_YOUT_L);
-    measurement->movement.y = (int16_t)((upper_y << 8) | lower_y);
-
-    uint8_t upper_z = ICM42688P_read_single_reg(ICM42688P_ACCEL_ZOUT_H);
-    uint8_t lower_z = ICM42688P_read_single_reg(ICM42688P_ACCEL_ZOUT_L);
-    measurement->movement.z = (int16_t)((upper_z << 8) | lower_z);
-}
-
-// ToDo: This would be the more elegant solution bit it emits weird values.
-// void ICM42688P_read_movement(measurement_t *measurement) {
-//     uint8_t data[6];
-//     ICM42688P_read_data(ICM42688P_ACCEL_XOUT_H, data, 6);
-
-//     uint16_t x = (int16_t)((data[0] << 8) | data[1]);
-//     uint16_t y = (int16_t)((data[2] << 8) | data[3]);
-//     uint16_t z = (int16_t)((data[4] << 8) | data[5]);
-
-//     measurement->movement.x = x;
-//     measurement->movement.y = y;
-//     measurement->movement.z = z;
-// }
-
-measurement_t ICM42688P_read_all() {
-    measurement_t measurement;
-    
-    measurement.steps = ICM42688P_read_steps();
-    ICM42688P_read_movement(&measurement);
-
-    ESP_LOGV(TAG, "Read the following data:\nSteps: %d\nX: %d\nY: %d\nZ: %d", measurement.steps, measurement.movement.x, measurement.movement.y, measurement.movement.z); 
-
-    return measurement;
-}
-
-void ICM42688P_start_measurement() {
-    ICM42688P_write_data(ICM42688P_PEDOMETER_ENABLE);
-}
-
-void ICM42688P_stop_measurement() {
-    ICM42688P_write_data(ICM42688P_PEDOMETER_DISABLE);
-}
\ No newline at end of file
+#endif
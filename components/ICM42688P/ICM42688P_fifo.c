@@ -0,0 +1,312 @@
+#include "ICM42688P_fifo.h"
+
+typedef struct {
+    ICM42688P_imu_sample_t* pSamples;
+    size_t maxSamples;
+    size_t count;
+} imu_block_t;
+
+// Takes one decoded packet, false stops parsing before it
+typedef bool (*packet_sink_t)(void* ctx, const ICM42688P_fifo_packet_t* pPacket, int64_t timestamp_us, ICM42688P_fifo_stats_t* pStats);
+
+static int16_t get_i16(const uint8_t* data);
+static void get_movement(const uint8_t* data, movement_t* pMovement);
+static size_t parse_packets(const uint8_t* data, size_t len, ICM42688P_fifo_stats_t* pStats, const ICM42688P_fifo_clock_t* pClock,
+                            packet_sink_t sink, void* ctx);
+static bool push_accel(void* ctx, const ICM42688P_fifo_packet_t* pPacket, int64_t timestamp_us, ICM42688P_fifo_stats_t* pStats);
+static bool store_imu(void* ctx, const ICM42688P_fifo_packet_t* pPacket, int64_t timestamp_us, ICM42688P_fifo_stats_t* pStats);
+
+// ----- implementation -----
+
+// Sensor data is big-endian, the reset default of INTF_CONFIG0
+int16_t get_i16(const uint8_t* data) {
+    return (int16_t)((data[0] << 8) | data[1]);
+}
+
+void get_movement(const uint8_t* data, movement_t* pMovement) {
+    pMovement->x = get_i16(&data[0]);
+    pMovement->y = get_i16(&data[2]);
+    pMovement->z = get_i16(&data[4]);
+}
+
+/*
+ * @brief Size of the packet starting with header
+ *
+ * @return 8, 16 or 20, 0 if the header marks an empty FIFO or is not a valid packet header
+ */
+size_t ICM42688P_fifo_packet_size(uint8_t header) {
+    if (header & ICM42688P_FIFO_HEADER_EMPTY) {
+        return 0;
+    }
+    bool accel = (header & ICM42688P_FIFO_HEADER_ACCEL) != 0;
+    bool gyro = (header & ICM42688P_FIFO_HEADER_GYRO) != 0;
+    if (header & ICM42688P_FIFO_HEADER_20) {
+        return (accel && gyro) ? 20 : 0;
+    }
+    if (accel && gyro) {
+        return 16;
+    }
+    return (accel || gyro) ? 8 : 0;
+}
+
+/*
+ * @brief Decodes one packet
+ *
+ *  Packet layouts, see the datasheet section on the FIFO:
+ *    8 byte:   [header] [accel or gyro x y z] [temp:8]
+ *    16 byte:  [header] [accel x y z] [gyro x y z] [temp:8] [timestamp:16]
+ *    20 byte:  [header] [accel x y z] [gyro x y z] [temp:16] [timestamp:16] [x y z extension bits]
+ *  The extension bits of the 20 byte packet are dropped, samples stay 16 bit.
+ *
+ * @return size of the packet, 0 if data does not start with a complete packet
+ */
+size_t ICM42688P_fifo_decode(const uint8_t* data, size_t len, ICM42688P_fifo_packet_t* pPacket) {
+    if (len == 0) {
+        return 0;
+    }
+    size_t size = ICM42688P_fifo_packet_size(data[0]);
+    if (size == 0 || size > len) {
+        return 0;
+    }
+
+    pPacket->header = data[0];
+    pPacket->hasAccel = (data[0] & ICM42688P_FIFO_HEADER_ACCEL) != 0;
+    pPacket->hasGyro = (data[0] & ICM42688P_FIFO_HEADER_GYRO) != 0;
+    pPacket->timestamp = 0;
+    const uint8_t* pos = &data[1];
+    if (pPacket->hasAccel) {
+        get_movement(pos, &pPacket->accel);
+        pos += 6;
+    }
+    if (pPacket->hasGyro) {
+        get_movement(pos, &pPacket->gyro);
+        pos += 6;
+    }
+    if (size == 20) {
+        pPacket->temperature = get_i16(pos);
+        pos += 2;
+    } else {
+        // 2.07 LSB/°C against 132.48 LSB/°C of the 16 bit value
+        pPacket->temperature = (int16_t)((int8_t)*pos * 64);
+        pos += 1;
+    }
+    if (size >= 16) {
+        pPacket->timestamp = (uint16_t)get_i16(pos);
+    }
+
+    // The sensor fills in this value until the first sample after power up is ready
+    if (pPacket->hasAccel && pPacket->accel.x == ICM42688P_FIFO_INVALID_SAMPLE) {
+        pPacket->hasAccel = false;
+    }
+    if (pPacket->hasGyro && pPacket->gyro.x == ICM42688P_FIFO_INVALID_SAMPLE) {
+        pPacket->hasGyro = false;
+    }
+    return size;
+}
+
+/*
+ * @brief Walks the packets of a FIFO burst read and hands each one with its timestamp to sink
+ *
+ *  Stops at the end of the data, at an empty FIFO marker, at an unknown header or when sink
+ *  returns false. Packets are dated by pClock, or get timestamp 0 without it.
+ *
+ * @return number of bytes parsed
+ */
+size_t parse_packets(const uint8_t* data, size_t len, ICM42688P_fifo_stats_t* pStats, const ICM42688P_fifo_clock_t* pClock,
+                     packet_sink_t sink, void* ctx) {
+    int32_t anchorIndex = (pClock != NULL) ? pClock->anchorIndex : 0;
+    if (anchorIndex < 0) {
+        int32_t count = 0;
+        for (size_t pos = 0, size; pos < len && (size = ICM42688P_fifo_packet_size(data[pos])) != 0 && size <= len - pos; pos += size) {
+            count++;
+        }
+        anchorIndex += count;
+    }
+
+    size_t pos = 0;
+    int32_t index = 0;
+    while (pos < len && !(data[pos] & ICM42688P_FIFO_HEADER_EMPTY)) {
+        ICM42688P_fifo_packet_t packet;
+        size_t size = ICM42688P_fifo_decode(&data[pos], len - pos, &packet);
+        if (size == 0) {
+            if (ICM42688P_fifo_packet_size(data[pos]) == 0) {
+                pStats->errors++; // out of sync, the next read starts at a packet boundary again
+            }
+            break;
+        }
+        int64_t timestamp_us = (pClock != NULL) ? pClock->anchor_us + (int64_t)(index - anchorIndex) * pClock->period_us : 0;
+        if (!sink(ctx, &packet, timestamp_us, pStats)) {
+            break;
+        }
+        pos += size;
+        pStats->packets++;
+        index++;
+    }
+    return pos;
+}
+
+bool push_accel(void* ctx, const ICM42688P_fifo_packet_t* pPacket, int64_t timestamp_us, ICM42688P_fifo_stats_t* pStats) {
+    if (!pPacket->hasAccel) {
+        pStats->skipped++;
+    } else if (ICM42688P_ring_push((ICM42688P_ring_t*)ctx, &pPacket->accel, timestamp_us)) {
+        pStats->samples++;
+    }
+    return true;
+}
+
+bool store_imu(void* ctx, const ICM42688P_fifo_packet_t* pPacket, int64_t timestamp_us, ICM42688P_fifo_stats_t* pStats) {
+    imu_block_t* pBlock = ctx;
+    if (!pPacket->hasAccel || !pPacket->hasGyro) {
+        pStats->skipped++;
+        return true;
+    }
+    if (pBlock->count == pBlock->maxSamples) {
+        return false;
+    }
+    ICM42688P_imu_sample_t* pSample = &pBlock->pSamples[pBlock->count++];
+    pSample->accel = pPacket->accel;
+    pSample->gyro = pPacket->gyro;
+    pSample->timestamp_us = timestamp_us;
+    pStats->samples++;
+    return true;
+}
+
+/*
+ * @brief Adds the accelerometer samples of a FIFO burst read to the ring
+ *
+ * @return number of bytes parsed
+ */
+size_t ICM42688P_fifo_parse(const uint8_t* data, size_t len, ICM42688P_ring_t* pRing, ICM42688P_fifo_stats_t* pStats, const ICM42688P_fifo_clock_t* pClock) {
+    return parse_packets(data, len, pStats, pClock, push_accel, pRing);
+}
+
+/*
+ * @brief Copies the packets with accelerometer and gyroscope data of a FIFO burst read
+ *
+ *  Parsing stops once maxSamples are stored, the rest of the data is left for the next call.
+ *
+ * @return number of bytes parsed, the number of samples is in *pCount
+ */
+size_t ICM42688P_fifo_parse_imu(const uint8_t* data, size_t len, ICM42688P_imu_sample_t* pSamples, size_t maxSamples, size_t* pCount,
+                                ICM42688P_fifo_stats_t* pStats, const ICM42688P_fifo_clock_t* pClock) {
+    imu_block_t block = { .pSamples = pSamples, .maxSamples = maxSamples, .count = 0 };
+    size_t parsed = parse_packets(data, len, pStats, pClock, store_imu, &block);
+    *pCount = block.count;
+    return parsed;
+}
+
+// Sample period of an ACCEL_CONFIG0 output data rate, 0 if unknown
+uint32_t ICM42688P_odr_period_us(uint8_t odr) {
+    switch (odr) {
+        case 0x03:  return 125;     // 8 kHz
+        case 0x04:  return 250;
+        case 0x05:  return 500;
+        case 0x06:  return 1000;
+        case 0x0F:  return 2000;    // 500 Hz
+        case 0x07:  return 5000;
+        case 0x08:  return 10000;
+        case 0x09:  return 20000;
+        case 0x0A:  return 40000;   // 25 Hz
+        case 0x0B:  return 80000;
+        case 0x0C:  return 160000;
+        case 0x0D:  return 320000;
+        case 0x0E:  return 640000;  // 1.5625 Hz
+        default:    return 0;
+    }
+}
+
+/*
+ * @brief Dates the packets of a read from the interrupts counted around its FIFO count
+ *
+ *  pBefore and pAfter are taken just before and just after FIFO_COUNT is read, read_us between
+ *  pBefore and the count. Data ready raises an interrupt per packet, so the latest one marks
+ *  packet count - 1 since the flush whichever read it falls into: the interrupts of packets read
+ *  before are subtracted instead of reset ahead of the count. The watermark interrupt repeats for
+ *  every packet above the watermark, so the latest one marks the newest packet counted, unless
+ *  one came in during the count. If the newest packet is more than half a period younger than
+ *  the latest interrupt, its own interrupt is still pending and the latest marks the one before.
+ *  Anything else dates the read from read_us, and a data ready count that lost interrupts is put
+ *  back in step with the packets. The caller adds the packets read to packetsRead afterwards.
+ */
+void ICM42688P_fifo_timeline_clock(ICM42688P_fifo_timeline_t* pTimeline, const ICM42688P_fifo_interrupts_t* pBefore, const ICM42688P_fifo_interrupts_t* pAfter,
+                                   uint32_t packets, int64_t read_us, ICM42688P_fifo_clock_t* pClock) {
+    pClock->anchor_us = read_us;
+    pClock->anchorIndex = -1;
+    pClock->period_us = pTimeline->period_us;
+    if (packets == 0 || pTimeline->period_us == 0) {
+        return;
+    }
+    bool pending = read_us - pAfter->last_us >= pTimeline->period_us / 2;
+    int64_t newest = (int64_t)pTimeline->packetsRead + packets - 1;
+    int64_t marked; // packet since the flush that raised the latest interrupt
+    if (pTimeline->dataReady) {
+        marked = (int64_t)pAfter->count - 1 + pTimeline->offset;
+        int64_t ahead = marked - newest;
+        bool inStep = (ahead == 0) || (ahead == 1 && pAfter->last_us >= read_us) || (ahead == -1 && pending);
+        if (!inStep) {
+            pTimeline->offset -= (int32_t)ahead; // the next interrupt belongs to the next packet again
+            return;
+        }
+    } else {
+        bool fresh = (int32_t)(pAfter->count - pTimeline->interruptsSeen) > 0 && pAfter->count == pBefore->count;
+        pTimeline->interruptsSeen = pAfter->count;
+        if (!fresh) {
+            return;
+        }
+        marked = newest;
+        if (pending) {
+            marked--;
+            pTimeline->interruptsSeen++; // not taken for a later packet once it runs
+        }
+    }
+    if (pAfter->count == 0 || marked < (int64_t)pTimeline->packetsRead) {
+        return; // raised by a packet read before
+    }
+    pClock->anchor_us = pAfter->last_us;
+    pClock->anchorIndex = (int32_t)(marked - pTimeline->packetsRead);
+}
+
+// Only a power of two of the storage is used, so the indexes may wrap around
+void ICM42688P_ring_init(ICM42688P_ring_t* pRing, movement_t* storage, int64_t* timestamps, uint32_t size) {
+    while (size & (size - 1)) {
+        size &= size - 1;
+    }
+    pRing->items = storage;
+    pRing->timestamps = timestamps;
+    pRing->size = size;
+    pRing->head = 0;
+    pRing->tail = 0;
+    pRing->dropped = 0;
+}
+
+// A full ring keeps its older samples, so a slow consumer sees gaps instead of torn data
+bool ICM42688P_ring_push(ICM42688P_ring_t* pRing, const movement_t* pMovement, int64_t timestamp_us) {
+    uint32_t head = pRing->head;
+    if (head - __atomic_load_n(&pRing->tail, __ATOMIC_ACQUIRE) >= pRing->size) {
+        pRing->dropped++;
+        return false;
+    }
+    pRing->items[head & (pRing->size - 1)] = *pMovement;
+    if (pRing->timestamps != NULL) {
+        pRing->timestamps[head & (pRing->size - 1)] = timestamp_us;
+    }
+    __atomic_store_n(&pRing->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool ICM42688P_ring_pop(ICM42688P_ring_t* pRing, movement_t* pMovement, int64_t* pTimestamp_us) {
+    uint32_t tail = pRing->tail;
+    if (__atomic_load_n(&pRing->head, __ATOMIC_ACQUIRE) == tail) {
+        return false;
+    }
+    *pMovement = pRing->items[tail & (pRing->size - 1)];
+    if (pTimestamp_us != NULL) {
+        *pTimestamp_us = (pRing->timestamps != NULL) ? pRing->timestamps[tail & (pRing->size - 1)] : 0;
+    }
+    __atomic_store_n(&pRing->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+uint32_t ICM42688P_ring_count(const ICM42688P_ring_t* pRing) {
+    return __atomic_load_n(&pRing->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&pRing->tail, __ATOMIC_ACQUIRE);
+}
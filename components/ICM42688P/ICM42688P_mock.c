@@ -0,0 +1,89 @@
+#include <string.h>
+
+#include "ICM42688P.h"
+#include "ICM42688P_mock.h"
+
+static esp_err_t mock_read(void* ctx, uint8_t reg, uint8_t* pData, size_t length);
+static esp_err_t mock_write(void* ctx, uint8_t reg, uint8_t value);
+static esp_err_t mock_write_many(void* ctx, const uint16_t* regValues, size_t count);
+static void store(ICM42688P_mock_t* pMock, uint8_t reg, uint8_t value);
+
+// ----- implementation -----
+
+void ICM42688P_mock_init(ICM42688P_mock_t* pMock) {
+    memset(pMock, 0, sizeof(ICM42688P_mock_t));
+    pMock->transport.ctx = pMock;
+    pMock->transport.read = mock_read;
+    pMock->transport.write = mock_write;
+    pMock->transport.write_many = mock_write_many;
+    pMock->registers[ICM42688P_WHO_AM_I] = ICM42688P_WHO_AM_I_VALUE;
+}
+
+void ICM42688P_mock_set_fifo(ICM42688P_mock_t* pMock, const uint8_t* data, size_t length) {
+    pMock->fifo = data;
+    pMock->fifoLength = length;
+    pMock->fifoPosition = 0;
+}
+
+// Self clearing registers act like the sensor, everything else just keeps the value
+void store(ICM42688P_mock_t* pMock, uint8_t reg, uint8_t value) {
+    if (reg == ICM42688P_DEVICE_CONFIG && (value & ICM42688P_SOFT_RESET)) {
+        memset(pMock->registers, 0, sizeof(pMock->registers));
+        pMock->registers[ICM42688P_WHO_AM_I] = ICM42688P_WHO_AM_I_VALUE;
+        return;
+    }
+    if (reg == ICM42688P_SIGNAL_PATH_RESET) {
+        if (value & ICM42688P_FIFO_FLUSH) {
+            pMock->fifoPosition = pMock->fifoLength;
+        }
+        return;
+    }
+    pMock->registers[reg] = value;
+}
+
+esp_err_t mock_read(void* ctx, uint8_t reg, uint8_t* pData, size_t length) {
+    ICM42688P_mock_t* pMock = ctx;
+    pMock->reads++;
+    if (pMock->fail) {
+        return ESP_FAIL;
+    }
+    if (reg == ICM42688P_FIFO_DATA) {
+        size_t available = pMock->fifoLength - pMock->fifoPosition;
+        size_t copied = (length < available) ? length : available;
+        memcpy(pData, &pMock->fifo[pMock->fifoPosition], copied);
+        memset(&pData[copied], ICM42688P_FIFO_HEADER_EMPTY, length - copied);
+        pMock->fifoPosition += copied;
+        return ESP_OK;
+    }
+    if (reg == ICM42688P_FIFO_COUNTH) {
+        size_t available = pMock->fifoLength - pMock->fifoPosition;
+        pMock->registers[ICM42688P_FIFO_COUNTH] = (available >> 8) & 0xFF;
+        pMock->registers[ICM42688P_FIFO_COUNTH + 1] = available & 0xFF;
+    }
+    for (size_t i = 0; i < length; i++) {
+        pData[i] = pMock->registers[(reg + i) % ICM42688P_MOCK_REGISTERS];
+    }
+    return ESP_OK;
+}
+
+esp_err_t mock_write(void* ctx, uint8_t reg, uint8_t value) {
+    ICM42688P_mock_t* pMock = ctx;
+    pMock->writes++;
+    if (pMock->fail) {
+        return ESP_FAIL;
+    }
+    store(pMock, reg, value);
+    return ESP_OK;
+}
+
+esp_err_t mock_write_many(void* ctx, const uint16_t* regValues, size_t count) {
+    ICM42688P_mock_t* pMock = ctx;
+    pMock->batches++;
+    if (pMock->fail) {
+        return ESP_FAIL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        store(pMock, regValues[i] >> 8, regValues[i] & 0xFF);
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,249 @@
+#include "driver/gpio.h"
+#include "esp_timer.h"
+
+#include "ICM42688P.h"
+
+static const char *TAG = "ICM42688P";
+
+// Interrupt driven streaming, the ISR only takes the time and wakes the reader task
+static ICM42688P_stream_config_t gStream;
+static TaskHandle_t gReaderTask = NULL;
+static volatile bool gStreaming = false;
+static volatile bool gReaderParked = false;   // out of the loop, waits for ICM42688P_stream_stop() to delete it
+static portMUX_TYPE gStreamLock = portMUX_INITIALIZER_UNLOCKED;
+static ICM42688P_fifo_interrupts_t gInterrupts = { 0 };    // since the FIFO flush
+static ICM42688P_stream_stats_t gStreamStats = { 0 };
+
+static void int_isr_handler(void* arg);
+static void reader_task(void* arg);
+static ICM42688P_fifo_interrupts_t take_interrupts(void);
+
+// ----- implementation -----
+
+/*
+ * @brief Moves all samples waiting in the FIFO into the ring, with a single burst transaction
+ *
+ *  For polling, the newest sample is dated with the time of the read.
+ *
+ * @return number of samples added
+ */
+int ICM42688P_fifo_read(ICM42688P_ring_t* pRing, ICM42688P_fifo_stats_t* pStats) {
+    const ICM42688P_fifo_clock_t clock = {
+        .anchor_us = esp_timer_get_time(),
+        .anchorIndex = -1,
+        .period_us = ICM42688P_fifo_period_us(),
+    };
+    return ICM42688P_fifo_drain(pRing, pStats, &clock);
+}
+
+/*
+ * @brief Moves up to maxSamples accelerometer and gyroscope samples out of the FIFO
+ *
+ *  The newest sample is dated with the time of the read.
+ *
+ * @return number of samples stored in pSamples
+ */
+int ICM42688P_imu_read(ICM42688P_imu_sample_t* pSamples, size_t maxSamples, ICM42688P_fifo_stats_t* pStats) {
+    const ICM42688P_fifo_clock_t clock = {
+        .anchor_us = esp_timer_get_time(),
+        .anchorIndex = -1,
+        .period_us = ICM42688P_fifo_period_us(),
+    };
+    return ICM42688P_fifo_drain_imu(pSamples, maxSamples, pStats, &clock);
+}
+
+void IRAM_ATTR int_isr_handler(void* arg) {
+    int64_t now_us = esp_timer_get_time();
+    portENTER_CRITICAL_ISR(&gStreamLock);
+    gInterrupts.count++;
+    gInterrupts.last_us = now_us;
+    gStreamStats.interrupts++;
+    portEXIT_CRITICAL_ISR(&gStreamLock);
+
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(gReaderTask, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+ICM42688P_fifo_interrupts_t take_interrupts(void) {
+    taskENTER_CRITICAL(&gStreamLock);
+    ICM42688P_fifo_interrupts_t interrupts = gInterrupts;
+    taskEXIT_CRITICAL(&gStreamLock);
+    return interrupts;
+}
+
+/*
+ * @brief Drains the FIFO whenever the sensor raises INT1
+ *
+ *  The interrupts are taken once FIFO_COUNT is read, so the timeline knows which packet of the
+ *  read the latest one belongs to. All other packets are dated from it in steps of the sample
+ *  period.
+ */
+void reader_task(void* arg) {
+    ICM42688P_fifo_timeline_t timeline = {
+        .dataReady = (gStream.mode == ICM42688P_INT_DATA_READY),
+        .period_us = ICM42688P_fifo_period_us(),
+    };
+    while (gStreaming) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ICM42688P_READER_TIMEOUT_MS));
+        if (!gStreaming) {
+            break;
+        }
+
+        ICM42688P_fifo_interrupts_t before = take_interrupts();
+        int64_t read_us = esp_timer_get_time();
+        int packets = ICM42688P_fifo_count();
+        ICM42688P_fifo_interrupts_t after = take_interrupts();
+        if (packets <= 0) {
+            continue;
+        }
+        ICM42688P_fifo_clock_t clock;
+        ICM42688P_fifo_timeline_clock(&timeline, &before, &after, packets, read_us, &clock);
+
+        ICM42688P_fifo_stats_t stats = { 0 };
+        int samples = ICM42688P_fifo_drain_packets(gStream.pRing, packets, &stats, &clock);
+        timeline.packetsRead += packets;
+        taskENTER_CRITICAL(&gStreamLock);
+        gStreamStats.reads++;
+        gStreamStats.fifo.packets += stats.packets;
+        gStreamStats.fifo.samples += stats.samples;
+        gStreamStats.fifo.skipped += stats.skipped;
+        gStreamStats.fifo.errors += stats.errors;
+        taskEXIT_CRITICAL(&gStreamLock);
+
+        if (samples > 0 && gStream.consumer != NULL) {
+            xTaskNotifyGive(gStream.consumer);
+        }
+    }
+    gReaderParked = true;
+    vTaskSuspend(NULL);
+}
+
+/*
+ * @brief Streams samples through the FIFO, read whenever the sensor raises its INT1 pin
+ *
+ *  Samples carry the time of the interrupt instead of the time of the read.
+ */
+esp_err_t ICM42688P_stream_start(const ICM42688P_stream_config_t* pConfig) {
+    if (gStreaming || pConfig->pRing == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    gStream = *pConfig;
+    if (gStream.mode == ICM42688P_INT_WATERMARK) {
+        if (gStream.watermark == 0) {
+            gStream.watermark = 1;
+        } else if (gStream.watermark > ICM42688P_MAX_WATERMARK) {
+            gStream.watermark = ICM42688P_MAX_WATERMARK;
+        }
+    }
+
+    esp_err_t err = ICM42688P_fifo_start(gStream.odr);
+    if (err != ESP_OK) {
+        return err;
+    }
+    uint16_t watermark = gStream.watermark * ICM42688P_FIFO_ACCEL_PACKET;
+    uint8_t source = (gStream.mode == ICM42688P_INT_WATERMARK) ? ICM42688P_INT_SOURCE_FIFO_THS : ICM42688P_INT_SOURCE_DRDY;
+    const uint16_t interrupt[] = {
+        (ICM42688P_FIFO_CONFIG1 << 8) | ICM42688P_FIFO_WM_GT_TH | ICM42688P_FIFO_ACCEL_EN,
+        (ICM42688P_FIFO_CONFIG2 << 8) | (watermark & 0xFF),
+        (ICM42688P_FIFO_CONFIG3 << 8) | ((watermark >> 8) & 0x0F),
+        (ICM42688P_INT_CONFIG << 8) | ICM42688P_INT1_PULSED_PUSH_PULL_HIGH,
+        (ICM42688P_INT_CONFIG1 << 8) | ICM42688P_INT_ASYNC_RESET_OFF,
+    };
+    err = ICM42688P_write_batch(interrupt, sizeof(interrupt) / sizeof(interrupt[0]));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to configure the interrupt");
+        return err;
+    }
+
+    gpio_config_t gpioConfigIn = {
+        .pin_bit_mask = 1ULL << gStream.intPin,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_POSEDGE
+    };
+    gpio_config(&gpioConfigIn);
+    err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) { // already installed, e.g. for the buttons
+        ESP_LOGE(TAG, "Failed to install ISR service: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    gInterrupts = (ICM42688P_fifo_interrupts_t){ 0 };
+    gReaderParked = false;
+    gStreaming = true;
+    if (xTaskCreate(reader_task, "imu_reader", ICM42688P_READER_STACKSIZE, NULL, ICM42688P_READER_PRIORITY, &gReaderTask) != pdPASS) {
+        gStreaming = false;
+        ESP_LOGE(TAG, "Failed to create reader task");
+        return ESP_ERR_NO_MEM;
+    }
+    err = gpio_isr_handler_add(gStream.intPin, int_isr_handler, NULL);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to add ISR handler for INT1: %s", esp_err_to_name(err));
+        ICM42688P_stream_stop();
+        return err;
+    }
+
+    // Start from an empty FIFO, the interrupts count its packets from here
+    const uint16_t enable[] = {
+        (ICM42688P_SIGNAL_PATH_RESET << 8) | ICM42688P_FIFO_FLUSH,
+        (ICM42688P_INT_SOURCE0 << 8) | source,
+    };
+    ICM42688P_write_batch(enable, sizeof(enable) / sizeof(enable[0]));
+    ESP_LOGI(TAG, "Streaming with %s interrupt on GPIO %d", (gStream.mode == ICM42688P_INT_WATERMARK) ? "watermark" : "data ready", gStream.intPin);
+    return ESP_OK;
+}
+
+void ICM42688P_stream_stop(void) {
+    if (!gStreaming) {
+        return;
+    }
+    ICM42688P_write_data((ICM42688P_INT_SOURCE0 << 8) | 0x00);
+    gpio_isr_handler_remove(gStream.intPin);
+    gStreaming = false;
+    // The reader only parks itself, so its handle stays valid until it is deleted here
+    xTaskNotifyGive(gReaderTask);
+    while (!gReaderParked) {
+        vTaskDelay(1);
+    }
+    vTaskDelete(gReaderTask);
+    gReaderTask = NULL;
+    ICM42688P_fifo_stop();
+}
+
+void ICM42688P_stream_get_stats(ICM42688P_stream_stats_t* pStats) {
+    taskENTER_CRITICAL(&gStreamLock);
+    *pStats = gStreamStats;
+    taskEXIT_CRITICAL(&gStreamLock);
+}
+
+/*
+ * @brief Reads the accelerometer registers back to back for durationMs
+ *
+ *  Only measures the bus clock the driver was built with, change it in Kconfig and run again to
+ *  compare clocks. Computed wire times, not measured, without the per transaction driver overhead:
+ *    SPI, 6 byte read (7 bytes): 112 us at 500 kHz, 7 us at 8 MHz, 2.3 us at 24 MHz
+ *    SPI, full FIFO burst (2049 bytes): 32.8 ms at 500 kHz, 2.0 ms at 8 MHz, 0.7 ms at 24 MHz
+ *    I2C, 6 byte read (9 bytes with both addresses and the register, 9 clocks each): 200 us at 400 kHz
+ *
+ * @return register reads per second
+ */
+uint32_t ICM42688P_measure_read_rate(uint32_t durationMs) {
+    measurement_t measurement;
+    uint32_t reads = 0;
+    int64_t start_us = esp_timer_get_time();
+    int64_t end_us = start_us + (int64_t)durationMs * 1000;
+    while (esp_timer_get_time() < end_us) {
+        ICM42688P_read_movement(&measurement);
+        reads++;
+    }
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+    uint32_t rate = (elapsed_us > 0) ? (uint32_t)(reads * 1000000LL / elapsed_us) : 0;
+#if CONFIG_ICM42688P_INTERFACE_I2C
+    ESP_LOGI(TAG, "%" PRIu32 " reads/s at %d Hz I2C clock", rate, CONFIG_I2C_MASTER_BITRATE);
+#else
+    ESP_LOGI(TAG, "%" PRIu32 " reads/s at %d Hz SPI clock", rate, CONFIG_ICM42688P_SPI_CLOCK_HZ);
+#endif
+    return rate;
+}
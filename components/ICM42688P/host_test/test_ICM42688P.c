@@ -0,0 +1,213 @@
+#include <string.h>
+
+#include "host_test.h"
+#include "ICM42688P.h"
+#include "ICM42688P_mock.h"
+
+// The register logic of the driver on the mock transport: the shadow cache, batches and FIFO reads
+
+static uint32_t gDelayTicks = 0;
+
+void vTaskDelay(TickType_t ticks) {
+    gDelayTicks += ticks;
+}
+
+static ICM42688P_mock_t gMock;
+
+static void init_driver(void) {
+    ICM42688P_mock_init(&gMock);
+    CHECK_EQ(ICM42688P_init(&gMock.transport), ESP_OK);
+    gMock.reads = 0;
+    gMock.writes = 0;
+    gMock.batches = 0;
+}
+
+static size_t put_imu_packet(uint8_t* buf, int16_t x) {
+    memset(buf, 0, ICM42688P_FIFO_IMU_PACKET);
+    buf[0] = ICM42688P_FIFO_HEADER_ACCEL | ICM42688P_FIFO_HEADER_GYRO;
+    buf[1] = (uint8_t)((uint16_t)x >> 8);
+    buf[2] = (uint8_t)x;
+    buf[7] = (uint8_t)((uint16_t)-x >> 8);
+    buf[8] = (uint8_t)-x;
+    return ICM42688P_FIFO_IMU_PACKET;
+}
+
+static void test_not_initialized(void) {
+    uint8_t data;
+    CHECK_EQ(ICM42688P_read_data(ICM42688P_WHO_AM_I, &data, 1), ESP_ERR_INVALID_STATE);
+    CHECK_EQ(ICM42688P_write_data(ICM42688P_CONFIG_ODR), ESP_ERR_INVALID_STATE);
+    CHECK_EQ(ICM42688P_write_batch(NULL, 0), ESP_ERR_INVALID_STATE);
+}
+
+// The reset sequence reaches the sensor with its waits, a silent sensor is reported
+static void test_init(void) {
+    ICM42688P_mock_init(&gMock);
+    gDelayTicks = 0;
+    CHECK_EQ(ICM42688P_init(&gMock.transport), ESP_OK);
+    CHECK_EQ(gMock.batches, 1);
+    CHECK_EQ(gMock.registers[ICM42688P_PWR_MGMT0], ICM42688P_CONFIG_MODE & 0xFF);
+    CHECK_EQ(gMock.registers[ICM42688P_APEX_CONFIG0], ICM42688P_CONFIG_APEX & 0xFF);
+    CHECK_EQ(gMock.registers[ICM42688P_SIGNAL_PATH_RESET], 0); // self clearing
+    CHECK(gDelayTicks >= 2 * 2); // 1 ms twice, each at least one full tick
+
+    ICM42688P_mock_init(&gMock);
+    gMock.fail = true;
+    CHECK_EQ(ICM42688P_init(&gMock.transport), ESP_ERR_NOT_FOUND);
+}
+
+// Written registers come from the shadow, unchanged values are not written again
+static void test_shadow(void) {
+    init_driver();
+    ICM42688P_start_measurement();
+    CHECK_EQ(gMock.reads, 0);
+    CHECK_EQ(gMock.writes, 1);
+    CHECK_EQ(gMock.registers[ICM42688P_APEX_CONFIG0], (ICM42688P_CONFIG_APEX & 0xFF) | ICM42688P_PED_ENABLE);
+    ICM42688P_start_measurement();
+    CHECK_EQ(gMock.writes, 1);
+    ICM42688P_stop_measurement();
+    CHECK_EQ(gMock.writes, 2);
+    CHECK_EQ(gMock.registers[ICM42688P_APEX_CONFIG0], ICM42688P_CONFIG_APEX & 0xFF);
+
+    // Never written, read once and then cached
+    gMock.registers[ICM42688P_INT_CONFIG] = 0x10;
+    CHECK_EQ(ICM42688P_update_register(ICM42688P_INT_CONFIG, 0x03, 0x03), ESP_OK);
+    CHECK_EQ(gMock.registers[ICM42688P_INT_CONFIG], 0x13);
+    CHECK_EQ(ICM42688P_update_register(ICM42688P_INT_CONFIG, 0x01, 0x00), ESP_OK);
+    CHECK_EQ(gMock.registers[ICM42688P_INT_CONFIG], 0x12);
+    CHECK_EQ(gMock.reads, 1);
+    CHECK_EQ(ICM42688P_update_register(ICM42688P_INT_CONFIG, 0x02, 0x02), ESP_OK);
+    CHECK_EQ(gMock.writes, 4);
+
+    // Self clearing registers are read and written every time
+    CHECK_EQ(ICM42688P_update_register(ICM42688P_SIGNAL_PATH_RESET, ICM42688P_FIFO_FLUSH, ICM42688P_FIFO_FLUSH), ESP_OK);
+    CHECK_EQ(ICM42688P_update_register(ICM42688P_SIGNAL_PATH_RESET, ICM42688P_FIFO_FLUSH, ICM42688P_FIFO_FLUSH), ESP_OK);
+    CHECK_EQ(gMock.reads, 3);
+    CHECK_EQ(gMock.writes, 6);
+
+    // A failed read leaves register and cache alone
+    gMock.fail = true;
+    CHECK_EQ(ICM42688P_update_register(ICM42688P_INT_SOURCE0, 0x08, 0x08), ESP_FAIL);
+    gMock.fail = false;
+    CHECK_EQ(ICM42688P_update_register(ICM42688P_INT_SOURCE0, 0x08, 0x08), ESP_OK);
+    CHECK_EQ(gMock.reads, 5);
+}
+
+// Registers of the other banks share addresses with bank 0, they are never cached
+static void test_banks(void) {
+    init_driver();
+    CHECK_EQ(ICM42688P_write_data((ICM42688P_REG_BANK_SEL << 8) | 1), ESP_OK);
+    CHECK_EQ(ICM42688P_update_register(ICM42688P_APEX_CONFIG0, 0x01, 0x01), ESP_OK);
+    CHECK_EQ(ICM42688P_update_register(ICM42688P_APEX_CONFIG0, 0x01, 0x01), ESP_OK);
+    CHECK_EQ(gMock.reads, 2);
+    CHECK_EQ(gMock.writes, 3);
+
+    // Back in bank 0 the shadow of before is still valid
+    CHECK_EQ(ICM42688P_write_data((ICM42688P_REG_BANK_SEL << 8) | 0), ESP_OK);
+    gMock.registers[ICM42688P_APEX_CONFIG0] = ICM42688P_CONFIG_APEX & 0xFF;
+    CHECK_EQ(ICM42688P_update_register(ICM42688P_APEX_CONFIG0, 0x01, 0x01), ESP_OK);
+    CHECK_EQ(gMock.reads, 2);
+}
+
+// A failed batch and a soft reset leave the sensor in an unknown state, the shadow is dropped
+static void test_invalidate(void) {
+    init_driver();
+    static const uint16_t batch[] = { (ICM42688P_INT_CONFIG << 8) | 0x03, (ICM42688P_FIFO_CONFIG1 << 8) | 0x03 };
+    gMock.fail = true;
+    CHECK_EQ(ICM42688P_write_batch(batch, 2), ESP_FAIL);
+    gMock.fail = false;
+    ICM42688P_start_measurement();
+    CHECK_EQ(gMock.reads, 1);
+
+    CHECK_EQ(ICM42688P_write_batch(batch, 2), ESP_OK);
+    CHECK_EQ(ICM42688P_update_register(ICM42688P_FIFO_CONFIG1, 0x03, 0x03), ESP_OK);
+    CHECK_EQ(gMock.reads, 1);
+    CHECK_EQ(gMock.batches, 2);
+
+    CHECK_EQ(ICM42688P_write_data(ICM42688P_CONFIG_RESET), ESP_OK);
+    CHECK_EQ(gMock.registers[ICM42688P_FIFO_CONFIG1], 0);
+    CHECK_EQ(ICM42688P_update_register(ICM42688P_FIFO_CONFIG1, 0x01, 0x01), ESP_OK);
+    CHECK_EQ(gMock.reads, 2);
+    CHECK_EQ(gMock.registers[ICM42688P_FIFO_CONFIG1], 0x01);
+}
+
+static void test_sample_registers(void) {
+    init_driver();
+    static const uint8_t samples[12] = { 0x12, 0x34, 0xFF, 0xFE, 0x80, 0x00, 0x00, 0x01, 0x7F, 0xFF, 0xC0, 0x00 };
+    memcpy(&gMock.registers[ICM42688P_ACCEL_XOUT_H], samples, sizeof(samples));
+    gMock.registers[ICM42688P_STEPS_OUT_L] = 0x34;
+    gMock.registers[ICM42688P_STEPS_OUT_H] = 0x12;
+
+    measurement_t measurement = ICM42688P_read_all();
+    CHECK_EQ(measurement.steps, 0x1234);
+    CHECK(measurement.movement.x == 0x1234 && measurement.movement.y == -2 && measurement.movement.z == INT16_MIN);
+    CHECK_EQ(gMock.reads, 2);
+
+    ICM42688P_imu_sample_t sample;
+    CHECK_EQ(ICM42688P_read_imu(&sample), ESP_OK);
+    CHECK(sample.accel.x == 0x1234 && sample.gyro.x == 1 && sample.gyro.y == INT16_MAX && sample.gyro.z == -16384);
+
+    // A failed read leaves the last values
+    gMock.fail = true;
+    ICM42688P_read_movement(&measurement);
+    CHECK_EQ(measurement.movement.x, 0x1234);
+    CHECK_EQ(ICM42688P_read_imu(&sample), ESP_FAIL);
+}
+
+// Only complete packets are read, the rest stays in the FIFO
+static void test_fifo(void) {
+    init_driver();
+    gDelayTicks = 0;
+    CHECK_EQ(ICM42688P_imu_start(ICM42688P_ODR_1KHZ), ESP_OK);
+    CHECK_EQ(ICM42688P_fifo_period_us(), 1000);
+    CHECK(gDelayTicks > ICM42688P_GYRO_STARTUP_MS);
+    CHECK_EQ(gMock.batches, 2);
+    CHECK_EQ(gMock.registers[ICM42688P_FIFO_CONFIG], ICM42688P_FIFO_MODE_STREAM);
+    CHECK_EQ(gMock.registers[ICM42688P_FIFO_CONFIG1], ICM42688P_FIFO_ACCEL_EN | ICM42688P_FIFO_GYRO_EN);
+    CHECK_EQ(gMock.registers[ICM42688P_PWR_MGMT0], ICM42688P_PWR_ACCEL_LN | ICM42688P_PWR_GYRO_LN);
+
+    uint8_t fifo[4 * ICM42688P_FIFO_IMU_PACKET + 5];
+    size_t len = 0;
+    for (int16_t i = 1; i <= 4; i++) {
+        len += put_imu_packet(&fifo[len], i * 100);
+    }
+    memset(&fifo[len], 0x60, 5);
+    ICM42688P_mock_set_fifo(&gMock, fifo, len + 5);
+
+    ICM42688P_imu_sample_t samples[3];
+    ICM42688P_fifo_stats_t stats = { 0 };
+    ICM42688P_fifo_clock_t clock = { .anchor_us = 5000, .anchorIndex = -1, .period_us = 1000 };
+    CHECK_EQ(ICM42688P_fifo_drain_imu(samples, 3, &stats, &clock), 3);
+    CHECK_EQ(gMock.fifoPosition, 3 * ICM42688P_FIFO_IMU_PACKET);
+    CHECK(samples[0].accel.x == 100 && samples[0].gyro.x == -100 && samples[2].accel.x == 300);
+    CHECK_EQ(samples[0].timestamp_us, 3000);
+    CHECK_EQ(samples[2].timestamp_us, 5000);
+
+    CHECK_EQ(ICM42688P_fifo_drain_imu(samples, 3, &stats, NULL), 1);
+    CHECK_EQ(samples[0].accel.x, 400);
+    CHECK_EQ(gMock.fifoPosition, len);
+    CHECK_EQ(ICM42688P_fifo_drain_imu(samples, 3, &stats, NULL), 0);
+    CHECK_EQ(stats.samples, 4);
+    CHECK_EQ(stats.errors, 0);
+
+    // The accelerometer ring takes the same packets
+    ICM42688P_mock_set_fifo(&gMock, fifo, len);
+    movement_t items[8];
+    ICM42688P_ring_t ring;
+    ICM42688P_ring_init(&ring, items, NULL, 8);
+    CHECK_EQ(ICM42688P_fifo_drain(&ring, &stats, NULL), 4);
+    CHECK_EQ(ICM42688P_ring_count(&ring), 4);
+
+    CHECK_EQ(ICM42688P_fifo_stop(), ESP_OK);
+    CHECK_EQ(gMock.registers[ICM42688P_FIFO_CONFIG], ICM42688P_FIFO_MODE_BYPASS);
+}
+
+int main(void) {
+    RUN_TEST(test_not_initialized);
+    RUN_TEST(test_init);
+    RUN_TEST(test_shadow);
+    RUN_TEST(test_banks);
+    RUN_TEST(test_invalidate);
+    RUN_TEST(test_sample_registers);
+    RUN_TEST(test_fifo);
+    return host_test_result();
+}
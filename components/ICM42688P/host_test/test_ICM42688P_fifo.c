@@ -0,0 +1,332 @@
+#include <string.h>
+
+#include "host_test.h"
+#include "ICM42688P_fifo.h"
+
+// FIFO packets built byte by byte after the layouts of the datasheet
+
+#define HEADER_ACCEL    (ICM42688P_FIFO_HEADER_ACCEL)
+#define HEADER_IMU      (ICM42688P_FIFO_HEADER_ACCEL | ICM42688P_FIFO_HEADER_GYRO)
+#define HEADER_IMU_20   (HEADER_IMU | ICM42688P_FIFO_HEADER_20)
+
+static size_t put_i16(uint8_t* buf, int16_t value) {
+    buf[0] = (uint8_t)((uint16_t)value >> 8);
+    buf[1] = (uint8_t)value;
+    return 2;
+}
+
+static size_t put_movement(uint8_t* buf, int16_t x, int16_t y, int16_t z) {
+    return put_i16(&buf[0], x) + put_i16(&buf[2], y) + put_i16(&buf[4], z);
+}
+
+static size_t put_accel_packet(uint8_t* buf, int16_t x, int16_t y, int16_t z, int8_t temperature) {
+    buf[0] = HEADER_ACCEL;
+    size_t len = 1 + put_movement(&buf[1], x, y, z);
+    buf[len++] = (uint8_t)temperature;
+    return len;
+}
+
+// Accelerometer (x, x + 1, x + 2), gyroscope (-x, -x - 1, -x - 2)
+static size_t put_imu_packet(uint8_t* buf, int16_t x, uint16_t timestamp) {
+    buf[0] = HEADER_IMU;
+    size_t len = 1;
+    len += put_movement(&buf[len], x, x + 1, x + 2);
+    len += put_movement(&buf[len], -x, -x - 1, -x - 2);
+    buf[len++] = 25;
+    len += put_i16(&buf[len], (int16_t)timestamp);
+    return len;
+}
+
+static void test_packet_size(void) {
+    CHECK_EQ(ICM42688P_fifo_packet_size(HEADER_ACCEL), 8);
+    CHECK_EQ(ICM42688P_fifo_packet_size(ICM42688P_FIFO_HEADER_GYRO), 8);
+    CHECK_EQ(ICM42688P_fifo_packet_size(HEADER_IMU), 16);
+    CHECK_EQ(ICM42688P_fifo_packet_size(HEADER_IMU_20), 20);
+    CHECK_EQ(ICM42688P_fifo_packet_size(HEADER_ACCEL | ICM42688P_FIFO_HEADER_20), 0);
+    CHECK_EQ(ICM42688P_fifo_packet_size(0x00), 0);
+    CHECK_EQ(ICM42688P_fifo_packet_size(ICM42688P_FIFO_HEADER_EMPTY | HEADER_IMU), 0);
+}
+
+static void test_decode(void) {
+    uint8_t buf[20];
+    ICM42688P_fifo_packet_t packet;
+
+    // 8 byte packet, the 8 bit temperature scaled to the 16 bit one, also below 0
+    CHECK_EQ(put_accel_packet(buf, 1, -2, INT16_MAX, 10), 8);
+    CHECK_EQ(ICM42688P_fifo_decode(buf, 8, &packet), 8);
+    CHECK(packet.hasAccel && !packet.hasGyro);
+    CHECK(packet.accel.x == 1 && packet.accel.y == -2 && packet.accel.z == INT16_MAX);
+    CHECK_EQ(packet.temperature, 640);
+    CHECK_EQ(packet.timestamp, 0);
+    buf[7] = (uint8_t)-128;
+    ICM42688P_fifo_decode(buf, 8, &packet);
+    CHECK_EQ(packet.temperature, -8192);
+    CHECK_EQ(ICM42688P_fifo_decode(buf, 7, &packet), 0);
+    CHECK_EQ(ICM42688P_fifo_decode(buf, 0, &packet), 0);
+
+    // 16 byte packet
+    CHECK_EQ(put_imu_packet(buf, 1000, 0xFFFE), 16);
+    CHECK_EQ(ICM42688P_fifo_decode(buf, sizeof(buf), &packet), 16);
+    CHECK(packet.hasAccel && packet.hasGyro);
+    CHECK(packet.accel.x == 1000 && packet.accel.y == 1001 && packet.accel.z == 1002);
+    CHECK(packet.gyro.x == -1000 && packet.gyro.y == -1001 && packet.gyro.z == -1002);
+    CHECK_EQ(packet.temperature, 25 * 64);
+    CHECK_EQ(packet.timestamp, 0xFFFE);
+
+    // 20 byte packet, 16 bit temperature and the extension bits dropped
+    buf[0] = HEADER_IMU_20;
+    put_i16(&buf[13], -1234);
+    put_i16(&buf[15], 0x1234);
+    memset(&buf[17], 0xFF, 3);
+    CHECK_EQ(ICM42688P_fifo_decode(buf, 20, &packet), 20);
+    CHECK(packet.accel.x == 1000 && packet.gyro.z == -1002);
+    CHECK_EQ(packet.temperature, -1234);
+    CHECK_EQ(packet.timestamp, 0x1234);
+    CHECK_EQ(ICM42688P_fifo_decode(buf, 19, &packet), 0);
+
+    // Samples not ready after power up
+    put_imu_packet(buf, 1, 0);
+    put_i16(&buf[1], ICM42688P_FIFO_INVALID_SAMPLE);
+    CHECK_EQ(ICM42688P_fifo_decode(buf, 16, &packet), 16);
+    CHECK(!packet.hasAccel && packet.hasGyro);
+    put_i16(&buf[7], ICM42688P_FIFO_INVALID_SAMPLE);
+    ICM42688P_fifo_decode(buf, 16, &packet);
+    CHECK(!packet.hasAccel && !packet.hasGyro);
+}
+
+// All packets of a read are dated from the anchor at the output data rate
+static void test_parse_ring(void) {
+    uint8_t data[64];
+    size_t len = 0;
+    for (int16_t i = 0; i < 4; i++) {
+        len += put_accel_packet(&data[len], i, 0, 0, 0);
+    }
+    put_i16(&data[2 * 8 + 1], ICM42688P_FIFO_INVALID_SAMPLE);
+
+    movement_t items[8];
+    int64_t timestamps[8];
+    ICM42688P_ring_t ring;
+    ICM42688P_ring_init(&ring, items, timestamps, 8);
+    ICM42688P_fifo_stats_t stats = { 0 };
+    ICM42688P_fifo_clock_t clock = { .anchor_us = 10000, .anchorIndex = -1, .period_us = 1000 };
+    CHECK_EQ(ICM42688P_fifo_parse(data, len, &ring, &stats, &clock), len);
+    CHECK_EQ(stats.packets, 4);
+    CHECK_EQ(stats.samples, 3);
+    CHECK_EQ(stats.skipped, 1);
+    CHECK_EQ(stats.errors, 0);
+
+    static const int16_t xs[] = { 0, 1, 3 };
+    static const int64_t expected_us[] = { 7000, 8000, 10000 };
+    for (size_t i = 0; i < 3; i++) {
+        movement_t movement;
+        int64_t timestamp_us;
+        CHECK(ICM42688P_ring_pop(&ring, &movement, &timestamp_us));
+        CHECK_EQ(movement.x, xs[i]);
+        CHECK_EQ(timestamp_us, expected_us[i]);
+    }
+    CHECK_EQ(ICM42688P_ring_count(&ring), 0);
+
+    // Without a clock every sample gets timestamp 0
+    memset(&stats, 0, sizeof(stats));
+    ICM42688P_fifo_parse(data, 8, &ring, &stats, NULL);
+    int64_t timestamp_us = -1;
+    movement_t movement;
+    CHECK(ICM42688P_ring_pop(&ring, &movement, &timestamp_us));
+    CHECK_EQ(timestamp_us, 0);
+}
+
+// Parsing stops at the empty marker, a partial packet and an unknown header
+static void test_parse_stops(void) {
+    uint8_t data[64];
+    size_t len = put_accel_packet(data, 1, 1, 1, 0);
+    data[len] = ICM42688P_FIFO_HEADER_EMPTY;
+    memset(&data[len + 1], 0x55, 8);
+
+    movement_t items[4];
+    ICM42688P_ring_t ring;
+    ICM42688P_ring_init(&ring, items, NULL, 4);
+    ICM42688P_fifo_stats_t stats = { 0 };
+    CHECK_EQ(ICM42688P_fifo_parse(data, len + 9, &ring, &stats, NULL), 8);
+    CHECK_EQ(stats.errors, 0);
+
+    // The rest of a packet split by the burst size arrives with the next read
+    put_accel_packet(&data[8], 2, 2, 2, 0);
+    CHECK_EQ(ICM42688P_fifo_parse(data, 8 + 5, &ring, &stats, NULL), 8);
+    CHECK_EQ(stats.errors, 0);
+
+    data[8] = 0x00;
+    CHECK_EQ(ICM42688P_fifo_parse(data, 16, &ring, &stats, NULL), 8);
+    CHECK_EQ(stats.errors, 1);
+}
+
+// IMU blocks stop once full, the rest is parsed by the next call
+static void test_parse_imu(void) {
+    uint8_t data[5 * 16 + 8];
+    size_t len = 0;
+    len += put_imu_packet(&data[len], 10, 0);
+    len += put_accel_packet(&data[len], 0, 0, 0, 0);
+    for (int16_t i = 1; i < 5; i++) {
+        len += put_imu_packet(&data[len], 10 + i, 0);
+    }
+
+    ICM42688P_imu_sample_t samples[3];
+    size_t count = 0;
+    ICM42688P_fifo_stats_t stats = { 0 };
+    ICM42688P_fifo_clock_t clock = { .anchor_us = 0, .anchorIndex = 0, .period_us = 500 };
+    size_t parsed = ICM42688P_fifo_parse_imu(data, len, samples, 3, &count, &stats, &clock);
+    CHECK_EQ(parsed, 16 + 8 + 2 * 16);
+    CHECK_EQ(count, 3);
+    CHECK_EQ(stats.skipped, 1);
+    CHECK(samples[0].accel.x == 10 && samples[0].gyro.x == -10);
+    CHECK(samples[2].accel.x == 12 && samples[2].gyro.z == -14);
+    CHECK_EQ(samples[2].timestamp_us, 3 * 500);
+
+    parsed += ICM42688P_fifo_parse_imu(&data[parsed], len - parsed, samples, 3, &count, &stats, NULL);
+    CHECK_EQ(parsed, len);
+    CHECK_EQ(count, 2);
+    CHECK_EQ(samples[1].accel.x, 14);
+    CHECK_EQ(stats.samples, 5);
+}
+
+static void test_ring(void) {
+    movement_t items[6];
+    ICM42688P_ring_t ring;
+    ICM42688P_ring_init(&ring, items, NULL, 6);
+    CHECK_EQ(ring.size, 4);
+
+    // A full ring drops the new samples, indexes keep counting past the size
+    for (int16_t round = 0; round < 3; round++) {
+        for (int16_t i = 0; i < 5; i++) {
+            movement_t movement = { .x = round * 10 + i };
+            CHECK_EQ(ICM42688P_ring_push(&ring, &movement, 0), i < 4);
+        }
+        CHECK_EQ(ICM42688P_ring_count(&ring), 4);
+        for (int16_t i = 0; i < 4; i++) {
+            movement_t movement;
+            CHECK(ICM42688P_ring_pop(&ring, &movement, NULL));
+            CHECK_EQ(movement.x, round * 10 + i);
+        }
+        movement_t movement;
+        CHECK(!ICM42688P_ring_pop(&ring, &movement, NULL));
+    }
+    CHECK_EQ(ring.dropped, 3);
+}
+
+static void test_odr_period(void) {
+    CHECK_EQ(ICM42688P_odr_period_us(0x03), 125);
+    CHECK_EQ(ICM42688P_odr_period_us(0x0F), 2000);
+    CHECK_EQ(ICM42688P_odr_period_us(0x09), 20000);
+    CHECK_EQ(ICM42688P_odr_period_us(0x00), 0);
+    CHECK_EQ(ICM42688P_odr_period_us(0x10), 0);
+}
+
+// Packet n comes in at (n + 1) ms, its interrupt runs 5 us later
+#define TIMELINE_PERIOD_US  1000
+
+static int64_t packet_us(uint32_t n) {
+    return (int64_t)(n + 1) * TIMELINE_PERIOD_US;
+}
+
+static int64_t interrupt_us(uint32_t n) {
+    return packet_us(n) + 5;
+}
+
+// Reads packets first to first + packets - 1, each has to be dated with the time of its interrupt
+static void check_read_dated(ICM42688P_fifo_timeline_t* pTimeline, uint32_t first, uint32_t packets, int64_t read_us,
+                             ICM42688P_fifo_interrupts_t before, ICM42688P_fifo_interrupts_t after) {
+    CHECK_EQ(pTimeline->packetsRead, first);
+    uint8_t data[8 * 8];
+    size_t len = 0;
+    for (uint32_t i = 0; i < packets; i++) {
+        len += put_accel_packet(&data[len], (int16_t)(first + i), 0, 0, 0);
+    }
+    ICM42688P_fifo_clock_t clock;
+    ICM42688P_fifo_timeline_clock(pTimeline, &before, &after, packets, read_us, &clock);
+    pTimeline->packetsRead += packets;
+
+    movement_t items[8];
+    int64_t timestamps[8];
+    ICM42688P_ring_t ring;
+    ICM42688P_ring_init(&ring, items, timestamps, 8);
+    ICM42688P_fifo_stats_t stats = { 0 };
+    ICM42688P_fifo_parse(data, len, &ring, &stats, &clock);
+    for (uint32_t i = 0; i < packets; i++) {
+        movement_t movement;
+        int64_t timestamp_us;
+        CHECK(ICM42688P_ring_pop(&ring, &movement, &timestamp_us));
+        CHECK_EQ(timestamp_us, interrupt_us(movement.x));
+    }
+}
+
+// Reads packets that cannot be tied to an interrupt, the newest is dated with the time of the read
+static void check_read_undated(ICM42688P_fifo_timeline_t* pTimeline, uint32_t packets, int64_t read_us,
+                               ICM42688P_fifo_interrupts_t before, ICM42688P_fifo_interrupts_t after) {
+    ICM42688P_fifo_clock_t clock;
+    ICM42688P_fifo_timeline_clock(pTimeline, &before, &after, packets, read_us, &clock);
+    pTimeline->packetsRead += packets;
+    CHECK_EQ(clock.anchor_us, read_us);
+    CHECK_EQ(clock.anchorIndex, -1);
+    CHECK_EQ(clock.period_us, TIMELINE_PERIOD_US);
+}
+
+static ICM42688P_fifo_interrupts_t interrupts(uint32_t count, uint32_t lastPacket) {
+    return (ICM42688P_fifo_interrupts_t){ .count = count, .last_us = interrupt_us(lastPacket) };
+}
+
+// Data ready: the latest interrupt marks its packet by count, whichever read the packet is in
+static void test_timeline_data_ready(void) {
+    ICM42688P_fifo_timeline_t timeline = { .dataReady = true, .period_us = TIMELINE_PERIOD_US };
+    check_read_dated(&timeline, 0, 3, 3500, interrupts(3, 2), interrupts(3, 2));
+
+    // Packet 6 comes in while FIFO_COUNT is read and is counted, its interrupt only runs after the
+    // count: it still marks packet 6, and the read after is not shifted by it
+    check_read_dated(&timeline, 3, 4, 6990, interrupts(6, 5), interrupts(7, 6));
+    check_read_dated(&timeline, 7, 2, 8500, interrupts(9, 8), interrupts(9, 8));
+
+    // Packet 11 comes in just after the count, its interrupt marks a packet of the next read
+    check_read_dated(&timeline, 9, 2, 11999, interrupts(11, 10), interrupts(12, 11));
+    check_read_dated(&timeline, 11, 1, 12500, interrupts(12, 11), interrupts(12, 11));
+
+    // Packet 13 is counted before its interrupt ran, the latest interrupt marks the packet before
+    check_read_dated(&timeline, 12, 2, 14003, interrupts(13, 12), interrupts(13, 12));
+    // With only that packet, the marked one was read before
+    check_read_undated(&timeline, 1, 15003, interrupts(14, 13), interrupts(14, 13));
+    check_read_dated(&timeline, 15, 1, 16500, interrupts(16, 15), interrupts(16, 15));
+
+    // The interrupt of packet 16 gets lost: the read after is undated, the ones after that in step again
+    check_read_undated(&timeline, 2, 18100, interrupts(17, 17), interrupts(17, 17));
+    check_read_dated(&timeline, 18, 2, 20500, interrupts(19, 19), interrupts(19, 19));
+    CHECK_EQ(timeline.offset, 1);
+
+    // Timed out without any interrupt
+    check_read_undated(&timeline, 1, 21500, interrupts(19, 19), interrupts(19, 19));
+}
+
+// Watermark of 3: packets 2 and up of a read raise an interrupt each
+static void test_timeline_watermark(void) {
+    ICM42688P_fifo_timeline_t timeline = { .dataReady = false, .period_us = TIMELINE_PERIOD_US };
+    check_read_dated(&timeline, 0, 4, 4500, interrupts(2, 3), interrupts(2, 3));
+
+    // Packet 7 comes in while FIFO_COUNT is read, it may or may not be counted
+    check_read_undated(&timeline, 4, 7999, interrupts(3, 6), interrupts(4, 7));
+    check_read_dated(&timeline, 8, 3, 11500, interrupts(5, 10), interrupts(5, 10));
+
+    // The interrupt of packet 14 has not run yet when it is counted
+    check_read_dated(&timeline, 11, 4, 15003, interrupts(6, 13), interrupts(6, 13));
+
+    // Timed out below the watermark
+    check_read_undated(&timeline, 2, 17500, interrupts(7, 14), interrupts(7, 14));
+}
+
+int main(void) {
+    RUN_TEST(test_packet_size);
+    RUN_TEST(test_decode);
+    RUN_TEST(test_parse_ring);
+    RUN_TEST(test_parse_stops);
+    RUN_TEST(test_parse_imu);
+    RUN_TEST(test_ring);
+    RUN_TEST(test_odr_period);
+    RUN_TEST(test_timeline_data_ready);
+    RUN_TEST(test_timeline_watermark);
+    return host_test_result();
+}
@@ -1,7 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include "esp_err.h"
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "ICM42688P_fifo.h"
+#include "ICM42688P_transport.h"
 
 #ifndef ICM42688P_H
 #define ICM42688P_H
@@ -19,29 +25,150 @@
 #define ICM42688P_PEDOMETER_ENABLE        0x5622
 #define ICM42688P_PEDOMETER_DISABLE       0x5602
 
+#define ICM42688P_DEVICE_CONFIG   0x11
+#define ICM42688P_SOFT_RESET      0x01
+#define ICM42688P_APEX_CONFIG0    0x56
+#define ICM42688P_PED_ENABLE      0x20
+#define ICM42688P_WHO_AM_I        0x75
+#define ICM42688P_WHO_AM_I_VALUE  0x47
+#define ICM42688P_REG_BANK_SEL    0x76
+
+#define ICM42688P_I2C_ADDRESS     0x68      // AP_AD0 low, 0x69 if high
+#define ICM42688P_SHADOW_SIZE     0x80      // bank 0 registers kept in the shadow cache
+
 #define ICM42688P_ACCEL_XOUT_H    0x1F
 #define ICM42688P_ACCEL_XOUT_L    0x20
 #define ICM42688P_ACCEL_YOUT_H    0x21
 #define ICM42688P_ACCEL_YOUT_L    0x22
 #define ICM42688P_ACCEL_ZOUT_H    0x23
 #define ICM42688P_ACCEL_ZOUT_L    0x24
+#define ICM42688P_GYRO_XOUT_H     0x25
 #define ICM42688P_STEPS_OUT_L     0x31
 #define ICM42688P_STEPS_OUT_H     0x32
 
+// FIFO streaming
+#define ICM42688P_FIFO_CONFIG       0x16
+#define ICM42688P_FIFO_COUNTH       0x2E
+#define ICM42688P_FIFO_DATA         0x30
+#define ICM42688P_SIGNAL_PATH_RESET 0x4B
+#define ICM42688P_INTF_CONFIG0      0x4C
+#define ICM42688P_PWR_MGMT0         0x4E
+#define ICM42688P_GYRO_CONFIG0      0x4F
+#define ICM42688P_ACCEL_CONFIG0     0x50
+#define ICM42688P_FIFO_CONFIG1      0x5F
+
+#define ICM42688P_FIFO_MODE_BYPASS  0x00
+#define ICM42688P_FIFO_MODE_STREAM  0x40
+#define ICM42688P_FIFO_FLUSH        0x02
+#define ICM42688P_FIFO_ACCEL_EN     0x01
+#define ICM42688P_FIFO_GYRO_EN      0x02
+#define ICM42688P_INTF_BIG_ENDIAN   0x30    // FIFO count in bytes, count and data big-endian
+#define ICM42688P_PWR_ACCEL_LN      0x03    // low noise mode, needed above 500 Hz
+#define ICM42688P_PWR_GYRO_LN       0x0C
+#define ICM42688P_ACCEL_FS_4G       0x40
+#define ICM42688P_GYRO_FS_2000DPS   0x00
+#define ICM42688P_GYRO_STARTUP_MS   45
+
+// Scale of the raw values at the ranges set by the driver
+#define ICM42688P_ACCEL_LSB_PER_G   8192.0f
+#define ICM42688P_GYRO_LSB_PER_DPS  16.4f
+
+// Output data rates for ICM42688P_fifo_start()
+#define ICM42688P_ODR_8KHZ          0x03
+#define ICM42688P_ODR_4KHZ          0x04
+#define ICM42688P_ODR_2KHZ          0x05
+#define ICM42688P_ODR_1KHZ          0x06
+#define ICM42688P_ODR_500HZ         0x0F
+#define ICM42688P_ODR_200HZ         0x07
+#define ICM42688P_ODR_100HZ         0x08
+#define ICM42688P_ODR_50HZ          0x09
+
+// Interrupts
+#define ICM42688P_INT_CONFIG        0x14
+#define ICM42688P_INT_STATUS        0x2D
+#define ICM42688P_FIFO_CONFIG2      0x60    // watermark in bytes, bits 7:0
+#define ICM42688P_FIFO_CONFIG3      0x61    // watermark bits 11:8
+#define ICM42688P_INT_CONFIG1       0x64
+#define ICM42688P_INT_SOURCE0       0x65
+
+#define ICM42688P_INT1_PULSED_PUSH_PULL_HIGH 0x03
+#define ICM42688P_INT_ASYNC_RESET_OFF        0x00   // the reset default 1 breaks the INT pins
+#define ICM42688P_INT_SOURCE_DRDY            0x08
+#define ICM42688P_INT_SOURCE_FIFO_THS        0x04
+#define ICM42688P_FIFO_WM_GT_TH              0x20
+
+#define ICM42688P_READER_STACKSIZE  3072
+#define ICM42688P_READER_PRIORITY   6
+#define ICM42688P_READER_TIMEOUT_MS 100     // drains the FIFO even if an interrupt got lost
+#define ICM42688P_MAX_WATERMARK     192     // samples, leaves room in the FIFO for the read
+
+#define ICM42688P_FIFO_ACCEL_PACKET 8       // header, x, y, z, temperature
+#define ICM42688P_FIFO_IMU_PACKET   16      // header, accel, gyro, temperature, timestamp
+#define ICM42688P_FIFO_MAX_IMU_SAMPLES (ICM42688P_FIFO_SIZE / ICM42688P_FIFO_IMU_PACKET)
+#define ICM42688P_FIFO_BURST_SIZE   ICM42688P_FIFO_SIZE
+#define ICM42688P_MAX_REGISTER_READ 16
+#define ICM42688P_SPI_QUEUE_SIZE    8       // register writes in flight per batch
+
+typedef enum {
+    ICM42688P_INT_DATA_READY,   // an interrupt per sample
+    ICM42688P_INT_WATERMARK,    // an interrupt per watermark samples
+} ICM42688P_int_mode_t;
+
 typedef struct {
-    int16_t x;
-    int16_t y;
-    int16_t z;
-} movement_t;
+    int intPin;                 // GPIO connected to INT1
+    ICM42688P_int_mode_t mode;
+    uint8_t odr;                // ICM42688P_ODR_*
+    uint16_t watermark;         // samples, ICM42688P_INT_WATERMARK only
+    ICM42688P_ring_t* pRing;    // receives the samples, should hold timestamps
+    TaskHandle_t consumer;      // optional, notified after every read
+} ICM42688P_stream_config_t;
+
+typedef struct {
+    uint32_t interrupts;
+    uint32_t reads;
+    ICM42688P_fifo_stats_t fifo;
+} ICM42688P_stream_stats_t;
+
 typedef struct {
     uint16_t steps;
     movement_t movement;
 } measurement_t;
 
+// Bus backends, configure_accelerometer() picks the one selected in Kconfig
+const ICM42688P_transport_t* ICM42688P_spi_init(int spiHost);
+const ICM42688P_transport_t* ICM42688P_i2c_init(int i2cPort);
+
+esp_err_t ICM42688P_init(const ICM42688P_transport_t* pTransport);
+esp_err_t ICM42688P_read_data(uint8_t start_reg, uint8_t* pData, size_t length);
+esp_err_t ICM42688P_write_data(uint16_t reg_value);
+esp_err_t ICM42688P_write_batch(const uint16_t* regValues, size_t count);
+esp_err_t ICM42688P_update_register(uint8_t reg, uint8_t mask, uint8_t value);
+void ICM42688P_invalidate_shadow(void);
+
 void ICM42688P_reset();
+uint32_t ICM42688P_measure_read_rate(uint32_t durationMs);
 void configure_accelerometer();
 measurement_t ICM42688P_read_all();
+uint16_t ICM42688P_read_steps();
+void ICM42688P_read_movement(measurement_t *measurement);
 void ICM42688P_start_measurement(void);
 void ICM42688P_stop_measurement(void);
 
+esp_err_t ICM42688P_fifo_start(uint8_t odr);
+esp_err_t ICM42688P_fifo_stop(void);
+int ICM42688P_fifo_count(void);
+int ICM42688P_fifo_drain(ICM42688P_ring_t* pRing, ICM42688P_fifo_stats_t* pStats, const ICM42688P_fifo_clock_t* pClock);
+int ICM42688P_fifo_drain_packets(ICM42688P_ring_t* pRing, size_t packets, ICM42688P_fifo_stats_t* pStats, const ICM42688P_fifo_clock_t* pClock);
+int ICM42688P_fifo_read(ICM42688P_ring_t* pRing, ICM42688P_fifo_stats_t* pStats);
+uint32_t ICM42688P_fifo_period_us(void);
+
+esp_err_t ICM42688P_imu_start(uint8_t odr);
+esp_err_t ICM42688P_read_imu(ICM42688P_imu_sample_t* pSample);
+int ICM42688P_fifo_drain_imu(ICM42688P_imu_sample_t* pSamples, size_t maxSamples, ICM42688P_fifo_stats_t* pStats, const ICM42688P_fifo_clock_t* pClock);
+int ICM42688P_imu_read(ICM42688P_imu_sample_t* pSamples, size_t maxSamples, ICM42688P_fifo_stats_t* pStats);
+
+esp_err_t ICM42688P_stream_start(const ICM42688P_stream_config_t* pConfig);
+void ICM42688P_stream_stop(void);
+void ICM42688P_stream_get_stats(ICM42688P_stream_stats_t* pStats);
+
 #endif // ICM42688P_H
\ No newline at end of file
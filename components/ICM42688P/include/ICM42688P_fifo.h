@@ -0,0 +1,99 @@
+#ifndef ICM42688P_FIFO_H
+#define ICM42688P_FIFO_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+// FIFO packet parser and sample ring. Free of ESP-IDF includes, so captured FIFO dumps can be
+// parsed on the host.
+
+#define ICM42688P_FIFO_SIZE             2048
+
+// FIFO packet header
+#define ICM42688P_FIFO_HEADER_EMPTY     0x80    // no data, the FIFO ran empty
+#define ICM42688P_FIFO_HEADER_ACCEL     0x40
+#define ICM42688P_FIFO_HEADER_GYRO      0x20
+#define ICM42688P_FIFO_HEADER_20        0x10    // 20 byte high resolution packet
+#define ICM42688P_FIFO_INVALID_SAMPLE   INT16_MIN
+
+typedef struct {
+    int16_t x;
+    int16_t y;
+    int16_t z;
+} movement_t;
+
+typedef struct {
+    uint8_t header;
+    bool hasAccel;
+    bool hasGyro;
+    movement_t accel;
+    movement_t gyro;
+    int16_t temperature;    // raw, 8 bit packets are scaled to 16 bit
+    uint16_t timestamp;     // only in 16 and 20 byte packets
+} ICM42688P_fifo_packet_t;
+
+// One packet of a FIFO with accelerometer and gyroscope enabled
+typedef struct {
+    movement_t accel;
+    movement_t gyro;
+    int64_t timestamp_us;
+} ICM42688P_imu_sample_t;
+
+typedef struct {
+    uint32_t packets;
+    uint32_t samples;       // samples added to the ring or the block
+    uint32_t skipped;       // packets without the valid samples asked for
+    uint32_t errors;        // unknown packet headers, the rest of the read is discarded
+} ICM42688P_fifo_stats_t;
+
+/*
+ * Packets leave the sensor at the output data rate, so one known timestamp dates all packets of a
+ * read. The anchor is usually the time of an interrupt.
+ */
+typedef struct {
+    int64_t anchor_us;      // time of the packet at anchorIndex
+    int32_t anchorIndex;    // packet of the read, may lie past it, negative counts from the end, -1 = last
+    uint32_t period_us;
+} ICM42688P_fifo_clock_t;
+
+// INT1 interrupts counted by the ISR since the FIFO was flushed
+typedef struct {
+    uint32_t count;
+    int64_t last_us;        // time of the latest one
+} ICM42688P_fifo_interrupts_t;
+
+// Ties the interrupts to the packets they were raised for, across reads
+typedef struct {
+    bool dataReady;         // an interrupt per packet, else the watermark interrupt repeating above it
+    uint32_t period_us;
+    uint32_t packetsRead;   // since the FIFO was flushed
+    uint32_t interruptsSeen;    // counted when the last read took its FIFO count
+    int32_t offset;         // interrupt n marks packet n - 1 + offset, moved by lost interrupts
+} ICM42688P_fifo_timeline_t;
+
+// Single producer, single consumer ring of samples, producer and consumer may run on different tasks
+typedef struct {
+    movement_t* items;
+    int64_t* timestamps;    // optional, same size as items
+    uint32_t size;
+    uint32_t head;          // only written by the producer
+    uint32_t tail;          // only written by the consumer
+    uint32_t dropped;       // samples lost because the ring was full
+} ICM42688P_ring_t;
+
+size_t ICM42688P_fifo_packet_size(uint8_t header);
+size_t ICM42688P_fifo_decode(const uint8_t* data, size_t len, ICM42688P_fifo_packet_t* pPacket);
+size_t ICM42688P_fifo_parse(const uint8_t* data, size_t len, ICM42688P_ring_t* pRing, ICM42688P_fifo_stats_t* pStats, const ICM42688P_fifo_clock_t* pClock);
+size_t ICM42688P_fifo_parse_imu(const uint8_t* data, size_t len, ICM42688P_imu_sample_t* pSamples, size_t maxSamples, size_t* pCount,
+                                ICM42688P_fifo_stats_t* pStats, const ICM42688P_fifo_clock_t* pClock);
+uint32_t ICM42688P_odr_period_us(uint8_t odr);
+void ICM42688P_fifo_timeline_clock(ICM42688P_fifo_timeline_t* pTimeline, const ICM42688P_fifo_interrupts_t* pBefore, const ICM42688P_fifo_interrupts_t* pAfter,
+                                   uint32_t packets, int64_t read_us, ICM42688P_fifo_clock_t* pClock);
+
+void ICM42688P_ring_init(ICM42688P_ring_t* pRing, movement_t* storage, int64_t* timestamps, uint32_t size);
+bool ICM42688P_ring_push(ICM42688P_ring_t* pRing, const movement_t* pMovement, int64_t timestamp_us);
+bool ICM42688P_ring_pop(ICM42688P_ring_t* pRing, movement_t* pMovement, int64_t* pTimestamp_us);
+uint32_t ICM42688P_ring_count(const ICM42688P_ring_t* pRing);
+
+#endif // ICM42688P_FIFO_H
@@ -0,0 +1,28 @@
+#ifndef ICM42688P_MOCK_H
+#define ICM42688P_MOCK_H
+
+#include <stdbool.h>
+#include "ICM42688P_transport.h"
+
+// Register file in RAM behind the transport interface, so the driver runs without a sensor, e.g.
+// on the linux target. Reads of FIFO_DATA are served from the data given to
+// ICM42688P_mock_set_fifo(), FIFO_COUNTH reports what is left of it.
+
+#define ICM42688P_MOCK_REGISTERS 256
+
+typedef struct {
+    ICM42688P_transport_t transport;    // pass to ICM42688P_init()
+    uint8_t registers[ICM42688P_MOCK_REGISTERS];
+    const uint8_t* fifo;
+    size_t fifoLength;
+    size_t fifoPosition;
+    uint32_t reads;         // bus transactions, write_many counts once
+    uint32_t writes;
+    uint32_t batches;
+    bool fail;              // every transaction fails while set
+} ICM42688P_mock_t;
+
+void ICM42688P_mock_init(ICM42688P_mock_t* pMock);
+void ICM42688P_mock_set_fifo(ICM42688P_mock_t* pMock, const uint8_t* data, size_t length);
+
+#endif // ICM42688P_MOCK_H
@@ -0,0 +1,20 @@
+#ifndef ICM42688P_TRANSPORT_H
+#define ICM42688P_TRANSPORT_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include "esp_err.h"
+
+// Bus access of the driver. The register logic in ICM42688P.c only talks to the sensor through
+// this table, so it runs unchanged over SPI, I2C or the mock in ICM42688P_mock.h.
+//
+// Register values of write_many are packed as (register << 8) | value, like ICM42688P_CONFIG_*.
+
+typedef struct {
+    void* ctx;
+    esp_err_t (*read)(void* ctx, uint8_t reg, uint8_t* pData, size_t length);  // burst from reg on
+    esp_err_t (*write)(void* ctx, uint8_t reg, uint8_t value);
+    esp_err_t (*write_many)(void* ctx, const uint16_t* regValues, size_t count);
+} ICM42688P_transport_t;
+
+#endif // ICM42688P_TRANSPORT_H
@@ -0,0 +1,247 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "activity.h"
+
+static const char *TAG = "ACTIVITY";
+
+static uint32_t unwrap_steps(activity_t* pActivity, int64_t elapsed_ms, uint16_t rawSteps);
+static void update_window(activity_t* pActivity, int64_t timestamp_ms, float intensity_g);
+static activity_state_t classify(const activity_t* pActivity);
+static void update_state(activity_t* pActivity, int64_t timestamp_ms, uint32_t* pEvents);
+
+// ----- implementation -----
+
+/*
+ * @brief Returns the steps since the last update
+ *
+ *  The counter is 16 bit, the difference modulo 2^16 stays right across the wrap. A difference
+ *  larger than the wearer can walk in the elapsed time means the counter restarted, after a sensor
+ *  reset or a failed read, and only moves the baseline.
+ */
+uint32_t unwrap_steps(activity_t* pActivity, int64_t elapsed_ms, uint16_t rawSteps) {
+    uint16_t delta = (uint16_t)(rawSteps - pActivity->lastRaw);
+    int64_t plausible = elapsed_ms * ACTIVITY_MAX_STEP_RATE / 1000 + ACTIVITY_MAX_STEP_BURST;
+    pActivity->lastRaw = rawSteps;
+    if (delta > plausible) {
+        ESP_LOGW(TAG, "Step counter jumped by %u in %d ms, counter reset", delta, (int)elapsed_ms);
+        pActivity->counterResets++;
+        return 0;
+    }
+    return delta;
+}
+
+/*
+ * @brief Adds an update to the window and recomputes cadence and intensity
+ *
+ *  The cadence is taken between the oldest and the newest entry, the intensity is the mean over
+ *  all entries. The sum is kept along, so an update costs the same for any window size.
+ */
+void update_window(activity_t* pActivity, int64_t timestamp_ms, float intensity_g) {
+    activity_entry_t entry;
+    if (pActivity->windowCount == pActivity->windowSize && ringbuffer_get(pActivity->window, &entry, 0)) {
+        pActivity->intensitySum -= entry.intensity_g;
+    } else {
+        pActivity->windowCount++;
+    }
+
+    entry.timestamp_ms = timestamp_ms;
+    entry.steps = pActivity->totalSteps;
+    entry.intensity_g = intensity_g;
+    ringbuffer_add(pActivity->window, &entry);
+    pActivity->intensitySum += intensity_g;
+    if (pActivity->intensitySum < 0.0) {
+        pActivity->intensitySum = 0.0;
+    }
+    pActivity->intensity_g = (float)(pActivity->intensitySum / pActivity->windowCount);
+
+    activity_entry_t oldest;
+    pActivity->cadence_spm = 0.0f;
+    if (ringbuffer_get(pActivity->window, &oldest, 0)) {
+        int64_t span_ms = timestamp_ms - oldest.timestamp_ms;
+        if (span_ms >= ACTIVITY_MIN_SPAN_MS) {
+            pActivity->cadence_spm = (float)(pActivity->totalSteps - oldest.steps) * 60000.0f / (float)span_ms;
+        }
+    }
+}
+
+activity_state_t classify(const activity_t* pActivity) {
+    const activity_config_t* pConfig = &pActivity->config;
+    if (pActivity->cadence_spm < pConfig->walkCadence_spm) {
+        return ACTIVITY_IDLE;
+    }
+    if (pActivity->cadence_spm >= pConfig->runCadence_spm || pActivity->intensity_g >= pConfig->runIntensity_g) {
+        return ACTIVITY_RUN;
+    }
+    return ACTIVITY_WALK;
+}
+
+// A new state is only taken over once it lasted hold_ms, so a short stop does not report idle
+void update_state(activity_t* pActivity, int64_t timestamp_ms, uint32_t* pEvents) {
+    activity_state_t next = classify(pActivity);
+    if (next != pActivity->candidate) {
+        pActivity->candidate = next;
+        pActivity->candidateSince_ms = timestamp_ms;
+    }
+    if (pActivity->candidate != pActivity->state && timestamp_ms - pActivity->candidateSince_ms >= pActivity->config.hold_ms) {
+        ESP_LOGI(TAG, "%s -> %s at %.0f steps/min", activity_state_name(pActivity->state), activity_state_name(pActivity->candidate), pActivity->cadence_spm);
+        pActivity->state = pActivity->candidate;
+        *pEvents |= ACTIVITY_EVENT_STATE;
+    }
+}
+
+/*
+ * @brief Sets up an engine, zero fields of the config take the defaults
+ *
+ * @return ESP_ERR_NO_MEM if the window does not fit into memory
+ */
+esp_err_t activity_init(activity_t* pActivity, const activity_config_t* pConfig) {
+    memset(pActivity, 0, sizeof(activity_t));
+    pActivity->config = *pConfig;
+    activity_config_t* pOwn = &pActivity->config;
+    if (pOwn->interval_ms == 0) {
+        pOwn->interval_ms = ACTIVITY_DEFAULT_INTERVAL_MS;
+    }
+    if (pOwn->window_ms == 0) {
+        pOwn->window_ms = ACTIVITY_DEFAULT_WINDOW_MS;
+    }
+    if (pOwn->walkCadence_spm <= 0.0f) {
+        pOwn->walkCadence_spm = ACTIVITY_DEFAULT_WALK_CADENCE;
+    }
+    if (pOwn->runCadence_spm <= 0.0f) {
+        pOwn->runCadence_spm = ACTIVITY_DEFAULT_RUN_CADENCE;
+    }
+    if (pOwn->runIntensity_g <= 0.0f) {
+        pOwn->runIntensity_g = ACTIVITY_DEFAULT_RUN_INTENSITY;
+    }
+    if (pOwn->hold_ms == 0) {
+        pOwn->hold_ms = ACTIVITY_DEFAULT_HOLD_MS;
+    }
+
+    // One entry per update across the window, plus the one at its start
+    pActivity->windowSize = pOwn->window_ms / pOwn->interval_ms + 1;
+    pActivity->window = ringbuffer_create(pActivity->windowSize, sizeof(activity_entry_t));
+    if (pActivity->window == RINGBUFFER_ERROR_OUTOFMEMORY) {
+        ESP_LOGE(TAG, "No memory for a window of %u entries", (unsigned)pActivity->windowSize);
+        pActivity->window = 0;
+        return ESP_ERR_NO_MEM;
+    }
+    activity_reset(pActivity);
+    return ESP_OK;
+}
+
+void activity_deinit(activity_t* pActivity) {
+    if (pActivity->window != 0) {
+        ringbuffer_destroy(&pActivity->window);
+    }
+}
+
+// Forgets all steps and the state, the next update starts over as the first one
+void activity_reset(activity_t* pActivity) {
+    ringbuffer_clear(pActivity->window);
+    pActivity->windowCount = 0;
+    pActivity->intensitySum = 0.0;
+    pActivity->started = false;
+    pActivity->totalSteps = 0;
+    pActivity->counterResets = 0;
+    pActivity->state = ACTIVITY_IDLE;
+    pActivity->candidate = ACTIVITY_IDLE;
+    pActivity->cadence_spm = 0.0f;
+    pActivity->intensity_g = 0.0f;
+    memset(&pActivity->summary, 0, sizeof(activity_summary_t));
+}
+
+/*
+ * @brief Feeds one reading of the step counter and the accelerometer
+ *
+ *  The first update only reports the initial state. Later ones report a state once it lasted
+ *  hold_ms, and a summary every summary_ms.
+ *
+ * @param timestamp_ms monotonic time of the reading
+ * @param rawSteps the pedometer counter as read from the sensor
+ * @param accelMagnitude_g length of the acceleration vector
+ * @param pReport filled if an event is returned, may be NULL
+ *
+ * @return ACTIVITY_EVENT_* flags of the events to publish, 0 for none
+ */
+uint32_t activity_update(activity_t* pActivity, int64_t timestamp_ms, uint16_t rawSteps, float accelMagnitude_g, activity_report_t* pReport) {
+    uint32_t events = 0;
+    activity_state_t previous = pActivity->state;
+    float intensity_g = fabsf(accelMagnitude_g - 1.0f);
+
+    if (!pActivity->started) {
+        pActivity->started = true;
+        pActivity->lastRaw = rawSteps;
+        pActivity->lastTimestamp_ms = timestamp_ms;
+        pActivity->candidateSince_ms = timestamp_ms;
+        pActivity->summary.start_ms = timestamp_ms;
+        update_window(pActivity, timestamp_ms, intensity_g);
+        events |= ACTIVITY_EVENT_STATE;
+    } else {
+        int64_t elapsed_ms = timestamp_ms - pActivity->lastTimestamp_ms;
+        if (elapsed_ms < 0) {
+            elapsed_ms = 0;
+        }
+        uint32_t steps = unwrap_steps(pActivity, elapsed_ms, rawSteps);
+        pActivity->totalSteps += steps;
+        pActivity->summary.steps += steps;
+        pActivity->summary.time_ms[pActivity->state] += (uint32_t)elapsed_ms;
+        pActivity->lastTimestamp_ms = timestamp_ms;
+
+        update_window(pActivity, timestamp_ms, intensity_g);
+        update_state(pActivity, timestamp_ms, &events);
+        if (pActivity->cadence_spm > pActivity->summary.peakCadence_spm) {
+            pActivity->summary.peakCadence_spm = pActivity->cadence_spm;
+        }
+    }
+
+    activity_summary_t* pSummary = &pActivity->summary;
+    if (pActivity->config.summary_ms > 0 && timestamp_ms - pSummary->start_ms >= pActivity->config.summary_ms) {
+        pSummary->end_ms = timestamp_ms;
+        pSummary->cadence_spm = (float)pSummary->steps * 60000.0f / (float)(pSummary->end_ms - pSummary->start_ms);
+        events |= ACTIVITY_EVENT_SUMMARY;
+    }
+
+    if (events != 0 && pReport != NULL) {
+        pReport->state = pActivity->state;
+        pReport->previous = previous;
+        pReport->timestamp_ms = timestamp_ms;
+        pReport->totalSteps = pActivity->totalSteps;
+        pReport->cadence_spm = pActivity->cadence_spm;
+        pReport->intensity_g = pActivity->intensity_g;
+        pReport->summary = *pSummary;
+    }
+    if (events & ACTIVITY_EVENT_SUMMARY) {
+        memset(pSummary, 0, sizeof(activity_summary_t));
+        pSummary->start_ms = timestamp_ms;
+    }
+    return events;
+}
+
+const char* activity_state_name(activity_state_t state) {
+    switch (state) {
+        case ACTIVITY_IDLE: return "idle";
+        case ACTIVITY_WALK: return "walk";
+        case ACTIVITY_RUN:  return "run";
+        default:            return "unknown";
+    }
+}
+
+// {"state":"walk","previous":"idle","steps":1234,"cadence":104.5,"intensity":0.21}
+int activity_format_state(char* buf, size_t size, const activity_report_t* pReport) {
+    return snprintf(buf, size, "{\"state\":\"%s\",\"previous\":\"%s\",\"steps\":%" PRIu32 ",\"cadence\":%.1f,\"intensity\":%.2f}",
+                    activity_state_name(pReport->state), activity_state_name(pReport->previous),
+                    pReport->totalSteps, pReport->cadence_spm, pReport->intensity_g);
+}
+
+// {"steps":120,"duration":60.0,"cadence":98.2,"peak_cadence":121.0,"idle":12.3,"walk":47.7,"run":0.0,"total":1234}
+int activity_format_summary(char* buf, size_t size, const activity_report_t* pReport) {
+    const activity_summary_t* pSummary = &pReport->summary;
+    return snprintf(buf, size, "{\"steps\":%" PRIu32 ",\"duration\":%.1f,\"cadence\":%.1f,\"peak_cadence\":%.1f,"
+                    "\"idle\":%.1f,\"walk\":%.1f,\"run\":%.1f,\"total\":%" PRIu32 "}",
+                    pSummary->steps, (pSummary->end_ms - pSummary->start_ms) / 1000.0,
+                    pSummary->cadence_spm, pSummary->peakCadence_spm,
+                    pSummary->time_ms[ACTIVITY_IDLE] / 1000.0, pSummary->time_ms[ACTIVITY_WALK] / 1000.0,
+                    pSummary->time_ms[ACTIVITY_RUN] / 1000.0, pReport->totalSteps);
+}
@@ -0,0 +1,102 @@
+#include <math.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "activity.h"
+#include "ICM42688P.h"
+#include "mqtt_impl.h"
+
+static const char *TAG = "ACTIVITY";
+
+#define ACTIVITY_TASK_STACKSIZE     4096
+#define ACTIVITY_TASK_PRIORITY      3
+
+static activity_t gActivity;
+static TaskHandle_t gActivityTask = NULL;
+static volatile bool gRunning = false;
+
+static void publish(const char* subtopic, const char* payload, int len);
+static void activity_task(void* pvParameters);
+
+// ----- implementation -----
+
+void publish(const char* subtopic, const char* payload, int len) {
+    char topic[64];
+    snprintf(topic, sizeof(topic), "%s/%s", CONFIG_ACTIVITY_TOPIC, subtopic);
+    mqtt_sendpayload(topic, (uint8_t*)payload, (uint16_t)len);
+}
+
+// Polls the pedometer, the network only hears about state changes and summaries
+void activity_task(void* pvParameters) {
+    TickType_t lastWake = xTaskGetTickCount();
+    char message[ACTIVITY_MAX_MESSAGE_SIZE];
+
+    while (gRunning) {
+        measurement_t measurement = ICM42688P_read_all();
+        float x = measurement.movement.x;
+        float y = measurement.movement.y;
+        float z = measurement.movement.z;
+        float magnitude_g = sqrtf(x * x + y * y + z * z) / ICM42688P_ACCEL_LSB_PER_G;
+
+        activity_report_t report;
+        uint32_t events = activity_update(&gActivity, esp_timer_get_time() / 1000, measurement.steps, magnitude_g, &report);
+        if (events & ACTIVITY_EVENT_STATE) {
+            int len = activity_format_state(message, sizeof(message), &report);
+            if (len > 0 && len < (int)sizeof(message)) {
+                publish("state", message, len);
+            }
+        }
+        if (events & ACTIVITY_EVENT_SUMMARY) {
+            int len = activity_format_summary(message, sizeof(message), &report);
+            if (len > 0 && len < (int)sizeof(message)) {
+                publish("summary", message, len);
+            }
+        }
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(CONFIG_ACTIVITY_INTERVAL_MS));
+    }
+
+    ICM42688P_stop_measurement();
+    activity_deinit(&gActivity);
+    gActivityTask = NULL;
+    vTaskDelete(NULL);
+}
+
+/*
+ * @brief Enables the pedometer and starts publishing activity
+ *
+ *  The sensor must be configured and MQTT connected before.
+ */
+esp_err_t activity_start(void) {
+    if (gRunning || gActivityTask != NULL) { // a stopped task may still be cleaning up
+        return ESP_ERR_INVALID_STATE;
+    }
+    const activity_config_t config = {
+        .interval_ms = CONFIG_ACTIVITY_INTERVAL_MS,
+        .window_ms = CONFIG_ACTIVITY_WINDOW_S * 1000,
+        .walkCadence_spm = CONFIG_ACTIVITY_WALK_CADENCE,
+        .runCadence_spm = CONFIG_ACTIVITY_RUN_CADENCE,
+        .summary_ms = CONFIG_ACTIVITY_SUMMARY_S * 1000,
+    };
+    esp_err_t err = activity_init(&gActivity, &config);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    ICM42688P_start_measurement();
+    gRunning = true;
+    if (xTaskCreate(activity_task, "activity", ACTIVITY_TASK_STACKSIZE, NULL, ACTIVITY_TASK_PRIORITY, &gActivityTask) != pdPASS) {
+        gRunning = false;
+        ICM42688P_stop_measurement();
+        activity_deinit(&gActivity);
+        ESP_LOGE(TAG, "Failed to create activity task");
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Activity tracking started, summary every %d s", CONFIG_ACTIVITY_SUMMARY_S);
+    return ESP_OK;
+}
+
+// The task finishes its current read and cleans up on its own
+void activity_stop(void) {
+    gRunning = false;
+}
@@ -0,0 +1,202 @@
+#include <math.h>
+#include <string.h>
+
+#include "host_test.h"
+#include "activity.h"
+
+// Synthetic step streams through the engine, one update every 100 ms like the activity task
+
+#define INTERVAL_MS     100
+
+typedef struct {
+    activity_t activity;
+    int64_t now_ms;
+    double steps;           // true steps, the sensor reports them truncated and wrapped
+    uint16_t offset;        // raw counter value at the start
+    uint32_t events;        // all events since the last check
+    activity_report_t report;
+    activity_report_t stateReport;  // last report with ACTIVITY_EVENT_STATE
+    int64_t stateAt_ms;
+    uint32_t stateEvents;
+    uint32_t summaries;
+} walker_t;
+
+static void walker_init(walker_t* pWalker, uint32_t summary_ms, uint16_t offset) {
+    memset(pWalker, 0, sizeof(walker_t));
+    const activity_config_t config = { .interval_ms = INTERVAL_MS, .summary_ms = summary_ms };
+    CHECK_EQ(activity_init(&pWalker->activity, &config), ESP_OK);
+    pWalker->offset = offset;
+}
+
+// Walks for duration_ms at the cadence, the accelerometer reads magnitude_g
+static void walk(walker_t* pWalker, int64_t duration_ms, float cadence_spm, float magnitude_g) {
+    for (int64_t end_ms = pWalker->now_ms + duration_ms; pWalker->now_ms < end_ms; pWalker->now_ms += INTERVAL_MS) {
+        uint16_t raw = (uint16_t)(pWalker->offset + (uint32_t)pWalker->steps);
+        uint32_t events = activity_update(&pWalker->activity, pWalker->now_ms, raw, magnitude_g, &pWalker->report);
+        if (events & ACTIVITY_EVENT_STATE) {
+            pWalker->stateReport = pWalker->report;
+            pWalker->stateAt_ms = pWalker->now_ms;
+            pWalker->stateEvents++;
+        }
+        if (events & ACTIVITY_EVENT_SUMMARY) {
+            pWalker->summaries++;
+        }
+        pWalker->events |= events;
+        pWalker->steps += cadence_spm * INTERVAL_MS / 60000.0;
+    }
+}
+
+static void test_first_update(void) {
+    walker_t walker;
+    walker_init(&walker, 0, 500);
+    walk(&walker, INTERVAL_MS, 0.0f, 1.0f);
+    CHECK_EQ(walker.events, ACTIVITY_EVENT_STATE);
+    CHECK_EQ(walker.stateReport.state, ACTIVITY_IDLE);
+    CHECK_EQ(walker.stateReport.totalSteps, 0); // the counter value before the start is not counted
+    activity_deinit(&walker.activity);
+}
+
+// The 16 bit counter wraps while walking, the total keeps counting
+static void test_unwrap(void) {
+    walker_t walker;
+    walker_init(&walker, 0, 65500);
+    walk(&walker, 60000, 120.0f, 1.1f);
+    CHECK_EQ(walker.activity.totalSteps, 119);
+    CHECK_EQ(walker.activity.counterResets, 0);
+    CHECK(walker.activity.lastRaw < 65500); // wrapped
+
+    // A sensor reset drops the counter to 0, only the baseline moves
+    activity_t* pActivity = &walker.activity;
+    uint32_t total = pActivity->totalSteps;
+    activity_update(pActivity, walker.now_ms, 0, 1.0f, NULL);
+    CHECK_EQ(pActivity->totalSteps, total);
+    CHECK_EQ(pActivity->counterResets, 1);
+    activity_update(pActivity, walker.now_ms + INTERVAL_MS, 3, 1.0f, NULL);
+    CHECK_EQ(pActivity->totalSteps, total + 3);
+
+    // A burst the pedometer reports at once is plausible, more is a reset
+    activity_update(pActivity, walker.now_ms + 2 * INTERVAL_MS, 3 + ACTIVITY_MAX_STEP_BURST, 1.0f, NULL);
+    CHECK_EQ(pActivity->totalSteps, total + 3 + ACTIVITY_MAX_STEP_BURST);
+    activity_update(pActivity, walker.now_ms + 3 * INTERVAL_MS, 3 + 3 * ACTIVITY_MAX_STEP_BURST, 1.0f, NULL);
+    CHECK_EQ(pActivity->totalSteps, total + 3 + ACTIVITY_MAX_STEP_BURST);
+    CHECK_EQ(pActivity->counterResets, 2);
+
+    // After a long gap, e.g. missed reads, many steps are plausible
+    activity_update(pActivity, walker.now_ms + 60000, 3 + 3 * ACTIVITY_MAX_STEP_BURST + 200, 1.0f, NULL);
+    CHECK_EQ(pActivity->totalSteps, total + 3 + ACTIVITY_MAX_STEP_BURST + 200);
+    activity_deinit(pActivity);
+}
+
+// Idle, walking, running by cadence and by intensity, and back to idle
+static void test_classification(void) {
+    walker_t walker;
+    walker_init(&walker, 0, 0);
+    walk(&walker, 20000, 100.0f, 1.2f);
+    CHECK_EQ(walker.stateEvents, 2);
+    CHECK_EQ(walker.stateReport.state, ACTIVITY_WALK);
+    CHECK_EQ(walker.stateReport.previous, ACTIVITY_IDLE);
+    // Classified once the window spans 2 s, reported after the 3 s hold
+    CHECK_EQ(walker.stateAt_ms, ACTIVITY_MIN_SPAN_MS + ACTIVITY_DEFAULT_HOLD_MS);
+    CHECK(fabsf(walker.activity.cadence_spm - 100.0f) < 5.0f);
+    CHECK(fabsf(walker.activity.intensity_g - 0.2f) < 0.01f);
+
+    walk(&walker, 20000, 160.0f, 1.2f);
+    CHECK_EQ(walker.stateReport.state, ACTIVITY_RUN);
+    CHECK_EQ(walker.stateReport.previous, ACTIVITY_WALK);
+
+    // A slower pace with strong impacts still counts as running
+    walk(&walker, 20000, 110.0f, 1.0f);
+    CHECK_EQ(walker.stateReport.state, ACTIVITY_WALK);
+    walk(&walker, 20000, 110.0f, 1.8f);
+    CHECK_EQ(walker.stateReport.state, ACTIVITY_RUN);
+    CHECK_EQ(walker.stateEvents, 5);
+
+    // The intensity drops below the running level before the cadence drops below walking
+    walk(&walker, 20000, 0.0f, 1.0f);
+    CHECK_EQ(walker.stateReport.state, ACTIVITY_IDLE);
+    CHECK_EQ(walker.stateReport.previous, ACTIVITY_WALK);
+    CHECK_EQ(walker.stateEvents, 7);
+    CHECK_EQ(walker.activity.cadence_spm, 0.0f);
+    activity_deinit(&walker.activity);
+}
+
+// A stop shorter than the hold time is not reported
+static void test_hold(void) {
+    walker_t walker;
+    walker_init(&walker, 0, 0);
+    // A short window, so a stop shows in the cadence right away
+    activity_deinit(&walker.activity);
+    const activity_config_t config = { .interval_ms = INTERVAL_MS, .window_ms = 3000 };
+    CHECK_EQ(activity_init(&walker.activity, &config), ESP_OK);
+
+    walk(&walker, 20000, 100.0f, 1.1f);
+    CHECK_EQ(walker.stateReport.state, ACTIVITY_WALK);
+    uint32_t stateEvents = walker.stateEvents;
+
+    // Idle while the 2 s stop fills most of the window, for about 2 s
+    walk(&walker, 2000, 0.0f, 1.0f);
+    CHECK_EQ(walker.activity.candidate, ACTIVITY_IDLE);
+    walk(&walker, 20000, 100.0f, 1.1f);
+    CHECK_EQ(walker.activity.state, ACTIVITY_WALK);
+    CHECK_EQ(walker.stateEvents, stateEvents);
+
+    walk(&walker, 20000, 0.0f, 1.0f);
+    CHECK_EQ(walker.activity.state, ACTIVITY_IDLE);
+    CHECK_EQ(walker.stateEvents, stateEvents + 1);
+    activity_deinit(&walker.activity);
+}
+
+static void test_summary(void) {
+    walker_t walker;
+    walker_init(&walker, 60000, 100);
+    walk(&walker, 30000, 0.0f, 1.0f);
+    walk(&walker, 30000 + INTERVAL_MS, 120.0f, 1.1f);
+    CHECK_EQ(walker.summaries, 1);
+
+    const activity_summary_t* pSummary = &walker.report.summary;
+    CHECK_EQ(pSummary->start_ms, 0);
+    CHECK_EQ(pSummary->end_ms, 60000);
+    CHECK(pSummary->steps >= 59 && pSummary->steps <= 60);
+    CHECK(fabsf(pSummary->cadence_spm - 60.0f) < 1.0f);
+    CHECK(pSummary->peakCadence_spm >= 110.0f);
+    CHECK_EQ(pSummary->time_ms[ACTIVITY_IDLE] + pSummary->time_ms[ACTIVITY_WALK] + pSummary->time_ms[ACTIVITY_RUN], 60000);
+    CHECK(pSummary->time_ms[ACTIVITY_WALK] > 20000);
+
+    // The next period starts empty
+    walk(&walker, 60000, 120.0f, 1.1f);
+    CHECK_EQ(walker.summaries, 2);
+    CHECK_EQ(walker.report.summary.start_ms, 60000);
+    CHECK_EQ(walker.report.summary.time_ms[ACTIVITY_IDLE], 0);
+    activity_deinit(&walker.activity);
+}
+
+static void test_format(void) {
+    activity_report_t report = {
+        .state = ACTIVITY_WALK,
+        .previous = ACTIVITY_IDLE,
+        .totalSteps = 1234,
+        .cadence_spm = 104.5f,
+        .intensity_g = 0.21f,
+        .summary = { .start_ms = 0, .end_ms = 60000, .steps = 120, .cadence_spm = 120.0f, .peakCadence_spm = 121.0f,
+                     .time_ms = { 12300, 47700, 0 } },
+    };
+    char buf[ACTIVITY_MAX_MESSAGE_SIZE];
+    const char* state = "{\"state\":\"walk\",\"previous\":\"idle\",\"steps\":1234,\"cadence\":104.5,\"intensity\":0.21}";
+    CHECK_EQ(activity_format_state(buf, sizeof(buf), &report), strlen(state));
+    CHECK(strcmp(buf, state) == 0);
+    const char* summary = "{\"steps\":120,\"duration\":60.0,\"cadence\":120.0,\"peak_cadence\":121.0,"
+                          "\"idle\":12.3,\"walk\":47.7,\"run\":0.0,\"total\":1234}";
+    CHECK_EQ(activity_format_summary(buf, sizeof(buf), &report), strlen(summary));
+    CHECK(strcmp(buf, summary) == 0);
+    CHECK(strcmp(activity_state_name(ACTIVITY_STATE_COUNT), "unknown") == 0);
+}
+
+int main(void) {
+    RUN_TEST(test_first_update);
+    RUN_TEST(test_unwrap);
+    RUN_TEST(test_classification);
+    RUN_TEST(test_hold);
+    RUN_TEST(test_summary);
+    RUN_TEST(test_format);
+    return host_test_result();
+}
@@ -0,0 +1,107 @@
+#ifndef ACTIVITY_H
+#define ACTIVITY_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#include "ringbuffer.h"
+
+// Activity analytics on top of the pedometer. The engine takes the raw 16 bit step counter and the
+// accelerometer magnitude, and derives the total step count, the cadence and whether the wearer is
+// idle, walking or running. It only reports state changes and periodic summaries, so the network
+// sees a few messages per minute instead of every sample.
+//
+// activity.c has no dependencies on the sensor or the network and runs on the host,
+// activity_task.c connects it to the ICM42688P and MQTT. One instance per sensor, not thread-safe.
+
+#define ACTIVITY_DEFAULT_INTERVAL_MS        100
+#define ACTIVITY_DEFAULT_WINDOW_MS          10000
+#define ACTIVITY_DEFAULT_WALK_CADENCE       50.0f   // steps per minute
+#define ACTIVITY_DEFAULT_RUN_CADENCE        140.0f
+#define ACTIVITY_DEFAULT_RUN_INTENSITY      0.6f    // g
+#define ACTIVITY_DEFAULT_HOLD_MS            3000
+#define ACTIVITY_MIN_SPAN_MS                2000    // shorter windows give no cadence
+#define ACTIVITY_MAX_STEP_RATE              8       // steps per second, more means a counter reset
+#define ACTIVITY_MAX_STEP_BURST             16      // steps the pedometer may report at once
+#define ACTIVITY_MAX_MESSAGE_SIZE           192
+
+#define ACTIVITY_EVENT_STATE                0x01
+#define ACTIVITY_EVENT_SUMMARY              0x02
+
+typedef enum {
+    ACTIVITY_IDLE,
+    ACTIVITY_WALK,
+    ACTIVITY_RUN,
+    ACTIVITY_STATE_COUNT
+} activity_state_t;
+
+typedef struct {
+    uint32_t interval_ms;       // time between updates, sizes the window
+    uint32_t window_ms;         // span of cadence and intensity
+    float walkCadence_spm;      // cadence from which the wearer walks
+    float runCadence_spm;       // cadence from which the wearer runs
+    float runIntensity_g;       // intensity from which walking counts as running
+    uint32_t hold_ms;           // a new state must last this long before it is reported
+    uint32_t summary_ms;        // period of the summaries, 0 = none
+} activity_config_t;
+
+// One update in the window
+typedef struct {
+    int64_t timestamp_ms;
+    uint32_t steps;             // unwrapped total
+    float intensity_g;          // deviation of the accelerometer magnitude from 1 g
+} activity_entry_t;
+
+typedef struct {
+    int64_t start_ms;
+    int64_t end_ms;
+    uint32_t steps;
+    float cadence_spm;          // steps over the whole period
+    float peakCadence_spm;      // highest window cadence
+    uint32_t time_ms[ACTIVITY_STATE_COUNT];
+} activity_summary_t;
+
+typedef struct {
+    activity_state_t state;
+    activity_state_t previous;
+    int64_t timestamp_ms;
+    uint32_t totalSteps;
+    float cadence_spm;
+    float intensity_g;
+    activity_summary_t summary; // valid with ACTIVITY_EVENT_SUMMARY
+} activity_report_t;
+
+typedef struct {
+    activity_config_t config;
+    RingbufferHandle window;
+    uint32_t windowSize;
+    uint32_t windowCount;
+    double intensitySum;        // over the entries in the window
+    bool started;
+    uint16_t lastRaw;
+    int64_t lastTimestamp_ms;
+    uint32_t totalSteps;
+    uint32_t counterResets;
+    activity_state_t state;
+    activity_state_t candidate;
+    int64_t candidateSince_ms;
+    float cadence_spm;
+    float intensity_g;
+    activity_summary_t summary; // running period
+} activity_t;
+
+esp_err_t activity_init(activity_t* pActivity, const activity_config_t* pConfig);
+void activity_deinit(activity_t* pActivity);
+void activity_reset(activity_t* pActivity);
+uint32_t activity_update(activity_t* pActivity, int64_t timestamp_ms, uint16_t rawSteps, float accelMagnitude_g, activity_report_t* pReport);
+const char* activity_state_name(activity_state_t state);
+int activity_format_state(char* buf, size_t size, const activity_report_t* pReport);
+int activity_format_summary(char* buf, size_t size, const activity_report_t* pReport);
+
+// Connects the engine to the sensor and publishes to CONFIG_ACTIVITY_TOPIC over MQTT
+esp_err_t activity_start(void);
+void activity_stop(void);
+
+#endif // ACTIVITY_H
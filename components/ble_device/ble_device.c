@@ -1,9 +1,34 @@
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "host/ble_hs.h"
+
 #include "ble_device.h"
 
+// ########## types ##########
+// The subscriptions to the button and stream characteristics, the MTU and the outbound queue of a
+// connection are kept by the streams, under the same handle
+typedef struct {
+    bool used;
+    uint16_t connHandle;
+    bool linkNotify;
+    ble_link_info_t link;                       // MTU and the parameters granted
+    esp_timer_handle_t linkTimer;               // applies the profile once discovery is done
+} ble_connection_t;
+
 // ########## prototypes ##########
 static void printAddr(const uint8_t* addr);
 static int handleGAPEvent(struct ble_gap_event *event, void *arg);
 static void enableAdvertising(void);
+static ble_connection_t* findConnection(uint16_t connHandle);
+static ble_connection_t* addConnection(uint16_t connHandle);
+static void removeConnection(uint16_t connHandle);
+static int sendNotification(void* ctx, uint16_t connHandle, const uint8_t* data, uint16_t len);
+static void onFlushTimer(void* arg);
+static void armFlushTimer(void);
+static void pollStreams(void);
+static void onLinkTimer(void* arg);
+static void applyLink(uint16_t connHandle);
+static void notifyLink(uint16_t connHandle);
 
 // ########## globals ##########
 static const char *TAG = "BLE_DEVICE";
@@ -16,9 +41,27 @@ extern uint8_t gLeftButtonstatus;
 extern uint8_t gRightButtonstatus;
 
 static uint8_t gAddrType;
-static uint16_t gConnectionHandle;
-static bool gNotifyState;
 static uint16_t gButtonValueHandle;
+static uint16_t gStreamValueHandle;
+static uint16_t gLinkValueHandle;
+
+// One entry per central, guarded by gLock like the streams. The streams send while it is held,
+// nothing NimBLE calls back synchronously from a send may take it.
+static ble_connection_t gConnections[BLE_DEVICE_MAX_CONNECTIONS];
+static SemaphoreHandle_t gLock = NULL;
+
+// Notifications are packed by the streams, one per characteristic, and shared by all subscribers
+static ble_stream_t gButtonStream;
+static ble_stream_t gDataStream;
+static esp_timer_handle_t gFlushTimer = NULL;
+
+#if CONFIG_BLE_LINK_PROFILE_HIGH_THROUGHPUT
+static ble_link_profile_t gLinkProfile = BLE_LINK_HIGH_THROUGHPUT;
+#elif CONFIG_BLE_LINK_PROFILE_LOW_POWER
+static ble_link_profile_t gLinkProfile = BLE_LINK_LOW_POWER;
+#else
+static ble_link_profile_t gLinkProfile = BLE_LINK_LOW_LATENCY;
+#endif
 
 // ########## implementation ##########
 
@@ -52,6 +95,54 @@ esp_err_t gattCharacteristicAccessButton(uint16_t connHandle, uint16_t attrHandl
     return rc;
 }
 
+// The stream has no value of its own, it only carries notifications
+esp_err_t gattCharacteristicAccessStream(uint16_t connHandle, uint16_t attrHandle, struct ble_gatt_access_ctxt* ctxt, void* arg) {
+    return BLE_ATT_ERR_READ_NOT_PERMITTED;
+}
+
+// Reads the link parameters of the calling connection, a one byte write selects its profile
+esp_err_t gattCharacteristicAccessLink(uint16_t connHandle, uint16_t attrHandle, struct ble_gatt_access_ctxt* ctxt, void* arg) {
+    if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
+        uint8_t profile;
+        if (OS_MBUF_PKTLEN(ctxt->om) != 1 || os_mbuf_copydata(ctxt->om, 0, 1, &profile) != 0) {
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        }
+        if (ble_link_get_params(profile) == NULL) {
+            return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+        }
+        xSemaphoreTake(gLock, portMAX_DELAY);
+        ble_connection_t* pConn = findConnection(connHandle);
+        bool pending = true;
+        if (pConn != NULL) {
+            pConn->link.profile = profile;
+            pending = esp_timer_is_active(pConn->linkTimer);
+        }
+        xSemaphoreGive(gLock);
+        if (pConn == NULL) {
+            return BLE_ATT_ERR_UNLIKELY;
+        }
+        if (!pending) {
+            applyLink(connHandle);
+        }
+        return 0;
+    }
+
+    uint8_t value[BLE_LINK_INFO_SIZE];
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    ble_connection_t* pConn = findConnection(connHandle);
+    if (pConn != NULL) {
+        ble_link_encode(&pConn->link, value);
+    }
+    xSemaphoreGive(gLock);
+    if (pConn == NULL) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+    if (os_mbuf_append(ctxt->om, value, sizeof(value)) != 0) {
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+    return 0;
+}
+
 static const struct ble_gatt_svc_def gGATTServices[] = {
     {
         .type = BLE_GATT_SVC_TYPE_PRIMARY,
@@ -62,6 +153,18 @@ static const struct ble_gatt_svc_def gGATTServices[] = {
                 .access_cb = gattCharacteristicAccessButton,
                 .val_handle = &gButtonValueHandle,
                 .flags = BLE_GATT_CHR_F_NOTIFY | BLE_GATT_CHR_F_READ,
+            }, {
+                /* Characteristic: packed records, see ble_device_stream() */
+                .uuid = BLE_UUID128_DECLARE(GATT_CUSTOM_STREAM_UUID),
+                .access_cb = gattCharacteristicAccessStream,
+                .val_handle = &gStreamValueHandle,
+                .flags = BLE_GATT_CHR_F_NOTIFY,
+            }, {
+                /* Characteristic: link profile and parameters, see ble_link.h */
+                .uuid = BLE_UUID128_DECLARE(GATT_CUSTOM_LINK_UUID),
+                .access_cb = gattCharacteristicAccessLink,
+                .val_handle = &gLinkValueHandle,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY,
             }, {
                 0, /* No more characteristics in this service */
             },
@@ -100,6 +203,10 @@ void printAddr(const uint8_t* addr) {
 }
 
 int handleGAPEvent(struct ble_gap_event *event, void *arg) {
+    ble_connection_t* pConn;
+    uint16_t connHandle;
+    bool changed = false;
+
     switch (event->type) {
         case BLE_GAP_EVENT_CONNECT:
             // A new connection was established or a connection attempt failed
@@ -107,13 +214,29 @@ int handleGAPEvent(struct ble_gap_event *event, void *arg) {
             if (event->connect.status != 0) {
                 // Connection failed; resume advertising
                 enableAdvertising();
+                break;
             }
-            gConnectionHandle = event->connect.conn_handle;
+            connHandle = event->connect.conn_handle;
+            xSemaphoreTake(gLock, portMAX_DELAY);
+            pConn = addConnection(connHandle);
+            xSemaphoreGive(gLock);
+            if (pConn == NULL) {
+                MODLOG_DFLT(WARN, "no room for conn_handle=%d\n", connHandle);
+                ble_gap_terminate(connHandle, BLE_ERR_CONN_LIMIT);
+                break;
+            }
+            // Ask for the larger MTU right away, instead of waiting for the client to do it
+            ble_gattc_exchange_mtu(connHandle, NULL, NULL);
+            esp_timer_start_once(pConn->linkTimer, BLE_LINK_UPDATE_DELAY_MS * 1000);
+            // Stays visible for further centrals as long as there is room
+            enableAdvertising();
             break;
 
         case BLE_GAP_EVENT_DISCONNECT:
-            MODLOG_DFLT(INFO, "disconnect; reason=%d\n", event->disconnect.reason);
-            gConnectionHandle = 0;
+            MODLOG_DFLT(INFO, "disconnect; conn_handle=%d reason=%d\n", event->disconnect.conn.conn_handle, event->disconnect.reason);
+            xSemaphoreTake(gLock, portMAX_DELAY);
+            removeConnection(event->disconnect.conn.conn_handle);
+            xSemaphoreGive(gLock);
             // Connection terminated; resume advertising
             enableAdvertising();
             break;
@@ -124,17 +247,91 @@ int handleGAPEvent(struct ble_gap_event *event, void *arg) {
             break;
 
         case BLE_GAP_EVENT_SUBSCRIBE:
-            MODLOG_DFLT(INFO, "subscribe event\n cur_notify=%d\n val_handle=%d\n", event->subscribe.cur_notify, gButtonValueHandle);
-            if (event->subscribe.attr_handle == gButtonValueHandle) {
-                gNotifyState = event->subscribe.cur_notify;
-            } else if (event->subscribe.attr_handle != gButtonValueHandle) {
-                gNotifyState = event->subscribe.cur_notify;
+            MODLOG_DFLT(INFO, "subscribe event\n conn_handle=%d\n cur_notify=%d\n attr_handle=%d\n",
+                        event->subscribe.conn_handle, event->subscribe.cur_notify, event->subscribe.attr_handle);
+            xSemaphoreTake(gLock, portMAX_DELAY);
+            pConn = findConnection(event->subscribe.conn_handle);
+            if (pConn != NULL) {
+                bool notify = event->subscribe.cur_notify;
+                if (event->subscribe.attr_handle == gButtonValueHandle) {
+                    ble_stream_subscribe(&gButtonStream, pConn->connHandle, notify);
+                } else if (event->subscribe.attr_handle == gStreamValueHandle) {
+                    ble_stream_subscribe(&gDataStream, pConn->connHandle, notify);
+                } else if (event->subscribe.attr_handle == gLinkValueHandle) {
+                    pConn->linkNotify = notify;
+                }
             }
-            ESP_LOGI("BLE_GAP_SUBSCRIBE_EVENT", "conn_handle from subscribe=%d", gConnectionHandle);
+            xSemaphoreGive(gLock);
             break;
 
         case BLE_GAP_EVENT_MTU:
             MODLOG_DFLT(INFO, "mtu update event; conn_handle=%d mtu=%d\n", event->mtu.conn_handle, event->mtu.value);
+            xSemaphoreTake(gLock, portMAX_DELAY);
+            pConn = findConnection(event->mtu.conn_handle);
+            if (pConn != NULL) {
+                ble_stream_set_mtu(&gButtonStream, pConn->connHandle, event->mtu.value);
+                ble_stream_set_mtu(&gDataStream, pConn->connHandle, event->mtu.value);
+                changed = ble_link_refresh(pConn->connHandle, &pConn->link);
+            }
+            xSemaphoreGive(gLock);
+            if (changed) {
+                notifyLink(event->mtu.conn_handle);
+            }
+            break;
+
+        case BLE_GAP_EVENT_CONN_UPDATE:
+            MODLOG_DFLT(INFO, "connection updated; conn_handle=%d status=%d\n", event->conn_update.conn_handle, event->conn_update.status);
+            xSemaphoreTake(gLock, portMAX_DELAY);
+            pConn = findConnection(event->conn_update.conn_handle);
+            if (pConn != NULL) {
+                pConn->link.status = (uint8_t)event->conn_update.status;
+                ble_link_refresh(pConn->connHandle, &pConn->link);
+            }
+            xSemaphoreGive(gLock);
+            notifyLink(event->conn_update.conn_handle);
+            break;
+
+#if CONFIG_BT_NIMBLE_50_FEATURE_SUPPORT
+        case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+            MODLOG_DFLT(INFO, "phy update; conn_handle=%d status=%d tx=%d rx=%d\n", event->phy_updated.conn_handle,
+                        event->phy_updated.status, event->phy_updated.tx_phy, event->phy_updated.rx_phy);
+            if (event->phy_updated.status != 0) {
+                break;
+            }
+            xSemaphoreTake(gLock, portMAX_DELAY);
+            pConn = findConnection(event->phy_updated.conn_handle);
+            if (pConn != NULL) {
+                pConn->link.txPhy = event->phy_updated.tx_phy;
+                pConn->link.rxPhy = event->phy_updated.rx_phy;
+            }
+            xSemaphoreGive(gLock);
+            notifyLink(event->phy_updated.conn_handle);
+            break;
+#endif
+
+#ifdef BLE_GAP_EVENT_DATA_LEN_CHG
+        case BLE_GAP_EVENT_DATA_LEN_CHG:
+            MODLOG_DFLT(INFO, "data length; conn_handle=%d tx=%d rx=%d\n", event->data_len_chg.conn_handle,
+                        event->data_len_chg.max_tx_octets, event->data_len_chg.max_rx_octets);
+            xSemaphoreTake(gLock, portMAX_DELAY);
+            pConn = findConnection(event->data_len_chg.conn_handle);
+            if (pConn != NULL) {
+                pConn->link.txOctets = event->data_len_chg.max_tx_octets;
+                pConn->link.rxOctets = event->data_len_chg.max_rx_octets;
+            }
+            xSemaphoreGive(gLock);
+            notifyLink(event->data_len_chg.conn_handle);
+            break;
+#endif
+
+        case BLE_GAP_EVENT_NOTIFY_TX:
+            // A notification left, its buffers are free again for the ones held back. NimBLE reports
+            // this from within ble_gattc_notify_custom(), while a stream sends under gLock, so the
+            // poll runs on the flush timer instead of here.
+            if (event->notify_tx.status == 0) {
+                esp_timer_stop(gFlushTimer);
+                esp_timer_start_once(gFlushTimer, 0);
+            }
             break;
     }
     return 0;
@@ -149,6 +346,20 @@ void enableAdvertising() {
     struct ble_hs_adv_fields fields;
     int rc;
 
+    if (ble_gap_adv_active()) {
+        return;
+    }
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    uint8_t connections = 0;
+    for (uint8_t i = 0; i < BLE_DEVICE_MAX_CONNECTIONS; i++) {
+        connections += gConnections[i].used ? 1 : 0;
+    }
+    xSemaphoreGive(gLock);
+    if (connections >= BLE_DEVICE_MAX_CONNECTIONS) {
+        MODLOG_DFLT(INFO, "all %d connections in use, not advertising\n", BLE_DEVICE_MAX_CONNECTIONS);
+        return;
+    }
+
     /*  Set the advertisement data included in our advertisements:
      *     o Flags (indicates advertisement type and other general info)
      *     o Advertising tx power
@@ -228,10 +439,52 @@ esp_err_t initGATTServer() {
 
 esp_err_t ble_device_init() {
     esp_err_t rc = ESP_OK;
+    const ble_stream_config_t buttonConfig = {
+        .recordSize = sizeof(int16_t), // one button value per record, as the characteristic reads
+        .flushMs = CONFIG_BLE_STREAM_FLUSH_MS,
+        .poolSize = 2,
+        .maxPeers = BLE_DEVICE_MAX_CONNECTIONS,
+        .send = sendNotification,
+        .ctx = &gButtonValueHandle,
+    };
+    const ble_stream_config_t dataConfig = {
+        .recordSize = 0,
+        .flushMs = CONFIG_BLE_STREAM_FLUSH_MS,
+        .poolSize = CONFIG_BLE_STREAM_POOL_SIZE,
+        .maxPeers = BLE_DEVICE_MAX_CONNECTIONS,
+        .send = sendNotification,
+        .ctx = &gStreamValueHandle,
+    };
+    const esp_timer_create_args_t timerArgs = {
+        .callback = onFlushTimer,
+        .name = "ble_flush",
+    };
+    gLock = xSemaphoreCreateMutex();
+    if (gLock == NULL
+        || ble_stream_init(&gButtonStream, &buttonConfig) != BLE_STREAM_SUCCESS
+        || ble_stream_init(&gDataStream, &dataConfig) != BLE_STREAM_SUCCESS) {
+        return ESP_ERR_NO_MEM;
+    }
+    if ((rc = esp_timer_create(&timerArgs, &gFlushTimer)) != ESP_OK) {
+        return rc;
+    }
+    // One link timer per connection, each knows its table entry
+    for (uint8_t i = 0; i < BLE_DEVICE_MAX_CONNECTIONS; i++) {
+        const esp_timer_create_args_t linkTimerArgs = {
+            .callback = onLinkTimer,
+            .arg = &gConnections[i],
+            .name = "ble_link",
+        };
+        if ((rc = esp_timer_create(&linkTimerArgs, &gConnections[i].linkTimer)) != ESP_OK) {
+            return rc;
+        }
+    }
+
     // Initialize NimBLE
     nimble_port_init();
     ble_hs_cfg.sync_cb = onSync;
     ble_hs_cfg.reset_cb = onReset;
+    ble_att_set_preferred_mtu(BLE_STREAM_MAX_PAYLOAD + BLE_STREAM_ATT_HEADER);
 
     if ((rc = initGATTServer()) != ESP_OK) {
         return rc;
@@ -251,12 +504,261 @@ void ble_device_start() {
     nimble_port_freertos_init(bleHostTaskMain);
 }
 
+// ########## Connections ##########
+
+// All of these expect gLock to be held
+ble_connection_t* findConnection(uint16_t connHandle) {
+    for (uint8_t i = 0; i < BLE_DEVICE_MAX_CONNECTIONS; i++) {
+        if (gConnections[i].used && gConnections[i].connHandle == connHandle) {
+            return &gConnections[i];
+        }
+    }
+    return NULL;
+}
+
+// A new central starts without subscriptions, at the default MTU and with the configured profile
+ble_connection_t* addConnection(uint16_t connHandle) {
+    for (uint8_t i = 0; i < BLE_DEVICE_MAX_CONNECTIONS; i++) {
+        ble_connection_t* pConn = &gConnections[i];
+        if (pConn->used) {
+            continue;
+        }
+        if (ble_stream_add_peer(&gButtonStream, connHandle) != BLE_STREAM_SUCCESS
+            || ble_stream_add_peer(&gDataStream, connHandle) != BLE_STREAM_SUCCESS) {
+            ble_stream_remove_peer(&gButtonStream, connHandle);
+            return NULL;
+        }
+        pConn->used = true;
+        pConn->connHandle = connHandle;
+        pConn->linkNotify = false;
+        ble_link_reset(&pConn->link, gLinkProfile);
+        ble_link_refresh(connHandle, &pConn->link);
+        ESP_LOGI(TAG, "conn %u uses slot %u of %d", connHandle, i, BLE_DEVICE_MAX_CONNECTIONS);
+        return pConn;
+    }
+    return NULL;
+}
+
+// Drops whatever the connection still had queued, the packets are free for the others
+void removeConnection(uint16_t connHandle) {
+    ble_connection_t* pConn = findConnection(connHandle);
+    if (pConn == NULL) {
+        return;
+    }
+    esp_timer_stop(pConn->linkTimer);
+    ble_stream_remove_peer(&gButtonStream, connHandle);
+    ble_stream_remove_peer(&gDataStream, connHandle);
+    pConn->used = false;
+}
+
+/*
+ * @brief Lists the connected centrals
+ *
+ * @return number of handles written, at most max
+ */
+uint8_t ble_device_get_connections(uint16_t* handles, uint8_t max) {
+    uint8_t count = 0;
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    for (uint8_t i = 0; i < BLE_DEVICE_MAX_CONNECTIONS && count < max; i++) {
+        if (gConnections[i].used) {
+            handles[count++] = gConnections[i].connHandle;
+        }
+    }
+    xSemaphoreGive(gLock);
+    return count;
+}
+
+// ########## Notification streams ##########
+
+// Out of buffers is not an error, the stream keeps the packet for this connection and tries again
+int sendNotification(void* ctx, uint16_t connHandle, const uint8_t* data, uint16_t len) {
+    uint16_t attrHandle = *(const uint16_t*)ctx;
+    struct os_mbuf* om = ble_hs_mbuf_from_flat(data, len);
+    if (om == NULL) {
+        return BLE_STREAM_RETRY;
+    }
+    int rc = ble_gattc_notify_custom(connHandle, attrHandle, om); // frees om in any case
+    if (rc == BLE_HS_ENOMEM) {
+        return BLE_STREAM_RETRY;
+    }
+    if (rc != 0) {
+        MODLOG_DFLT(WARN, "notify failed; conn_handle=%d attr_handle=%d rc=%d\n", connHandle, attrHandle, rc);
+        return -1;
+    }
+    return 0;
+}
+
+// Polls both streams and schedules the next poll while anything waits
+void pollStreams() {
+    int64_t now_ms = esp_timer_get_time() / 1000;
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    int64_t wait_ms = ble_stream_poll(&gButtonStream, now_ms);
+    int64_t dataWait_ms = ble_stream_poll(&gDataStream, now_ms);
+    bool pending = ble_stream_is_pending(&gButtonStream) || ble_stream_is_pending(&gDataStream);
+    xSemaphoreGive(gLock);
+
+    if (dataWait_ms < wait_ms) {
+        wait_ms = dataWait_ms;
+    }
+    if (pending) {
+        esp_timer_stop(gFlushTimer);
+        esp_timer_start_once(gFlushTimer, wait_ms * 1000);
+    }
+}
+
+void onFlushTimer(void* arg) {
+    pollStreams();
+}
+
+// Started by the first record that waits, the timer then keeps itself going until all are sent
+void armFlushTimer() {
+    if (!esp_timer_is_active(gFlushTimer)) {
+        esp_timer_start_once(gFlushTimer, CONFIG_BLE_STREAM_FLUSH_MS * 1000);
+    }
+}
+
+// Button values that follow each other within CONFIG_BLE_STREAM_FLUSH_MS share a notification,
+// which goes to every subscribed central
 void ble_device_notify(int16_t data) {
-    if (!gNotifyState) { // only if notification is on
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    int rc = ble_stream_send(&gButtonStream, (const uint8_t*)&data, sizeof(data), esp_timer_get_time() / 1000);
+    xSemaphoreGive(gLock);
+    if (rc == BLE_STREAM_ERROR_NO_PEER) { // nobody listens
+        return;
+    }
+    if (rc != BLE_STREAM_SUCCESS) {
+        ESP_LOGW(TAG, "Button notification dropped: %d", rc);
         return;
     }
+    armFlushTimer();
+}
 
-    struct os_mbuf* om = ble_hs_mbuf_from_flat(&data, sizeof(data));
-    esp_err_t rc = ble_gattc_notify_custom(gConnectionHandle, gButtonValueHandle, om);
-    assert(rc == 0);
-}
\ No newline at end of file
+/*
+ * @brief Queues one record, e.g. an IMU sample or an event frame, for the stream characteristic
+ *
+ *  Records are packed as [length][record] into notifications as large as the smallest MTU of the
+ *  subscribers allows. Each notification is built once and sent to every subscriber.
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_STATE without a subscriber, ESP_ERR_INVALID_SIZE if the
+ *  record does not fit into a notification, ESP_ERR_NO_MEM while the slowest subscriber holds all
+ *  packets of the pool, the caller should back off and retry or drop the record
+ */
+esp_err_t ble_device_stream(const uint8_t* data, size_t len) {
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    int rc = ble_stream_send(&gDataStream, data, len, esp_timer_get_time() / 1000);
+    xSemaphoreGive(gLock);
+    if (rc == BLE_STREAM_ERROR_NO_PEER) {
+        return ESP_ERR_INVALID_STATE;
+    } else if (rc == BLE_STREAM_ERROR_FULL) {
+        return ESP_ERR_NO_MEM;
+    } else if (rc != BLE_STREAM_SUCCESS) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    armFlushTimer();
+    return ESP_OK;
+}
+
+void ble_device_get_stream_stats(ble_stream_stats_t* pStats) {
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    *pStats = gDataStream.stats;
+    xSemaphoreGive(gLock);
+}
+
+// ########## Link profiles ##########
+
+void onLinkTimer(void* arg) {
+    ble_connection_t* pConn = (ble_connection_t*)arg;
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    uint16_t connHandle = pConn->used ? pConn->connHandle : BLE_HS_CONN_HANDLE_NONE;
+    xSemaphoreGive(gLock);
+    if (connHandle != BLE_HS_CONN_HANDLE_NONE) {
+        applyLink(connHandle);
+    }
+}
+
+// Requests the profile of the connection, the central answers with GAP events
+void applyLink(uint16_t connHandle) {
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    ble_connection_t* pConn = findConnection(connHandle);
+    ble_link_profile_t profile = (pConn != NULL) ? pConn->link.profile : gLinkProfile;
+    xSemaphoreGive(gLock);
+    if (pConn == NULL) {
+        return;
+    }
+
+    int rc = ble_link_apply(connHandle, profile);
+    if (rc != 0) {
+        xSemaphoreTake(gLock, portMAX_DELAY);
+        if ((pConn = findConnection(connHandle)) != NULL) {
+            pConn->link.status = (uint8_t)rc;
+        }
+        xSemaphoreGive(gLock);
+    }
+    notifyLink(connHandle);
+}
+
+// Tells a subscribed central about the parameters it granted
+void notifyLink(uint16_t connHandle) {
+    uint8_t value[BLE_LINK_INFO_SIZE];
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    ble_connection_t* pConn = findConnection(connHandle);
+    bool notify = pConn != NULL && pConn->linkNotify;
+    if (notify) {
+        ble_link_encode(&pConn->link, value);
+    }
+    xSemaphoreGive(gLock);
+    if (!notify) {
+        return;
+    }
+    struct os_mbuf* om = ble_hs_mbuf_from_flat(value, sizeof(value));
+    if (om == NULL || ble_gattc_notify_custom(connHandle, gLinkValueHandle, om) != 0) {
+        MODLOG_DFLT(WARN, "link notification dropped; conn_handle=%d\n", connHandle);
+    }
+}
+
+/*
+ * @brief Selects the link profile of all connections and of the ones to come
+ *
+ *  Typically low latency while only buttons are used, high throughput while samples stream and
+ *  low power when nothing happens for a while. A central can still pick its own profile through
+ *  the link characteristic.
+ */
+esp_err_t ble_device_set_link_profile(ble_link_profile_t profile) {
+    if (ble_link_get_params(profile) == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint16_t handles[BLE_DEVICE_MAX_CONNECTIONS];
+    uint8_t count = 0;
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    gLinkProfile = profile;
+    for (uint8_t i = 0; i < BLE_DEVICE_MAX_CONNECTIONS; i++) {
+        ble_connection_t* pConn = &gConnections[i];
+        if (!pConn->used) {
+            continue;
+        }
+        pConn->link.profile = profile;
+        if (!esp_timer_is_active(pConn->linkTimer)) { // else the timer applies it shortly
+            handles[count++] = pConn->connHandle;
+        }
+    }
+    xSemaphoreGive(gLock);
+    for (uint8_t i = 0; i < count; i++) {
+        applyLink(handles[i]);
+    }
+    return ESP_OK;
+}
+
+/*
+ * @brief Copies the link parameters of one connection
+ *
+ * @return ESP_OK or ESP_ERR_NOT_FOUND if the handle is not connected
+ */
+esp_err_t ble_device_get_link_info(uint16_t connHandle, ble_link_info_t* pInfo) {
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    ble_connection_t* pConn = findConnection(connHandle);
+    if (pConn != NULL) {
+        *pInfo = pConn->link;
+    }
+    xSemaphoreGive(gLock);
+    return (pConn != NULL) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
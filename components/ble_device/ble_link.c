@@ -0,0 +1,148 @@
+#include <string.h>
+#include "esp_log.h"
+#include "host/ble_hs.h"
+
+#include "ble_link.h"
+
+static const char *TAG = "BLE_LINK";
+
+static const ble_link_params_t gProfiles[BLE_LINK_PROFILE_COUNT] = {
+    [BLE_LINK_LOW_LATENCY] = {
+        .itvlMin = 6,               // 7.5 ms
+        .itvlMax = 12,              // 15 ms
+        .latency = 0,
+        .supervisionTimeout = 200,  // 2 s
+        .phyMask = BLE_GAP_LE_PHY_1M_MASK | BLE_GAP_LE_PHY_2M_MASK,
+        .txOctets = 0,
+    },
+    [BLE_LINK_HIGH_THROUGHPUT] = {
+        .itvlMin = 12,              // 15 ms, the shortest many phones grant
+        .itvlMax = 24,              // 30 ms
+        .latency = 0,
+        .supervisionTimeout = 400,  // 4 s
+        .phyMask = BLE_GAP_LE_PHY_2M_MASK,
+        .txOctets = BLE_LINK_DLE_MAX_OCTETS,
+    },
+    [BLE_LINK_LOW_POWER] = {
+        .itvlMin = 80,              // 100 ms
+        .itvlMax = 160,             // 200 ms
+        .latency = 4,               // wakes up every 1 s at most, when there is nothing to send
+        .supervisionTimeout = 600,  // 6 s, above (1 + latency) * interval * 2
+        .phyMask = BLE_GAP_LE_PHY_1M_MASK,
+        .txOctets = 0,
+    },
+};
+
+static int request_phy(uint16_t connHandle, uint8_t phyMask);
+
+// ----- implementation -----
+
+#if CONFIG_BT_NIMBLE_50_FEATURE_SUPPORT
+int request_phy(uint16_t connHandle, uint8_t phyMask) {
+    return ble_gap_set_prefered_le_phy(connHandle, phyMask, phyMask, BLE_GAP_LE_PHY_CODED_ANY);
+}
+#else
+// Without the Bluetooth 5 features the link stays on the 1M PHY
+int request_phy(uint16_t connHandle, uint8_t phyMask) {
+    return 0;
+}
+#endif
+
+const ble_link_params_t* ble_link_get_params(ble_link_profile_t profile) {
+    return (profile < BLE_LINK_PROFILE_COUNT) ? &gProfiles[profile] : NULL;
+}
+
+const char* ble_link_profile_name(ble_link_profile_t profile) {
+    switch (profile) {
+        case BLE_LINK_LOW_LATENCY:      return "low latency";
+        case BLE_LINK_HIGH_THROUGHPUT:  return "high throughput";
+        case BLE_LINK_LOW_POWER:        return "low power";
+        default:                        return "unknown";
+    }
+}
+
+/*
+ * @brief Requests the parameters of a profile from the central
+ *
+ *  The three requests run independently, a central that rejects one still gets the others. The
+ *  results arrive as GAP events.
+ *
+ * @return 0, or the error of the connection parameter request
+ */
+int ble_link_apply(uint16_t connHandle, ble_link_profile_t profile) {
+    const ble_link_params_t* pParams = ble_link_get_params(profile);
+    if (pParams == NULL) {
+        return BLE_HS_EINVAL;
+    }
+
+    int rc = request_phy(connHandle, pParams->phyMask);
+    if (rc != 0) {
+        ESP_LOGW(TAG, "PHY request failed: %d", rc);
+    }
+    if (pParams->txOctets != 0) {
+        rc = ble_gap_set_data_len(connHandle, pParams->txOctets, BLE_LINK_DLE_MAX_TIME_US);
+        if (rc != 0) {
+            ESP_LOGW(TAG, "Data length request failed: %d", rc);
+        }
+    }
+
+    const struct ble_gap_upd_params update = {
+        .itvl_min = pParams->itvlMin,
+        .itvl_max = pParams->itvlMax,
+        .latency = pParams->latency,
+        .supervision_timeout = pParams->supervisionTimeout,
+        .min_ce_len = 0,
+        .max_ce_len = 0,
+    };
+    rc = ble_gap_update_params(connHandle, &update);
+    if (rc != 0) {
+        ESP_LOGW(TAG, "Connection update request failed: %d", rc);
+    }
+    ESP_LOGI(TAG, "conn %u: requested %s profile", connHandle, ble_link_profile_name(profile));
+    return rc;
+}
+
+// The values of a fresh connection
+void ble_link_reset(ble_link_info_t* pInfo, ble_link_profile_t profile) {
+    memset(pInfo, 0, sizeof(ble_link_info_t));
+    pInfo->profile = profile;
+    pInfo->txPhy = 1;
+    pInfo->rxPhy = 1;
+    pInfo->mtu = BLE_ATT_MTU_DFLT;
+    pInfo->txOctets = 27;
+    pInfo->rxOctets = 27;
+}
+
+/*
+ * @brief Reads the connection parameters and the MTU currently in effect
+ *
+ * @return true if anything changed
+ */
+bool ble_link_refresh(uint16_t connHandle, ble_link_info_t* pInfo) {
+    struct ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(connHandle, &desc) != 0) {
+        return false;
+    }
+    uint16_t mtu = ble_att_mtu(connHandle);
+    bool changed = pInfo->interval != desc.conn_itvl || pInfo->latency != desc.conn_latency
+                   || pInfo->supervisionTimeout != desc.supervision_timeout || (mtu != 0 && pInfo->mtu != mtu);
+    pInfo->interval = desc.conn_itvl;
+    pInfo->latency = desc.conn_latency;
+    pInfo->supervisionTimeout = desc.supervision_timeout;
+    if (mtu != 0) {
+        pInfo->mtu = mtu;
+    }
+    return changed;
+}
+
+void ble_link_encode(const ble_link_info_t* pInfo, uint8_t* buf) {
+    buf[0] = (uint8_t)pInfo->profile;
+    buf[1] = pInfo->txPhy;
+    buf[2] = pInfo->rxPhy;
+    buf[3] = pInfo->status;
+    const uint16_t values[] = { pInfo->interval, pInfo->latency, pInfo->supervisionTimeout, pInfo->mtu, pInfo->txOctets, pInfo->rxOctets };
+    for (int i = 0; i < 6; i++) {
+        buf[4 + 2 * i] = values[i] & 0xFF;
+        buf[5 + 2 * i] = values[i] >> 8;
+    }
+}
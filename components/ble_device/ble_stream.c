@@ -0,0 +1,338 @@
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+
+#include "ble_stream.h"
+
+static const char *TAG = "BLE_STREAM";
+
+static ble_stream_peer_t* find_peer(ble_stream_t* pStream, uint16_t connHandle);
+static uint16_t payload_for_mtu(uint16_t mtu);
+static void update_payload_max(ble_stream_t* pStream);
+static void release_packet(ble_stream_t* pStream, uint8_t index);
+static void release_queue(ble_stream_t* pStream, ble_stream_peer_t* pPeer);
+static void publish_current(ble_stream_t* pStream);
+static uint8_t take_packet(ble_stream_t* pStream);
+static void send_peer(ble_stream_t* pStream, ble_stream_peer_t* pPeer);
+static void send_all(ble_stream_t* pStream);
+static bool has_queued(const ble_stream_t* pStream);
+
+// ----- implementation -----
+
+ble_stream_peer_t* find_peer(ble_stream_t* pStream, uint16_t connHandle) {
+    for (uint8_t i = 0; i < pStream->config.maxPeers; i++) {
+        if (pStream->peers[i].used && pStream->peers[i].connHandle == connHandle) {
+            return &pStream->peers[i];
+        }
+    }
+    return NULL;
+}
+
+uint16_t payload_for_mtu(uint16_t mtu) {
+    uint16_t payload = (mtu > BLE_STREAM_ATT_HEADER) ? mtu - BLE_STREAM_ATT_HEADER : 0;
+    return (payload > BLE_STREAM_MAX_PAYLOAD) ? BLE_STREAM_MAX_PAYLOAD : payload;
+}
+
+// Packets have to fit every subscriber, so the smallest MTU decides
+void update_payload_max(ble_stream_t* pStream) {
+    uint16_t payload = BLE_STREAM_MAX_PAYLOAD;
+    for (uint8_t i = 0; i < pStream->config.maxPeers; i++) {
+        ble_stream_peer_t* pPeer = &pStream->peers[i];
+        if (pPeer->used && pPeer->subscribed && pPeer->payloadMax < payload) {
+            payload = pPeer->payloadMax;
+        }
+    }
+    pStream->payloadMax = (pStream->subscribers > 0) ? payload : payload_for_mtu(BLE_STREAM_DEFAULT_MTU);
+}
+
+void release_packet(ble_stream_t* pStream, uint8_t index) {
+    if (pStream->packets[index].refs > 0) {
+        pStream->packets[index].refs--;
+    }
+}
+
+// Drops what a connection still had queued, the packets are free once no other one holds them
+void release_queue(ble_stream_t* pStream, ble_stream_peer_t* pPeer) {
+    while (pPeer->count > 0) {
+        release_packet(pStream, pPeer->queue[pPeer->first]);
+        pPeer->first = (pPeer->first + 1) % pStream->config.poolSize;
+        pPeer->count--;
+    }
+}
+
+/*
+ * @brief Hands the packet being filled to every subscriber
+ *
+ *  The packet is not copied, each subscriber queues its index and releases it once sent.
+ */
+void publish_current(ble_stream_t* pStream) {
+    uint8_t index = pStream->current;
+    pStream->current = BLE_STREAM_NO_PACKET;
+    pStream->flushAt_ms = 0;
+    if (index == BLE_STREAM_NO_PACKET) {
+        return;
+    }
+    ble_stream_packet_t* pPacket = &pStream->packets[index];
+    pPacket->refs = 0;
+    if (pPacket->len == 0) {
+        return;
+    }
+    for (uint8_t i = 0; i < pStream->config.maxPeers; i++) {
+        ble_stream_peer_t* pPeer = &pStream->peers[i];
+        if (pPeer->used && pPeer->subscribed) {
+            pPeer->queue[(pPeer->first + pPeer->count) % pStream->config.poolSize] = index;
+            pPeer->count++;
+            pPacket->refs++;
+        }
+    }
+    pStream->stats.payloads++;
+}
+
+// Returns a packet no subscriber holds any more, BLE_STREAM_NO_PACKET if all are in use
+uint8_t take_packet(ble_stream_t* pStream) {
+    for (uint8_t i = 0; i < pStream->config.poolSize; i++) {
+        if (pStream->packets[i].refs == 0 && i != pStream->current) {
+            pStream->packets[i].len = 0;
+            return i;
+        }
+    }
+    return BLE_STREAM_NO_PACKET;
+}
+
+/*
+ * @brief Sends the packets queued for one connection, in order
+ *
+ *  Stops at the first packet the stack has no buffers for, it is the first one sent on the next
+ *  attempt, so notifications never overtake each other. The other connections are not held up.
+ */
+void send_peer(ble_stream_t* pStream, ble_stream_peer_t* pPeer) {
+    while (pPeer->count > 0) {
+        uint8_t index = pPeer->queue[pPeer->first];
+        ble_stream_packet_t* pPacket = &pStream->packets[index];
+        int rc = pStream->config.send(pStream->config.ctx, pPeer->connHandle, pPacket->data, pPacket->len);
+        if (rc == BLE_STREAM_RETRY) {
+            pStream->stats.retries++;
+            return;
+        }
+        if (rc == 0) {
+            pStream->stats.notifications++;
+        } else {
+            pStream->stats.sendErrors++;
+        }
+        pPeer->first = (pPeer->first + 1) % pStream->config.poolSize;
+        pPeer->count--;
+        release_packet(pStream, index);
+    }
+}
+
+void send_all(ble_stream_t* pStream) {
+    for (uint8_t i = 0; i < pStream->config.maxPeers; i++) {
+        if (pStream->peers[i].used) {
+            send_peer(pStream, &pStream->peers[i]);
+        }
+    }
+}
+
+bool has_queued(const ble_stream_t* pStream) {
+    for (uint8_t i = 0; i < pStream->config.maxPeers; i++) {
+        if (pStream->peers[i].used && pStream->peers[i].count > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * @brief Sets up a stream without connections, all packets and queues are allocated here
+ *
+ * @return BLE_STREAM_SUCCESS, BLE_STREAM_ERROR_ARGUMENT or BLE_STREAM_ERROR_NO_MEMORY
+ */
+int ble_stream_init(ble_stream_t* pStream, const ble_stream_config_t* pConfig) {
+    memset(pStream, 0, sizeof(ble_stream_t));
+    if (pConfig->send == NULL || pConfig->poolSize < 2 || pConfig->poolSize == BLE_STREAM_NO_PACKET
+        || pConfig->maxPeers == 0 || pConfig->recordSize > BLE_STREAM_MAX_PAYLOAD) {
+        ESP_LOGE(TAG, "Invalid stream config");
+        return BLE_STREAM_ERROR_ARGUMENT;
+    }
+    pStream->config = *pConfig;
+    pStream->current = BLE_STREAM_NO_PACKET;
+    pStream->storage = malloc((size_t)pConfig->poolSize * BLE_STREAM_MAX_PAYLOAD);
+    pStream->packets = calloc(pConfig->poolSize, sizeof(ble_stream_packet_t));
+    pStream->peers = calloc(pConfig->maxPeers, sizeof(ble_stream_peer_t));
+    if (pStream->storage == NULL || pStream->packets == NULL || pStream->peers == NULL) {
+        ble_stream_deinit(pStream);
+        return BLE_STREAM_ERROR_NO_MEMORY;
+    }
+    for (uint8_t i = 0; i < pConfig->poolSize; i++) {
+        pStream->packets[i].data = &pStream->storage[(size_t)i * BLE_STREAM_MAX_PAYLOAD];
+    }
+    for (uint8_t i = 0; i < pConfig->maxPeers; i++) {
+        pStream->peers[i].queue = malloc(pConfig->poolSize);
+        if (pStream->peers[i].queue == NULL) {
+            ble_stream_deinit(pStream);
+            return BLE_STREAM_ERROR_NO_MEMORY;
+        }
+    }
+    update_payload_max(pStream);
+    return BLE_STREAM_SUCCESS;
+}
+
+void ble_stream_deinit(ble_stream_t* pStream) {
+    if (pStream->peers != NULL) {
+        for (uint8_t i = 0; i < pStream->config.maxPeers; i++) {
+            free(pStream->peers[i].queue);
+        }
+    }
+    free(pStream->peers);
+    free(pStream->packets);
+    free(pStream->storage);
+    pStream->peers = NULL;
+    pStream->packets = NULL;
+    pStream->storage = NULL;
+}
+
+// A new connection starts at the default MTU and without subscription
+int ble_stream_add_peer(ble_stream_t* pStream, uint16_t connHandle) {
+    if (find_peer(pStream, connHandle) != NULL) {
+        return BLE_STREAM_SUCCESS;
+    }
+    for (uint8_t i = 0; i < pStream->config.maxPeers; i++) {
+        ble_stream_peer_t* pPeer = &pStream->peers[i];
+        if (!pPeer->used) {
+            pPeer->used = true;
+            pPeer->subscribed = false;
+            pPeer->connHandle = connHandle;
+            pPeer->payloadMax = payload_for_mtu(BLE_STREAM_DEFAULT_MTU);
+            pPeer->first = 0;
+            pPeer->count = 0;
+            return BLE_STREAM_SUCCESS;
+        }
+    }
+    return BLE_STREAM_ERROR_FULL;
+}
+
+// Releases everything the connection still had queued
+void ble_stream_remove_peer(ble_stream_t* pStream, uint16_t connHandle) {
+    ble_stream_peer_t* pPeer = find_peer(pStream, connHandle);
+    if (pPeer == NULL) {
+        return;
+    }
+    ble_stream_subscribe(pStream, connHandle, false);
+    release_queue(pStream, pPeer);
+    pPeer->used = false;
+}
+
+// Takes over the ATT MTU of a connection, it only grows during a connection
+void ble_stream_set_mtu(ble_stream_t* pStream, uint16_t connHandle, uint16_t mtu) {
+    ble_stream_peer_t* pPeer = find_peer(pStream, connHandle);
+    if (pPeer == NULL) {
+        return;
+    }
+    pPeer->payloadMax = payload_for_mtu(mtu);
+    update_payload_max(pStream);
+    ESP_LOGD(TAG, "conn %u: MTU %u, %u bytes per notification", connHandle, mtu, pPeer->payloadMax);
+}
+
+/*
+ * @brief Turns notifications of a connection on or off
+ *
+ *  A new subscriber receives the packets published from now on. If its MTU is smaller than the
+ *  packet being filled, that packet goes to the others first. Unsubscribing drops the packets the
+ *  connection had queued, otherwise they would hold the pool until it disconnects.
+ */
+void ble_stream_subscribe(ble_stream_t* pStream, uint16_t connHandle, bool subscribed) {
+    ble_stream_peer_t* pPeer = find_peer(pStream, connHandle);
+    if (pPeer == NULL || pPeer->subscribed == subscribed) {
+        return;
+    }
+    if (subscribed && pStream->current != BLE_STREAM_NO_PACKET
+        && pStream->packets[pStream->current].len > pPeer->payloadMax) {
+        publish_current(pStream);
+    }
+    pPeer->subscribed = subscribed;
+    if (subscribed) {
+        pStream->subscribers++;
+    } else {
+        pStream->subscribers--;
+        release_queue(pStream, pPeer);
+    }
+    update_payload_max(pStream);
+    if (pStream->subscribers == 0 && pStream->current != BLE_STREAM_NO_PACKET) {
+        pStream->current = BLE_STREAM_NO_PACKET; // nobody left to send it to
+        pStream->flushAt_ms = 0;
+    }
+}
+
+/*
+ * @brief Appends one record to the packet being filled
+ *
+ *  Full packets are sent right away, the last one waits up to flushMs for more records.
+ *
+ * @return BLE_STREAM_SUCCESS, BLE_STREAM_ERROR_NO_PEER without subscribers, or
+ *  BLE_STREAM_ERROR_FULL if no packet could take the record
+ */
+int ble_stream_send(ble_stream_t* pStream, const uint8_t* data, size_t len, int64_t now_ms) {
+    size_t header = (pStream->config.recordSize == 0) ? BLE_STREAM_RECORD_HEADER : 0;
+    if (len == 0 || len + header > pStream->payloadMax
+        || (pStream->config.recordSize != 0 && len != pStream->config.recordSize)) {
+        return BLE_STREAM_ERROR_ARGUMENT;
+    }
+    if (pStream->subscribers == 0) {
+        return BLE_STREAM_ERROR_NO_PEER;
+    }
+
+    if (pStream->current != BLE_STREAM_NO_PACKET
+        && pStream->packets[pStream->current].len + header + len > pStream->payloadMax) {
+        publish_current(pStream);
+        send_all(pStream);
+    }
+    if (pStream->current == BLE_STREAM_NO_PACKET) {
+        pStream->current = take_packet(pStream);
+        if (pStream->current == BLE_STREAM_NO_PACKET) {
+            send_all(pStream); // only reached while the stack is out of buffers
+            pStream->current = take_packet(pStream);
+        }
+        if (pStream->current == BLE_STREAM_NO_PACKET) {
+            pStream->stats.dropped++;
+            return BLE_STREAM_ERROR_FULL;
+        }
+        pStream->flushAt_ms = now_ms + pStream->config.flushMs;
+    }
+
+    ble_stream_packet_t* pPacket = &pStream->packets[pStream->current];
+    if (header > 0) {
+        pPacket->data[pPacket->len] = (uint8_t)len;
+    }
+    memcpy(&pPacket->data[pPacket->len + header], data, len);
+    pPacket->len += header + len;
+    pStream->stats.records++;
+    return BLE_STREAM_SUCCESS;
+}
+
+/*
+ * @brief Retries deferred packets, and publishes the current one once its oldest record is due
+ *
+ * @return milliseconds until the stream wants to be polled again
+ */
+int64_t ble_stream_poll(ble_stream_t* pStream, int64_t now_ms) {
+    if (pStream->current != BLE_STREAM_NO_PACKET && now_ms >= pStream->flushAt_ms) {
+        publish_current(pStream);
+    }
+    send_all(pStream);
+    if (has_queued(pStream)) {
+        return 1; // out of buffers, try again shortly
+    }
+    if (pStream->current != BLE_STREAM_NO_PACKET) {
+        return pStream->flushAt_ms - now_ms;
+    }
+    return BLE_STREAM_IDLE_POLL_MS;
+}
+
+void ble_stream_flush(ble_stream_t* pStream) {
+    publish_current(pStream);
+    send_all(pStream);
+}
+
+bool ble_stream_is_pending(const ble_stream_t* pStream) {
+    return pStream->current != BLE_STREAM_NO_PACKET || has_queued(pStream);
+}
@@ -0,0 +1,255 @@
+#include <string.h>
+
+#include "host_test.h"
+#include "ble_stream.h"
+
+// The notification streams against a fake stack, every connection records what it received
+
+#define MAX_CONN        8
+#define MAX_SENT        64
+
+#define LINK_OK         0
+#define LINK_BUSY       1   // out of buffers
+#define LINK_LOST       2   // notify fails
+
+typedef struct {
+    int link;
+    int sent;
+    uint16_t len[MAX_SENT];
+    uint8_t first[MAX_SENT];        // first byte of the notification
+    const uint8_t* data[MAX_SENT];  // the packet sent, shared by all connections
+} fake_conn_t;
+
+static fake_conn_t gConns[MAX_CONN];
+
+static int fake_send(void* ctx, uint16_t connHandle, const uint8_t* data, uint16_t len) {
+    fake_conn_t* pConn = &gConns[connHandle];
+    if (pConn->link == LINK_BUSY) {
+        return BLE_STREAM_RETRY;
+    }
+    if (pConn->link == LINK_LOST) {
+        return -1;
+    }
+    CHECK(pConn->sent < MAX_SENT);
+    pConn->len[pConn->sent] = len;
+    pConn->first[pConn->sent] = data[0];
+    pConn->data[pConn->sent] = data;
+    pConn->sent++;
+    return 0;
+}
+
+static void fake_reset(void) {
+    memset(gConns, 0, sizeof(gConns));
+}
+
+static const ble_stream_config_t gFixedConfig = {
+    .recordSize = 12, .flushMs = 20, .poolSize = 4, .maxPeers = 3, .send = fake_send,
+};
+
+// Connections 1 and 2 at MTU 247 subscribed, connection 3 at MTU 100 only connected
+static void setup_fixed(ble_stream_t* pStream) {
+    fake_reset();
+    CHECK_EQ(ble_stream_init(pStream, &gFixedConfig), BLE_STREAM_SUCCESS);
+    for (uint16_t conn = 1; conn <= 3; conn++) {
+        CHECK_EQ(ble_stream_add_peer(pStream, conn), BLE_STREAM_SUCCESS);
+    }
+    ble_stream_set_mtu(pStream, 1, 247);
+    ble_stream_set_mtu(pStream, 2, 247);
+    ble_stream_set_mtu(pStream, 3, 100);
+    ble_stream_subscribe(pStream, 1, true);
+    ble_stream_subscribe(pStream, 2, true);
+}
+
+static void send_records(ble_stream_t* pStream, int count, int64_t now_ms) {
+    uint8_t record[12] = { 0 };
+    for (int i = 0; i < count; i++) {
+        record[0] = (uint8_t)i;
+        CHECK_EQ(ble_stream_send(pStream, record, sizeof(record), now_ms), BLE_STREAM_SUCCESS);
+    }
+}
+
+static void test_arguments(void) {
+    ble_stream_t stream;
+    ble_stream_config_t config = gFixedConfig;
+    config.send = NULL;
+    CHECK_EQ(ble_stream_init(&stream, &config), BLE_STREAM_ERROR_ARGUMENT);
+
+    fake_reset();
+    CHECK_EQ(ble_stream_init(&stream, &gFixedConfig), BLE_STREAM_SUCCESS);
+    uint8_t record[12] = { 0 };
+    CHECK_EQ(ble_stream_send(&stream, record, sizeof(record), 0), BLE_STREAM_ERROR_NO_PEER);
+    CHECK_EQ(ble_stream_send(&stream, record, 11, 0), BLE_STREAM_ERROR_ARGUMENT);
+    for (uint16_t conn = 1; conn <= 3; conn++) {
+        CHECK_EQ(ble_stream_add_peer(&stream, conn), BLE_STREAM_SUCCESS);
+    }
+    CHECK_EQ(ble_stream_add_peer(&stream, 2), BLE_STREAM_SUCCESS);
+    CHECK_EQ(ble_stream_add_peer(&stream, 4), BLE_STREAM_ERROR_FULL);
+    ble_stream_deinit(&stream);
+}
+
+// Each packet is built once and sent to every subscriber, the smallest MTU sizes it
+static void test_fan_out(void) {
+    ble_stream_t stream;
+    setup_fixed(&stream);
+    CHECK_EQ(stream.payloadMax, 244);
+
+    send_records(&stream, 45, 0); // two full packets of 20 records
+    CHECK_EQ(gConns[1].sent, 2);
+    CHECK_EQ(gConns[2].sent, 2);
+    CHECK_EQ(gConns[1].len[0], 240);
+    CHECK(gConns[1].data[0] == gConns[2].data[0]);
+    CHECK_EQ(stream.stats.payloads, 2);
+    CHECK_EQ(stream.stats.notifications, 4);
+
+    // The 60 bytes being filled fit the new subscriber's 97 and stay
+    ble_stream_subscribe(&stream, 3, true);
+    CHECK_EQ(stream.payloadMax, 97);
+    uint8_t record[12] = { 0 };
+    for (int i = 45; i < 55; i++) {
+        record[0] = (uint8_t)i;
+        CHECK_EQ(ble_stream_send(&stream, record, sizeof(record), 5), BLE_STREAM_SUCCESS);
+    }
+    CHECK_EQ(gConns[3].sent, 1);
+    CHECK_EQ(gConns[3].len[0], 96);
+    CHECK_EQ(gConns[3].first[0], 40);
+    CHECK_EQ(gConns[1].sent, 3);
+
+    // The rest goes out once the oldest record waited flushMs
+    CHECK(ble_stream_is_pending(&stream));
+    CHECK_EQ(ble_stream_poll(&stream, 10), 15);
+    CHECK_EQ(gConns[3].sent, 1);
+    CHECK_EQ(ble_stream_poll(&stream, 25), BLE_STREAM_IDLE_POLL_MS);
+    CHECK_EQ(gConns[3].sent, 2);
+    CHECK_EQ(gConns[3].len[1], 84);
+    CHECK_EQ(gConns[3].first[1], 48);
+    CHECK(!ble_stream_is_pending(&stream));
+    ble_stream_deinit(&stream);
+}
+
+// A connection out of buffers holds up nobody else, until its queue holds the whole pool
+static void test_backpressure(void) {
+    ble_stream_t stream;
+    setup_fixed(&stream);
+    ble_stream_subscribe(&stream, 3, true);
+    gConns[2].link = LINK_BUSY;
+
+    uint8_t record[12] = { 0 };
+    int accepted = 0;
+    for (int i = 0; i < 80; i++) {
+        int rc = ble_stream_send(&stream, record, sizeof(record), 100);
+        CHECK(rc == BLE_STREAM_SUCCESS || rc == BLE_STREAM_ERROR_FULL);
+        accepted += (rc == BLE_STREAM_SUCCESS);
+    }
+    CHECK_EQ(accepted, 4 * 8); // four packets of 8 records
+    CHECK_EQ(stream.stats.dropped, 80 - accepted);
+    CHECK_EQ(gConns[1].sent, 4);
+    CHECK_EQ(gConns[3].sent, 4);
+    CHECK_EQ(gConns[2].sent, 0);
+    CHECK_EQ(ble_stream_poll(&stream, 101), 1);
+
+    gConns[2].link = LINK_OK;
+    ble_stream_poll(&stream, 102);
+    CHECK_EQ(gConns[2].sent, 4);
+    for (int i = 1; i < 4; i++) {
+        CHECK(gConns[2].data[i] != gConns[2].data[i - 1]); // in order, each packet once
+    }
+    CHECK(!ble_stream_is_pending(&stream));
+    ble_stream_deinit(&stream);
+}
+
+static void check_pool_free(const ble_stream_t* pStream) {
+    for (uint8_t i = 0; i < gFixedConfig.poolSize; i++) {
+        CHECK_EQ(pStream->packets[i].refs, 0);
+    }
+}
+
+// A disconnect releases the packets queued for the connection
+static void test_remove_peer(void) {
+    ble_stream_t stream;
+    setup_fixed(&stream);
+    gConns[1].link = LINK_BUSY;
+    send_records(&stream, 8, 200);
+    ble_stream_flush(&stream);
+    CHECK(ble_stream_is_pending(&stream));
+
+    ble_stream_remove_peer(&stream, 1);
+    CHECK(!ble_stream_is_pending(&stream));
+    CHECK_EQ(stream.subscribers, 1);
+    check_pool_free(&stream);
+    CHECK_EQ(ble_stream_add_peer(&stream, 4), BLE_STREAM_SUCCESS);
+
+    // Without subscribers the packet being filled is dropped
+    send_records(&stream, 1, 300);
+    ble_stream_subscribe(&stream, 2, false);
+    CHECK(!ble_stream_is_pending(&stream));
+    uint8_t record[12] = { 0 };
+    CHECK_EQ(ble_stream_send(&stream, record, sizeof(record), 300), BLE_STREAM_ERROR_NO_PEER);
+    ble_stream_deinit(&stream);
+}
+
+// A connection that unsubscribes while out of buffers no longer holds the pool
+static void test_unsubscribe(void) {
+    ble_stream_t stream;
+    setup_fixed(&stream);
+    gConns[1].link = LINK_BUSY;
+    uint8_t record[12] = { 0 };
+    while (ble_stream_send(&stream, record, sizeof(record), 0) == BLE_STREAM_SUCCESS) {
+    }
+    CHECK_EQ(stream.peers[0].count, gFixedConfig.poolSize);
+
+    ble_stream_subscribe(&stream, 1, false);
+    CHECK_EQ(stream.peers[0].count, 0);
+    CHECK(!ble_stream_is_pending(&stream));
+    check_pool_free(&stream);
+    send_records(&stream, 20 * gFixedConfig.poolSize, 1);
+    ble_stream_flush(&stream);
+    CHECK_EQ(gConns[1].sent, 0);
+
+    // Subscribing again only delivers what is published from then on
+    gConns[1].link = LINK_OK;
+    int sent = gConns[2].sent;
+    ble_stream_subscribe(&stream, 1, true);
+    ble_stream_flush(&stream);
+    CHECK_EQ(gConns[1].sent, 0);
+    send_records(&stream, 21, 2); // the 21st publishes the first 20
+    CHECK_EQ(gConns[1].sent, 1);
+    CHECK_EQ(gConns[2].sent, sent + 1);
+    CHECK(gConns[1].data[0] == gConns[2].data[sent]);
+    ble_stream_deinit(&stream);
+}
+
+// Records of any size carry a length byte, a failed notify is counted and dropped
+static void test_variable_records(void) {
+    fake_reset();
+    ble_stream_t stream;
+    const ble_stream_config_t config = { .recordSize = 0, .flushMs = 10, .poolSize = 2, .maxPeers = 1, .send = fake_send };
+    CHECK_EQ(ble_stream_init(&stream, &config), BLE_STREAM_SUCCESS);
+    ble_stream_add_peer(&stream, 5);
+    ble_stream_subscribe(&stream, 5, true);
+    CHECK_EQ(stream.payloadMax, BLE_STREAM_DEFAULT_MTU - BLE_STREAM_ATT_HEADER);
+
+    uint8_t data[20] = { 5 };
+    CHECK_EQ(ble_stream_send(&stream, data, 5, 0), BLE_STREAM_SUCCESS);
+    CHECK_EQ(ble_stream_send(&stream, data, 3, 0), BLE_STREAM_SUCCESS);
+    CHECK_EQ(ble_stream_send(&stream, data, 20, 0), BLE_STREAM_ERROR_ARGUMENT);
+    CHECK_EQ(ble_stream_send(&stream, data, 12, 0), BLE_STREAM_SUCCESS);
+    CHECK_EQ(gConns[5].sent, 1);
+    CHECK_EQ(gConns[5].len[0], 1 + 5 + 1 + 3);
+    CHECK_EQ(gConns[5].first[0], 5);
+
+    gConns[5].link = LINK_LOST;
+    ble_stream_flush(&stream);
+    CHECK_EQ(stream.stats.sendErrors, 1);
+    CHECK(!ble_stream_is_pending(&stream));
+    ble_stream_deinit(&stream);
+}
+
+int main(void) {
+    RUN_TEST(test_arguments);
+    RUN_TEST(test_fan_out);
+    RUN_TEST(test_backpressure);
+    RUN_TEST(test_remove_peer);
+    RUN_TEST(test_unsubscribe);
+    RUN_TEST(test_variable_records);
+    return host_test_result();
+}
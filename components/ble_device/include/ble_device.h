@@ -12,14 +12,26 @@
 #include "services/gap/ble_svc_gap.h"
 #include "services/gatt/ble_svc_gatt.h"
 
+#include "ble_link.h"
+#include "ble_stream.h"
+
 #define GATT_CUSTOM_SERVICE_UUID                "7f52a68c-45b2-4333-9cf3-cc377ef2ccdb"
 #define CATT_CUSTOM_BUTTON_UUID                 "edd6a5ba-9285-439b-a46d-dccaf3e82cf0"
+#define GATT_CUSTOM_STREAM_UUID                 "3c8a1f5e-2b7d-4e91-a6c4-58d0e7b2f913"
+#define GATT_CUSTOM_LINK_UUID                   "a4e2c9d1-7f36-4b58-9e0a-1d6b3f8c2e75"
 #define GATT_DEVICE_INFO_UUID                   0x180A
 #define GATT_MANUFACTURER_NAME_UUID             0x2A29
 #define GATT_MODEL_NUMBER_UUID                  0x2A24
 
+#define BLE_DEVICE_MAX_CONNECTIONS              CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+
 esp_err_t ble_device_init(void);
 void ble_device_start(void);
 void ble_device_notify(int16_t data);
+esp_err_t ble_device_stream(const uint8_t* data, size_t len);
+void ble_device_get_stream_stats(ble_stream_stats_t* pStats);
+esp_err_t ble_device_set_link_profile(ble_link_profile_t profile);
+esp_err_t ble_device_get_link_info(uint16_t connHandle, ble_link_info_t* pInfo);
+uint8_t ble_device_get_connections(uint16_t* handles, uint8_t max);
 
 #endif /* MAIN_BLEDEVICE_H_ */
\ No newline at end of file
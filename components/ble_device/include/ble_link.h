@@ -0,0 +1,59 @@
+#ifndef BLE_LINK_H
+#define BLE_LINK_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Link profiles the peripheral negotiates after connecting: connection interval, peripheral
+// latency, PHY and data length. The central has the last word, what it granted is collected from
+// the GAP events into one ble_link_info_t per connection and can be read back through the link
+// characteristic. The caller guards the info, these functions do not lock.
+//
+// Link characteristic layout, little endian, BLE_LINK_INFO_SIZE bytes:
+//   [profile:8] [txPhy:8] [rxPhy:8] [status:8] [interval:16] [latency:16] [timeout:16]
+//   [mtu:16] [txOctets:16] [rxOctets:16]
+// interval in 1.25 ms, timeout in 10 ms units, PHY 1 = 1M, 2 = 2M, 3 = coded. status is 0, or the
+// low byte of the error of the last rejected update. Writing one byte selects a profile.
+
+#define BLE_LINK_INFO_SIZE              16
+#define BLE_LINK_UPDATE_DELAY_MS        1000    // centrals tend to reject updates during service discovery
+#define BLE_LINK_DLE_MAX_OCTETS         251
+#define BLE_LINK_DLE_MAX_TIME_US        2120    // 251 octets on the 1M PHY
+
+typedef enum {
+    BLE_LINK_LOW_LATENCY,       // short interval, for buttons
+    BLE_LINK_HIGH_THROUGHPUT,   // 2M PHY and long packets, for sensor streams
+    BLE_LINK_LOW_POWER,         // long interval with latency, for idle links
+    BLE_LINK_PROFILE_COUNT
+} ble_link_profile_t;
+
+typedef struct {
+    uint16_t itvlMin;           // 1.25 ms units
+    uint16_t itvlMax;
+    uint16_t latency;           // connection events the peripheral may skip
+    uint16_t supervisionTimeout; // 10 ms units
+    uint8_t phyMask;            // BLE_GAP_LE_PHY_*_MASK
+    uint16_t txOctets;          // data length, 0 = keep
+} ble_link_params_t;
+
+typedef struct {
+    ble_link_profile_t profile;
+    uint8_t txPhy;
+    uint8_t rxPhy;
+    uint8_t status;
+    uint16_t interval;
+    uint16_t latency;
+    uint16_t supervisionTimeout;
+    uint16_t mtu;
+    uint16_t txOctets;
+    uint16_t rxOctets;
+} ble_link_info_t;
+
+const ble_link_params_t* ble_link_get_params(ble_link_profile_t profile);
+const char* ble_link_profile_name(ble_link_profile_t profile);
+int ble_link_apply(uint16_t connHandle, ble_link_profile_t profile);
+void ble_link_reset(ble_link_info_t* pInfo, ble_link_profile_t profile);
+bool ble_link_refresh(uint16_t connHandle, ble_link_info_t* pInfo);
+void ble_link_encode(const ble_link_info_t* pInfo, uint8_t* buf);
+
+#endif // BLE_LINK_H
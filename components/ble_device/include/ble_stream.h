@@ -0,0 +1,96 @@
+#ifndef BLE_STREAM_H
+#define BLE_STREAM_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Packs many small records into one notification and fans it out to every subscribed connection.
+// A packet is encoded once and shared, each subscriber only holds its index in a queue of its own,
+// so the cost of a record does not grow with the subscribers. Packets are sized to the smallest
+// MTU among the subscribers. Records are never split across notifications. The stream only knows a
+// send function, so it runs on the host as well. Not thread-safe.
+//
+// Notification layout: [record][record]... for fixed size records, [length][record]... otherwise.
+//
+// When the stack runs out of buffers, the send function reports BLE_STREAM_RETRY and the packet
+// stays queued for that connection until the next poll. A packet is reused once every subscriber
+// sent it. Once all are in use, new records are rejected with BLE_STREAM_ERROR_FULL, so the
+// producer sees the backpressure instead of the stack asserting.
+
+#define BLE_STREAM_SUCCESS              0
+#define BLE_STREAM_ERROR_FULL          -1  // all packets of the pool wait to be sent
+#define BLE_STREAM_ERROR_ARGUMENT      -2
+#define BLE_STREAM_ERROR_NO_MEMORY     -3
+#define BLE_STREAM_ERROR_NO_PEER       -4  // nobody subscribed
+
+#define BLE_STREAM_RETRY                1  // returned by the send function, try the packet again later
+
+#define BLE_STREAM_ATT_HEADER           3  // opcode and attribute handle of a notification
+#define BLE_STREAM_DEFAULT_MTU          23
+#define BLE_STREAM_MAX_PAYLOAD          244 // 251 byte LL payload with data length extension, minus L2CAP and ATT headers
+#define BLE_STREAM_RECORD_HEADER        1
+#define BLE_STREAM_IDLE_POLL_MS         1000
+#define BLE_STREAM_NO_PACKET            0xFF
+
+// Sends one notification, returns 0, BLE_STREAM_RETRY or a negative value if the packet is lost
+typedef int (*ble_stream_send_t)(void* ctx, uint16_t connHandle, const uint8_t* data, uint16_t len);
+
+typedef struct {
+    uint16_t recordSize;    // size of every record, 0 = variable, with a length byte in front
+    uint32_t flushMs;       // latest time a record waits for more to fill its notification
+    uint8_t poolSize;       // packets shared by all connections, at least 2
+    uint8_t maxPeers;       // connections the stream serves
+    ble_stream_send_t send;
+    void* ctx;
+} ble_stream_config_t;
+
+typedef struct {
+    uint32_t records;
+    uint32_t payloads;      // packets encoded
+    uint32_t notifications; // packets sent, one per payload and subscriber
+    uint32_t dropped;       // records rejected because the pool was exhausted
+    uint32_t retries;       // sends deferred for lack of buffers
+    uint32_t sendErrors;    // notifications lost
+} ble_stream_stats_t;
+
+typedef struct {
+    uint16_t len;
+    uint8_t refs;           // subscribers that still have to send it
+    uint8_t* data;
+} ble_stream_packet_t;
+
+typedef struct {
+    bool used;
+    bool subscribed;
+    uint16_t connHandle;
+    uint16_t payloadMax;    // from the MTU of the connection
+    uint8_t* queue;         // packet indices in sending order, poolSize entries
+    uint8_t first;
+    uint8_t count;
+} ble_stream_peer_t;
+
+typedef struct {
+    ble_stream_config_t config;
+    uint16_t payloadMax;    // smallest of the subscribers
+    uint8_t* storage;       // poolSize * BLE_STREAM_MAX_PAYLOAD bytes
+    ble_stream_packet_t* packets;
+    ble_stream_peer_t* peers;
+    uint8_t current;        // packet being filled, BLE_STREAM_NO_PACKET if none
+    uint8_t subscribers;
+    int64_t flushAt_ms;     // deadline of the current packet, 0 = none
+    ble_stream_stats_t stats;
+} ble_stream_t;
+
+int ble_stream_init(ble_stream_t* pStream, const ble_stream_config_t* pConfig);
+void ble_stream_deinit(ble_stream_t* pStream);
+int ble_stream_add_peer(ble_stream_t* pStream, uint16_t connHandle);
+void ble_stream_remove_peer(ble_stream_t* pStream, uint16_t connHandle);
+void ble_stream_set_mtu(ble_stream_t* pStream, uint16_t connHandle, uint16_t mtu);
+void ble_stream_subscribe(ble_stream_t* pStream, uint16_t connHandle, bool subscribed);
+int ble_stream_send(ble_stream_t* pStream, const uint8_t* data, size_t len, int64_t now_ms);
+int64_t ble_stream_poll(ble_stream_t* pStream, int64_t now_ms);
+void ble_stream_flush(ble_stream_t* pStream);
+bool ble_stream_is_pending(const ble_stream_t* pStream);
+
+#endif // BLE_STREAM_H
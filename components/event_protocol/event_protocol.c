@@ -0,0 +1,254 @@
+#include <string.h>
+
+#include "event_protocol.h"
+
+static void put_u16(uint8_t* buf, uint16_t value);
+static uint16_t get_u16(const uint8_t* buf);
+
+// ----- implementation -----
+
+void put_u16(uint8_t* buf, uint16_t value) {
+    buf[0] = (uint8_t)(value >> 8);
+    buf[1] = (uint8_t)value;
+}
+
+uint16_t get_u16(const uint8_t* buf) {
+    return (uint16_t)((buf[0] << 8) | buf[1]);
+}
+
+/*
+ * @brief Writes value as unsigned LEB128
+ *
+ * @return number of bytes written, 0 if buf is too small
+ */
+size_t event_protocol_put_varint(uint8_t* buf, size_t size, uint64_t value) {
+    size_t len = 0;
+    do {
+        if (len >= size) {
+            return 0;
+        }
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        buf[len++] = (value != 0) ? (byte | 0x80) : byte;
+    } while (value != 0);
+    return len;
+}
+
+/*
+ * @brief Reads an unsigned LEB128 value
+ *
+ * @return number of bytes read, 0 if the varint is truncated or does not fit into 64 bits
+ */
+size_t event_protocol_get_varint(const uint8_t* buf, size_t size, uint64_t* pValue) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < size && i < EVENT_PROTOCOL_MAX_VARINT_SIZE; i++) {
+        uint8_t byte = buf[i];
+        if (i == EVENT_PROTOCOL_MAX_VARINT_SIZE - 1 && byte > 0x01) {
+            return 0; // bits beyond 64
+        }
+        value |= (uint64_t)(byte & 0x7F) << (7 * i);
+        if ((byte & 0x80) == 0) {
+            *pValue = value;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+// CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xFFFF
+uint16_t event_protocol_crc16(const uint8_t* data, size_t len) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+void event_encoder_begin(event_encoder_t* pEncoder, uint8_t* buf, size_t size, uint16_t sequence) {
+    pEncoder->buf = buf;
+    pEncoder->size = size;
+    pEncoder->len = EVENT_PROTOCOL_HEADER_SIZE;
+    pEncoder->count = 0;
+    pEncoder->sequence = sequence;
+    pEncoder->lastTimestamp_us = 0;
+}
+
+/*
+ * @brief Appends one event to the frame
+ *
+ *  Timestamps must not decrease within a frame, each is stored as the difference to the one before.
+ *
+ * @return EVENT_PROTOCOL_SUCCESS, or EVENT_PROTOCOL_ERROR_NO_SPACE if the frame is full. The frame
+ *  is unchanged on errors, so it can be finished and the event added to the next one.
+ */
+int event_encoder_add(event_encoder_t* pEncoder, uint8_t type, uint64_t timestamp_us, const uint8_t* payload, uint8_t size) {
+    if ((payload == NULL && size > 0) || (pEncoder->count > 0 && timestamp_us < pEncoder->lastTimestamp_us)) {
+        return EVENT_PROTOCOL_ERROR_ARGUMENT;
+    }
+    if (pEncoder->count >= EVENT_PROTOCOL_MAX_EVENTS) {
+        return EVENT_PROTOCOL_ERROR_NO_SPACE;
+    }
+
+    uint8_t prefix[2 * EVENT_PROTOCOL_MAX_VARINT_SIZE + 2];
+    size_t prefixLen = 0;
+    uint64_t delta = 0;
+    if (pEncoder->count == 0) {
+        prefixLen += event_protocol_put_varint(prefix, sizeof(prefix), timestamp_us);
+    } else {
+        delta = timestamp_us - pEncoder->lastTimestamp_us;
+    }
+    prefix[prefixLen++] = type;
+    prefixLen += event_protocol_put_varint(&prefix[prefixLen], sizeof(prefix) - prefixLen, delta);
+    prefix[prefixLen++] = size;
+
+    size_t needed = prefixLen + size;
+    if (pEncoder->len + needed + EVENT_PROTOCOL_CRC_SIZE > pEncoder->size
+        || pEncoder->len + needed - EVENT_PROTOCOL_HEADER_SIZE > UINT16_MAX) {
+        return EVENT_PROTOCOL_ERROR_NO_SPACE;
+    }
+    memcpy(&pEncoder->buf[pEncoder->len], prefix, prefixLen);
+    if (size > 0) {
+        memcpy(&pEncoder->buf[pEncoder->len + prefixLen], payload, size);
+    }
+    pEncoder->len += needed;
+    pEncoder->count++;
+    pEncoder->lastTimestamp_us = timestamp_us;
+    return EVENT_PROTOCOL_SUCCESS;
+}
+
+/*
+ * @brief Writes the header and the CRC, the frame is then ready to be sent
+ *
+ *  A frame without events only carries its sequence number, e.g. as a heartbeat.
+ */
+int event_encoder_finish(event_encoder_t* pEncoder, size_t* pFrameSize) {
+    if (pEncoder->count == 0) {
+        size_t len = (pEncoder->len < pEncoder->size) ? event_protocol_put_varint(&pEncoder->buf[pEncoder->len], pEncoder->size - pEncoder->len, 0) : 0;
+        if (len == 0) {
+            return EVENT_PROTOCOL_ERROR_NO_SPACE;
+        }
+        pEncoder->len += len;
+    }
+    if (pEncoder->len + EVENT_PROTOCOL_CRC_SIZE > pEncoder->size) {
+        return EVENT_PROTOCOL_ERROR_NO_SPACE;
+    }
+
+    uint8_t* buf = pEncoder->buf;
+    buf[0] = (uint8_t)((EVENT_PROTOCOL_VERSION << 5) | EVENT_FRAME_TYPE_EVENTS);
+    buf[1] = pEncoder->count;
+    put_u16(&buf[2], pEncoder->sequence);
+    put_u16(&buf[4], (uint16_t)(pEncoder->len - EVENT_PROTOCOL_HEADER_SIZE));
+    put_u16(&buf[pEncoder->len], event_protocol_crc16(buf, pEncoder->len));
+    *pFrameSize = pEncoder->len + EVENT_PROTOCOL_CRC_SIZE;
+    return EVENT_PROTOCOL_SUCCESS;
+}
+
+/*
+ * @brief Size of the frame starting at data, once its header has arrived
+ *
+ *  Lets stream transports like TCP know how many bytes to wait for.
+ */
+int event_protocol_frame_size(const uint8_t* data, size_t len, size_t* pFrameSize) {
+    if (len < EVENT_PROTOCOL_HEADER_SIZE) {
+        return EVENT_PROTOCOL_ERROR_INCOMPLETE;
+    }
+    if ((data[0] >> 5) != EVENT_PROTOCOL_VERSION) {
+        return EVENT_PROTOCOL_ERROR_VERSION;
+    }
+    *pFrameSize = EVENT_PROTOCOL_HEADER_SIZE + get_u16(&data[4]) + EVENT_PROTOCOL_CRC_SIZE;
+    return EVENT_PROTOCOL_SUCCESS;
+}
+
+/*
+ * @brief Checks header and CRC of a frame, events are then read with event_decoder_next()
+ *
+ *  Bytes beyond the frame are ignored, the decoder keeps pointing into frame.
+ */
+int event_decoder_begin(event_decoder_t* pDecoder, const uint8_t* frame, size_t len) {
+    size_t frameSize;
+    int ret = event_protocol_frame_size(frame, len, &frameSize);
+    if (ret != EVENT_PROTOCOL_SUCCESS) {
+        return ret;
+    }
+    if (len < frameSize) {
+        return EVENT_PROTOCOL_ERROR_INCOMPLETE;
+    }
+    size_t end = frameSize - EVENT_PROTOCOL_CRC_SIZE;
+    if (event_protocol_crc16(frame, end) != get_u16(&frame[end])) {
+        return EVENT_PROTOCOL_ERROR_CRC;
+    }
+
+    pDecoder->header.version = frame[0] >> 5;
+    pDecoder->header.type = frame[0] & 0x1F;
+    pDecoder->header.count = frame[1];
+    pDecoder->header.sequence = get_u16(&frame[2]);
+    pDecoder->header.length = get_u16(&frame[4]);
+    if (pDecoder->header.type >= EVENT_FRAME_TYPE_COUNT) {
+        return EVENT_PROTOCOL_ERROR_MALFORMED;
+    }
+
+    size_t varintLen = event_protocol_get_varint(&frame[EVENT_PROTOCOL_HEADER_SIZE], end - EVENT_PROTOCOL_HEADER_SIZE, &pDecoder->lastTimestamp_us);
+    if (varintLen == 0) {
+        return EVENT_PROTOCOL_ERROR_MALFORMED;
+    }
+    pDecoder->frame = frame;
+    pDecoder->pos = EVENT_PROTOCOL_HEADER_SIZE + varintLen;
+    pDecoder->end = end;
+    pDecoder->remaining = pDecoder->header.count;
+    return EVENT_PROTOCOL_SUCCESS;
+}
+
+/*
+ * @brief Reads the next event of the frame
+ *
+ * @return EVENT_PROTOCOL_SUCCESS, EVENT_PROTOCOL_END after the last event, or
+ *  EVENT_PROTOCOL_ERROR_MALFORMED if the body does not match the header
+ */
+int event_decoder_next(event_decoder_t* pDecoder, event_protocol_event_t* pEvent) {
+    if (pDecoder->remaining == 0) {
+        return (pDecoder->pos == pDecoder->end) ? EVENT_PROTOCOL_END : EVENT_PROTOCOL_ERROR_MALFORMED;
+    }
+    const uint8_t* frame = pDecoder->frame;
+    size_t pos = pDecoder->pos;
+    if (pos >= pDecoder->end) {
+        return EVENT_PROTOCOL_ERROR_MALFORMED;
+    }
+    uint8_t type = frame[pos++];
+
+    uint64_t delta;
+    size_t varintLen = event_protocol_get_varint(&frame[pos], pDecoder->end - pos, &delta);
+    if (varintLen == 0 || delta > UINT64_MAX - pDecoder->lastTimestamp_us) {
+        return EVENT_PROTOCOL_ERROR_MALFORMED;
+    }
+    pos += varintLen;
+    if (pos >= pDecoder->end || frame[pos] > pDecoder->end - pos - 1) {
+        return EVENT_PROTOCOL_ERROR_MALFORMED;
+    }
+    uint8_t size = frame[pos++];
+
+    pEvent->type = type;
+    pEvent->timestamp_us = pDecoder->lastTimestamp_us + delta;
+    pEvent->size = size;
+    pEvent->payload = &frame[pos];
+    pDecoder->lastTimestamp_us = pEvent->timestamp_us;
+    pDecoder->pos = pos + size;
+    pDecoder->remaining--;
+    return EVENT_PROTOCOL_SUCCESS;
+}
+
+const char* event_protocol_strerror(int error) {
+    switch (error) {
+        case EVENT_PROTOCOL_SUCCESS:            return "success";
+        case EVENT_PROTOCOL_END:                return "end of frame";
+        case EVENT_PROTOCOL_ERROR_NO_SPACE:     return "no space";
+        case EVENT_PROTOCOL_ERROR_ARGUMENT:     return "invalid argument";
+        case EVENT_PROTOCOL_ERROR_INCOMPLETE:   return "incomplete frame";
+        case EVENT_PROTOCOL_ERROR_VERSION:      return "unsupported version";
+        case EVENT_PROTOCOL_ERROR_CRC:          return "CRC mismatch";
+        case EVENT_PROTOCOL_ERROR_MALFORMED:    return "malformed frame";
+        default:                                return "unknown error";
+    }
+}
@@ -0,0 +1,283 @@
+#include <string.h>
+
+#include "host_test.h"
+#include "event_protocol.h"
+
+// Encoder and decoder round trips, and the decoder fed with truncated, corrupted and random frames.
+// Decoded frames are copied to buffers of their exact size, AddressSanitizer reports any read past them.
+
+typedef struct {
+    uint8_t type;
+    uint64_t timestamp_us;
+    uint8_t size;
+    uint8_t payload[12];
+} sample_event_t;
+
+// One event of every type with its documented payload
+static const sample_event_t gEvents[] = {
+    { EVENT_TYPE_BUTTON,        1000,          2,  { 3, 1 } },
+    { EVENT_TYPE_LED,           1000,          2,  { 0, 1 } },
+    { EVENT_TYPE_POTENTIOMETER, 1127,          1,  { 200 } },
+    { EVENT_TYPE_IMU,           20000,         12, { 0x80, 0x00, 0x7f, 0xff, 0x00, 0x01, 0xff, 0xff, 0x12, 0x34, 0xfe, 0xdc } },
+    { EVENT_TYPE_ORIENTATION,   20000 + 16384, 8,  { 0x40, 0x00, 0x00, 0x00, 0xc0, 0x00, 0x00, 0x00 } },
+    { EVENT_TYPE_BUTTON,        UINT32_MAX * 4000ull, 2, { 3, 0 } },
+};
+
+#define EVENT_COUNT     (sizeof(gEvents) / sizeof(gEvents[0]))
+
+static uint32_t gRandom = 12345;
+
+static uint32_t next_random(void) {
+    gRandom ^= gRandom << 13;
+    gRandom ^= gRandom >> 17;
+    gRandom ^= gRandom << 5;
+    return gRandom;
+}
+
+static size_t encode_samples(uint8_t* buf, size_t size, uint16_t sequence) {
+    event_encoder_t encoder;
+    event_encoder_begin(&encoder, buf, size, sequence);
+    for (size_t i = 0; i < EVENT_COUNT; i++) {
+        CHECK_EQ(event_encoder_add(&encoder, gEvents[i].type, gEvents[i].timestamp_us, gEvents[i].payload, gEvents[i].size), EVENT_PROTOCOL_SUCCESS);
+    }
+    size_t frameSize = 0;
+    CHECK_EQ(event_encoder_finish(&encoder, &frameSize), EVENT_PROTOCOL_SUCCESS);
+    return frameSize;
+}
+
+// Decodes every event the frame holds, returns the last result
+static int decode_all(const uint8_t* frame, size_t len) {
+    event_decoder_t decoder;
+    int ret = event_decoder_begin(&decoder, frame, len);
+    if (ret != EVENT_PROTOCOL_SUCCESS) {
+        return ret;
+    }
+    event_protocol_event_t event;
+    uint64_t last_us = 0;
+    for (int i = 0; i <= EVENT_PROTOCOL_MAX_EVENTS; i++) {
+        ret = event_decoder_next(&decoder, &event);
+        if (ret != EVENT_PROTOCOL_SUCCESS) {
+            return ret;
+        }
+        CHECK(event.timestamp_us >= last_us);
+        CHECK(event.payload >= frame && event.payload + event.size <= frame + decoder.end);
+        last_us = event.timestamp_us;
+    }
+    CHECK(false); // more events than the count allows
+    return ret;
+}
+
+static int decode_copy(const uint8_t* frame, size_t len) {
+    uint8_t* copy = malloc(len > 0 ? len : 1);
+    memcpy(copy, frame, len);
+    int ret = decode_all(copy, len);
+    free(copy);
+    return ret;
+}
+
+// Rewrites length and CRC, so the corruption reaches the body decoder
+static void reseal(uint8_t* frame, size_t frameSize) {
+    size_t end = frameSize - EVENT_PROTOCOL_CRC_SIZE;
+    frame[4] = (uint8_t)((end - EVENT_PROTOCOL_HEADER_SIZE) >> 8);
+    frame[5] = (uint8_t)(end - EVENT_PROTOCOL_HEADER_SIZE);
+    uint16_t crc = event_protocol_crc16(frame, end);
+    frame[end] = (uint8_t)(crc >> 8);
+    frame[end + 1] = (uint8_t)crc;
+}
+
+static void test_varint(void) {
+    static const uint64_t values[] = { 0, 1, 127, 128, 16383, 16384, UINT32_MAX, UINT64_MAX / 3, UINT64_MAX };
+    static const size_t sizes[] = { 1, 1, 1, 2, 2, 3, 5, 9, 10 };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        uint8_t buf[EVENT_PROTOCOL_MAX_VARINT_SIZE];
+        uint64_t value = 0;
+        CHECK_EQ(event_protocol_put_varint(buf, sizeof(buf), values[i]), sizes[i]);
+        CHECK_EQ(event_protocol_put_varint(buf, sizes[i] - 1, values[i]), 0);
+        CHECK_EQ(event_protocol_get_varint(buf, sizes[i], &value), sizes[i]);
+        CHECK(value == values[i]);
+        CHECK_EQ(event_protocol_get_varint(buf, sizes[i] - 1, &value), 0);
+    }
+    // A tenth byte above 1 carries bits beyond 64, an eleventh byte is never read
+    uint8_t overflow[11] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x02, 0x00 };
+    uint64_t value;
+    CHECK_EQ(event_protocol_get_varint(overflow, sizeof(overflow), &value), 0);
+    overflow[9] = 0x81;
+    CHECK_EQ(event_protocol_get_varint(overflow, sizeof(overflow), &value), 0);
+}
+
+static void test_crc(void) {
+    // Check value of CRC-16/CCITT-FALSE
+    CHECK_EQ(event_protocol_crc16((const uint8_t*)"123456789", 9), 0x29B1);
+    CHECK_EQ(event_protocol_crc16(NULL, 0), 0xFFFF);
+}
+
+static void test_round_trip(void) {
+    uint8_t buf[256];
+    size_t frameSize = encode_samples(buf, sizeof(buf), 0xBEEF);
+
+    size_t announced = 0;
+    CHECK_EQ(event_protocol_frame_size(buf, EVENT_PROTOCOL_HEADER_SIZE, &announced), EVENT_PROTOCOL_SUCCESS);
+    CHECK_EQ(announced, frameSize);
+
+    event_decoder_t decoder;
+    CHECK_EQ(event_decoder_begin(&decoder, buf, frameSize), EVENT_PROTOCOL_SUCCESS);
+    CHECK_EQ(decoder.header.version, EVENT_PROTOCOL_VERSION);
+    CHECK_EQ(decoder.header.type, EVENT_FRAME_TYPE_EVENTS);
+    CHECK_EQ(decoder.header.count, EVENT_COUNT);
+    CHECK_EQ(decoder.header.sequence, 0xBEEF);
+    CHECK_EQ(decoder.header.length, frameSize - EVENT_PROTOCOL_HEADER_SIZE - EVENT_PROTOCOL_CRC_SIZE);
+    for (size_t i = 0; i < EVENT_COUNT; i++) {
+        event_protocol_event_t event;
+        CHECK_EQ(event_decoder_next(&decoder, &event), EVENT_PROTOCOL_SUCCESS);
+        CHECK_EQ(event.type, gEvents[i].type);
+        CHECK(event.timestamp_us == gEvents[i].timestamp_us);
+        CHECK_EQ(event.size, gEvents[i].size);
+        CHECK(memcmp(event.payload, gEvents[i].payload, event.size) == 0);
+    }
+    event_protocol_event_t event;
+    CHECK_EQ(event_decoder_next(&decoder, &event), EVENT_PROTOCOL_END);
+    CHECK_EQ(event_decoder_next(&decoder, &event), EVENT_PROTOCOL_END);
+
+    // Bytes of the next frame behind this one are left alone
+    uint8_t stream[512];
+    memcpy(stream, buf, frameSize);
+    memcpy(&stream[frameSize], buf, frameSize);
+    CHECK_EQ(decode_all(stream, 2 * frameSize), EVENT_PROTOCOL_END);
+    CHECK_EQ(decode_all(&stream[frameSize], frameSize), EVENT_PROTOCOL_END);
+}
+
+static void test_encoder_limits(void) {
+    uint8_t buf[EVENT_PROTOCOL_HEADER_SIZE + 1 + EVENT_PROTOCOL_CRC_SIZE];
+    event_encoder_t encoder;
+    size_t frameSize = 0;
+
+    // The heartbeat without events
+    event_encoder_begin(&encoder, buf, sizeof(buf), 7);
+    CHECK_EQ(event_encoder_finish(&encoder, &frameSize), EVENT_PROTOCOL_SUCCESS);
+    CHECK_EQ(frameSize, sizeof(buf));
+    CHECK_EQ(decode_copy(buf, frameSize), EVENT_PROTOCOL_END);
+    event_encoder_begin(&encoder, buf, sizeof(buf) - 1, 7);
+    CHECK_EQ(event_encoder_finish(&encoder, &frameSize), EVENT_PROTOCOL_ERROR_NO_SPACE);
+
+    // A rejected event leaves the frame as it was
+    uint8_t frame[64];
+    uint8_t payload[EVENT_PROTOCOL_MAX_PAYLOAD] = { 0 };
+    event_encoder_begin(&encoder, frame, sizeof(frame), 8);
+    CHECK_EQ(event_encoder_add(&encoder, EVENT_TYPE_LED, 500, payload, 2), EVENT_PROTOCOL_SUCCESS);
+    CHECK_EQ(event_encoder_add(&encoder, EVENT_TYPE_LED, 499, payload, 2), EVENT_PROTOCOL_ERROR_ARGUMENT);
+    CHECK_EQ(event_encoder_add(&encoder, EVENT_TYPE_LED, 500, NULL, 2), EVENT_PROTOCOL_ERROR_ARGUMENT);
+    CHECK_EQ(event_encoder_add(&encoder, EVENT_TYPE_IMU, 600, payload, 60), EVENT_PROTOCOL_ERROR_NO_SPACE);
+    CHECK_EQ(event_encoder_finish(&encoder, &frameSize), EVENT_PROTOCOL_SUCCESS);
+    CHECK_EQ(decode_copy(frame, frameSize), EVENT_PROTOCOL_END);
+
+    // At most 255 events per frame
+    static uint8_t large[EVENT_PROTOCOL_MAX_FRAME_SIZE];
+    event_encoder_begin(&encoder, large, sizeof(large), 9);
+    for (int i = 0; i < EVENT_PROTOCOL_MAX_EVENTS; i++) {
+        CHECK_EQ(event_encoder_add(&encoder, EVENT_TYPE_POTENTIOMETER, i, payload, 1), EVENT_PROTOCOL_SUCCESS);
+    }
+    CHECK_EQ(event_encoder_add(&encoder, EVENT_TYPE_POTENTIOMETER, 255, payload, 1), EVENT_PROTOCOL_ERROR_NO_SPACE);
+    CHECK_EQ(event_encoder_finish(&encoder, &frameSize), EVENT_PROTOCOL_SUCCESS);
+    CHECK_EQ(decode_copy(large, frameSize), EVENT_PROTOCOL_END);
+}
+
+// Every prefix of a frame is incomplete, a changed bit fails the CRC
+static void test_truncated_and_corrupted(void) {
+    uint8_t frame[256];
+    size_t frameSize = encode_samples(frame, sizeof(frame), 1);
+    for (size_t len = 0; len < frameSize; len++) {
+        CHECK_EQ(decode_copy(frame, len), EVENT_PROTOCOL_ERROR_INCOMPLETE);
+    }
+    for (size_t bit = 0; bit < frameSize * 8; bit++) {
+        frame[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+        int ret = decode_copy(frame, frameSize);
+        if (bit >= 5 && bit < 8) {
+            CHECK_EQ(ret, EVENT_PROTOCOL_ERROR_VERSION); // the version bits
+        } else if (bit / 8 != 4 && bit / 8 != 5) {
+            CHECK_EQ(ret, EVENT_PROTOCOL_ERROR_CRC);
+        } else {
+            CHECK(ret != EVENT_PROTOCOL_END); // the length, frame and CRC move
+        }
+        frame[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+    }
+    frame[0] = (uint8_t)((EVENT_PROTOCOL_VERSION << 5) | EVENT_FRAME_TYPE_COUNT);
+    reseal(frame, frameSize);
+    CHECK_EQ(decode_copy(frame, frameSize), EVENT_PROTOCOL_ERROR_MALFORMED);
+}
+
+// A valid CRC over a body that disagrees with the header
+static void test_malformed(void) {
+    uint8_t frame[256];
+    size_t frameSize = encode_samples(frame, sizeof(frame), 2);
+
+    // More events announced than the body holds, and fewer
+    frame[1] = EVENT_COUNT + 1;
+    reseal(frame, frameSize);
+    CHECK_EQ(decode_copy(frame, frameSize), EVENT_PROTOCOL_ERROR_MALFORMED);
+    frame[1] = EVENT_COUNT - 1;
+    reseal(frame, frameSize);
+    CHECK_EQ(decode_copy(frame, frameSize), EVENT_PROTOCOL_ERROR_MALFORMED);
+    frame[1] = EVENT_COUNT;
+
+    // The body cut off at every length, resealed so only the events are short
+    for (size_t end = EVENT_PROTOCOL_HEADER_SIZE; end < frameSize - EVENT_PROTOCOL_CRC_SIZE; end++) {
+        uint8_t cut[256];
+        memcpy(cut, frame, end);
+        reseal(cut, end + EVENT_PROTOCOL_CRC_SIZE);
+        CHECK_EQ(decode_copy(cut, end + EVENT_PROTOCOL_CRC_SIZE), EVENT_PROTOCOL_ERROR_MALFORMED);
+    }
+
+    // A delta that overflows the timestamp
+    uint8_t overflow[64];
+    size_t len = EVENT_PROTOCOL_HEADER_SIZE;
+    overflow[0] = (uint8_t)(EVENT_PROTOCOL_VERSION << 5);
+    overflow[1] = 1;
+    overflow[2] = overflow[3] = 0;
+    len += event_protocol_put_varint(&overflow[len], sizeof(overflow) - len, 2);
+    overflow[len++] = EVENT_TYPE_LED;
+    len += event_protocol_put_varint(&overflow[len], sizeof(overflow) - len, UINT64_MAX);
+    overflow[len++] = 0;
+    reseal(overflow, len + EVENT_PROTOCOL_CRC_SIZE);
+    CHECK_EQ(decode_copy(overflow, len + EVENT_PROTOCOL_CRC_SIZE), EVENT_PROTOCOL_ERROR_MALFORMED);
+}
+
+// Random bodies and random changes to a valid frame, all resealed: the decoder must only ever stop
+static void test_garbage(void) {
+    uint8_t frame[256];
+    uint8_t sample[256];
+    size_t sampleSize = encode_samples(sample, sizeof(sample), 3);
+    int decoded = 0;
+    for (int round = 0; round < 200000; round++) {
+        size_t frameSize;
+        if (round % 2 == 0) {
+            frameSize = EVENT_PROTOCOL_HEADER_SIZE + 1 + next_random() % 64 + EVENT_PROTOCOL_CRC_SIZE;
+            for (size_t i = 0; i < frameSize; i++) {
+                frame[i] = (uint8_t)next_random();
+            }
+            frame[1] = (uint8_t)(next_random() % 8);
+        } else {
+            frameSize = sampleSize;
+            memcpy(frame, sample, sampleSize);
+            for (uint32_t changes = 1 + next_random() % 4; changes > 0; changes--) {
+                frame[EVENT_PROTOCOL_HEADER_SIZE + next_random() % (frameSize - EVENT_PROTOCOL_HEADER_SIZE)] = (uint8_t)next_random();
+            }
+        }
+        frame[0] = (uint8_t)((EVENT_PROTOCOL_VERSION << 5) | EVENT_FRAME_TYPE_EVENTS);
+        reseal(frame, frameSize);
+        int ret = decode_copy(frame, frameSize);
+        CHECK(ret == EVENT_PROTOCOL_END || ret == EVENT_PROTOCOL_ERROR_MALFORMED);
+        decoded += (ret == EVENT_PROTOCOL_END);
+    }
+    CHECK(decoded > 0);
+}
+
+int main(void) {
+    RUN_TEST(test_varint);
+    RUN_TEST(test_crc);
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_encoder_limits);
+    RUN_TEST(test_truncated_and_corrupted);
+    RUN_TEST(test_malformed);
+    RUN_TEST(test_garbage);
+    return host_test_result();
+}
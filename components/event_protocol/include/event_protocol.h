@@ -0,0 +1,99 @@
+#ifndef EVENT_PROTOCOL_H
+#define EVENT_PROTOCOL_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Binary event protocol shared by the device and host tools. Plain C without ESP-IDF includes,
+// encoder and decoder work on caller provided buffers and never allocate.
+//
+// Frame, all multi-byte fields big-endian:
+//   [version:3|type:5] [count] [sequence:16] [length:16]   header, length = bytes of the body
+//   [base timestamp varint]                                 microseconds, of the first event
+//   count * ([event type] [delta varint] [size] [payload])  delta to the previous event in us
+//   [crc:16]                                                CRC-16/CCITT-FALSE over header and body
+//
+// Varints are unsigned LEB128, 7 bits per byte with the least significant group first.
+
+#define EVENT_PROTOCOL_VERSION              1
+
+#define EVENT_PROTOCOL_SUCCESS              0
+#define EVENT_PROTOCOL_END                  1   // no more events in the frame
+#define EVENT_PROTOCOL_ERROR_NO_SPACE      -1
+#define EVENT_PROTOCOL_ERROR_ARGUMENT      -2
+#define EVENT_PROTOCOL_ERROR_INCOMPLETE    -3   // more bytes of the frame are needed
+#define EVENT_PROTOCOL_ERROR_VERSION       -4
+#define EVENT_PROTOCOL_ERROR_CRC           -5
+#define EVENT_PROTOCOL_ERROR_MALFORMED     -6
+
+#define EVENT_PROTOCOL_HEADER_SIZE          6
+#define EVENT_PROTOCOL_CRC_SIZE             2
+#define EVENT_PROTOCOL_MAX_VARINT_SIZE      10
+#define EVENT_PROTOCOL_MAX_EVENTS           255
+#define EVENT_PROTOCOL_MAX_PAYLOAD          255
+#define EVENT_PROTOCOL_MAX_FRAME_SIZE       (EVENT_PROTOCOL_HEADER_SIZE + UINT16_MAX + EVENT_PROTOCOL_CRC_SIZE)
+// Worst case size of one event in the body, for sizing buffers
+#define EVENT_PROTOCOL_EVENT_OVERHEAD       (2 + EVENT_PROTOCOL_MAX_VARINT_SIZE)
+
+// Frame types, 5 bits
+#define EVENT_FRAME_TYPE_EVENTS             0
+#define EVENT_FRAME_TYPE_COUNT              1
+#if EVENT_FRAME_TYPE_COUNT > 32
+    #error "Too many frame types!"
+#endif
+
+// Event types and their payloads
+#define EVENT_TYPE_BUTTON           0   // [button id] [action], action: pressed=1, released=0
+#define EVENT_TYPE_LED              1   // [led id] [state]
+#define EVENT_TYPE_POTENTIOMETER    2   // [value]
+#define EVENT_TYPE_IMU              3   // [ax:16] [ay:16] [az:16] [gx:16] [gy:16] [gz:16], signed raw values
+#define EVENT_TYPE_ORIENTATION      4   // [w:16] [x:16] [y:16] [z:16], quaternion scaled by 2^14, see fusion_pack_q14()
+
+typedef struct {
+    uint8_t version;
+    uint8_t type;
+    uint8_t count;
+    uint16_t sequence;
+    uint16_t length;
+} event_frame_header_t;
+
+typedef struct {
+    uint8_t type;
+    uint64_t timestamp_us;
+    uint8_t size;
+    const uint8_t* payload;     // decoded events point into the frame
+} event_protocol_event_t;
+
+typedef struct {
+    uint8_t* buf;
+    size_t size;
+    size_t len;
+    uint8_t count;
+    uint16_t sequence;
+    uint64_t lastTimestamp_us;
+} event_encoder_t;
+
+typedef struct {
+    const uint8_t* frame;
+    size_t pos;
+    size_t end;                 // start of the CRC
+    uint8_t remaining;
+    uint64_t lastTimestamp_us;
+    event_frame_header_t header;
+} event_decoder_t;
+
+void event_encoder_begin(event_encoder_t* pEncoder, uint8_t* buf, size_t size, uint16_t sequence);
+int event_encoder_add(event_encoder_t* pEncoder, uint8_t type, uint64_t timestamp_us, const uint8_t* payload, uint8_t size);
+int event_encoder_finish(event_encoder_t* pEncoder, size_t* pFrameSize);
+
+int event_protocol_frame_size(const uint8_t* data, size_t len, size_t* pFrameSize);
+int event_decoder_begin(event_decoder_t* pDecoder, const uint8_t* frame, size_t len);
+int event_decoder_next(event_decoder_t* pDecoder, event_protocol_event_t* pEvent);
+
+size_t event_protocol_put_varint(uint8_t* buf, size_t size, uint64_t value);
+size_t event_protocol_get_varint(const uint8_t* buf, size_t size, uint64_t* pValue);
+uint16_t event_protocol_crc16(const uint8_t* data, size_t len);
+const char* event_protocol_strerror(int error);
+
+#endif // EVENT_PROTOCOL_H
@@ -0,0 +1,317 @@
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "fusion.h"
+
+#define FUSION_PI       3.14159265358979f
+#define RAD_TO_DEG      (180.0f / FUSION_PI)
+#define DEG_TO_RAD      (FUSION_PI / 180.0f)
+
+static void normalize(fusion_quaternion_t* pQ);
+static void integrate_gyro(fusion_quaternion_t* pQ, float gx, float gy, float gz, float dt);
+static bool normalize_accel(const fusion_sample_t* pSample, float* pAx, float* pAy, float* pAz);
+static fusion_quaternion_t from_euler(float roll, float pitch, float yaw);
+static fusion_quaternion_t accel_tilt(float ax, float ay, float az, float yaw);
+static void update_complementary(fusion_t* pFusion, const fusion_sample_t* pSample);
+static void update_madgwick(fusion_t* pFusion, const fusion_sample_t* pSample);
+static void update_mahony(fusion_t* pFusion, const fusion_sample_t* pSample);
+static int16_t to_q14(float value);
+
+// ----- implementation -----
+
+void normalize(fusion_quaternion_t* pQ) {
+    float norm = sqrtf(pQ->w * pQ->w + pQ->x * pQ->x + pQ->y * pQ->y + pQ->z * pQ->z);
+    if (norm > 0.0f) {
+        pQ->w /= norm;
+        pQ->x /= norm;
+        pQ->y /= norm;
+        pQ->z /= norm;
+    } else {
+        *pQ = (fusion_quaternion_t){ 1.0f, 0.0f, 0.0f, 0.0f };
+    }
+}
+
+// q += 0.5 * q * (0, g) * dt, first order is exact enough at IMU sample rates
+void integrate_gyro(fusion_quaternion_t* pQ, float gx, float gy, float gz, float dt) {
+    float h = 0.5f * dt;
+    fusion_quaternion_t q = *pQ;
+    pQ->w += h * (-q.x * gx - q.y * gy - q.z * gz);
+    pQ->x += h * (q.w * gx + q.y * gz - q.z * gy);
+    pQ->y += h * (q.w * gy - q.x * gz + q.z * gx);
+    pQ->z += h * (q.w * gz + q.x * gy - q.y * gx);
+    normalize(pQ);
+}
+
+// False in free fall, the direction of gravity is unknown then
+bool normalize_accel(const fusion_sample_t* pSample, float* pAx, float* pAy, float* pAz) {
+    float norm = sqrtf(pSample->accel[0] * pSample->accel[0] + pSample->accel[1] * pSample->accel[1]
+                       + pSample->accel[2] * pSample->accel[2]);
+    if (norm < 1e-6f) {
+        return false;
+    }
+    *pAx = pSample->accel[0] / norm;
+    *pAy = pSample->accel[1] / norm;
+    *pAz = pSample->accel[2] / norm;
+    return true;
+}
+
+// Z-Y-X order, angles in radians
+fusion_quaternion_t from_euler(float roll, float pitch, float yaw) {
+    float cr = cosf(roll * 0.5f);
+    float sr = sinf(roll * 0.5f);
+    float cp = cosf(pitch * 0.5f);
+    float sp = sinf(pitch * 0.5f);
+    float cy = cosf(yaw * 0.5f);
+    float sy = sinf(yaw * 0.5f);
+    fusion_quaternion_t q = {
+        .w = cr * cp * cy + sr * sp * sy,
+        .x = sr * cp * cy - cr * sp * sy,
+        .y = cr * sp * cy + sr * cp * sy,
+        .z = cr * cp * sy - sr * sp * cy,
+    };
+    return q;
+}
+
+// Orientation that has gravity where the accelerometer sees it, with the given yaw
+fusion_quaternion_t accel_tilt(float ax, float ay, float az, float yaw) {
+    float roll = atan2f(ay, az);
+    float pitch = atan2f(-ax, sqrtf(ay * ay + az * az));
+    return from_euler(roll, pitch, yaw);
+}
+
+/*
+ * @brief Integrates the gyroscope and moves a fraction alpha towards the accelerometer tilt
+ *
+ *  The tilt keeps the current yaw. Close to +-90 degrees pitch the yaw is ill defined and the
+ *  correction gets noisy, Madgwick or Mahony handle that range better.
+ */
+void update_complementary(fusion_t* pFusion, const fusion_sample_t* pSample) {
+    integrate_gyro(&pFusion->q, pSample->gyro[0], pSample->gyro[1], pSample->gyro[2], pFusion->period_s);
+
+    float ax, ay, az;
+    if (!normalize_accel(pSample, &ax, &ay, &az)) {
+        return;
+    }
+    fusion_euler_t euler;
+    fusion_to_euler(&pFusion->q, &euler);
+    fusion_quaternion_t target = accel_tilt(ax, ay, az, euler.yaw * DEG_TO_RAD);
+
+    // q and -q are the same rotation, blend towards the closer one
+    fusion_quaternion_t* pQ = &pFusion->q;
+    float dot = pQ->w * target.w + pQ->x * target.x + pQ->y * target.y + pQ->z * target.z;
+    float alpha = (dot < 0.0f) ? -pFusion->config.gain : pFusion->config.gain;
+    float keep = 1.0f - pFusion->config.gain;
+    pQ->w = keep * pQ->w + alpha * target.w;
+    pQ->x = keep * pQ->x + alpha * target.x;
+    pQ->y = keep * pQ->y + alpha * target.y;
+    pQ->z = keep * pQ->z + alpha * target.z;
+    normalize(pQ);
+}
+
+/*
+ * @brief Madgwick's IMU update
+ *
+ *  The gradient of the error between measured and expected gravity is subtracted from the rate of
+ *  change, scaled by beta. See Madgwick, "An efficient orientation filter for inertial and
+ *  inertial/magnetic sensor arrays", 2010.
+ */
+void update_madgwick(fusion_t* pFusion, const fusion_sample_t* pSample) {
+    fusion_quaternion_t* pQ = &pFusion->q;
+    float q0 = pQ->w, q1 = pQ->x, q2 = pQ->y, q3 = pQ->z;
+    float gx = pSample->gyro[0], gy = pSample->gyro[1], gz = pSample->gyro[2];
+
+    float qDot0 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+    float qDot1 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+    float qDot2 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+    float qDot3 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+    float ax, ay, az;
+    if (normalize_accel(pSample, &ax, &ay, &az)) {
+        float _2q0 = 2.0f * q0, _2q1 = 2.0f * q1, _2q2 = 2.0f * q2, _2q3 = 2.0f * q3;
+        float _4q0 = 4.0f * q0, _4q1 = 4.0f * q1, _4q2 = 4.0f * q2;
+        float _8q1 = 8.0f * q1, _8q2 = 8.0f * q2;
+        float q0q0 = q0 * q0, q1q1 = q1 * q1, q2q2 = q2 * q2, q3q3 = q3 * q3;
+
+        float s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
+        float s1 = _4q1 * q3q3 - _2q3 * ax + 4.0f * q0q0 * q1 - _2q0 * ay - _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+        float s2 = 4.0f * q0q0 * q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+        float s3 = 4.0f * q1q1 * q3 - _2q1 * ax + 4.0f * q2q2 * q3 - _2q2 * ay;
+        float norm = sqrtf(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3);
+        if (norm > 0.0f) {
+            float beta = pFusion->config.gain / norm;
+            qDot0 -= beta * s0;
+            qDot1 -= beta * s1;
+            qDot2 -= beta * s2;
+            qDot3 -= beta * s3;
+        }
+    }
+
+    pQ->w += qDot0 * pFusion->period_s;
+    pQ->x += qDot1 * pFusion->period_s;
+    pQ->y += qDot2 * pFusion->period_s;
+    pQ->z += qDot3 * pFusion->period_s;
+    normalize(pQ);
+}
+
+/*
+ * @brief Mahony's IMU update
+ *
+ *  The cross product of measured and expected gravity is fed back into the gyroscope rates,
+ *  proportional with Kp and integrated with Ki. The integral converges to the gyroscope bias.
+ */
+void update_mahony(fusion_t* pFusion, const fusion_sample_t* pSample) {
+    fusion_quaternion_t* pQ = &pFusion->q;
+    float gx = pSample->gyro[0], gy = pSample->gyro[1], gz = pSample->gyro[2];
+
+    float ax, ay, az;
+    if (normalize_accel(pSample, &ax, &ay, &az)) {
+        // Half of the expected gravity direction in the sensor frame
+        float vx = pQ->x * pQ->z - pQ->w * pQ->y;
+        float vy = pQ->w * pQ->x + pQ->y * pQ->z;
+        float vz = pQ->w * pQ->w - 0.5f + pQ->z * pQ->z;
+
+        float ex = ay * vz - az * vy;
+        float ey = az * vx - ax * vz;
+        float ez = ax * vy - ay * vx;
+
+        if (pFusion->config.integralGain > 0.0f) {
+            float ki = 2.0f * pFusion->config.integralGain * pFusion->period_s;
+            pFusion->integral[0] += ki * ex;
+            pFusion->integral[1] += ki * ey;
+            pFusion->integral[2] += ki * ez;
+            gx += pFusion->integral[0];
+            gy += pFusion->integral[1];
+            gz += pFusion->integral[2];
+        }
+        float kp = 2.0f * pFusion->config.gain;
+        gx += kp * ex;
+        gy += kp * ey;
+        gz += kp * ez;
+    }
+    integrate_gyro(pQ, gx, gy, gz, pFusion->period_s);
+}
+
+void fusion_init(fusion_t* pFusion, const fusion_config_t* pConfig) {
+    memset(pFusion, 0, sizeof(fusion_t));
+    pFusion->config = *pConfig;
+    pFusion->period_s = (pConfig->sampleRate_hz > 0.0f) ? 1.0f / pConfig->sampleRate_hz : 0.0f;
+    if (pFusion->config.gain <= 0.0f) {
+        switch (pConfig->algorithm) {
+            // alpha is a weight per update, derived from the time constant so it holds at any rate
+            case FUSION_COMPLEMENTARY:  pFusion->config.gain = pFusion->period_s / FUSION_DEFAULT_TAU_S; break;
+            case FUSION_MADGWICK:       pFusion->config.gain = FUSION_DEFAULT_BETA; break;
+            case FUSION_MAHONY:         pFusion->config.gain = FUSION_DEFAULT_KP; break;
+        }
+    }
+    pFusion->outputEvery = 1;
+    if (pConfig->outputRate_hz > 0.0f && pConfig->outputRate_hz < pConfig->sampleRate_hz) {
+        pFusion->outputEvery = (uint32_t)(pConfig->sampleRate_hz / pConfig->outputRate_hz + 0.5f);
+    }
+    fusion_reset(pFusion);
+}
+
+void fusion_reset(fusion_t* pFusion) {
+    pFusion->q = (fusion_quaternion_t){ 1.0f, 0.0f, 0.0f, 0.0f };
+    memset(pFusion->integral, 0, sizeof(pFusion->integral));
+    pFusion->pending = 0;
+    pFusion->updates = 0;
+}
+
+/*
+ * @brief Advances the orientation by one sample period
+ *
+ *  The first sample sets the tilt straight from the accelerometer, so the filter does not need
+ *  seconds to converge from an arbitrary start.
+ */
+void fusion_update(fusion_t* pFusion, const fusion_sample_t* pSample) {
+    float ax, ay, az;
+    if (pFusion->updates == 0 && normalize_accel(pSample, &ax, &ay, &az)) {
+        pFusion->q = accel_tilt(ax, ay, az, 0.0f);
+    } else {
+        switch (pFusion->config.algorithm) {
+            case FUSION_COMPLEMENTARY:  update_complementary(pFusion, pSample); break;
+            case FUSION_MADGWICK:       update_madgwick(pFusion, pSample); break;
+            case FUSION_MAHONY:         update_mahony(pFusion, pSample); break;
+        }
+    }
+    pFusion->updates++;
+}
+
+/*
+ * @brief Runs a block of samples, e.g. one FIFO read, through the filter
+ *
+ *  Every outputEvery-th orientation is stored in pOutputs. Once pOutputs is full, the samples are
+ *  still used, but no more orientations are stored.
+ *
+ * @return number of orientations stored
+ */
+size_t fusion_update_block(fusion_t* pFusion, const fusion_sample_t* pSamples, size_t count,
+                           fusion_quaternion_t* pOutputs, size_t maxOutputs) {
+    size_t outputs = 0;
+    for (size_t i = 0; i < count; i++) {
+        fusion_update(pFusion, &pSamples[i]);
+        if (++pFusion->pending >= pFusion->outputEvery && outputs < maxOutputs) {
+            pOutputs[outputs++] = pFusion->q;
+            pFusion->pending = 0;
+        }
+    }
+    return outputs;
+}
+
+void fusion_sample_from_raw(const int16_t accel[3], const int16_t gyro[3], float accelLsbPerG,
+                            float gyroLsbPerDps, fusion_sample_t* pSample) {
+    for (int i = 0; i < 3; i++) {
+        pSample->accel[i] = accel[i] / accelLsbPerG;
+        pSample->gyro[i] = gyro[i] / gyroLsbPerDps * DEG_TO_RAD;
+    }
+}
+
+void fusion_to_euler(const fusion_quaternion_t* pQ, fusion_euler_t* pEuler) {
+    float sinPitch = 2.0f * (pQ->w * pQ->y - pQ->z * pQ->x);
+    if (sinPitch > 1.0f) {
+        sinPitch = 1.0f;
+    } else if (sinPitch < -1.0f) {
+        sinPitch = -1.0f;
+    }
+    pEuler->roll = atan2f(2.0f * (pQ->w * pQ->x + pQ->y * pQ->z), 1.0f - 2.0f * (pQ->x * pQ->x + pQ->y * pQ->y)) * RAD_TO_DEG;
+    pEuler->pitch = asinf(sinPitch) * RAD_TO_DEG;
+    pEuler->yaw = atan2f(2.0f * (pQ->w * pQ->z + pQ->x * pQ->y), 1.0f - 2.0f * (pQ->y * pQ->y + pQ->z * pQ->z)) * RAD_TO_DEG;
+}
+
+int16_t to_q14(float value) {
+    float scaled = value * FUSION_Q14_ONE;
+    if (scaled > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (scaled < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return (int16_t)lrintf(scaled);
+}
+
+/*
+ * @brief Packs w, x, y, z as big-endian signed 16 bit values scaled by FUSION_Q14_ONE
+ *
+ *  The payload of EVENT_TYPE_ORIENTATION, resolution about 0.007 degrees.
+ *
+ * @return FUSION_PACKED_SIZE
+ */
+size_t fusion_pack_q14(const fusion_quaternion_t* pQ, uint8_t* data) {
+    const float values[4] = { pQ->w, pQ->x, pQ->y, pQ->z };
+    for (int i = 0; i < 4; i++) {
+        uint16_t value = (uint16_t)to_q14(values[i]);
+        data[2 * i] = (uint8_t)(value >> 8);
+        data[2 * i + 1] = (uint8_t)value;
+    }
+    return FUSION_PACKED_SIZE;
+}
+
+const char* fusion_algorithm_name(fusion_algorithm_t algorithm) {
+    switch (algorithm) {
+        case FUSION_COMPLEMENTARY:  return "complementary";
+        case FUSION_MADGWICK:       return "madgwick";
+        case FUSION_MAHONY:         return "mahony";
+    }
+    return "unknown";
+}
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "fusion.h"
+#include "fusion_task.h"
+#include "ICM42688P.h"
+#if CONFIG_FUSION_OUTPUT_EVENTS
+#include "event_protocol.h"
+#include "packet_sender.h"
+#else
+#include "mqtt_impl.h"
+#endif
+
+static const char *TAG = "FUSION";
+
+#define FUSION_TASK_STACKSIZE       4096
+#define FUSION_TASK_PRIORITY        5       // above activity, the FIFO must not overflow
+
+#if CONFIG_FUSION_ODR_1KHZ
+#define FUSION_ODR                  ICM42688P_ODR_1KHZ
+#define FUSION_SAMPLE_RATE_HZ       1000
+#elif CONFIG_FUSION_ODR_500HZ
+#define FUSION_ODR                  ICM42688P_ODR_500HZ
+#define FUSION_SAMPLE_RATE_HZ       500
+#elif CONFIG_FUSION_ODR_200HZ
+#define FUSION_ODR                  ICM42688P_ODR_200HZ
+#define FUSION_SAMPLE_RATE_HZ       200
+#else
+#define FUSION_ODR                  ICM42688P_ODR_100HZ
+#define FUSION_SAMPLE_RATE_HZ       100
+#endif
+
+#if CONFIG_FUSION_ALGORITHM_COMPLEMENTARY
+#define FUSION_ALGORITHM            FUSION_COMPLEMENTARY
+#elif CONFIG_FUSION_ALGORITHM_MAHONY
+#define FUSION_ALGORITHM            FUSION_MAHONY
+#else
+#define FUSION_ALGORITHM            FUSION_MADGWICK
+#endif
+
+// Read at the output rate, but at least twice per FIFO fill
+#define FUSION_BLOCK_SIZE           ICM42688P_FIFO_MAX_IMU_SAMPLES
+#define FUSION_FIFO_TIME_MS         (FUSION_BLOCK_SIZE * 1000 / FUSION_SAMPLE_RATE_HZ)
+#define FUSION_OUTPUT_PERIOD_MS     (1000 / CONFIG_FUSION_OUTPUT_RATE_HZ)
+#define FUSION_READ_INTERVAL_MS     ((FUSION_OUTPUT_PERIOD_MS < FUSION_FIFO_TIME_MS / 2) ? FUSION_OUTPUT_PERIOD_MS : FUSION_FIFO_TIME_MS / 2)
+
+static fusion_t gFusion;
+static ICM42688P_imu_sample_t gRaw[FUSION_BLOCK_SIZE];
+static fusion_sample_t gSamples[FUSION_BLOCK_SIZE];
+static fusion_quaternion_t gOutputs[FUSION_BLOCK_SIZE];
+static ICM42688P_fifo_stats_t gFifoStats;
+static TaskHandle_t gFusionTask = NULL;
+static volatile bool gRunning = false;
+
+#if CONFIG_FUSION_OUTPUT_EVENTS
+static char gCollectorIP[] = CONFIG_IPV4_ADDR;
+static uint8_t gFrame[UDP_TELEMETRY_MAX_EVENT_SIZE];
+static event_encoder_t gEncoder;
+static uint16_t gSequence = 0;
+#endif
+
+static void publish(const fusion_quaternion_t* pQ, int64_t timestamp_us);
+static void publish_done(void);
+static void process_block(size_t count);
+static void fusion_task(void* pvParameters);
+
+// ----- implementation -----
+
+#if CONFIG_FUSION_OUTPUT_EVENTS
+
+// Orientations of one read share a frame, it leaves once full or after the read
+void publish(const fusion_quaternion_t* pQ, int64_t timestamp_us) {
+    uint8_t payload[FUSION_PACKED_SIZE];
+    fusion_pack_q14(pQ, payload);
+    if (event_encoder_add(&gEncoder, EVENT_TYPE_ORIENTATION, timestamp_us, payload, sizeof(payload)) == EVENT_PROTOCOL_ERROR_NO_SPACE) {
+        publish_done();
+        event_encoder_add(&gEncoder, EVENT_TYPE_ORIENTATION, timestamp_us, payload, sizeof(payload));
+    }
+}
+
+void publish_done(void) {
+    size_t frameSize;
+    if (gEncoder.count > 0 && event_encoder_finish(&gEncoder, &frameSize) == EVENT_PROTOCOL_SUCCESS) {
+        packetsender_sendTelemetry(gCollectorIP, CONFIG_PORT, gFrame, (uint16_t)frameSize);
+        gSequence++;
+    }
+    event_encoder_begin(&gEncoder, gFrame, sizeof(gFrame), gSequence);
+}
+
+#else
+
+void publish(const fusion_quaternion_t* pQ, int64_t timestamp_us) {
+    fusion_euler_t euler;
+    fusion_to_euler(pQ, &euler);
+    char message[FUSION_MAX_MESSAGE_SIZE];
+    int len = snprintf(message, sizeof(message),
+                       "{\"w\":%.4f,\"x\":%.4f,\"y\":%.4f,\"z\":%.4f,\"roll\":%.1f,\"pitch\":%.1f,\"yaw\":%.1f}",
+                       pQ->w, pQ->x, pQ->y, pQ->z, euler.roll, euler.pitch, euler.yaw);
+    if (len > 0 && len < (int)sizeof(message)) {
+        mqtt_sendpayload(CONFIG_FUSION_TOPIC, (uint8_t*)message, (uint16_t)len);
+    }
+}
+
+void publish_done(void) {
+}
+
+#endif
+
+void process_block(size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const int16_t accel[3] = { gRaw[i].accel.x, gRaw[i].accel.y, gRaw[i].accel.z };
+        const int16_t gyro[3] = { gRaw[i].gyro.x, gRaw[i].gyro.y, gRaw[i].gyro.z };
+        fusion_sample_from_raw(accel, gyro, ICM42688P_ACCEL_LSB_PER_G, ICM42688P_GYRO_LSB_PER_DPS, &gSamples[i]);
+    }
+    // The outputs can not overflow gOutputs, so output k belongs to sample first + k * outputEvery
+    size_t first = gFusion.outputEvery - gFusion.pending - 1;
+    size_t outputs = fusion_update_block(&gFusion, gSamples, count, gOutputs, FUSION_BLOCK_SIZE);
+    for (size_t k = 0; k < outputs; k++) {
+        publish(&gOutputs[k], gRaw[first + k * gFusion.outputEvery].timestamp_us);
+    }
+}
+
+// Drains the FIFO, the samples are dated from the read time at the output data rate
+void fusion_task(void* pvParameters) {
+    TickType_t lastWake = xTaskGetTickCount();
+
+    while (gRunning) {
+        size_t count;
+        do {
+            ICM42688P_fifo_clock_t clock = {
+                .anchor_us = esp_timer_get_time(),
+                .anchorIndex = -1,
+                .period_us = ICM42688P_fifo_period_us(),
+            };
+            int read = ICM42688P_fifo_drain_imu(gRaw, FUSION_BLOCK_SIZE, &gFifoStats, &clock);
+            count = (read > 0) ? (size_t)read : 0;
+            process_block(count);
+        } while (count == FUSION_BLOCK_SIZE);
+        publish_done();
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(FUSION_READ_INTERVAL_MS));
+    }
+
+    ICM42688P_fifo_stop();
+    ESP_LOGI(TAG, "Stopped after %" PRIu32 " samples, %" PRIu32 " FIFO errors", gFifoStats.samples, gFifoStats.errors);
+    gFusionTask = NULL;
+    vTaskDelete(NULL);
+}
+
+/*
+ * @brief Streams accelerometer and gyroscope samples through the FIFO and starts the filter
+ *
+ *  The sensor must be configured and the network connected before. The FIFO is read by this task
+ *  alone, ICM42688P_stream_start() must not run at the same time.
+ */
+esp_err_t fusion_start(void) {
+    if (gRunning || gFusionTask != NULL) { // a stopped task may still be cleaning up
+        return ESP_ERR_INVALID_STATE;
+    }
+    const fusion_config_t config = {
+        .algorithm = FUSION_ALGORITHM,
+        .sampleRate_hz = FUSION_SAMPLE_RATE_HZ,
+        .outputRate_hz = CONFIG_FUSION_OUTPUT_RATE_HZ,
+    };
+    fusion_init(&gFusion, &config);
+    memset(&gFifoStats, 0, sizeof(gFifoStats));
+#if CONFIG_FUSION_OUTPUT_EVENTS
+    event_encoder_begin(&gEncoder, gFrame, sizeof(gFrame), gSequence);
+#endif
+
+    esp_err_t err = ICM42688P_imu_start(FUSION_ODR);
+    if (err != ESP_OK) {
+        return err;
+    }
+    gRunning = true;
+    if (xTaskCreate(fusion_task, "fusion", FUSION_TASK_STACKSIZE, NULL, FUSION_TASK_PRIORITY, &gFusionTask) != pdPASS) {
+        gRunning = false;
+        ICM42688P_fifo_stop();
+        ESP_LOGE(TAG, "Failed to create fusion task");
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "%s at %d Hz, orientation at %d Hz", fusion_algorithm_name(FUSION_ALGORITHM),
+             FUSION_SAMPLE_RATE_HZ, CONFIG_FUSION_OUTPUT_RATE_HZ);
+    return ESP_OK;
+}
+
+// The task finishes its current read and cleans up on its own
+void fusion_stop(void) {
+    gRunning = false;
+}
@@ -0,0 +1,126 @@
+#include <getopt.h>
+
+#include "host_bench.h"
+#include "fusion_trace.h"
+
+// Runs the fusion filters over a motion trace and reports their speed and accuracy. The trace is
+// either synthetic, with the true orientation known, or recorded as CSV.
+
+#define BENCH_SETTLE_S          2.0     // errors before this are not counted
+
+static void run(fusion_algorithm_t algorithm, const trace_t* pTrace, float gain, float integralGain, int repeat) {
+    const fusion_config_t config = {
+        .algorithm = algorithm,
+        .sampleRate_hz = pTrace->rate_hz,
+        .outputRate_hz = 0,
+        .gain = gain,
+        .integralGain = (algorithm == FUSION_MAHONY) ? integralGain : 0.0f,
+    };
+    fusion_t fusion;
+    tilt_error_t error = trace_tilt_error(&config, pTrace, BENCH_SETTLE_S, &fusion);
+
+    // Speed, in blocks as from the FIFO
+    fusion_quaternion_t outputs[128];
+    double start = bench_now_s();
+    for (int r = 0; r < repeat; r++) {
+        fusion_init(&fusion, &config);
+        for (size_t i = 0; i < pTrace->count; i += 128) {
+            size_t block = (pTrace->count - i < 128) ? pTrace->count - i : 128;
+            fusion_update_block(&fusion, &pTrace->samples[i], block, outputs, 128);
+        }
+    }
+    double elapsed = bench_now_s() - start;
+    double rate = (double)pTrace->count * repeat / elapsed;
+
+    fusion_euler_t euler;
+    fusion_to_euler(&fusion.q, &euler);
+    if (error.counted > 0) {
+        printf("%-14s %12.0f updates/s   tilt error rms %6.3f deg  max %6.3f deg\n",
+               fusion_algorithm_name(algorithm), rate, error.rms_deg, error.max_deg);
+    } else {
+        printf("%-14s %12.0f updates/s   final roll %7.2f pitch %7.2f yaw %7.2f deg\n",
+               fusion_algorithm_name(algorithm), rate, euler.roll, euler.pitch, euler.yaw);
+    }
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -a ALGORITHM   complementary, madgwick, mahony or all (default all)\n"
+            "  -f FILE        recorded CSV trace instead of a synthetic one\n"
+            "  -r HZ          sample rate (default 1000)\n"
+            "  -d SECONDS     synthetic trace duration (default 60)\n"
+            "  -m DPS         synthetic peak rotation rate (default 200)\n"
+            "  -n DPS         synthetic gyroscope noise (default 0.1)\n"
+            "  -b DPS         synthetic gyroscope bias, at most (default 0.5)\n"
+            "  -N G           synthetic accelerometer noise (default 0.01)\n"
+            "  -g GAIN        alpha, beta or Kp, 0 = default (default 0)\n"
+            "  -i KI          Mahony integral gain (default 0.05)\n"
+            "  -R REPEAT      passes for the speed measurement (default 10)\n"
+            "  -s SEED        random seed (default 1)\n",
+            name);
+}
+
+int main(int argc, char** argv) {
+    synth_config_t synth = {
+        .rate_hz = 1000.0,
+        .duration_s = 60.0,
+        .gyroNoise_dps = 0.1,
+        .gyroBias_dps = 0.5,
+        .accelNoise_g = 0.01,
+        .motion_dps = 200.0,
+        .seed = 1,
+    };
+    const char* algorithm = "all";
+    const char* file = NULL;
+    float gain = 0.0f;
+    float integralGain = 0.05f;
+    int repeat = 10;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:f:r:d:m:n:b:N:g:i:R:s:h")) != -1) {
+        switch (opt) {
+            case 'a': algorithm = optarg; break;
+            case 'f': file = optarg; break;
+            case 'r': synth.rate_hz = atof(optarg); break;
+            case 'd': synth.duration_s = atof(optarg); break;
+            case 'm': synth.motion_dps = atof(optarg); break;
+            case 'n': synth.gyroNoise_dps = atof(optarg); break;
+            case 'b': synth.gyroBias_dps = atof(optarg); break;
+            case 'N': synth.accelNoise_g = atof(optarg); break;
+            case 'g': gain = (float)atof(optarg); break;
+            case 'i': integralGain = (float)atof(optarg); break;
+            case 'R': repeat = atoi(optarg); break;
+            case 's': synth.seed = (uint32_t)strtoul(optarg, NULL, 0); break;
+            default: usage(argv[0]); return (opt == 'h') ? 0 : 2;
+        }
+    }
+    if (synth.rate_hz <= 0.0 || repeat <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    trace_t trace;
+    memset(&trace, 0, sizeof(trace));
+    int err = (file != NULL) ? trace_load_csv(file, (float)synth.rate_hz, &trace) : trace_synthesize(&synth, &trace);
+    if (err != 0) {
+        fprintf(stderr, "No trace to run\n");
+        return 1;
+    }
+    printf("%zu samples at %.0f Hz%s\n", trace.count, trace.rate_hz, trace.truth ? ", with reference" : "");
+
+    const fusion_algorithm_t algorithms[] = { FUSION_COMPLEMENTARY, FUSION_MADGWICK, FUSION_MAHONY };
+    bool found = false;
+    for (size_t i = 0; i < sizeof(algorithms) / sizeof(algorithms[0]); i++) {
+        if (strcmp(algorithm, "all") == 0 || strcmp(algorithm, fusion_algorithm_name(algorithms[i])) == 0) {
+            run(algorithms[i], &trace, gain, integralGain, repeat);
+            found = true;
+        }
+    }
+    trace_free(&trace);
+    if (!found) {
+        fprintf(stderr, "Unknown algorithm %s\n", algorithm);
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,231 @@
+#ifndef FUSION_TRACE_H
+#define FUSION_TRACE_H
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fusion.h"
+
+// Motion traces for the fusion test and benchmark: synthetic with the true orientation known, or
+// recorded as CSV with an optional reference orientation. Include from one file per program only.
+
+#define TRACE_PI                3.14159265358979
+#define TRACE_MAX_LINE          512
+
+typedef struct {
+    fusion_sample_t* samples;
+    fusion_quaternion_t* truth;     // NULL if the trace has no reference orientation
+    size_t count;
+    float rate_hz;
+} trace_t;
+
+typedef struct {
+    double rate_hz;
+    double duration_s;
+    double gyroNoise_dps;
+    double gyroBias_dps;
+    double accelNoise_g;
+    double motion_dps;              // peak rotation rate
+    uint32_t seed;
+} synth_config_t;
+
+typedef struct {
+    double rms_deg;
+    double max_deg;
+    size_t counted;                 // 0 without a reference orientation
+} tilt_error_t;
+
+static uint64_t gTraceRandom = 1;
+
+static double trace_uniform(void) {
+    gTraceRandom ^= gTraceRandom << 13;
+    gTraceRandom ^= gTraceRandom >> 7;
+    gTraceRandom ^= gTraceRandom << 17;
+    return ((gTraceRandom >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static double trace_gaussian(void) {
+    return sqrt(-2.0 * log(trace_uniform())) * cos(2.0 * TRACE_PI * trace_uniform());
+}
+
+static fusion_quaternion_t trace_multiply(fusion_quaternion_t a, fusion_quaternion_t b) {
+    fusion_quaternion_t q = {
+        .w = a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+        .x = a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+        .y = a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+        .z = a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+    };
+    return q;
+}
+
+// Gravity direction in the sensor frame, the third row of the rotation matrix
+static void trace_gravity(const fusion_quaternion_t* q, double g[3]) {
+    g[0] = 2.0 * (q->x * q->z - q->w * q->y);
+    g[1] = 2.0 * (q->w * q->x + q->y * q->z);
+    g[2] = q->w * q->w - q->x * q->x - q->y * q->y + q->z * q->z;
+}
+
+// Angle between the true and the estimated gravity, the part of the orientation an IMU can observe
+static double trace_tilt_error_deg(const fusion_quaternion_t* truth, const fusion_quaternion_t* estimate) {
+    double a[3], b[3];
+    trace_gravity(truth, a);
+    trace_gravity(estimate, b);
+    double dot = (a[0] * b[0] + a[1] * b[1] + a[2] * b[2])
+               / sqrt((a[0] * a[0] + a[1] * a[1] + a[2] * a[2]) * (b[0] * b[0] + b[1] * b[1] + b[2] * b[2]));
+    if (dot > 1.0) {
+        dot = 1.0;
+    }
+    return acos(dot) * 180.0 / TRACE_PI;
+}
+
+/*
+ * @brief Creates a trace of smooth rotations on all three axes
+ *
+ *  The true orientation is integrated exactly from the rotation rate, the gyroscope sees the rate
+ *  plus bias and noise, the accelerometer sees gravity plus noise and short linear accelerations.
+ */
+static int trace_synthesize(const synth_config_t* pConfig, trace_t* pTrace) {
+    pTrace->count = (size_t)(pConfig->rate_hz * pConfig->duration_s);
+    pTrace->rate_hz = (float)pConfig->rate_hz;
+    pTrace->samples = calloc(pTrace->count, sizeof(fusion_sample_t));
+    pTrace->truth = calloc(pTrace->count, sizeof(fusion_quaternion_t));
+    if (pTrace->samples == NULL || pTrace->truth == NULL) {
+        return -1;
+    }
+    gTraceRandom = pConfig->seed ? pConfig->seed : 1;
+
+    const double dt = 1.0 / pConfig->rate_hz;
+    const double toRad = TRACE_PI / 180.0;
+    const double freq[3] = { 0.31, 0.17, 0.23 };
+    double bias[3];
+    for (int axis = 0; axis < 3; axis++) {
+        bias[axis] = pConfig->gyroBias_dps * (2.0 * trace_uniform() - 1.0) * toRad;
+    }
+
+    fusion_quaternion_t q = { 1.0f, 0.0f, 0.0f, 0.0f };
+    for (size_t i = 0; i < pTrace->count; i++) {
+        double t = i * dt;
+        double rate[3];
+        for (int axis = 0; axis < 3; axis++) {
+            rate[axis] = pConfig->motion_dps * toRad * sin(2.0 * TRACE_PI * freq[axis] * t + axis);
+        }
+
+        pTrace->truth[i] = q;
+        double g[3];
+        trace_gravity(&q, g);
+        // Occasional bumps of linear acceleration, as when the device is moved around
+        double bump = (fmod(t, 3.0) < 0.2) ? 0.3 : 0.0;
+        for (int axis = 0; axis < 3; axis++) {
+            pTrace->samples[i].accel[axis] = (float)(g[axis] + bump * (axis == 0) + pConfig->accelNoise_g * trace_gaussian());
+            pTrace->samples[i].gyro[axis] = (float)(rate[axis] + bias[axis] + pConfig->gyroNoise_dps * toRad * trace_gaussian());
+        }
+
+        // Exact step for a constant rate over dt
+        double angle = sqrt(rate[0] * rate[0] + rate[1] * rate[1] + rate[2] * rate[2]) * dt;
+        if (angle > 0.0) {
+            double s = sin(angle / 2.0) / (angle / dt);
+            fusion_quaternion_t step = { (float)cos(angle / 2.0), (float)(rate[0] * s), (float)(rate[1] * s), (float)(rate[2] * s) };
+            q = trace_multiply(q, step);
+            double norm = sqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+            q.w /= norm;
+            q.x /= norm;
+            q.y /= norm;
+            q.z /= norm;
+        }
+    }
+    return 0;
+}
+
+/*
+ * @brief Loads a recorded trace
+ *
+ *  One sample per line: ax,ay,az,gx,gy,gz[,qw,qx,qy,qz] in g and degrees per second, with an
+ *  optional reference orientation. Lines starting with # and a header line are skipped.
+ */
+static int trace_load_csv(const char* path, float rate_hz, trace_t* pTrace) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    size_t capacity = 0;
+    bool hasTruth = true;
+    char line[TRACE_MAX_LINE];
+    memset(pTrace, 0, sizeof(trace_t));
+    pTrace->rate_hz = rate_hz;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        double v[10];
+        int fields = sscanf(line, "%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf",
+                            &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9]);
+        if (fields < 6) {
+            continue;
+        }
+        if (pTrace->count == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            fusion_sample_t* samples = realloc(pTrace->samples, capacity * sizeof(fusion_sample_t));
+            fusion_quaternion_t* truth = realloc(pTrace->truth, capacity * sizeof(fusion_quaternion_t));
+            if (samples != NULL) {
+                pTrace->samples = samples;
+            }
+            if (truth != NULL) {
+                pTrace->truth = truth;
+            }
+            if (samples == NULL || truth == NULL) {
+                fclose(file);
+                return -1;
+            }
+        }
+        fusion_sample_t* pSample = &pTrace->samples[pTrace->count];
+        for (int axis = 0; axis < 3; axis++) {
+            pSample->accel[axis] = (float)v[axis];
+            pSample->gyro[axis] = (float)(v[3 + axis] * TRACE_PI / 180.0);
+        }
+        hasTruth = hasTruth && fields == 10;
+        if (fields == 10) {
+            pTrace->truth[pTrace->count] = (fusion_quaternion_t){ (float)v[6], (float)v[7], (float)v[8], (float)v[9] };
+        }
+        pTrace->count++;
+    }
+    fclose(file);
+    if (!hasTruth) {
+        free(pTrace->truth);
+        pTrace->truth = NULL;
+    }
+    return (pTrace->count > 0) ? 0 : -1;
+}
+
+static void trace_free(trace_t* pTrace) {
+    free(pTrace->samples);
+    free(pTrace->truth);
+    memset(pTrace, 0, sizeof(trace_t));
+}
+
+/*
+ * @brief Runs the filter over the trace one sample at a time and compares its tilt with the truth
+ *
+ *  The first settle_s are not counted, the filters settle from the first accelerometer sample.
+ *  The estimate after sample i is compared with the true orientation at sample i + 1.
+ */
+static tilt_error_t trace_tilt_error(const fusion_config_t* pConfig, const trace_t* pTrace, double settle_s, fusion_t* pFusion) {
+    tilt_error_t error = { 0 };
+    fusion_init(pFusion, pConfig);
+    size_t settle = (size_t)(settle_s * pTrace->rate_hz);
+    double sum = 0.0;
+    for (size_t i = 0; i < pTrace->count; i++) {
+        fusion_update(pFusion, &pTrace->samples[i]);
+        if (pTrace->truth != NULL && i + 1 < pTrace->count && i >= settle) {
+            double deg = trace_tilt_error_deg(&pTrace->truth[i + 1], &pFusion->q);
+            sum += deg * deg;
+            error.max_deg = (deg > error.max_deg) ? deg : error.max_deg;
+            error.counted++;
+        }
+    }
+    error.rms_deg = (error.counted > 0) ? sqrt(sum / error.counted) : 0.0;
+    return error;
+}
+
+#endif // FUSION_TRACE_H
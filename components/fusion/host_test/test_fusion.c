@@ -0,0 +1,188 @@
+#include <string.h>
+
+#include "host_test.h"
+#include "fusion_trace.h"
+
+// Accuracy of the filters against a known orientation, and the output the firmware builds on:
+// the packed quaternion of EVENT_TYPE_ORIENTATION and the outputs of fusion_update_block().
+// The recorded trace is given as the first argument.
+
+static const fusion_algorithm_t gAlgorithms[] = { FUSION_COMPLEMENTARY, FUSION_MADGWICK, FUSION_MAHONY };
+
+// Tilt error bounds in degrees, by algorithm, with some room above what the filters reach now
+typedef struct {
+    double rms;
+    double max;
+} tilt_bound_t;
+
+static const char* gRecordedPath = NULL;
+
+static void check_tilt(const trace_t* pTrace, fusion_algorithm_t algorithm, double settle_s, tilt_bound_t bound) {
+    const fusion_config_t config = {
+        .algorithm = algorithm,
+        .sampleRate_hz = pTrace->rate_hz,
+        .integralGain = (algorithm == FUSION_MAHONY) ? 0.05f : 0.0f,
+    };
+    fusion_t fusion;
+    tilt_error_t error = trace_tilt_error(&config, pTrace, settle_s, &fusion);
+    fprintf(stderr, "  %-14s tilt error rms %.3f deg, max %.3f deg\n", fusion_algorithm_name(algorithm), error.rms_deg, error.max_deg);
+    CHECK(error.counted > 0);
+    CHECK(error.rms_deg < bound.rms);
+    CHECK(error.max_deg < bound.max);
+}
+
+// Rotations on all axes up to 200 deg/s, 0.5 deg/s gyroscope bias and bumps of 0.3 g
+static void test_synthetic_tilt(void) {
+    const synth_config_t synth = {
+        .rate_hz = 1000.0,
+        .duration_s = 20.0,
+        .gyroNoise_dps = 0.1,
+        .gyroBias_dps = 0.5,
+        .accelNoise_g = 0.01,
+        .motion_dps = 200.0,
+        .seed = 1,
+    };
+    static const tilt_bound_t bounds[] = { { 1.6, 4.0 }, { 0.7, 2.8 }, { 1.5, 3.8 } };
+    trace_t trace;
+    CHECK_EQ(trace_synthesize(&synth, &trace), 0);
+    for (size_t i = 0; i < sizeof(gAlgorithms) / sizeof(gAlgorithms[0]); i++) {
+        check_tilt(&trace, gAlgorithms[i], 2.0, bounds[i]);
+    }
+    trace_free(&trace);
+}
+
+// Tilts to 40 degrees and back at 100 Hz, quantized like the FIFO samples
+static void test_recorded_tilt(void) {
+    static const tilt_bound_t bounds[] = { { 0.6, 1.0 }, { 0.4, 0.8 }, { 0.5, 0.8 } };
+    trace_t trace;
+    CHECK(gRecordedPath != NULL);
+    if (gRecordedPath == NULL || trace_load_csv(gRecordedPath, 100.0f, &trace) != 0) {
+        CHECK(!"recorded trace not loaded");
+        return;
+    }
+    CHECK(trace.truth != NULL);
+    CHECK(trace.count > 500);
+    for (size_t i = 0; i < sizeof(gAlgorithms) / sizeof(gAlgorithms[0]); i++) {
+        check_tilt(&trace, gAlgorithms[i], 1.0, bounds[i]);
+    }
+    trace_free(&trace);
+}
+
+static fusion_quaternion_t unpack_q14(const uint8_t* data) {
+    float values[4];
+    for (int i = 0; i < 4; i++) {
+        values[i] = (float)(int16_t)((data[2 * i] << 8) | data[2 * i + 1]) / FUSION_Q14_ONE;
+    }
+    return (fusion_quaternion_t){ values[0], values[1], values[2], values[3] };
+}
+
+// Rotation between two orientations, in double as float rounding alone is 0.03 degrees here
+static double angle_deg(const fusion_quaternion_t* a, const fusion_quaternion_t* b) {
+    double dot = (double)a->w * b->w + (double)a->x * b->x + (double)a->y * b->y + (double)a->z * b->z;
+    double norms = ((double)a->w * a->w + (double)a->x * a->x + (double)a->y * a->y + (double)a->z * a->z)
+                 * ((double)b->w * b->w + (double)b->x * b->x + (double)b->y * b->y + (double)b->z * b->z);
+    dot = fabs(dot) / sqrt(norms);
+    return 2.0 * acos((dot > 1.0) ? 1.0 : dot) * 180.0 / TRACE_PI;
+}
+
+static void test_pack_q14(void) {
+    uint8_t data[FUSION_PACKED_SIZE];
+    const fusion_quaternion_t identity = { 1.0f, 0.0f, 0.0f, 0.0f };
+    CHECK_EQ(fusion_pack_q14(&identity, data), FUSION_PACKED_SIZE);
+    static const uint8_t expected[] = { 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    CHECK(memcmp(data, expected, sizeof(expected)) == 0);
+
+    // Negative values are two's complement, out of range ones saturate
+    const fusion_quaternion_t edges = { -1.0f, 2.5f, -2.5f, 0.5f / FUSION_Q14_ONE * 3.0f };
+    fusion_pack_q14(&edges, data);
+    CHECK(data[0] == 0xC0 && data[1] == 0x00);
+    CHECK(data[2] == 0x7F && data[3] == 0xFF);
+    CHECK(data[4] == 0x80 && data[5] == 0x00);
+    CHECK(data[6] == 0x00 && data[7] == 0x02);
+
+    // Unit quaternions come back within half a step per component, and within 0.01 degrees
+    gTraceRandom = 5;
+    for (int n = 0; n < 10000; n++) {
+        fusion_quaternion_t q = { (float)trace_gaussian(), (float)trace_gaussian(), (float)trace_gaussian(), (float)trace_gaussian() };
+        float norm = sqrtf(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+        q = (fusion_quaternion_t){ q.w / norm, q.x / norm, q.y / norm, q.z / norm };
+        fusion_pack_q14(&q, data);
+        fusion_quaternion_t back = unpack_q14(data);
+        const float half = 0.5f / FUSION_Q14_ONE + 1e-7f;
+        CHECK(fabsf(back.w - q.w) <= half && fabsf(back.x - q.x) <= half && fabsf(back.y - q.y) <= half && fabsf(back.z - q.z) <= half);
+        CHECK(angle_deg(&q, &back) < 0.01);
+    }
+}
+
+static void check_output_every(float sampleRate_hz, float outputRate_hz, uint32_t expected) {
+    const fusion_config_t config = { .algorithm = FUSION_MADGWICK, .sampleRate_hz = sampleRate_hz, .outputRate_hz = outputRate_hz };
+    fusion_t fusion;
+    fusion_init(&fusion, &config);
+    CHECK_EQ(fusion.outputEvery, expected);
+    CHECK_EQ(fusion.pending, 0);
+}
+
+/*
+ * fusion_task.c dates output k of a block with sample first + k * outputEvery, where first is
+ * outputEvery - pending - 1 from before the block. Blocks of uneven sizes are run through one
+ * filter, and every output is compared with a second filter updated one sample at a time.
+ */
+static void test_output_decimation(void) {
+    check_output_every(1000.0f, 0.0f, 1);
+    check_output_every(1000.0f, 100.0f, 10);
+    check_output_every(1000.0f, 300.0f, 3);
+    check_output_every(1000.0f, 1000.0f, 1);
+    check_output_every(100.0f, 200.0f, 1);
+
+    const synth_config_t synth = { .rate_hz = 1000.0, .duration_s = 1.0, .motion_dps = 100.0, .seed = 3 };
+    trace_t trace;
+    CHECK_EQ(trace_synthesize(&synth, &trace), 0);
+    const fusion_config_t config = { .algorithm = FUSION_MAHONY, .sampleRate_hz = 1000.0f, .outputRate_hz = 100.0f };
+    fusion_t blocks;
+    fusion_t single;
+    fusion_init(&blocks, &config);
+    fusion_init(&single, &config);
+    fusion_quaternion_t* history = calloc(trace.count, sizeof(fusion_quaternion_t));
+    for (size_t i = 0; i < trace.count; i++) {
+        fusion_update(&single, &trace.samples[i]);
+        history[i] = single.q;
+    }
+
+    static const size_t sizes[] = { 7, 13, 1, 25, 10, 9, 64, 3, 30 };
+    fusion_quaternion_t outputs[64];
+    size_t pos = 0;
+    size_t total = 0;
+    for (size_t b = 0; pos < trace.count; b = (b + 1) % (sizeof(sizes) / sizeof(sizes[0]))) {
+        size_t count = (trace.count - pos < sizes[b]) ? trace.count - pos : sizes[b];
+        size_t first = blocks.outputEvery - blocks.pending - 1;
+        size_t stored = fusion_update_block(&blocks, &trace.samples[pos], count, outputs, 64);
+        CHECK_EQ(stored, (count + blocks.outputEvery - 1 - first) / blocks.outputEvery);
+        CHECK(blocks.pending < blocks.outputEvery);
+        for (size_t k = 0; k < stored; k++) {
+            size_t sample = pos + first + k * blocks.outputEvery;
+            CHECK(sample < pos + count);
+            CHECK((sample + 1) % blocks.outputEvery == 0);
+            CHECK(memcmp(&outputs[k], &history[sample], sizeof(fusion_quaternion_t)) == 0);
+        }
+        pos += count;
+        total += stored;
+    }
+    CHECK_EQ(total, trace.count / 10);
+
+    // A full output array keeps the samples but stores no more
+    fusion_init(&blocks, &config);
+    CHECK_EQ(fusion_update_block(&blocks, trace.samples, 50, outputs, 2), 2);
+    CHECK_EQ(blocks.updates, 50);
+    CHECK(memcmp(&blocks.q, &history[49], sizeof(fusion_quaternion_t)) == 0);
+    free(history);
+    trace_free(&trace);
+}
+
+int main(int argc, char* argv[]) {
+    gRecordedPath = (argc > 1) ? argv[1] : NULL;
+    RUN_TEST(test_synthetic_tilt);
+    RUN_TEST(test_recorded_tilt);
+    RUN_TEST(test_pack_q14);
+    RUN_TEST(test_output_decimation);
+    return host_test_result();
+}
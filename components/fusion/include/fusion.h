@@ -0,0 +1,73 @@
+#ifndef FUSION_H
+#define FUSION_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+// Orientation from accelerometer and gyroscope samples. Plain C without ESP-IDF includes, so the
+// filters run unchanged on the host. One instance per sensor, not thread-safe.
+//
+// The quaternion rotates vectors from the sensor frame into the reference frame, whose z axis
+// points up. Without a magnetometer, yaw is only integrated from the gyroscope and drifts.
+
+#define FUSION_DEFAULT_TAU_S        1.0f    // complementary, time constant of the accelerometer blend
+#define FUSION_DEFAULT_BETA         0.1f    // Madgwick
+#define FUSION_DEFAULT_KP           1.0f    // Mahony
+#define FUSION_Q14_ONE              16384   // scale of packed quaternions
+#define FUSION_PACKED_SIZE          8
+
+typedef enum {
+    FUSION_COMPLEMENTARY,   // gyro integration blended towards the accelerometer tilt
+    FUSION_MADGWICK,        // gradient descent correction
+    FUSION_MAHONY,          // PI feedback on the gyroscope rates
+} fusion_algorithm_t;
+
+typedef struct {
+    float w;
+    float x;
+    float y;
+    float z;
+} fusion_quaternion_t;
+
+typedef struct {
+    float roll;     // degrees
+    float pitch;
+    float yaw;
+} fusion_euler_t;
+
+typedef struct {
+    float accel[3]; // g
+    float gyro[3];  // rad/s
+} fusion_sample_t;
+
+typedef struct {
+    fusion_algorithm_t algorithm;
+    float sampleRate_hz;
+    float outputRate_hz;    // orientations returned by fusion_update_block(), 0 = every sample
+    float gain;             // alpha per update, beta or Kp of the algorithm, 0 = default
+    float integralGain;     // Mahony Ki, removes gyroscope bias, 0 = off
+} fusion_config_t;
+
+typedef struct {
+    fusion_config_t config;
+    float period_s;
+    fusion_quaternion_t q;
+    float integral[3];      // Mahony bias estimate, rad/s
+    uint32_t outputEvery;
+    uint32_t pending;       // updates since the last output
+    uint32_t updates;
+} fusion_t;
+
+void fusion_init(fusion_t* pFusion, const fusion_config_t* pConfig);
+void fusion_reset(fusion_t* pFusion);
+void fusion_update(fusion_t* pFusion, const fusion_sample_t* pSample);
+size_t fusion_update_block(fusion_t* pFusion, const fusion_sample_t* pSamples, size_t count,
+                           fusion_quaternion_t* pOutputs, size_t maxOutputs);
+
+void fusion_sample_from_raw(const int16_t accel[3], const int16_t gyro[3], float accelLsbPerG,
+                            float gyroLsbPerDps, fusion_sample_t* pSample);
+void fusion_to_euler(const fusion_quaternion_t* pQ, fusion_euler_t* pEuler);
+size_t fusion_pack_q14(const fusion_quaternion_t* pQ, uint8_t* data);
+const char* fusion_algorithm_name(fusion_algorithm_t algorithm);
+
+#endif // FUSION_H
@@ -0,0 +1,13 @@
+#ifndef FUSION_TASK_H
+#define FUSION_TASK_H
+
+#include "esp_err.h"
+
+#define FUSION_MAX_MESSAGE_SIZE     160
+
+// Runs the filter on the FIFO samples of the ICM42688P and publishes the orientation at
+// CONFIG_FUSION_OUTPUT_RATE_HZ, as JSON over MQTT or as EVENT_TYPE_ORIENTATION frames
+esp_err_t fusion_start(void);
+void fusion_stop(void);
+
+#endif // FUSION_TASK_H
@@ -0,0 +1,249 @@
+#include <getopt.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "host_bench.h"
+#include "tcp_channel.h"
+
+// Events sent to a receiver thread on the loopback interface: through a persistent tcp_channel,
+// and with a connection per event as packetsender_sendTCP() did before the channel. Every event
+// carries its send time, the receiver takes the latency when the last byte of it arrives.
+
+#define BENCH_EVENT_SIZE    32
+#define BENCH_BUFFER_SIZE   2048    // CONFIG_PACKET_SENDER_TCP_BUFFER_SIZE
+#define BENCH_COALESCE_MS   50      // CONFIG_PACKET_SENDER_TCP_COALESCE_MS
+
+typedef struct {
+    int listener;
+    uint16_t port;
+    uint32_t count;
+    uint32_t received;
+    double* latency_s;      // by sequence number
+    double last_s;          // time the last event arrived
+} receiver_t;
+
+static double gStart_s;
+
+static int64_t now_ms(void) {
+    return (int64_t)(bench_now_s() * 1e3);
+}
+
+static void make_event(uint8_t* event, uint32_t seq) {
+    double sent_s = bench_now_s();
+    memset(event, 0, BENCH_EVENT_SIZE);
+    memcpy(event, &seq, sizeof(seq));
+    memcpy(&event[8], &sent_s, sizeof(sent_s));
+}
+
+static void receive_event(receiver_t* pReceiver, const uint8_t* event) {
+    uint32_t seq;
+    double sent_s;
+    memcpy(&seq, event, sizeof(seq));
+    memcpy(&sent_s, &event[8], sizeof(sent_s));
+    pReceiver->last_s = bench_now_s();
+    if (seq < pReceiver->count) {
+        pReceiver->latency_s[seq] = pReceiver->last_s - sent_s;
+        pReceiver->received++;
+    }
+}
+
+// Takes connections one after the other and reads fixed size events from each until it closes
+static void* receive_tcp(void* arg) {
+    receiver_t* pReceiver = arg;
+    uint8_t event[BENCH_EVENT_SIZE];
+    while (pReceiver->received < pReceiver->count) {
+        int conn = accept(pReceiver->listener, NULL, NULL);
+        if (conn < 0) {
+            break; // timed out, events are missing
+        }
+        struct timeval timeout = { .tv_sec = 2 };
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        size_t have = 0;
+        while (pReceiver->received < pReceiver->count) {
+            ssize_t got = recv(conn, &event[have], sizeof(event) - have, 0);
+            if (got <= 0) {
+                break;
+            }
+            have += got;
+            if (have == sizeof(event)) {
+                receive_event(pReceiver, event);
+                have = 0;
+            }
+        }
+        close(conn);
+    }
+    return NULL;
+}
+
+static void start_receiver(receiver_t* pReceiver, pthread_t* pThread, uint32_t count) {
+    pReceiver->listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(addr);
+    int reuse = 1;
+    setsockopt(pReceiver->listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    bind(pReceiver->listener, (struct sockaddr *)&addr, sizeof(addr));
+    listen(pReceiver->listener, SOMAXCONN);
+    getsockname(pReceiver->listener, (struct sockaddr *)&addr, &len);
+    struct timeval timeout = { .tv_sec = 2 };
+    setsockopt(pReceiver->listener, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    pReceiver->port = ntohs(addr.sin_port);
+    pReceiver->count = count;
+    pReceiver->received = 0;
+    pReceiver->latency_s = calloc(count, sizeof(double));
+    pthread_create(pThread, NULL, receive_tcp, pReceiver);
+}
+
+// Spaces the events interval_us apart, polling the channel while it waits
+static void pace(TcpChannel* pChannel, uint32_t i, long interval_us) {
+    double due_s = gStart_s + i * interval_us * 1e-6;
+    while (interval_us > 0 && bench_now_s() < due_s) {
+        if (pChannel != NULL) {
+            tcp_channel_poll(pChannel, now_ms());
+        }
+    }
+}
+
+static uint32_t send_channel(uint16_t port, tcp_channel_mode_t mode, uint32_t count, long interval_us) {
+    tcp_channel_config_t config = {
+        .hostIP = "127.0.0.1",
+        .port = port,
+        .mode = mode,
+        .bufferSize = BENCH_BUFFER_SIZE,
+        .coalesceMs = BENCH_COALESCE_MS,
+        .connectTimeoutMs = 1000,
+        .backoffBaseMs = 100,
+        .backoffMaxMs = 1000,
+    };
+    TcpChannel* pChannel = tcp_channel_create(&config);
+    uint8_t event[BENCH_EVENT_SIZE];
+    for (uint32_t i = 0; i < count; i++) {
+        pace(pChannel, i, interval_us);
+        make_event(event, i);
+        // A full buffer is backpressure, the firmware would drop, the benchmark waits
+        while (tcp_channel_send(pChannel, event, sizeof(event), now_ms()) == TCP_CHANNEL_ERROR_FULL) {
+            tcp_channel_poll(pChannel, now_ms());
+        }
+        tcp_channel_poll(pChannel, now_ms());
+    }
+    tcp_channel_stats_t stats;
+    double end_s = bench_now_s() + 2.0;
+    do {
+        tcp_channel_poll(pChannel, now_ms());
+        tcp_channel_get_stats(pChannel, &stats);
+    } while (stats.bytesSent < (uint64_t)count * BENCH_EVENT_SIZE && bench_now_s() < end_s);
+    tcp_channel_destroy(pChannel);
+    return stats.connects;
+}
+
+// As packetsender_sendTCP() before the channel, minus its logging
+static uint32_t send_per_event(uint16_t port, uint32_t count, long interval_us) {
+    struct sockaddr_in dest_addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = inet_addr("127.0.0.1"),
+        .sin_port = htons(port),
+    };
+    uint8_t event[BENCH_EVENT_SIZE];
+    uint32_t connects = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        pace(NULL, i, interval_us);
+        make_event(event, i);
+        int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+        if (sock < 0) {
+            continue;
+        }
+        if (connect(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) == 0) {
+            connects++;
+            send(sock, event, sizeof(event), 0);
+            shutdown(sock, 0);
+        }
+        close(sock);
+    }
+    return connects;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    double events_s;
+    double p50_us;
+    double p99_us;
+    uint32_t connects;
+    uint32_t missing;
+} result_t;
+
+static result_t run(int path, uint32_t count, long interval_us) {
+    receiver_t receiver;
+    pthread_t thread;
+    start_receiver(&receiver, &thread, count);
+    gStart_s = bench_now_s();
+    result_t result;
+    if (path == 0) {
+        result.connects = send_channel(receiver.port, TCP_CHANNEL_LOW_LATENCY, count, interval_us);
+    } else if (path == 1) {
+        result.connects = send_channel(receiver.port, TCP_CHANNEL_BULK, count, interval_us);
+    } else {
+        result.connects = send_per_event(receiver.port, count, interval_us);
+    }
+    pthread_join(thread, NULL);
+    close(receiver.listener);
+
+    result.events_s = receiver.received / (receiver.last_s - gStart_s);
+    qsort(receiver.latency_s, count, sizeof(double), compare_double);
+    // Missing events sort first with 0, they only show in the count
+    result.missing = count - receiver.received;
+    const double* pLatency = &receiver.latency_s[result.missing];
+    result.p50_us = (receiver.received > 0) ? pLatency[receiver.received / 2] * 1e6 : 0.0;
+    result.p99_us = (receiver.received > 0) ? pLatency[(size_t)(receiver.received * 0.99)] * 1e6 : 0.0;
+    free(receiver.latency_s);
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    long count = 10000;
+    long pacedCount = 2000;
+    long interval_us = 1000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:l:i:")) != -1) {
+        switch (opt) {
+        case 'n': count = strtol(optarg, NULL, 10); break;
+        case 'l': pacedCount = strtol(optarg, NULL, 10); break;
+        case 'i': interval_us = strtol(optarg, NULL, 10); break;
+        default:
+            fprintf(stderr, "usage: %s [-n events as fast as possible] [-l paced events] [-i us between paced events]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (count <= 0 || pacedCount <= 0 || interval_us <= 0) {
+        fprintf(stderr, "event counts and the interval must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    // Sent as fast as possible the latency is mostly queueing, so it is taken from a paced run
+    static const char* names[] = { "channel low latency", "channel bulk", "connect per event" };
+    printf("%d byte events: throughput of %ld sent as fast as possible, latency of %ld sent %ld us apart\n",
+           BENCH_EVENT_SIZE, count, pacedCount, interval_us);
+    printf("| %-19s | %9s | %8s | %8s | %8s |\n", "path", "events/s", "p50 us", "p99 us", "connects");
+    printf("|---------------------|-----------|----------|----------|----------|\n");
+    uint32_t missing = 0;
+    for (int path = 0; path < 3; path++) {
+        result_t throughput = run(path, count, 0);
+        result_t latency = run(path, pacedCount, interval_us);
+        printf("| %-19s | %9.0f | %8.1f | %8.1f | %8u |\n", names[path], throughput.events_s, latency.p50_us,
+               latency.p99_us, throughput.connects);
+        missing += throughput.missing + latency.missing;
+    }
+    if (missing > 0) {
+        fprintf(stderr, "%u events did not arrive\n", missing);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
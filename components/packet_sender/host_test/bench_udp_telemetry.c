@@ -0,0 +1,249 @@
+#include <getopt.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "host_bench.h"
+#include "udp_telemetry.h"
+
+// Events sent to a receiver thread on the loopback interface: packed by udp_telemetry and sent in
+// batches with sendmmsg(), and one datagram per event from a new socket as packetsender_sendUDP()
+// did before. Every event carries its send time, the receiver takes the latency on arrival.
+
+#define BENCH_EVENT_SIZE    32
+#define BENCH_MTU           1472    // CONFIG_PACKET_SENDER_UDP_MTU
+#define BENCH_FLUSH_MS      100     // CONFIG_PACKET_SENDER_UDP_FLUSH_MS
+#define BENCH_POOL_SIZE     4       // CONFIG_PACKET_SENDER_UDP_POOL_SIZE
+
+typedef struct {
+    int sock;
+    uint16_t port;
+    uint32_t count;
+    uint32_t received;
+    uint32_t datagrams;
+    double* latency_s;      // by sequence number
+    double last_s;          // time the last event arrived
+} receiver_t;
+
+static double gStart_s;
+
+static int64_t now_ms(void) {
+    return (int64_t)(bench_now_s() * 1e3);
+}
+
+static void make_event(uint8_t* event, uint32_t seq) {
+    double sent_s = bench_now_s();
+    memset(event, 0, BENCH_EVENT_SIZE);
+    memcpy(event, &seq, sizeof(seq));
+    memcpy(&event[8], &sent_s, sizeof(sent_s));
+}
+
+// Splits a datagram into its events, a bare event has no length byte
+static void receive_datagram(receiver_t* pReceiver, const uint8_t* data, size_t len, bool packed) {
+    double now_s = bench_now_s();
+    pReceiver->datagrams++;
+    size_t pos = 0;
+    while (pos < len) {
+        size_t eventLen = packed ? data[pos++] : len;
+        if (eventLen < 16 || pos + eventLen > len) {
+            return;
+        }
+        uint32_t seq;
+        double sent_s;
+        memcpy(&seq, &data[pos], sizeof(seq));
+        memcpy(&sent_s, &data[pos + 8], sizeof(sent_s));
+        if (seq < pReceiver->count && pReceiver->latency_s[seq] == 0.0) {
+            pReceiver->latency_s[seq] = now_s - sent_s;
+            pReceiver->received++;
+            pReceiver->last_s = now_s;
+        }
+        pos += eventLen;
+    }
+}
+
+static void* receive_udp_packed(void* arg) {
+    receiver_t* pReceiver = arg;
+    uint8_t datagram[UDP_TELEMETRY_MAX_PAYLOAD];
+    while (pReceiver->received < pReceiver->count) {
+        ssize_t len = recv(pReceiver->sock, datagram, sizeof(datagram), 0);
+        if (len < 0) {
+            break; // timed out, the rest was lost
+        }
+        receive_datagram(pReceiver, datagram, len, true);
+    }
+    return NULL;
+}
+
+static void* receive_udp_bare(void* arg) {
+    receiver_t* pReceiver = arg;
+    uint8_t datagram[UDP_TELEMETRY_MAX_PAYLOAD];
+    while (pReceiver->received < pReceiver->count) {
+        ssize_t len = recv(pReceiver->sock, datagram, sizeof(datagram), 0);
+        if (len < 0) {
+            break;
+        }
+        receive_datagram(pReceiver, datagram, len, false);
+    }
+    return NULL;
+}
+
+static void start_receiver(receiver_t* pReceiver, pthread_t* pThread, uint32_t count, bool packed) {
+    memset(pReceiver, 0, sizeof(receiver_t));
+    pReceiver->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(addr);
+    int size = 4 * 1024 * 1024;
+    setsockopt(pReceiver->sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    bind(pReceiver->sock, (struct sockaddr *)&addr, sizeof(addr));
+    getsockname(pReceiver->sock, (struct sockaddr *)&addr, &len);
+    struct timeval timeout = { .tv_sec = 1 };
+    setsockopt(pReceiver->sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    pReceiver->port = ntohs(addr.sin_port);
+    pReceiver->count = count;
+    pReceiver->latency_s = calloc(count, sizeof(double));
+    pthread_create(pThread, NULL, packed ? receive_udp_packed : receive_udp_bare, pReceiver);
+}
+
+// Spaces the events interval_us apart, polling the sender while it waits
+static void pace(UdpTelemetry* pTelemetry, uint32_t i, long interval_us) {
+    double due_s = gStart_s + i * interval_us * 1e-6;
+    while (interval_us > 0 && bench_now_s() < due_s) {
+        if (pTelemetry != NULL) {
+            udp_telemetry_poll(pTelemetry, now_ms());
+        }
+    }
+}
+
+// Returns the datagrams sent
+static uint32_t send_telemetry(uint16_t port, uint32_t count, long interval_us) {
+    udp_telemetry_config_t config = {
+        .hostIP = "127.0.0.1",
+        .port = port,
+        .mtu = BENCH_MTU,
+        .flushMs = BENCH_FLUSH_MS,
+        .poolSize = BENCH_POOL_SIZE,
+    };
+    UdpTelemetry* pTelemetry = udp_telemetry_create(&config);
+    uint8_t event[BENCH_EVENT_SIZE];
+    for (uint32_t i = 0; i < count; i++) {
+        pace(pTelemetry, i, interval_us);
+        make_event(event, i);
+        // An exhausted pool is backpressure, the firmware would drop, the benchmark waits
+        while (udp_telemetry_send(pTelemetry, event, sizeof(event), now_ms()) == UDP_TELEMETRY_ERROR_FULL) {
+            udp_telemetry_poll(pTelemetry, now_ms());
+        }
+        udp_telemetry_poll(pTelemetry, now_ms());
+    }
+    // Paced, the last events wait for the flush time like on the device
+    while (interval_us > 0 && udp_telemetry_poll(pTelemetry, now_ms()) < UDP_TELEMETRY_IDLE_POLL_MS) {
+    }
+    udp_telemetry_flush(pTelemetry);
+    udp_telemetry_stats_t stats;
+    udp_telemetry_get_stats(pTelemetry, &stats);
+    udp_telemetry_destroy(pTelemetry);
+    return stats.datagrams;
+}
+
+// As packetsender_sendUDP() before udp_telemetry, minus its logging
+static uint32_t send_per_event(uint16_t port, uint32_t count, long interval_us) {
+    struct sockaddr_in dest_addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = inet_addr("127.0.0.1"),
+        .sin_port = htons(port),
+    };
+    uint8_t event[BENCH_EVENT_SIZE];
+    uint32_t datagrams = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        pace(NULL, i, interval_us);
+        make_event(event, i);
+        int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (sock < 0) {
+            continue;
+        }
+        if (connect(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) == 0
+            && send(sock, event, sizeof(event), 0) == sizeof(event)) {
+            datagrams++;
+        }
+        shutdown(sock, 0);
+        close(sock);
+    }
+    return datagrams;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    double events_s;        // sent and received
+    double p50_us;
+    double p99_us;
+    uint32_t datagrams;
+    uint32_t lost;
+} result_t;
+
+static result_t run(bool telemetry, uint32_t count, long interval_us) {
+    receiver_t receiver;
+    pthread_t thread;
+    start_receiver(&receiver, &thread, count, telemetry);
+    gStart_s = bench_now_s();
+    result_t result;
+    if (telemetry) {
+        result.datagrams = send_telemetry(receiver.port, count, interval_us);
+    } else {
+        result.datagrams = send_per_event(receiver.port, count, interval_us);
+    }
+    pthread_join(thread, NULL);
+    close(receiver.sock);
+
+    result.events_s = (receiver.received > 0) ? receiver.received / (receiver.last_s - gStart_s) : 0.0;
+    qsort(receiver.latency_s, count, sizeof(double), compare_double);
+    // Lost events sort first with 0, they only show in the count
+    result.lost = count - receiver.received;
+    const double* pLatency = &receiver.latency_s[result.lost];
+    result.p50_us = (receiver.received > 0) ? pLatency[receiver.received / 2] * 1e6 : 0.0;
+    result.p99_us = (receiver.received > 0) ? pLatency[(size_t)(receiver.received * 0.99)] * 1e6 : 0.0;
+    free(receiver.latency_s);
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    long count = 100000;
+    long pacedCount = 2000;
+    long interval_us = 1000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:l:i:")) != -1) {
+        switch (opt) {
+        case 'n': count = strtol(optarg, NULL, 10); break;
+        case 'l': pacedCount = strtol(optarg, NULL, 10); break;
+        case 'i': interval_us = strtol(optarg, NULL, 10); break;
+        default:
+            fprintf(stderr, "usage: %s [-n events as fast as possible] [-l paced events] [-i us between paced events]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (count <= 0 || pacedCount <= 0 || interval_us <= 0) {
+        fprintf(stderr, "event counts and the interval must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    // Sent as fast as possible the latency is mostly queueing, so it is taken from a paced run
+    static const char* names[] = { "socket per event", "udp_telemetry" };
+    printf("%d byte events: throughput of %ld sent as fast as possible, latency of %ld sent %ld us apart\n",
+           BENCH_EVENT_SIZE, count, pacedCount, interval_us);
+    printf("| %-16s | %9s | %9s | %9s | %9s | %6s |\n", "path", "events/s", "datagrams", "p50 us", "p99 us", "lost");
+    printf("|------------------|-----------|-----------|-----------|-----------|--------|\n");
+    for (int path = 0; path < 2; path++) {
+        result_t throughput = run(path == 1, count, 0);
+        result_t latency = run(path == 1, pacedCount, interval_us);
+        printf("| %-16s | %9.0f | %9u | %9.1f | %9.1f | %6u |\n", names[path], throughput.events_s,
+               throughput.datagrams, latency.p50_us, latency.p99_us, throughput.lost + latency.lost);
+    }
+    return EXIT_SUCCESS;
+}
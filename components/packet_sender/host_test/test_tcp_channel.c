@@ -0,0 +1,250 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "host_test.h"
+#include "tcp_channel.h"
+
+// The channel against a peer on the loopback interface. The time passed to the channel is simulated,
+// only the socket events take real time, so every wait for them is bounded.
+
+#define BACKOFF_BASE_MS 100
+#define BACKOFF_MAX_MS  1000
+#define COALESCE_MS     50
+
+static int listen_loopback(uint16_t* pPort) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(addr);
+    CHECK(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    CHECK(listen(sock, 4) == 0);
+    getsockname(sock, (struct sockaddr *)&addr, &len);
+    *pPort = ntohs(addr.sin_port);
+    return sock;
+}
+
+// A port nobody listens on, the connection is refused
+static uint16_t closed_port(void) {
+    uint16_t port;
+    close(listen_loopback(&port));
+    return port;
+}
+
+static int accept_peer(int listener) {
+    int peer = accept(listener, NULL, NULL);
+    struct timeval timeout = { .tv_sec = 2 };
+    setsockopt(peer, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return peer;
+}
+
+static TcpChannel* create_channel(uint16_t port, tcp_channel_mode_t mode, size_t bufferSize) {
+    tcp_channel_config_t config = {
+        .hostIP = "127.0.0.1",
+        .port = port,
+        .mode = mode,
+        .bufferSize = bufferSize,
+        .coalesceMs = COALESCE_MS,
+        .connectTimeoutMs = 1000,
+        .backoffBaseMs = BACKOFF_BASE_MS,
+        .backoffMaxMs = BACKOFF_MAX_MS,
+    };
+    return tcp_channel_create(&config);
+}
+
+static tcp_channel_state_t channel_state(const TcpChannel* pChannel) {
+    tcp_channel_stats_t stats;
+    tcp_channel_get_stats(pChannel, &stats);
+    return stats.state;
+}
+
+// Polls at now_ms until the channel leaves the connection attempt, returns the last wait
+static int64_t poll_connect(TcpChannel* pChannel, int64_t now_ms) {
+    int64_t wait_ms = tcp_channel_poll(pChannel, now_ms);
+    for (int i = 0; i < 1000 && channel_state(pChannel) == TCP_CHANNEL_CONNECTING; i++) {
+        usleep(1000);
+        wait_ms = tcp_channel_poll(pChannel, now_ms);
+    }
+    return wait_ms;
+}
+
+// Receives exactly len bytes, or fails the check after the receive timeout
+static void expect_received(int peer, const char* expected) {
+    size_t len = strlen(expected);
+    char buf[256] = { 0 };
+    size_t received = 0;
+    while (received < len) {
+        ssize_t got = recv(peer, &buf[received], len - received, 0);
+        if (got <= 0) {
+            break;
+        }
+        received += got;
+    }
+    CHECK_EQ(received, len);
+    CHECK(memcmp(buf, expected, len) == 0);
+}
+
+static bool nothing_received(int peer) {
+    char c;
+    return recv(peer, &c, 1, MSG_DONTWAIT) < 0;
+}
+
+static void test_arguments(void) {
+    tcp_channel_config_t config = { .hostIP = "not an address", .port = 1, .bufferSize = 64 };
+    CHECK(tcp_channel_create(&config) == NULL);
+    config.hostIP = "127.0.0.1";
+    config.bufferSize = 2;
+    CHECK(tcp_channel_create(&config) == NULL);
+    CHECK(tcp_channel_create(NULL) == NULL);
+
+    TcpChannel* pChannel = create_channel(1, TCP_CHANNEL_LOW_LATENCY, 64);
+    uint8_t big[UINT16_MAX + 1] = { 0 };
+    CHECK_EQ(tcp_channel_send(pChannel, big, 0, 0), TCP_CHANNEL_ERROR_ARGUMENT);
+    CHECK_EQ(tcp_channel_send(pChannel, big, sizeof(big), 0), TCP_CHANNEL_ERROR_ARGUMENT);
+    CHECK(tcp_channel_matches(pChannel, "127.0.0.1", 1, TCP_CHANNEL_LOW_LATENCY));
+    CHECK(!tcp_channel_matches(pChannel, "127.0.0.1", 1, TCP_CHANNEL_BULK));
+    CHECK(!tcp_channel_matches(pChannel, "127.0.0.2", 1, TCP_CHANNEL_LOW_LATENCY));
+    tcp_channel_destroy(pChannel);
+}
+
+// Messages sent before the connection wait in the buffer and leave in order once connected
+static void test_buffered_until_connected(void) {
+    uint16_t port;
+    int listener = listen_loopback(&port);
+    // Two records of 2 + 5 bytes fit, the third does not
+    TcpChannel* pChannel = create_channel(port, TCP_CHANNEL_LOW_LATENCY, 16);
+    CHECK_EQ(tcp_channel_send(pChannel, (const uint8_t*)"first", 5, 0), TCP_CHANNEL_SUCCESS);
+    CHECK_EQ(tcp_channel_send(pChannel, (const uint8_t*)"other", 5, 0), TCP_CHANNEL_SUCCESS);
+    CHECK_EQ(tcp_channel_send(pChannel, (const uint8_t*)"third", 5, 0), TCP_CHANNEL_ERROR_FULL);
+
+    tcp_channel_stats_t stats;
+    tcp_channel_get_stats(pChannel, &stats);
+    CHECK_EQ(stats.state, TCP_CHANNEL_DISCONNECTED);
+    CHECK_EQ(stats.dropped, 1);
+    CHECK_EQ(stats.buffered, 14);
+
+    poll_connect(pChannel, 0);
+    CHECK_EQ(channel_state(pChannel), TCP_CHANNEL_CONNECTED);
+    tcp_channel_poll(pChannel, 0);
+    int peer = accept_peer(listener);
+    expect_received(peer, "firstother");
+
+    // Connected, low latency sends right away, also across the end of the ring
+    CHECK_EQ(tcp_channel_send(pChannel, (const uint8_t*)"wrapped", 7, 0), TCP_CHANNEL_SUCCESS);
+    expect_received(peer, "wrapped");
+    tcp_channel_get_stats(pChannel, &stats);
+    CHECK_EQ(stats.connects, 1);
+    CHECK_EQ(stats.bytesSent, 17);
+    CHECK_EQ(stats.buffered, 0);
+    CHECK_EQ(tcp_channel_poll(pChannel, 0), TCP_CHANNEL_IDLE_POLL_MS);
+
+    tcp_channel_destroy(pChannel);
+    close(peer);
+    close(listener);
+}
+
+// Bulk mode holds messages back for the coalescing time, or until half the buffer is used
+static void test_bulk_coalescing(void) {
+    uint16_t port;
+    int listener = listen_loopback(&port);
+    TcpChannel* pChannel = create_channel(port, TCP_CHANNEL_BULK, 64);
+    poll_connect(pChannel, 0);
+    CHECK_EQ(channel_state(pChannel), TCP_CHANNEL_CONNECTED);
+    int peer = accept_peer(listener);
+
+    CHECK_EQ(tcp_channel_send(pChannel, (const uint8_t*)"a", 1, 1000), TCP_CHANNEL_SUCCESS);
+    CHECK_EQ(tcp_channel_send(pChannel, (const uint8_t*)"b", 1, 1020), TCP_CHANNEL_SUCCESS);
+    CHECK_EQ(tcp_channel_poll(pChannel, 1030), 1000 + COALESCE_MS - 1030);
+    usleep(10000);
+    CHECK(nothing_received(peer));
+
+    tcp_channel_poll(pChannel, 1000 + COALESCE_MS);
+    expect_received(peer, "ab");
+
+    // 32 bytes buffered reach half of the buffer and leave without waiting
+    uint8_t block[15];
+    memset(block, 'x', sizeof(block));
+    CHECK_EQ(tcp_channel_send(pChannel, block, sizeof(block), 2000), TCP_CHANNEL_SUCCESS);
+    usleep(10000);
+    CHECK(nothing_received(peer));
+    CHECK_EQ(tcp_channel_send(pChannel, block, sizeof(block), 2000), TCP_CHANNEL_SUCCESS);
+    expect_received(peer, "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxx");
+
+    tcp_channel_destroy(pChannel);
+    close(peer);
+    close(listener);
+}
+
+// Refused attempts back off, doubling up to the maximum
+static void test_backoff(void) {
+    TcpChannel* pChannel = create_channel(closed_port(), TCP_CHANNEL_LOW_LATENCY, 64);
+    int64_t now_ms = 0;
+    int64_t expected_ms = BACKOFF_BASE_MS;
+    for (int attempt = 0; attempt < 6; attempt++) {
+        int64_t wait_ms = poll_connect(pChannel, now_ms);
+        CHECK_EQ(channel_state(pChannel), TCP_CHANNEL_BACKOFF);
+        CHECK_EQ(wait_ms, expected_ms);
+
+        // Polled early, the channel keeps waiting for the rest of the delay
+        CHECK_EQ(tcp_channel_poll(pChannel, now_ms + 1), expected_ms - 1);
+        now_ms += wait_ms;
+        expected_ms = (expected_ms * 2 > BACKOFF_MAX_MS) ? BACKOFF_MAX_MS : expected_ms * 2;
+    }
+    tcp_channel_stats_t stats;
+    tcp_channel_get_stats(pChannel, &stats);
+    CHECK_EQ(stats.connects, 0);
+    CHECK_EQ(stats.disconnects, 0);
+    tcp_channel_destroy(pChannel);
+}
+
+// A connection closed by the peer is noticed on the next poll, reconnecting resets the backoff
+static void test_reconnect(void) {
+    uint16_t port;
+    int listener = listen_loopback(&port);
+    TcpChannel* pChannel = create_channel(port, TCP_CHANNEL_LOW_LATENCY, 64);
+    poll_connect(pChannel, 0);
+    int peer = accept_peer(listener);
+    close(peer);
+
+    for (int i = 0; i < 1000 && channel_state(pChannel) == TCP_CHANNEL_CONNECTED; i++) {
+        usleep(1000);
+        tcp_channel_poll(pChannel, 0);
+    }
+    CHECK_EQ(channel_state(pChannel), TCP_CHANNEL_BACKOFF);
+    CHECK_EQ(tcp_channel_send(pChannel, (const uint8_t*)"later", 5, 0), TCP_CHANNEL_SUCCESS);
+    CHECK_EQ(tcp_channel_poll(pChannel, 0), BACKOFF_BASE_MS);
+
+    poll_connect(pChannel, BACKOFF_BASE_MS);
+    CHECK_EQ(channel_state(pChannel), TCP_CHANNEL_CONNECTED);
+    tcp_channel_poll(pChannel, BACKOFF_BASE_MS);
+    peer = accept_peer(listener);
+    expect_received(peer, "later");
+
+    tcp_channel_stats_t stats;
+    tcp_channel_get_stats(pChannel, &stats);
+    CHECK_EQ(stats.connects, 2);
+    CHECK_EQ(stats.disconnects, 1);
+    CHECK_EQ(stats.dropped, 0);
+
+    // The next outage starts from the base delay again
+    close(peer);
+    for (int i = 0; i < 1000 && channel_state(pChannel) == TCP_CHANNEL_CONNECTED; i++) {
+        usleep(1000);
+        tcp_channel_poll(pChannel, 1000);
+    }
+    CHECK_EQ(tcp_channel_poll(pChannel, 1000), BACKOFF_BASE_MS);
+
+    tcp_channel_destroy(pChannel);
+    close(listener);
+}
+
+int main(void) {
+    RUN_TEST(test_arguments);
+    RUN_TEST(test_buffered_until_connected);
+    RUN_TEST(test_bulk_coalescing);
+    RUN_TEST(test_backoff);
+    RUN_TEST(test_reconnect);
+    return host_test_result();
+}
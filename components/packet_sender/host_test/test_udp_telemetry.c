@@ -0,0 +1,170 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "host_test.h"
+#include "udp_telemetry.h"
+
+// The telemetry against a receiver on the loopback interface, with simulated time
+
+#define MTU         32      // two events of 10 bytes per datagram
+#define POOL_SIZE   3
+#define FLUSH_MS    20
+
+static int bind_loopback(uint16_t* pPort) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(addr);
+    CHECK(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    getsockname(sock, (struct sockaddr *)&addr, &len);
+    *pPort = ntohs(addr.sin_port);
+    struct timeval timeout = { .tv_sec = 2 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return sock;
+}
+
+static UdpTelemetry* create_telemetry(uint16_t port) {
+    udp_telemetry_config_t config = {
+        .hostIP = "127.0.0.1",
+        .port = port,
+        .mtu = MTU,
+        .flushMs = FLUSH_MS,
+        .poolSize = POOL_SIZE,
+    };
+    return udp_telemetry_create(&config);
+}
+
+// Ten bytes of the same character
+static void send_event(UdpTelemetry* pTelemetry, char c, int64_t now_ms) {
+    uint8_t event[10];
+    memset(event, c, sizeof(event));
+    CHECK_EQ(udp_telemetry_send(pTelemetry, event, sizeof(event), now_ms), UDP_TELEMETRY_SUCCESS);
+}
+
+// Receives one datagram and checks it holds the events of the given characters
+static void expect_datagram(int receiver, const char* events) {
+    uint8_t datagram[UDP_TELEMETRY_MAX_PAYLOAD];
+    ssize_t len = recv(receiver, datagram, sizeof(datagram), 0);
+    CHECK_EQ(len, (ssize_t)strlen(events) * 11);
+    for (size_t i = 0; len > 0 && i < strlen(events); i++) {
+        const uint8_t* pRecord = &datagram[i * 11];
+        CHECK_EQ(pRecord[0], 10);
+        CHECK(pRecord[1] == events[i] && pRecord[10] == events[i]);
+    }
+}
+
+static bool nothing_received(int receiver) {
+    uint8_t c;
+    return recv(receiver, &c, 1, MSG_DONTWAIT) < 0;
+}
+
+static void test_arguments(void) {
+    udp_telemetry_config_t config = { .hostIP = "127.0.0.1", .port = 1, .mtu = MTU, .poolSize = 1 };
+    CHECK(udp_telemetry_create(&config) == NULL);
+    config.poolSize = 2;
+    config.mtu = UDP_TELEMETRY_MAX_PAYLOAD + 1;
+    CHECK(udp_telemetry_create(&config) == NULL);
+    config.mtu = MTU;
+    config.hostIP = "localhost";
+    CHECK(udp_telemetry_create(&config) == NULL);
+    CHECK(udp_telemetry_create(NULL) == NULL);
+
+    UdpTelemetry* pTelemetry = create_telemetry(1);
+    uint8_t event[UDP_TELEMETRY_MAX_EVENT_SIZE + 1] = { 0 };
+    CHECK_EQ(udp_telemetry_send(pTelemetry, event, 0, 0), UDP_TELEMETRY_ERROR_ARGUMENT);
+    CHECK_EQ(udp_telemetry_send(pTelemetry, event, MTU, 0), UDP_TELEMETRY_ERROR_ARGUMENT);
+    CHECK_EQ(udp_telemetry_send(pTelemetry, event, MTU - 1, 0), UDP_TELEMETRY_SUCCESS);
+    CHECK(udp_telemetry_matches(pTelemetry, "127.0.0.1", 1));
+    CHECK(!udp_telemetry_matches(pTelemetry, "127.0.0.1", 2));
+    udp_telemetry_destroy(pTelemetry);
+}
+
+// Events are packed into datagrams, which leave together once all but the current one are full
+static void test_packing(void) {
+    uint16_t port;
+    int receiver = bind_loopback(&port);
+    UdpTelemetry* pTelemetry = create_telemetry(port);
+
+    send_event(pTelemetry, 'a', 0);
+    send_event(pTelemetry, 'b', 0);
+    send_event(pTelemetry, 'c', 0);
+    send_event(pTelemetry, 'd', 0);
+    CHECK(nothing_received(receiver));
+    send_event(pTelemetry, 'e', 0);
+    expect_datagram(receiver, "ab");
+    expect_datagram(receiver, "cd");
+    CHECK(nothing_received(receiver));
+
+    udp_telemetry_flush(pTelemetry);
+    expect_datagram(receiver, "e");
+
+    udp_telemetry_stats_t stats;
+    udp_telemetry_get_stats(pTelemetry, &stats);
+    CHECK_EQ(stats.events, 5);
+    CHECK_EQ(stats.datagrams, 3);
+    CHECK_EQ(stats.dropped, 0);
+    CHECK_EQ(stats.sendErrors, 0);
+    CHECK_EQ(udp_telemetry_poll(pTelemetry, 0), UDP_TELEMETRY_IDLE_POLL_MS);
+
+    udp_telemetry_destroy(pTelemetry);
+    close(receiver);
+}
+
+// An event waits at most flushMs, counted from the oldest one waiting
+static void test_flush_deadline(void) {
+    uint16_t port;
+    int receiver = bind_loopback(&port);
+    UdpTelemetry* pTelemetry = create_telemetry(port);
+
+    send_event(pTelemetry, 'a', 100);
+    send_event(pTelemetry, 'b', 110);
+    CHECK_EQ(udp_telemetry_poll(pTelemetry, 110), 100 + FLUSH_MS - 110);
+    CHECK(nothing_received(receiver));
+    CHECK_EQ(udp_telemetry_poll(pTelemetry, 100 + FLUSH_MS), UDP_TELEMETRY_IDLE_POLL_MS);
+    expect_datagram(receiver, "ab");
+
+    // The next event starts a new deadline
+    send_event(pTelemetry, 'c', 500);
+    CHECK_EQ(udp_telemetry_poll(pTelemetry, 500), FLUSH_MS);
+
+    udp_telemetry_destroy(pTelemetry);
+    close(receiver);
+}
+
+// A datagram that fails for good is dropped instead of blocking the pool
+static void test_refused(void) {
+    uint16_t port;
+    close(bind_loopback(&port));
+    UdpTelemetry* pTelemetry = create_telemetry(port);
+
+    // The first datagram leaves, the port unreachable reply fails the next send
+    send_event(pTelemetry, 'a', 0);
+    udp_telemetry_flush(pTelemetry);
+    usleep(10000);
+    send_event(pTelemetry, 'b', 0);
+    udp_telemetry_flush(pTelemetry);
+
+    udp_telemetry_stats_t stats;
+    udp_telemetry_get_stats(pTelemetry, &stats);
+    CHECK_EQ(stats.datagrams, 1);
+    CHECK_EQ(stats.sendErrors, 1);
+    CHECK_EQ(udp_telemetry_poll(pTelemetry, 0), UDP_TELEMETRY_IDLE_POLL_MS);
+
+    // Later datagrams are sent again
+    send_event(pTelemetry, 'c', 0);
+    udp_telemetry_flush(pTelemetry);
+    udp_telemetry_get_stats(pTelemetry, &stats);
+    CHECK_EQ(stats.datagrams, 2);
+    udp_telemetry_destroy(pTelemetry);
+}
+
+int main(void) {
+    RUN_TEST(test_arguments);
+    RUN_TEST(test_packing);
+    RUN_TEST(test_flush_deadline);
+    RUN_TEST(test_refused);
+    return host_test_result();
+}
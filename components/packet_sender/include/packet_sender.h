@@ -6,7 +6,32 @@
 #include "lwip/err.h"
 #include "lwip/sockets.h"
 
+#include "tcp_channel.h"
+#include "udp_telemetry.h"
+
+#define PACKETSENDER_MAX_CONNECTIONS        CONFIG_PACKET_SENDER_MAX_CONNECTIONS
+#define PACKETSENDER_TCP_BUFFER_SIZE        CONFIG_PACKET_SENDER_TCP_BUFFER_SIZE
+#define PACKETSENDER_TCP_COALESCE_MS        CONFIG_PACKET_SENDER_TCP_COALESCE_MS
+#define PACKETSENDER_TCP_BACKOFF_MAX_MS     CONFIG_PACKET_SENDER_TCP_BACKOFF_MAX_MS
+#define PACKETSENDER_TCP_KEEPALIVE_IDLE_S   CONFIG_PACKET_SENDER_TCP_KEEPALIVE_IDLE_S
+#define PACKETSENDER_TCP_KEEPALIVE_INTERVAL_S 5
+#define PACKETSENDER_TCP_KEEPALIVE_COUNT    3
+#define PACKETSENDER_TCP_BACKOFF_BASE_MS    500
+#define PACKETSENDER_TCP_CONNECT_TIMEOUT_MS 5000
+#define PACKETSENDER_MAX_UDP_ENDPOINTS      2
+#define PACKETSENDER_UDP_MTU                CONFIG_PACKET_SENDER_UDP_MTU
+#define PACKETSENDER_UDP_FLUSH_MS           CONFIG_PACKET_SENDER_UDP_FLUSH_MS
+#define PACKETSENDER_UDP_POOL_SIZE          CONFIG_PACKET_SENDER_UDP_POOL_SIZE
+#define PACKETSENDER_TASK_STACKSIZE         4096
+#define PACKETSENDER_TASK_PRIORITY          4
+
+// Persistent connections, opened on the first message to an endpoint and kept open
 void packetsender_sendTCP(char* hostIP, uint16_t port, uint8_t* payload, uint16_t payloadLen);
+void packetsender_sendTCP_bulk(char* hostIP, uint16_t port, uint8_t* payload, uint16_t payloadLen);
+void packetsender_get_tcp_stats(tcp_channel_stats_t* pStats);
+// Small events batched into few datagrams over one long-lived socket per endpoint
+void packetsender_sendTelemetry(char* hostIP, uint16_t port, uint8_t* payload, uint16_t payloadLen);
+void packetsender_get_udp_stats(udp_telemetry_stats_t* pStats);
 void packetsender_sendUDP(char* hostIP, uint16_t port, uint8_t* payload, uint16_t payloadLen);
 
 #endif /* MAIN_PACKETSENDER_H_ */
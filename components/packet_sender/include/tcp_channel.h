@@ -0,0 +1,63 @@
+#ifndef TCP_CHANNEL_H
+#define TCP_CHANNEL_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Persistent TCP connection with an outbound buffer. All socket calls are non-blocking, the channel
+// is driven by tcp_channel_poll(). Plain BSD sockets only, so it runs on lwIP and on a Linux host.
+// Not thread-safe, the caller serializes access.
+
+#define TCP_CHANNEL_SUCCESS             0
+#define TCP_CHANNEL_ERROR_FULL         -1
+#define TCP_CHANNEL_ERROR_ARGUMENT     -2
+
+#define TCP_CHANNEL_IDLE_POLL_MS        1000    // notices a connection closed by the peer
+#define TCP_CHANNEL_BUSY_POLL_MS        10      // while connecting or the socket buffer is full
+
+typedef enum {
+    TCP_CHANNEL_DISCONNECTED,
+    TCP_CHANNEL_CONNECTING,
+    TCP_CHANNEL_CONNECTED,
+    TCP_CHANNEL_BACKOFF,        // waiting before the next connection attempt
+} tcp_channel_state_t;
+
+typedef enum {
+    TCP_CHANNEL_LOW_LATENCY,    // TCP_NODELAY, every message is sent right away
+    TCP_CHANNEL_BULK,           // Nagle on, messages are held back for coalesceMs to fill segments
+} tcp_channel_mode_t;
+
+typedef struct {
+    const char* hostIP;
+    uint16_t port;
+    tcp_channel_mode_t mode;
+    size_t bufferSize;          // messages are kept here while disconnected
+    uint32_t coalesceMs;
+    uint32_t connectTimeoutMs;
+    uint32_t backoffBaseMs;     // doubles with every failed attempt
+    uint32_t backoffMaxMs;
+    uint16_t keepaliveIdleS;    // 0 = no keepalive
+    uint16_t keepaliveIntervalS;
+    uint8_t keepaliveCount;
+} tcp_channel_config_t;
+
+typedef struct {
+    tcp_channel_state_t state;
+    uint32_t connects;
+    uint32_t disconnects;
+    uint32_t dropped;           // messages rejected because the buffer was full
+    uint64_t bytesSent;
+    size_t buffered;
+} tcp_channel_stats_t;
+
+typedef struct _TcpChannel_ TcpChannel;
+
+TcpChannel* tcp_channel_create(const tcp_channel_config_t* pConfig);
+void tcp_channel_destroy(TcpChannel* pChannel);
+int tcp_channel_send(TcpChannel* pChannel, const uint8_t* data, size_t len, int64_t now_ms);
+int64_t tcp_channel_poll(TcpChannel* pChannel, int64_t now_ms);
+bool tcp_channel_matches(const TcpChannel* pChannel, const char* hostIP, uint16_t port, tcp_channel_mode_t mode);
+void tcp_channel_get_stats(const TcpChannel* pChannel, tcp_channel_stats_t* pStats);
+
+#endif // TCP_CHANNEL_H
@@ -0,0 +1,47 @@
+#ifndef UDP_TELEMETRY_H
+#define UDP_TELEMETRY_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Long-lived UDP endpoint that packs many small events into one datagram. Packets come from a pool
+// allocated once, nothing is allocated per event. Plain BSD sockets, so it runs on lwIP and on a
+// Linux host, where full packets leave in one sendmmsg() call. Not thread-safe.
+//
+// Datagram layout: [length][event][length][event]..., one length byte per event.
+
+#define UDP_TELEMETRY_SUCCESS           0
+#define UDP_TELEMETRY_ERROR_FULL       -1  // all packets of the pool are waiting to be sent
+#define UDP_TELEMETRY_ERROR_ARGUMENT   -2
+
+#define UDP_TELEMETRY_MAX_EVENT_SIZE    255
+#define UDP_TELEMETRY_MAX_PAYLOAD       1472 // Ethernet MTU minus IPv4 and UDP header
+#define UDP_TELEMETRY_IDLE_POLL_MS      1000
+
+typedef struct {
+    const char* hostIP;
+    uint16_t port;
+    uint16_t mtu;           // payload size of a datagram, at most UDP_TELEMETRY_MAX_PAYLOAD
+    uint32_t flushMs;       // latest time an event waits for more to fill its datagram
+    uint8_t poolSize;       // datagrams that may wait to be sent, at least 2
+} udp_telemetry_config_t;
+
+typedef struct {
+    uint32_t events;
+    uint32_t datagrams;
+    uint32_t dropped;       // events rejected because the pool was exhausted
+    uint32_t sendErrors;
+} udp_telemetry_stats_t;
+
+typedef struct _UdpTelemetry_ UdpTelemetry;
+
+UdpTelemetry* udp_telemetry_create(const udp_telemetry_config_t* pConfig);
+void udp_telemetry_destroy(UdpTelemetry* pTelemetry);
+int udp_telemetry_send(UdpTelemetry* pTelemetry, const uint8_t* data, size_t len, int64_t now_ms);
+int64_t udp_telemetry_poll(UdpTelemetry* pTelemetry, int64_t now_ms);
+void udp_telemetry_flush(UdpTelemetry* pTelemetry);
+bool udp_telemetry_matches(const UdpTelemetry* pTelemetry, const char* hostIP, uint16_t port);
+void udp_telemetry_get_stats(const UdpTelemetry* pTelemetry, udp_telemetry_stats_t* pStats);
+
+#endif // UDP_TELEMETRY_H
@@ -1,35 +1,248 @@
+#include <string.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
 #include "packet_sender.h"
 
 static const char* TAG = "PACKET_SENDER";
 
-void packetsender_sendTCP(char* hostIP, uint16_t port, uint8_t* payload, uint16_t payloadLen) {
-    int sock =  socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
-    if (sock < 0) {
-        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+// Connection cache, one channel per endpoint and mode. Guarded by gLock, polled by the sender task.
+static TcpChannel* gChannels[PACKETSENDER_MAX_CONNECTIONS];
+static uint8_t gChannelCount = 0;
+static UdpTelemetry* gTelemetry[PACKETSENDER_MAX_UDP_ENDPOINTS];
+static uint8_t gTelemetryCount = 0;
+static SemaphoreHandle_t gLock = NULL;
+static TaskHandle_t gSenderTask = NULL;
+static portMUX_TYPE gInitLock = portMUX_INITIALIZER_UNLOCKED;
+
+static bool init_sender(void);
+static TcpChannel* get_channel(const char* hostIP, uint16_t port, tcp_channel_mode_t mode);
+static void send_tcp(const char* hostIP, uint16_t port, const uint8_t* payload, uint16_t payloadLen, tcp_channel_mode_t mode);
+static UdpTelemetry* get_telemetry(const char* hostIP, uint16_t port);
+static void sender_task(void* arg);
+
+// ----- implementation -----
+
+/*
+ * @brief Creates the lock and the sender task on first use
+ *
+ *  The mutex is created outside the critical section, which must not call into the allocator,
+ *  and only published if no other task was faster. The loser deletes its mutex.
+ */
+bool init_sender(void) {
+    taskENTER_CRITICAL(&gInitLock);
+    bool ready = (gLock != NULL);
+    taskEXIT_CRITICAL(&gInitLock);
+    if (ready) {
+        return true;
+    }
+
+    SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+    if (lock == NULL) {
+        ESP_LOGE(TAG, "Failed to create lock");
+        return false;
+    }
+    taskENTER_CRITICAL(&gInitLock);
+    bool first = (gLock == NULL);
+    if (first) {
+        gLock = lock;
+    }
+    taskEXIT_CRITICAL(&gInitLock);
+    if (!first) {
+        vSemaphoreDelete(lock);
+        return true;
+    }
+    if (xTaskCreate(sender_task, "packet_sender", PACKETSENDER_TASK_STACKSIZE, NULL, PACKETSENDER_TASK_PRIORITY, &gSenderTask) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create sender task");
+    }
+    return true;
+}
+
+// Must be called with gLock held
+TcpChannel* get_channel(const char* hostIP, uint16_t port, tcp_channel_mode_t mode) {
+    for (uint8_t i = 0; i < gChannelCount; i++) {
+        if (tcp_channel_matches(gChannels[i], hostIP, port, mode)) {
+            return gChannels[i];
+        }
+    }
+    if (gChannelCount >= PACKETSENDER_MAX_CONNECTIONS) {
+        ESP_LOGE(TAG, "Maximum number of connections reached: %d", PACKETSENDER_MAX_CONNECTIONS);
+        return NULL;
+    }
+
+    const tcp_channel_config_t config = {
+        .hostIP = hostIP,
+        .port = port,
+        .mode = mode,
+        .bufferSize = PACKETSENDER_TCP_BUFFER_SIZE,
+        .coalesceMs = PACKETSENDER_TCP_COALESCE_MS,
+        .connectTimeoutMs = PACKETSENDER_TCP_CONNECT_TIMEOUT_MS,
+        .backoffBaseMs = PACKETSENDER_TCP_BACKOFF_BASE_MS,
+        .backoffMaxMs = PACKETSENDER_TCP_BACKOFF_MAX_MS,
+        .keepaliveIdleS = PACKETSENDER_TCP_KEEPALIVE_IDLE_S,
+        .keepaliveIntervalS = PACKETSENDER_TCP_KEEPALIVE_INTERVAL_S,
+        .keepaliveCount = PACKETSENDER_TCP_KEEPALIVE_COUNT,
+    };
+    TcpChannel* pChannel = tcp_channel_create(&config);
+    if (pChannel == NULL) {
+        return NULL;
+    }
+    gChannels[gChannelCount++] = pChannel;
+    ESP_LOGI(TAG, "Opened %s channel to %s:%d", (mode == TCP_CHANNEL_LOW_LATENCY) ? "low latency" : "bulk", hostIP, port);
+    return pChannel;
+}
+
+void send_tcp(const char* hostIP, uint16_t port, const uint8_t* payload, uint16_t payloadLen, tcp_channel_mode_t mode) {
+    if (hostIP == NULL || payload == NULL || !init_sender()) {
         return;
     }
-    ESP_LOGI(TAG, "Socket created, connecting to %s:%d", hostIP, port);
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    TcpChannel* pChannel = get_channel(hostIP, port, mode);
+    int ret = (pChannel != NULL) ? tcp_channel_send(pChannel, payload, payloadLen, esp_timer_get_time() / 1000) : TCP_CHANNEL_ERROR_ARGUMENT;
+    xSemaphoreGive(gLock);
 
-    struct sockaddr_in dest_addr;
-    dest_addr.sin_addr.s_addr = inet_addr(hostIP);
-    dest_addr.sin_family = AF_INET;
-    dest_addr.sin_port = htons(port);
-    int err = connect(sock, (struct sockaddr *)&dest_addr, sizeof(struct sockaddr_in6));
-    if (err != 0) {
-        ESP_LOGE(TAG, "Socket unable to connect: errno %d", errno);
+    if (ret == TCP_CHANNEL_ERROR_FULL) {
+        ESP_LOGW(TAG, "Buffer for %s:%d full, message dropped", hostIP, port);
+    }
+    // Connects a new channel, or picks up the deadline of a held back message
+    if (gSenderTask != NULL) {
+        xTaskNotifyGive(gSenderTask);
+    }
+}
+
+// Must be called with gLock held
+UdpTelemetry* get_telemetry(const char* hostIP, uint16_t port) {
+    for (uint8_t i = 0; i < gTelemetryCount; i++) {
+        if (udp_telemetry_matches(gTelemetry[i], hostIP, port)) {
+            return gTelemetry[i];
+        }
+    }
+    if (gTelemetryCount >= PACKETSENDER_MAX_UDP_ENDPOINTS) {
+        ESP_LOGE(TAG, "Maximum number of UDP endpoints reached: %d", PACKETSENDER_MAX_UDP_ENDPOINTS);
+        return NULL;
+    }
+
+    const udp_telemetry_config_t config = {
+        .hostIP = hostIP,
+        .port = port,
+        .mtu = PACKETSENDER_UDP_MTU,
+        .flushMs = PACKETSENDER_UDP_FLUSH_MS,
+        .poolSize = PACKETSENDER_UDP_POOL_SIZE,
+    };
+    UdpTelemetry* pTelemetry = udp_telemetry_create(&config);
+    if (pTelemetry == NULL) {
+        return NULL;
+    }
+    gTelemetry[gTelemetryCount++] = pTelemetry;
+    ESP_LOGI(TAG, "Opened telemetry socket to %s:%d", hostIP, port);
+    return pTelemetry;
+}
+
+/*
+ * @brief Keeps all cached channels connected and flushes their buffers and telemetry datagrams
+ *
+ *  Sleeps until the nearest deadline of any channel, or until a new message arrives.
+ */
+void sender_task(void* arg) {
+    while (true) {
+        int64_t wait_ms = TCP_CHANNEL_IDLE_POLL_MS;
+        int64_t now_ms = esp_timer_get_time() / 1000;
+
+        xSemaphoreTake(gLock, portMAX_DELAY);
+        for (uint8_t i = 0; i < gChannelCount; i++) {
+            int64_t next_ms = tcp_channel_poll(gChannels[i], now_ms);
+            if (next_ms < wait_ms) {
+                wait_ms = next_ms;
+            }
+        }
+        for (uint8_t i = 0; i < gTelemetryCount; i++) {
+            int64_t next_ms = udp_telemetry_poll(gTelemetry[i], now_ms);
+            if (next_ms < wait_ms) {
+                wait_ms = next_ms;
+            }
+        }
+        xSemaphoreGive(gLock);
+
+        // Rounded up by a tick, waits shorter than one tick would not block at all
+        ulTaskNotifyTake(pdTRUE, (wait_ms > 0) ? pdMS_TO_TICKS(wait_ms) + 1 : 1);
+    }
+}
+
+// Latency critical events, TCP_NODELAY
+void packetsender_sendTCP(char* hostIP, uint16_t port, uint8_t* payload, uint16_t payloadLen) {
+    send_tcp(hostIP, port, payload, payloadLen, TCP_CHANNEL_LOW_LATENCY);
+}
+
+// Bulk data, held back for PACKETSENDER_TCP_COALESCE_MS and coalesced into full segments
+void packetsender_sendTCP_bulk(char* hostIP, uint16_t port, uint8_t* payload, uint16_t payloadLen) {
+    send_tcp(hostIP, port, payload, payloadLen, TCP_CHANNEL_BULK);
+}
+
+// Summed over all channels, the state is the one of the first channel
+void packetsender_get_tcp_stats(tcp_channel_stats_t* pStats) {
+    memset(pStats, 0, sizeof(*pStats));
+    if (gLock == NULL) {
         return;
     }
-    ESP_LOGD(TAG, "Successfully connected");
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    for (uint8_t i = 0; i < gChannelCount; i++) {
+        tcp_channel_stats_t stats;
+        tcp_channel_get_stats(gChannels[i], &stats);
+        if (i == 0) {
+            pStats->state = stats.state;
+        }
+        pStats->connects += stats.connects;
+        pStats->disconnects += stats.disconnects;
+        pStats->dropped += stats.dropped;
+        pStats->bytesSent += stats.bytesSent;
+        pStats->buffered += stats.buffered;
+    }
+    xSemaphoreGive(gLock);
+}
 
-    err = send(sock, payload, payloadLen, 0);
-    if (err < 0) {
-        ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
+/*
+ * @brief Queues one event for the telemetry datagram to hostIP:port
+ *
+ *  Events are sent once a datagram is full or PACKETSENDER_UDP_FLUSH_MS after the first of them.
+ */
+void packetsender_sendTelemetry(char* hostIP, uint16_t port, uint8_t* payload, uint16_t payloadLen) {
+    if (hostIP == NULL || payload == NULL || !init_sender()) {
         return;
     }
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    UdpTelemetry* pTelemetry = get_telemetry(hostIP, port);
+    int ret = (pTelemetry != NULL) ? udp_telemetry_send(pTelemetry, payload, payloadLen, esp_timer_get_time() / 1000) : UDP_TELEMETRY_ERROR_ARGUMENT;
+    xSemaphoreGive(gLock);
 
-    ESP_LOGD(TAG, "Closing socket...");
-    shutdown(sock, 0);
-    close(sock);
+    if (ret == UDP_TELEMETRY_ERROR_FULL) {
+        ESP_LOGW(TAG, "Telemetry pool for %s:%d full, event dropped", hostIP, port);
+    } else if (ret == UDP_TELEMETRY_ERROR_ARGUMENT) {
+        ESP_LOGE(TAG, "Telemetry event of %d bytes rejected", payloadLen);
+    }
+    // Picks up the flush deadline of the datagram being filled
+    if (gSenderTask != NULL && ret == UDP_TELEMETRY_SUCCESS) {
+        xTaskNotifyGive(gSenderTask);
+    }
+}
+
+// Summed over all telemetry endpoints
+void packetsender_get_udp_stats(udp_telemetry_stats_t* pStats) {
+    memset(pStats, 0, sizeof(*pStats));
+    if (gLock == NULL) {
+        return;
+    }
+    xSemaphoreTake(gLock, portMAX_DELAY);
+    for (uint8_t i = 0; i < gTelemetryCount; i++) {
+        udp_telemetry_stats_t stats;
+        udp_telemetry_get_stats(gTelemetry[i], &stats);
+        pStats->events += stats.events;
+        pStats->datagrams += stats.datagrams;
+        pStats->dropped += stats.dropped;
+        pStats->sendErrors += stats.sendErrors;
+    }
+    xSemaphoreGive(gLock);
 }
 
 void packetsender_sendUDP(char* hostIP, uint16_t port, uint8_t* payload, uint16_t payloadLen) {
@@ -40,13 +253,14 @@ void packetsender_sendUDP(char* hostIP, uint16_t port, uint8_t* payload, uint16_
     }
     ESP_LOGI(TAG, "Socket created, sending datagram to %s:%d", hostIP, port);
 
-    struct sockaddr_in dest_addr;
+    struct sockaddr_in dest_addr = { 0 };
     dest_addr.sin_addr.s_addr = inet_addr(hostIP);
     dest_addr.sin_family = AF_INET;
     dest_addr.sin_port = htons(port);
-    int err = connect(sock, (struct sockaddr *)&dest_addr, sizeof(struct sockaddr_in6));
+    int err = connect(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
     if (err != 0) {
         ESP_LOGE(TAG, "Socket unable to connect: errno %d", errno);
+        close(sock);
         return;
     }
     ESP_LOGD(TAG, "Successfully connected");
@@ -54,6 +268,7 @@ void packetsender_sendUDP(char* hostIP, uint16_t port, uint8_t* payload, uint16_
     err = send(sock, payload, payloadLen, 0);
     if (err < 0) {
         ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
+        close(sock);
         return;
     }
 
@@ -0,0 +1,33 @@
+#ifndef PACKET_SENDER_PORT_H
+#define PACKET_SENDER_PORT_H
+
+// Sockets and logging for the portable parts of the packet sender, which also build on a Linux host
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#else
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) fprintf(stderr, "I (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ((void)(tag))
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // lwIP raises no SIGPIPE
+#endif
+
+#endif // PACKET_SENDER_PORT_H
@@ -0,0 +1,328 @@
+#include "packet_sender_port.h"
+#include "tcp_channel.h"
+
+#define TCP_CHANNEL_RECORD_HEADER   2   // length of each message in the outbound buffer
+#define TCP_CHANNEL_MAX_BACKOFF_SHIFT 16
+
+static const char *TAG = "TCP_CHANNEL";
+
+/*
+ * The outbound buffer holds whole messages as [length][payload] records. Only the payload is sent.
+ * A message cut off by a lost connection is dropped, the peer cannot resume it on a new one.
+ */
+struct _TcpChannel_ {
+    tcp_channel_config_t config;
+    char hostIP[INET_ADDRSTRLEN];   // config.hostIP points here
+    struct sockaddr_in addr;
+    int sock;
+    tcp_channel_state_t state;
+    int64_t deadline_ms;            // connect timeout or end of the backoff
+    int64_t flushAt_ms;             // BULK: send the held back messages at this time, 0 = none held back
+    uint8_t attempt;                // failed attempts since the last connect
+    uint8_t* buffer;
+    size_t head;                    // first record
+    size_t used;
+    size_t frontSent;               // payload bytes of the first record already sent
+    tcp_channel_stats_t stats;
+};
+
+static void ring_write(TcpChannel* pChannel, size_t offset, const uint8_t* data, size_t len) {
+    size_t pos = (pChannel->head + offset) % pChannel->config.bufferSize;
+    size_t first = pChannel->config.bufferSize - pos;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(&pChannel->buffer[pos], data, first);
+    memcpy(pChannel->buffer, data + first, len - first);
+}
+
+static size_t front_length(const TcpChannel* pChannel) {
+    size_t size = pChannel->config.bufferSize;
+    return ((size_t)pChannel->buffer[pChannel->head] << 8) | pChannel->buffer[(pChannel->head + 1) % size];
+}
+
+static void pop_front(TcpChannel* pChannel) {
+    size_t record = TCP_CHANNEL_RECORD_HEADER + front_length(pChannel);
+    pChannel->head = (pChannel->head + record) % pChannel->config.bufferSize;
+    pChannel->used -= record;
+    pChannel->frontSent = 0;
+}
+
+static uint32_t backoff_ms(const tcp_channel_config_t* pConfig, uint8_t attempt) {
+    uint8_t shift = (attempt < TCP_CHANNEL_MAX_BACKOFF_SHIFT) ? attempt : TCP_CHANNEL_MAX_BACKOFF_SHIFT;
+    uint64_t delay_ms = (uint64_t)pConfig->backoffBaseMs << shift;
+    return (delay_ms > pConfig->backoffMaxMs) ? pConfig->backoffMaxMs : (uint32_t)delay_ms;
+}
+
+static void close_socket(TcpChannel* pChannel, int64_t now_ms) {
+    if (pChannel->sock >= 0) {
+        shutdown(pChannel->sock, SHUT_RDWR);
+        close(pChannel->sock);
+        pChannel->sock = -1;
+    }
+    if (pChannel->state == TCP_CHANNEL_CONNECTED) {
+        pChannel->stats.disconnects++;
+    }
+    if (pChannel->frontSent > 0) {
+        pop_front(pChannel);
+        pChannel->stats.dropped++;
+    }
+    pChannel->state = TCP_CHANNEL_BACKOFF;
+    pChannel->deadline_ms = now_ms + backoff_ms(&pChannel->config, pChannel->attempt);
+    if (pChannel->attempt < UINT8_MAX) {
+        pChannel->attempt++;
+    }
+}
+
+static void set_options(TcpChannel* pChannel) {
+    int enable = 1;
+    if (pChannel->config.mode == TCP_CHANNEL_LOW_LATENCY) {
+        setsockopt(pChannel->sock, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    }
+    if (pChannel->config.keepaliveIdleS > 0) {
+        int idle = pChannel->config.keepaliveIdleS;
+        int interval = pChannel->config.keepaliveIntervalS;
+        int count = pChannel->config.keepaliveCount;
+        setsockopt(pChannel->sock, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+        setsockopt(pChannel->sock, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+        setsockopt(pChannel->sock, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+        setsockopt(pChannel->sock, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+    }
+}
+
+static void on_connected(TcpChannel* pChannel) {
+    pChannel->state = TCP_CHANNEL_CONNECTED;
+    pChannel->attempt = 0;
+    pChannel->stats.connects++;
+    ESP_LOGI(TAG, "Connected to %s:%d", pChannel->hostIP, pChannel->config.port);
+}
+
+static void start_connect(TcpChannel* pChannel, int64_t now_ms) {
+    pChannel->sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (pChannel->sock < 0) {
+        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+        close_socket(pChannel, now_ms);
+        return;
+    }
+    fcntl(pChannel->sock, F_SETFL, fcntl(pChannel->sock, F_GETFL, 0) | O_NONBLOCK);
+    set_options(pChannel);
+
+    int err = connect(pChannel->sock, (struct sockaddr *)&pChannel->addr, sizeof(pChannel->addr));
+    if (err == 0) {
+        on_connected(pChannel);
+    } else if (errno == EINPROGRESS) {
+        pChannel->state = TCP_CHANNEL_CONNECTING;
+        pChannel->deadline_ms = now_ms + pChannel->config.connectTimeoutMs;
+    } else {
+        ESP_LOGW(TAG, "Socket unable to connect: errno %d", errno);
+        close_socket(pChannel, now_ms);
+    }
+}
+
+static void socket_ready(int sock, bool* pReadable, bool* pWritable) {
+    fd_set readSet;
+    fd_set writeSet;
+    FD_ZERO(&readSet);
+    FD_ZERO(&writeSet);
+    FD_SET(sock, &readSet);
+    FD_SET(sock, &writeSet);
+    struct timeval timeout = { 0 };
+    if (select(sock + 1, &readSet, &writeSet, NULL, &timeout) <= 0) {
+        *pReadable = false;
+        *pWritable = false;
+        return;
+    }
+    *pReadable = FD_ISSET(sock, &readSet);
+    *pWritable = FD_ISSET(sock, &writeSet);
+}
+
+static void check_connect(TcpChannel* pChannel, int64_t now_ms) {
+    bool readable;
+    bool writable;
+    socket_ready(pChannel->sock, &readable, &writable);
+    if (!writable) {
+        if (now_ms >= pChannel->deadline_ms) {
+            ESP_LOGW(TAG, "Connection to %s:%d timed out", pChannel->hostIP, pChannel->config.port);
+            close_socket(pChannel, now_ms);
+        }
+        return;
+    }
+    int error = 0;
+    socklen_t len = sizeof(error);
+    getsockopt(pChannel->sock, SOL_SOCKET, SO_ERROR, &error, &len);
+    if (error != 0) {
+        ESP_LOGW(TAG, "Socket unable to connect: errno %d", error);
+        close_socket(pChannel, now_ms);
+        return;
+    }
+    on_connected(pChannel);
+}
+
+// Nothing is expected from the peer, reading only detects a closed connection
+static void drain_input(TcpChannel* pChannel, int64_t now_ms) {
+    bool readable;
+    bool writable;
+    socket_ready(pChannel->sock, &readable, &writable);
+    if (!readable) {
+        return;
+    }
+    uint8_t scratch[64];
+    ssize_t len = recv(pChannel->sock, scratch, sizeof(scratch), 0);
+    if (len == 0 || (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        ESP_LOGW(TAG, "Connection to %s:%d closed", pChannel->hostIP, pChannel->config.port);
+        close_socket(pChannel, now_ms);
+    }
+}
+
+// Sends as much as the socket takes without blocking
+static void flush(TcpChannel* pChannel, int64_t now_ms) {
+    size_t size = pChannel->config.bufferSize;
+    while (pChannel->used > 0) {
+        size_t remaining = front_length(pChannel) - pChannel->frontSent;
+        size_t pos = (pChannel->head + TCP_CHANNEL_RECORD_HEADER + pChannel->frontSent) % size;
+        size_t chunk = (remaining < size - pos) ? remaining : size - pos;
+
+        ssize_t sent = send(pChannel->sock, &pChannel->buffer[pos], chunk, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                ESP_LOGW(TAG, "Error occurred during sending: errno %d", errno);
+                close_socket(pChannel, now_ms);
+            }
+            return;
+        }
+        pChannel->stats.bytesSent += sent;
+        pChannel->frontSent += sent;
+        if (pChannel->frontSent == front_length(pChannel)) {
+            pop_front(pChannel);
+        }
+    }
+    pChannel->flushAt_ms = 0;
+}
+
+static bool flush_due(const TcpChannel* pChannel, int64_t now_ms) {
+    return pChannel->config.mode == TCP_CHANNEL_LOW_LATENCY || now_ms >= pChannel->flushAt_ms
+        || pChannel->used >= pChannel->config.bufferSize / 2;
+}
+
+TcpChannel* tcp_channel_create(const tcp_channel_config_t* pConfig) {
+    if (pConfig == NULL || pConfig->hostIP == NULL || pConfig->bufferSize <= TCP_CHANNEL_RECORD_HEADER) {
+        ESP_LOGE(TAG, "Invalid channel config");
+        return NULL;
+    }
+    TcpChannel* pChannel = calloc(1, sizeof(TcpChannel));
+    if (pChannel == NULL) {
+        return NULL;
+    }
+    pChannel->buffer = malloc(pConfig->bufferSize);
+    if (pChannel->buffer == NULL) {
+        free(pChannel);
+        return NULL;
+    }
+    pChannel->config = *pConfig;
+    strncpy(pChannel->hostIP, pConfig->hostIP, sizeof(pChannel->hostIP) - 1);
+    pChannel->config.hostIP = pChannel->hostIP;
+
+    pChannel->addr.sin_family = AF_INET;
+    pChannel->addr.sin_port = htons(pConfig->port);
+    if (inet_pton(AF_INET, pChannel->hostIP, &pChannel->addr.sin_addr) != 1) {
+        ESP_LOGE(TAG, "Invalid IPv4 address: %s", pConfig->hostIP);
+        tcp_channel_destroy(pChannel);
+        return NULL;
+    }
+    pChannel->sock = -1;
+    pChannel->state = TCP_CHANNEL_DISCONNECTED;
+    return pChannel;
+}
+
+void tcp_channel_destroy(TcpChannel* pChannel) {
+    if (pChannel == NULL) {
+        return;
+    }
+    if (pChannel->sock >= 0) {
+        close(pChannel->sock);
+    }
+    free(pChannel->buffer);
+    free(pChannel);
+}
+
+/*
+ * @brief Queues one message and sends it right away if the mode and the connection allow it
+ *
+ * @return TCP_CHANNEL_SUCCESS, or TCP_CHANNEL_ERROR_FULL if the buffer has no room for the whole message
+ */
+int tcp_channel_send(TcpChannel* pChannel, const uint8_t* data, size_t len, int64_t now_ms) {
+    if (len == 0 || len > UINT16_MAX) {
+        return TCP_CHANNEL_ERROR_ARGUMENT;
+    }
+    size_t record = TCP_CHANNEL_RECORD_HEADER + len;
+    if (record > pChannel->config.bufferSize - pChannel->used) {
+        pChannel->stats.dropped++;
+        return TCP_CHANNEL_ERROR_FULL;
+    }
+    uint8_t header[TCP_CHANNEL_RECORD_HEADER] = { (uint8_t)(len >> 8), (uint8_t)len };
+    ring_write(pChannel, pChannel->used, header, sizeof(header));
+    ring_write(pChannel, pChannel->used + sizeof(header), data, len);
+    pChannel->used += record;
+
+    if (pChannel->flushAt_ms == 0) {
+        pChannel->flushAt_ms = now_ms + pChannel->config.coalesceMs;
+    }
+    if (pChannel->state == TCP_CHANNEL_CONNECTED && flush_due(pChannel, now_ms)) {
+        flush(pChannel, now_ms);
+    }
+    return TCP_CHANNEL_SUCCESS;
+}
+
+/*
+ * @brief Connects, reconnects after the backoff and sends held back messages
+ *
+ * @return milliseconds until the channel wants to be polled again
+ */
+int64_t tcp_channel_poll(TcpChannel* pChannel, int64_t now_ms) {
+    switch (pChannel->state) {
+    case TCP_CHANNEL_DISCONNECTED:
+        start_connect(pChannel, now_ms);
+        break;
+    case TCP_CHANNEL_BACKOFF:
+        if (now_ms >= pChannel->deadline_ms) {
+            start_connect(pChannel, now_ms);
+        }
+        break;
+    case TCP_CHANNEL_CONNECTING:
+        check_connect(pChannel, now_ms);
+        break;
+    case TCP_CHANNEL_CONNECTED:
+        drain_input(pChannel, now_ms);
+        break;
+    }
+    if (pChannel->state == TCP_CHANNEL_CONNECTED && pChannel->used > 0 && flush_due(pChannel, now_ms)) {
+        flush(pChannel, now_ms);
+        if (pChannel->used > 0 && pChannel->state == TCP_CHANNEL_CONNECTED) {
+            return TCP_CHANNEL_BUSY_POLL_MS; // the socket buffer is full
+        }
+    }
+
+    switch (pChannel->state) {
+    case TCP_CHANNEL_BACKOFF:
+        return (pChannel->deadline_ms > now_ms) ? pChannel->deadline_ms - now_ms : 0;
+    case TCP_CHANNEL_CONNECTING:
+        return TCP_CHANNEL_BUSY_POLL_MS;
+    case TCP_CHANNEL_CONNECTED:
+        if (pChannel->used > 0) {
+            return pChannel->flushAt_ms - now_ms; // held back, flush_due() was false
+        }
+        return TCP_CHANNEL_IDLE_POLL_MS;
+    default:
+        return 0;
+    }
+}
+
+bool tcp_channel_matches(const TcpChannel* pChannel, const char* hostIP, uint16_t port, tcp_channel_mode_t mode) {
+    return pChannel->config.port == port && pChannel->config.mode == mode && strcmp(pChannel->hostIP, hostIP) == 0;
+}
+
+void tcp_channel_get_stats(const TcpChannel* pChannel, tcp_channel_stats_t* pStats) {
+    *pStats = pChannel->stats;
+    pStats->state = pChannel->state;
+    pStats->buffered = pChannel->used;
+}
@@ -0,0 +1,253 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // sendmmsg()
+#endif
+
+#include "packet_sender_port.h"
+#include "udp_telemetry.h"
+
+#define UDP_TELEMETRY_RECORD_HEADER 1
+
+static const char *TAG = "UDP_TELEMETRY";
+
+typedef struct {
+    uint16_t len;
+    uint8_t* data;
+} udp_packet_t;
+
+/*
+ * The packets form a ring in sending order. The last used one is being filled, all before it
+ * are full and wait for the flush.
+ */
+struct _UdpTelemetry_ {
+    udp_telemetry_config_t config;
+    char hostIP[INET_ADDRSTRLEN];   // config.hostIP points here
+    int sock;
+    uint8_t* storage;               // poolSize * mtu bytes
+    udp_packet_t* packets;
+    uint8_t first;
+    uint8_t count;
+    int64_t flushAt_ms;             // 0 = nothing waiting
+#if defined(__linux__)
+    struct mmsghdr* messages;
+    struct iovec* iovecs;
+#endif
+    udp_telemetry_stats_t stats;
+};
+
+static udp_packet_t* packet_at(UdpTelemetry* pTelemetry, uint8_t index) {
+    return &pTelemetry->packets[(pTelemetry->first + index) % pTelemetry->config.poolSize];
+}
+
+static void pop_packet(UdpTelemetry* pTelemetry) {
+    pTelemetry->first = (pTelemetry->first + 1) % pTelemetry->config.poolSize;
+    pTelemetry->count--;
+}
+
+// A full socket buffer is retried on the next flush, any other error loses the datagram
+static bool is_transient(int error) {
+    return error == EAGAIN || error == EWOULDBLOCK || error == ENOMEM || error == ENOBUFS;
+}
+
+// Returns the number of packets sent, pLost is set if the one after them failed for good
+#if defined(__linux__)
+static uint8_t send_packets(UdpTelemetry* pTelemetry, uint8_t count, bool* pLost) {
+    for (uint8_t i = 0; i < count; i++) {
+        udp_packet_t* pPacket = packet_at(pTelemetry, i);
+        pTelemetry->iovecs[i].iov_base = pPacket->data;
+        pTelemetry->iovecs[i].iov_len = pPacket->len;
+        memset(&pTelemetry->messages[i], 0, sizeof(struct mmsghdr));
+        pTelemetry->messages[i].msg_hdr.msg_iov = &pTelemetry->iovecs[i];
+        pTelemetry->messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    int sent = sendmmsg(pTelemetry->sock, pTelemetry->messages, count, 0);
+    if (sent < 0) {
+        pTelemetry->stats.sendErrors++;
+        *pLost = !is_transient(errno);
+        return 0;
+    }
+    return (uint8_t)sent;
+}
+#else
+static uint8_t send_packets(UdpTelemetry* pTelemetry, uint8_t count, bool* pLost) {
+    for (uint8_t i = 0; i < count; i++) {
+        udp_packet_t* pPacket = packet_at(pTelemetry, i);
+        if (send(pTelemetry->sock, pPacket->data, pPacket->len, 0) < 0) {
+            pTelemetry->stats.sendErrors++;
+            *pLost = !is_transient(errno);
+            return i;
+        }
+    }
+    return count;
+}
+#endif
+
+/*
+ * @brief Sends the full packets, and the one being filled if includeCurrent is set
+ *
+ *  The packets are sent in one batch, released ones are reused right away.
+ */
+static void flush_packets(UdpTelemetry* pTelemetry, bool includeCurrent) {
+    uint8_t count = pTelemetry->count;
+    if (count > 0 && (!includeCurrent || packet_at(pTelemetry, count - 1)->len == 0)) {
+        count--;
+    }
+    if (count == 0) {
+        return;
+    }
+
+    bool lost = false;
+    uint8_t sent = send_packets(pTelemetry, count, &lost);
+    pTelemetry->stats.datagrams += sent;
+    for (uint8_t i = 0; i < sent + (lost ? 1 : 0); i++) {
+        pop_packet(pTelemetry);
+    }
+    if (pTelemetry->count == 0) {
+        pTelemetry->flushAt_ms = 0;
+    }
+}
+
+UdpTelemetry* udp_telemetry_create(const udp_telemetry_config_t* pConfig) {
+    if (pConfig == NULL || pConfig->hostIP == NULL || pConfig->poolSize < 2
+        || pConfig->mtu <= UDP_TELEMETRY_RECORD_HEADER || pConfig->mtu > UDP_TELEMETRY_MAX_PAYLOAD) {
+        ESP_LOGE(TAG, "Invalid telemetry config");
+        return NULL;
+    }
+    UdpTelemetry* pTelemetry = calloc(1, sizeof(UdpTelemetry));
+    if (pTelemetry == NULL) {
+        return NULL;
+    }
+    pTelemetry->sock = -1;
+    pTelemetry->config = *pConfig;
+    strncpy(pTelemetry->hostIP, pConfig->hostIP, sizeof(pTelemetry->hostIP) - 1);
+    pTelemetry->config.hostIP = pTelemetry->hostIP;
+
+    pTelemetry->storage = malloc((size_t)pConfig->poolSize * pConfig->mtu);
+    pTelemetry->packets = calloc(pConfig->poolSize, sizeof(udp_packet_t));
+#if defined(__linux__)
+    pTelemetry->messages = calloc(pConfig->poolSize, sizeof(struct mmsghdr));
+    pTelemetry->iovecs = calloc(pConfig->poolSize, sizeof(struct iovec));
+    if (pTelemetry->messages == NULL || pTelemetry->iovecs == NULL) {
+        udp_telemetry_destroy(pTelemetry);
+        return NULL;
+    }
+#endif
+    if (pTelemetry->storage == NULL || pTelemetry->packets == NULL) {
+        udp_telemetry_destroy(pTelemetry);
+        return NULL;
+    }
+    for (uint8_t i = 0; i < pConfig->poolSize; i++) {
+        pTelemetry->packets[i].data = &pTelemetry->storage[(size_t)i * pConfig->mtu];
+    }
+
+    struct sockaddr_in dest_addr = { 0 };
+    dest_addr.sin_family = AF_INET;
+    dest_addr.sin_port = htons(pConfig->port);
+    if (inet_pton(AF_INET, pTelemetry->hostIP, &dest_addr.sin_addr) != 1) {
+        ESP_LOGE(TAG, "Invalid IPv4 address: %s", pConfig->hostIP);
+        udp_telemetry_destroy(pTelemetry);
+        return NULL;
+    }
+    pTelemetry->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (pTelemetry->sock < 0) {
+        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+        udp_telemetry_destroy(pTelemetry);
+        return NULL;
+    }
+    fcntl(pTelemetry->sock, F_SETFL, fcntl(pTelemetry->sock, F_GETFL, 0) | O_NONBLOCK);
+    // Connected once, every send skips the route lookup
+    if (connect(pTelemetry->sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) != 0) {
+        ESP_LOGE(TAG, "Socket unable to connect: errno %d", errno);
+        udp_telemetry_destroy(pTelemetry);
+        return NULL;
+    }
+    return pTelemetry;
+}
+
+void udp_telemetry_destroy(UdpTelemetry* pTelemetry) {
+    if (pTelemetry == NULL) {
+        return;
+    }
+    if (pTelemetry->sock >= 0) {
+        close(pTelemetry->sock);
+    }
+#if defined(__linux__)
+    free(pTelemetry->messages);
+    free(pTelemetry->iovecs);
+#endif
+    free(pTelemetry->packets);
+    free(pTelemetry->storage);
+    free(pTelemetry);
+}
+
+/*
+ * @brief Appends one event to the datagram being filled
+ *
+ *  Once all but the current packet of the pool are full, they are sent together.
+ *
+ * @return UDP_TELEMETRY_SUCCESS, or UDP_TELEMETRY_ERROR_FULL if no packet could take the event
+ */
+int udp_telemetry_send(UdpTelemetry* pTelemetry, const uint8_t* data, size_t len, int64_t now_ms) {
+    if (len == 0 || len > UDP_TELEMETRY_MAX_EVENT_SIZE || len + UDP_TELEMETRY_RECORD_HEADER > pTelemetry->config.mtu) {
+        return UDP_TELEMETRY_ERROR_ARGUMENT;
+    }
+    if (pTelemetry->count == 0) {
+        pTelemetry->count = 1;
+        packet_at(pTelemetry, 0)->len = 0;
+    }
+
+    udp_packet_t* pPacket = packet_at(pTelemetry, pTelemetry->count - 1);
+    if (pPacket->len + UDP_TELEMETRY_RECORD_HEADER + len > pTelemetry->config.mtu) {
+        if (pTelemetry->count == pTelemetry->config.poolSize) {
+            flush_packets(pTelemetry, true); // only reached if an earlier batch failed
+            if (pTelemetry->count == pTelemetry->config.poolSize) {
+                pTelemetry->stats.dropped++;
+                return UDP_TELEMETRY_ERROR_FULL;
+            }
+        }
+        if (pTelemetry->count == 0 || packet_at(pTelemetry, pTelemetry->count - 1)->len > 0) {
+            pTelemetry->count++;
+        }
+        pPacket = packet_at(pTelemetry, pTelemetry->count - 1);
+        pPacket->len = 0;
+    }
+
+    pPacket->data[pPacket->len] = (uint8_t)len;
+    memcpy(&pPacket->data[pPacket->len + UDP_TELEMETRY_RECORD_HEADER], data, len);
+    pPacket->len += UDP_TELEMETRY_RECORD_HEADER + len;
+    pTelemetry->stats.events++;
+    if (pTelemetry->flushAt_ms == 0) {
+        pTelemetry->flushAt_ms = now_ms + pTelemetry->config.flushMs;
+    }
+
+    if (pTelemetry->count == pTelemetry->config.poolSize) {
+        flush_packets(pTelemetry, false);
+    }
+    return UDP_TELEMETRY_SUCCESS;
+}
+
+/*
+ * @brief Sends everything waiting once the oldest event reached its deadline
+ *
+ * @return milliseconds until the telemetry wants to be polled again
+ */
+int64_t udp_telemetry_poll(UdpTelemetry* pTelemetry, int64_t now_ms) {
+    if (pTelemetry->flushAt_ms != 0 && now_ms >= pTelemetry->flushAt_ms) {
+        flush_packets(pTelemetry, true);
+        if (pTelemetry->flushAt_ms != 0) {
+            return 1; // the socket buffer was full, try again shortly
+        }
+    }
+    return (pTelemetry->flushAt_ms != 0) ? pTelemetry->flushAt_ms - now_ms : UDP_TELEMETRY_IDLE_POLL_MS;
+}
+
+void udp_telemetry_flush(UdpTelemetry* pTelemetry) {
+    flush_packets(pTelemetry, true);
+}
+
+bool udp_telemetry_matches(const UdpTelemetry* pTelemetry, const char* hostIP, uint16_t port) {
+    return pTelemetry->config.port == port && strcmp(pTelemetry->hostIP, hostIP) == 0;
+}
+
+void udp_telemetry_get_stats(const UdpTelemetry* pTelemetry, udp_telemetry_stats_t* pStats) {
+    *pStats = pTelemetry->stats;
+}
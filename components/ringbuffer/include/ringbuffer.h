@@ -14,7 +14,7 @@
 #define RINGBUFFER_ERROR_FULL           -2
 #define RINGBUFFER_ERROR_OUTOFMEMORY    -3
 
-typedef int32_t RingbufferHandle;
+typedef intptr_t RingbufferHandle; // holds the pointer, also on 64 bit hosts
 
 RingbufferHandle ringbuffer_create(uint32_t size, size_t element_size);
 void ringbuffer_destroy(RingbufferHandle* pRingBufferHandle);
@@ -0,0 +1,523 @@
+#define _GNU_SOURCE // recvmmsg(), accept4()
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include "collector.h"
+#include "column_log.h"
+#include "event_protocol.h"
+
+typedef enum {
+    SOURCE_UDP,
+    SOURCE_LISTEN,
+    SOURCE_TCP,
+    SOURCE_TIMER,
+    SOURCE_SIGNAL,
+} source_type_t;
+
+// epoll data points to one of these, connections start with it
+typedef struct {
+    source_type_t type;
+    int fd;
+} source_t;
+
+/*
+ * A device is identified by its source address. Its clock is unknown, the smallest difference
+ * between arrival and event time seen so far serves as the zero point for the latency.
+ */
+typedef struct {
+    uint32_t id;
+    uint32_t addr;
+    uint16_t port;
+    bool tcp;
+    bool haveSequence;
+    uint16_t nextSequence;
+    bool haveOffset;
+    int64_t minOffset_us;
+    uint64_t frames;
+    uint64_t events;
+    uint64_t lost;              // frames missing in the sequence
+    uint64_t late;              // duplicate or reordered frames
+    uint64_t restarts;
+    uint64_t errors;            // frames failing the CRC or the decoder
+    uint64_t latencySum_us;
+    uint64_t latencyMax_us;
+} device_t;
+
+typedef struct {
+    source_t source;
+    device_t* pDevice;
+    uint8_t* buf;
+    size_t len;
+    size_t cap;
+} tcp_conn_t;
+
+typedef struct {
+    uint64_t frames;
+    uint64_t events;
+    uint64_t lost;
+    uint64_t errors;
+    uint64_t latencySum_us;
+    uint64_t latencyMax_us;
+} interval_stats_t;
+
+static const collector_config_t* gConfig;
+static int gEpoll = -1;
+static ColumnLog* gLog = NULL;
+static device_t** gDevices = NULL;      // by id
+static uint32_t gDeviceCount = 0;
+static device_t** gDeviceTable = NULL;  // open addressing by address
+static uint32_t gDeviceTableSize = 0;
+static interval_stats_t gInterval;
+static interval_stats_t gTotal;
+
+static uint32_t hash_address(uint32_t addr, uint16_t port, bool tcp);
+static bool grow_device_table(void);
+static device_t* get_device(const struct sockaddr_in* pAddr, bool tcp);
+static void track_sequence(device_t* pDevice, uint16_t sequence);
+static bool handle_frame(device_t* pDevice, const uint8_t* frame, size_t len, int64_t now_us);
+static void handle_datagram(device_t* pDevice, const uint8_t* data, size_t len, int64_t now_us);
+static void receive_udp(source_t* pSource);
+static void accept_tcp(source_t* pSource);
+static void close_tcp(tcp_conn_t* pConn);
+static void receive_tcp(tcp_conn_t* pConn);
+static int open_socket(int type, uint16_t port);
+static bool watch(source_t* pSource);
+static void report_interval(uint32_t seconds);
+static void report_devices(void);
+
+// ----- implementation -----
+
+int64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint32_t hash_address(uint32_t addr, uint16_t port, bool tcp) {
+    uint32_t hash = (addr ^ ((uint32_t)port << 16) ^ (tcp ? 0x9E3779B9 : 0)) * 0x85EBCA6B;
+    return hash ^ (hash >> 16);
+}
+
+// Keeps the table at most half full
+bool grow_device_table(void) {
+    uint32_t size = (gDeviceTableSize == 0) ? 256 : gDeviceTableSize * 2;
+    device_t** pTable = calloc(size, sizeof(device_t*));
+    device_t** pDevices = realloc(gDevices, size / 2 * sizeof(device_t*));
+    if (pTable == NULL || pDevices == NULL) {
+        free(pTable);
+        if (pDevices != NULL) {
+            gDevices = pDevices;
+        }
+        return false;
+    }
+    gDevices = pDevices;
+    for (uint32_t i = 0; i < gDeviceCount; i++) {
+        uint32_t slot = hash_address(gDevices[i]->addr, gDevices[i]->port, gDevices[i]->tcp) & (size - 1);
+        while (pTable[slot] != NULL) {
+            slot = (slot + 1) & (size - 1);
+        }
+        pTable[slot] = gDevices[i];
+    }
+    free(gDeviceTable);
+    gDeviceTable = pTable;
+    gDeviceTableSize = size;
+    return true;
+}
+
+device_t* get_device(const struct sockaddr_in* pAddr, bool tcp) {
+    uint32_t addr = ntohl(pAddr->sin_addr.s_addr);
+    uint16_t port = ntohs(pAddr->sin_port);
+    if (gDeviceTableSize != 0) {
+        uint32_t slot = hash_address(addr, port, tcp) & (gDeviceTableSize - 1);
+        for (; gDeviceTable[slot] != NULL; slot = (slot + 1) & (gDeviceTableSize - 1)) {
+            device_t* pDevice = gDeviceTable[slot];
+            if (pDevice->addr == addr && pDevice->port == port && pDevice->tcp == tcp) {
+                return pDevice;
+            }
+        }
+    }
+
+    if ((gDeviceCount + 1) * 2 > gDeviceTableSize && !grow_device_table()) {
+        return NULL;
+    }
+    device_t* pDevice = calloc(1, sizeof(device_t));
+    if (pDevice == NULL) {
+        return NULL;
+    }
+    pDevice->id = gDeviceCount;
+    pDevice->addr = addr;
+    pDevice->port = port;
+    pDevice->tcp = tcp;
+    gDevices[gDeviceCount++] = pDevice;
+    uint32_t slot = hash_address(addr, port, tcp) & (gDeviceTableSize - 1);
+    while (gDeviceTable[slot] != NULL) {
+        slot = (slot + 1) & (gDeviceTableSize - 1);
+    }
+    gDeviceTable[slot] = pDevice;
+    return pDevice;
+}
+
+/*
+ * Sequence numbers wrap at 16 bits. A restarted device, or a new one behind a reused address,
+ * starts a new sequence and keeps its statistics.
+ */
+void track_sequence(device_t* pDevice, uint16_t sequence) {
+    if (pDevice->haveSequence) {
+        int16_t distance = (int16_t)(sequence - pDevice->nextSequence);
+        if (distance > COLLECTOR_MAX_SEQUENCE_GAP || distance < -COLLECTOR_MAX_SEQUENCE_GAP) {
+            pDevice->restarts++;
+            pDevice->haveOffset = false; // a new boot, a new clock
+            distance = 0;
+        } else if (distance < 0) {
+            pDevice->late++;
+            return;
+        }
+        pDevice->lost += (uint16_t)distance;
+        gInterval.lost += (uint16_t)distance;
+    }
+    pDevice->haveSequence = true;
+    pDevice->nextSequence = sequence + 1;
+}
+
+bool handle_frame(device_t* pDevice, const uint8_t* frame, size_t len, int64_t now_us) {
+    event_decoder_t decoder;
+    if (event_decoder_begin(&decoder, frame, len) != EVENT_PROTOCOL_SUCCESS) {
+        return false;
+    }
+    track_sequence(pDevice, decoder.header.sequence);
+    pDevice->frames++;
+    gInterval.frames++;
+
+    event_protocol_event_t event;
+    int ret;
+    while ((ret = event_decoder_next(&decoder, &event)) == EVENT_PROTOCOL_SUCCESS) {
+        int64_t offset_us = now_us - (int64_t)event.timestamp_us;
+        if (!pDevice->haveOffset || offset_us < pDevice->minOffset_us) {
+            pDevice->minOffset_us = offset_us;
+            pDevice->haveOffset = true;
+        }
+        uint64_t latency_us = (uint64_t)(offset_us - pDevice->minOffset_us);
+        pDevice->events++;
+        pDevice->latencySum_us += latency_us;
+        if (latency_us > pDevice->latencyMax_us) {
+            pDevice->latencyMax_us = latency_us;
+        }
+        gInterval.events++;
+        gInterval.latencySum_us += latency_us;
+        if (latency_us > gInterval.latencyMax_us) {
+            gInterval.latencyMax_us = latency_us;
+        }
+
+        if (gLog != NULL) {
+            const column_log_row_t row = {
+                .device = pDevice->id,
+                .sequence = decoder.header.sequence,
+                .type = event.type,
+                .timestamp_us = event.timestamp_us,
+                .latency_us = latency_us,
+                .size = event.size,
+                .payload = event.payload,
+            };
+            column_log_append(gLog, &row);
+        }
+    }
+    if (ret != EVENT_PROTOCOL_END) {
+        pDevice->errors++;
+        gInterval.errors++;
+    }
+    return true;
+}
+
+/*
+ * @brief A datagram holds one frame, or several as [length][frame] records when the device batches
+ *  them with its telemetry sender
+ */
+void handle_datagram(device_t* pDevice, const uint8_t* data, size_t len, int64_t now_us) {
+    size_t frameSize;
+    if (event_protocol_frame_size(data, len, &frameSize) == EVENT_PROTOCOL_SUCCESS && frameSize == len
+        && handle_frame(pDevice, data, len, now_us)) {
+        return;
+    }
+
+    size_t pos = 0;
+    while (pos < len && data[pos] != 0 && data[pos] <= len - pos - 1) {
+        pos += 1 + data[pos];
+    }
+    if (len == 0 || pos != len) {
+        pDevice->errors++;
+        gInterval.errors++;
+        return;
+    }
+    for (pos = 0; pos < len; pos += 1 + data[pos]) {
+        if (!handle_frame(pDevice, &data[pos + 1], data[pos], now_us)) {
+            pDevice->errors++;
+            gInterval.errors++;
+        }
+    }
+}
+
+void receive_udp(source_t* pSource) {
+    static uint8_t buffers[COLLECTOR_UDP_BATCH][UINT16_MAX];
+    static struct sockaddr_in addrs[COLLECTOR_UDP_BATCH];
+    static struct iovec iovecs[COLLECTOR_UDP_BATCH];
+    static struct mmsghdr messages[COLLECTOR_UDP_BATCH];
+
+    for (int i = 0; i < COLLECTOR_UDP_BATCH; i++) {
+        iovecs[i].iov_base = buffers[i];
+        iovecs[i].iov_len = sizeof(buffers[i]);
+        memset(&messages[i], 0, sizeof(messages[i]));
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        messages[i].msg_hdr.msg_name = &addrs[i];
+        messages[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+    }
+    int count = recvmmsg(pSource->fd, messages, COLLECTOR_UDP_BATCH, MSG_DONTWAIT, NULL);
+    int64_t now_us = monotonic_us();
+    for (int i = 0; i < count; i++) {
+        device_t* pDevice = get_device(&addrs[i], false);
+        if (pDevice != NULL) {
+            handle_datagram(pDevice, buffers[i], messages[i].msg_len, now_us);
+        }
+    }
+}
+
+void accept_tcp(source_t* pSource) {
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    int fd;
+    while ((fd = accept4(pSource->fd, (struct sockaddr*)&addr, &addrLen, SOCK_NONBLOCK)) >= 0) {
+        tcp_conn_t* pConn = calloc(1, sizeof(tcp_conn_t));
+        uint8_t* buf = malloc(COLLECTOR_TCP_BUFFER_SIZE);
+        device_t* pDevice = get_device(&addr, true);
+        if (pConn == NULL || buf == NULL || pDevice == NULL) {
+            free(pConn);
+            free(buf);
+            close(fd);
+            continue;
+        }
+        pConn->source.type = SOURCE_TCP;
+        pConn->source.fd = fd;
+        pConn->pDevice = pDevice;
+        pConn->buf = buf;
+        pConn->cap = COLLECTOR_TCP_BUFFER_SIZE;
+        if (!watch(&pConn->source)) {
+            close_tcp(pConn);
+        }
+        addrLen = sizeof(addr);
+    }
+}
+
+void close_tcp(tcp_conn_t* pConn) {
+    epoll_ctl(gEpoll, EPOLL_CTL_DEL, pConn->source.fd, NULL);
+    close(pConn->source.fd);
+    free(pConn->buf);
+    free(pConn);
+}
+
+// Frames arrive as a byte stream, the header tells how much of the next frame is missing
+void receive_tcp(tcp_conn_t* pConn) {
+    ssize_t received = recv(pConn->source.fd, &pConn->buf[pConn->len], pConn->cap - pConn->len, 0);
+    if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        close_tcp(pConn);
+        return;
+    }
+    if (received < 0) {
+        return;
+    }
+    pConn->len += (size_t)received;
+
+    int64_t now_us = monotonic_us();
+    size_t pos = 0;
+    while (true) {
+        size_t frameSize;
+        int ret = event_protocol_frame_size(&pConn->buf[pos], pConn->len - pos, &frameSize);
+        if (ret == EVENT_PROTOCOL_ERROR_VERSION) {
+            pConn->pDevice->errors++; // lost track of the frame boundaries, the device reconnects
+            gInterval.errors++;
+            close_tcp(pConn);
+            return;
+        }
+        if (ret == EVENT_PROTOCOL_ERROR_INCOMPLETE || frameSize > pConn->len - pos) {
+            break;
+        }
+        if (!handle_frame(pConn->pDevice, &pConn->buf[pos], frameSize, now_us)) {
+            pConn->pDevice->errors++;
+            gInterval.errors++;
+        }
+        pos += frameSize;
+    }
+    memmove(pConn->buf, &pConn->buf[pos], pConn->len - pos);
+    pConn->len -= pos;
+
+    size_t frameSize;
+    if (event_protocol_frame_size(pConn->buf, pConn->len, &frameSize) == EVENT_PROTOCOL_SUCCESS && frameSize > pConn->cap) {
+        uint8_t* buf = realloc(pConn->buf, frameSize);
+        if (buf == NULL) {
+            close_tcp(pConn);
+            return;
+        }
+        pConn->buf = buf;
+        pConn->cap = frameSize;
+    }
+}
+
+int open_socket(int type, uint16_t port) {
+    int fd = socket(AF_INET, type | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (type == SOCK_DGRAM) {
+        int size = 4 * 1024 * 1024; // bursts from hundreds of devices
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || (type == SOCK_STREAM && listen(fd, SOMAXCONN) != 0)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool watch(source_t* pSource) {
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = pSource };
+    return epoll_ctl(gEpoll, EPOLL_CTL_ADD, pSource->fd, &event) == 0;
+}
+
+void report_interval(uint32_t seconds) {
+    gTotal.frames += gInterval.frames;
+    gTotal.events += gInterval.events;
+    gTotal.lost += gInterval.lost;
+    gTotal.errors += gInterval.errors;
+    gTotal.latencySum_us += gInterval.latencySum_us;
+    if (gInterval.latencyMax_us > gTotal.latencyMax_us) {
+        gTotal.latencyMax_us = gInterval.latencyMax_us;
+    }
+    printf("devices %" PRIu32 "  frames/s %.0f  events/s %.0f  lost %" PRIu64 "  errors %" PRIu64 "  latency avg %.0f us max %" PRIu64 " us\n",
+        gDeviceCount, (double)gInterval.frames / seconds, (double)gInterval.events / seconds, gInterval.lost, gInterval.errors,
+        (gInterval.events > 0) ? (double)gInterval.latencySum_us / gInterval.events : 0.0, gInterval.latencyMax_us);
+    fflush(stdout);
+    memset(&gInterval, 0, sizeof(gInterval));
+}
+
+void report_devices(void) {
+    printf("%6s %-21s %4s %10s %10s %8s %8s %8s %8s %10s %10s\n", "id", "address", "tr", "frames", "events", "lost", "late", "restarts", "errors", "avg us", "max us");
+    for (uint32_t i = 0; i < gDeviceCount; i++) {
+        const device_t* pDevice = gDevices[i];
+        char address[32];
+        struct in_addr addr = { .s_addr = htonl(pDevice->addr) };
+        snprintf(address, sizeof(address), "%s:%u", inet_ntoa(addr), pDevice->port);
+        printf("%6" PRIu32 " %-21s %4s %10" PRIu64 " %10" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %10.0f %10" PRIu64 "\n",
+            pDevice->id, address, pDevice->tcp ? "tcp" : "udp", pDevice->frames, pDevice->events, pDevice->lost, pDevice->late, pDevice->restarts, pDevice->errors,
+            (pDevice->events > 0) ? (double)pDevice->latencySum_us / pDevice->events : 0.0, pDevice->latencyMax_us);
+    }
+}
+
+/*
+ * @brief Receives frames on UDP and TCP until interrupted, all sockets are served by one epoll loop
+ *
+ * @return 0 on a clean shutdown, 1 if a socket could not be set up
+ */
+int collector_run(const collector_config_t* pConfig) {
+    gConfig = pConfig;
+    gEpoll = epoll_create1(0);
+    if (gEpoll < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    source_t udp = { SOURCE_UDP, -1 };
+    source_t listener = { SOURCE_LISTEN, -1 };
+    source_t timer = { SOURCE_TIMER, timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK) };
+    source_t signals = { SOURCE_SIGNAL, -1 };
+    if (pConfig->udpPort != 0 && ((udp.fd = open_socket(SOCK_DGRAM, pConfig->udpPort)) < 0 || !watch(&udp))) {
+        fprintf(stderr, "Unable to receive on UDP port %u: %s\n", pConfig->udpPort, strerror(errno));
+        return 1;
+    }
+    if (pConfig->tcpPort != 0 && ((listener.fd = open_socket(SOCK_STREAM, pConfig->tcpPort)) < 0 || !watch(&listener))) {
+        fprintf(stderr, "Unable to listen on TCP port %u: %s\n", pConfig->tcpPort, strerror(errno));
+        return 1;
+    }
+    struct itimerspec interval = { { pConfig->reportInterval_s, 0 }, { pConfig->reportInterval_s, 0 } };
+    if (timer.fd < 0 || timerfd_settime(timer.fd, 0, &interval, NULL) != 0 || !watch(&timer)) {
+        perror("timerfd");
+        return 1;
+    }
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    signals.fd = signalfd(-1, &mask, SFD_NONBLOCK);
+    if (signals.fd < 0 || !watch(&signals)) {
+        perror("signalfd");
+        return 1;
+    }
+    if (pConfig->logPath != NULL && (gLog = column_log_open(pConfig->logPath)) == NULL) {
+        fprintf(stderr, "Unable to open log %s: %s\n", pConfig->logPath, strerror(errno));
+        return 1;
+    }
+    printf("Collecting on UDP port %u, TCP port %u\n", pConfig->udpPort, pConfig->tcpPort);
+    fflush(stdout);
+
+    int64_t end_us = (pConfig->duration_s != 0) ? monotonic_us() + (int64_t)pConfig->duration_s * 1000000 : 0;
+    bool running = true;
+    while (running) {
+        struct epoll_event events[COLLECTOR_MAX_EPOLL_EVENTS];
+        int timeout_ms = (end_us != 0) ? (int)((end_us - monotonic_us()) / 1000) : -1;
+        if (end_us != 0 && timeout_ms <= 0) {
+            break;
+        }
+        int count = epoll_wait(gEpoll, events, COLLECTOR_MAX_EPOLL_EVENTS, timeout_ms);
+        for (int i = 0; i < count; i++) {
+            source_t* pSource = events[i].data.ptr;
+            switch (pSource->type) {
+                case SOURCE_UDP:
+                    receive_udp(pSource);
+                    break;
+                case SOURCE_LISTEN:
+                    accept_tcp(pSource);
+                    break;
+                case SOURCE_TCP:
+                    receive_tcp((tcp_conn_t*)pSource);
+                    break;
+                case SOURCE_TIMER: {
+                    uint64_t expirations;
+                    if (read(pSource->fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                        report_interval(pConfig->reportInterval_s * (uint32_t)expirations);
+                    }
+                    break;
+                }
+                case SOURCE_SIGNAL:
+                    running = false;
+                    break;
+            }
+        }
+    }
+
+    report_interval(pConfig->reportInterval_s);
+    printf("total: devices %" PRIu32 "  frames %" PRIu64 "  events %" PRIu64 "  lost %" PRIu64 "  errors %" PRIu64 "  latency avg %.0f us max %" PRIu64 " us\n",
+        gDeviceCount, gTotal.frames, gTotal.events, gTotal.lost, gTotal.errors,
+        (gTotal.events > 0) ? (double)gTotal.latencySum_us / gTotal.events : 0.0, gTotal.latencyMax_us);
+    if (pConfig->perDeviceReport) {
+        report_devices();
+    }
+    column_log_close(gLog);
+    return 0;
+}
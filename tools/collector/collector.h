@@ -0,0 +1,43 @@
+#ifndef COLLECTOR_H
+#define COLLECTOR_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define COLLECTOR_DEFAULT_PORT      15651   // CONFIG_PORT of the firmware
+#define COLLECTOR_UDP_BATCH         64      // datagrams per recvmmsg() call
+#define COLLECTOR_TCP_BUFFER_SIZE   4096    // grows up to one full frame
+#define COLLECTOR_MAX_EPOLL_EVENTS  64
+#define COLLECTOR_MAX_SEQUENCE_GAP  1000    // larger jumps mean the device restarted
+
+typedef struct {
+    uint16_t udpPort;           // 0 = no UDP socket
+    uint16_t tcpPort;           // 0 = no TCP listener
+    const char* logPath;        // NULL = no log
+    uint32_t reportInterval_s;
+    uint32_t duration_s;        // 0 = until interrupted
+    bool perDeviceReport;
+} collector_config_t;
+
+typedef enum {
+    LOADGEN_UDP,                // one frame per datagram on a long-lived socket
+    LOADGEN_TELEMETRY,          // frames batched into datagrams, like packetsender_sendTelemetry()
+    LOADGEN_TCP,                // persistent connection with TCP_NODELAY, like packetsender_sendTCP()
+    LOADGEN_TCP_BULK,           // coalescing connection, like packetsender_sendTCP_bulk()
+} loadgen_transport_t;
+
+typedef struct {
+    const char* hostIP;
+    uint16_t port;
+    loadgen_transport_t transport;
+    uint32_t devices;
+    double framesPerSecond;     // per device
+    uint8_t eventsPerFrame;
+    uint32_t duration_s;        // 0 = until interrupted
+} loadgen_config_t;
+
+int collector_run(const collector_config_t* pConfig);
+int loadgen_run(const loadgen_config_t* pConfig);
+int64_t monotonic_us(void);
+
+#endif // COLLECTOR_H
@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "column_log.h"
+#include "event_protocol.h"
+
+enum { COL_DEVICE, COL_SEQUENCE, COL_TYPE, COL_TIMESTAMP, COL_LATENCY, COL_SIZE, COL_PAYLOAD };
+
+// Largest encoding of one row per column
+static const size_t gColumnMax[COLUMN_LOG_COLUMNS] = { 5, 3, 1, EVENT_PROTOCOL_MAX_VARINT_SIZE, EVENT_PROTOCOL_MAX_VARINT_SIZE, 1, EVENT_PROTOCOL_MAX_PAYLOAD };
+static const char gMagic[4] = { 'E', 'V', 'L', 'G' };
+
+struct _ColumnLog_ {
+    FILE* file;
+    uint32_t rows;
+    int64_t lastTimestamp_us;
+    uint8_t* columns[COLUMN_LOG_COLUMNS];
+    size_t used[COLUMN_LOG_COLUMNS];
+};
+
+static void put_u32(uint8_t* buf, uint32_t value);
+static uint32_t get_u32(const uint8_t* buf);
+static uint64_t zigzag(int64_t value);
+static int64_t unzigzag(uint64_t value);
+static void put_varint(ColumnLog* pLog, int column, uint64_t value);
+
+// ----- implementation -----
+
+void put_u32(uint8_t* buf, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        buf[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+uint32_t get_u32(const uint8_t* buf) {
+    return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+// Small negative and positive differences both become small varints
+uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+void put_varint(ColumnLog* pLog, int column, uint64_t value) {
+    pLog->used[column] += event_protocol_put_varint(&pLog->columns[column][pLog->used[column]], gColumnMax[column], value);
+}
+
+ColumnLog* column_log_open(const char* path) {
+    ColumnLog* pLog = calloc(1, sizeof(ColumnLog));
+    if (pLog == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < COLUMN_LOG_COLUMNS; i++) {
+        pLog->columns[i] = malloc(COLUMN_LOG_BLOCK_ROWS * gColumnMax[i]);
+        if (pLog->columns[i] == NULL) {
+            column_log_close(pLog);
+            return NULL;
+        }
+    }
+    pLog->file = fopen(path, "wb");
+    if (pLog->file == NULL) {
+        column_log_close(pLog);
+        return NULL;
+    }
+    const uint8_t version = COLUMN_LOG_VERSION;
+    fwrite(gMagic, sizeof(gMagic), 1, pLog->file);
+    fwrite(&version, 1, 1, pLog->file);
+    return pLog;
+}
+
+bool column_log_append(ColumnLog* pLog, const column_log_row_t* pRow) {
+    put_varint(pLog, COL_DEVICE, pRow->device);
+    put_varint(pLog, COL_SEQUENCE, pRow->sequence);
+    pLog->columns[COL_TYPE][pLog->used[COL_TYPE]++] = pRow->type;
+    put_varint(pLog, COL_TIMESTAMP, zigzag((int64_t)pRow->timestamp_us - pLog->lastTimestamp_us));
+    put_varint(pLog, COL_LATENCY, pRow->latency_us);
+    pLog->columns[COL_SIZE][pLog->used[COL_SIZE]++] = pRow->size;
+    memcpy(&pLog->columns[COL_PAYLOAD][pLog->used[COL_PAYLOAD]], pRow->payload, pRow->size);
+    pLog->used[COL_PAYLOAD] += pRow->size;
+    pLog->lastTimestamp_us = (int64_t)pRow->timestamp_us;
+
+    if (++pLog->rows == COLUMN_LOG_BLOCK_ROWS) {
+        return column_log_flush(pLog);
+    }
+    return true;
+}
+
+// Writes the rows collected so far as one block
+bool column_log_flush(ColumnLog* pLog) {
+    if (pLog->rows == 0) {
+        return true;
+    }
+    uint8_t header[4 * (1 + COLUMN_LOG_COLUMNS)];
+    put_u32(header, pLog->rows);
+    for (int i = 0; i < COLUMN_LOG_COLUMNS; i++) {
+        put_u32(&header[4 * (i + 1)], (uint32_t)pLog->used[i]);
+    }
+    bool ok = fwrite(header, sizeof(header), 1, pLog->file) == 1;
+    for (int i = 0; i < COLUMN_LOG_COLUMNS; i++) {
+        ok = ok && fwrite(pLog->columns[i], 1, pLog->used[i], pLog->file) == pLog->used[i];
+        pLog->used[i] = 0;
+    }
+    pLog->rows = 0;
+    pLog->lastTimestamp_us = 0;
+    return fflush(pLog->file) == 0 && ok;
+}
+
+void column_log_close(ColumnLog* pLog) {
+    if (pLog == NULL) {
+        return;
+    }
+    if (pLog->file != NULL) {
+        column_log_flush(pLog);
+        fclose(pLog->file);
+    }
+    for (int i = 0; i < COLUMN_LOG_COLUMNS; i++) {
+        free(pLog->columns[i]);
+    }
+    free(pLog);
+}
+
+/*
+ * @brief Prints a log as CSV, one line per event
+ *
+ * @return 0, or -1 if the file can't be read or is damaged
+ */
+int column_log_dump(const char* path, FILE* out) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+    uint8_t magic[5];
+    if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, gMagic, sizeof(gMagic)) != 0 || magic[4] != COLUMN_LOG_VERSION) {
+        fclose(file);
+        return -1;
+    }
+
+    fprintf(out, "device,sequence,type,timestamp_us,latency_us,payload\n");
+    int ret = 0;
+    uint8_t header[4 * (1 + COLUMN_LOG_COLUMNS)];
+    while (ret == 0 && fread(header, sizeof(header), 1, file) == 1) {
+        uint32_t rows = get_u32(header);
+        uint8_t* columns[COLUMN_LOG_COLUMNS] = { 0 };
+        size_t sizes[COLUMN_LOG_COLUMNS];
+        size_t pos[COLUMN_LOG_COLUMNS] = { 0 };
+        for (int i = 0; i < COLUMN_LOG_COLUMNS && ret == 0; i++) {
+            sizes[i] = get_u32(&header[4 * (i + 1)]);
+            columns[i] = malloc(sizes[i] + 1);
+            if (columns[i] == NULL || fread(columns[i], 1, sizes[i], file) != sizes[i]) {
+                ret = -1;
+            }
+        }
+
+        int64_t timestamp_us = 0;
+        for (uint32_t row = 0; row < rows && ret == 0; row++) {
+            uint64_t values[COLUMN_LOG_COLUMNS];
+            const int varints[] = { COL_DEVICE, COL_SEQUENCE, COL_TIMESTAMP, COL_LATENCY };
+            for (size_t v = 0; v < sizeof(varints) / sizeof(varints[0]); v++) {
+                int c = varints[v];
+                size_t len = event_protocol_get_varint(&columns[c][pos[c]], sizes[c] - pos[c], &values[c]);
+                pos[c] += len;
+                ret = (len == 0) ? -1 : ret;
+            }
+            if (ret != 0 || pos[COL_TYPE] >= sizes[COL_TYPE] || pos[COL_SIZE] >= sizes[COL_SIZE]) {
+                ret = -1;
+                break;
+            }
+            uint8_t type = columns[COL_TYPE][pos[COL_TYPE]++];
+            uint8_t size = columns[COL_SIZE][pos[COL_SIZE]++];
+            if (size > sizes[COL_PAYLOAD] - pos[COL_PAYLOAD]) {
+                ret = -1;
+                break;
+            }
+            timestamp_us += unzigzag(values[COL_TIMESTAMP]);
+            fprintf(out, "%" PRIu64 ",%" PRIu64 ",%u,%" PRId64 ",%" PRIu64 ",", values[COL_DEVICE], values[COL_SEQUENCE], type, timestamp_us, values[COL_LATENCY]);
+            for (uint8_t i = 0; i < size; i++) {
+                fprintf(out, "%02x", columns[COL_PAYLOAD][pos[COL_PAYLOAD]++]);
+            }
+            fputc('\n', out);
+        }
+        for (int i = 0; i < COLUMN_LOG_COLUMNS; i++) {
+            free(columns[i]);
+        }
+    }
+    fclose(file);
+    return ret;
+}
@@ -0,0 +1,44 @@
+#ifndef COLUMN_LOG_H
+#define COLUMN_LOG_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+// Compact columnar log of received events. Rows are collected into blocks, each column of a block
+// is stored contiguously so similar values sit next to each other and compress well.
+//
+// File:   "EVLG" [version]
+// Block:  [rows:32] COLUMN_LOG_COLUMNS * [bytes:32], then the columns in this order:
+//           device id      varint
+//           sequence       varint
+//           event type     byte
+//           timestamp      zigzag varint, difference to the previous row of the block in us
+//           latency        varint, us
+//           payload size   byte
+//           payloads       concatenated
+// All fixed size fields little-endian.
+
+#define COLUMN_LOG_VERSION      1
+#define COLUMN_LOG_BLOCK_ROWS   4096
+#define COLUMN_LOG_COLUMNS      7
+
+typedef struct {
+    uint32_t device;
+    uint16_t sequence;
+    uint8_t type;
+    uint64_t timestamp_us;
+    uint64_t latency_us;
+    uint8_t size;
+    const uint8_t* payload;
+} column_log_row_t;
+
+typedef struct _ColumnLog_ ColumnLog;
+
+ColumnLog* column_log_open(const char* path);
+bool column_log_append(ColumnLog* pLog, const column_log_row_t* pRow);
+bool column_log_flush(ColumnLog* pLog);
+void column_log_close(ColumnLog* pLog);
+int column_log_dump(const char* path, FILE* out);
+
+#endif // COLUMN_LOG_H
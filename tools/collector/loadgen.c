@@ -0,0 +1,279 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "collector.h"
+#include "event_protocol.h"
+#include "tcp_channel.h"
+#include "udp_telemetry.h"
+
+// Same settings as the firmware defaults in Kconfig
+#define LOADGEN_UDP_MTU             1472
+#define LOADGEN_UDP_FLUSH_MS        100
+#define LOADGEN_UDP_POOL_SIZE       4
+#define LOADGEN_TCP_BUFFER_SIZE     2048
+#define LOADGEN_TCP_COALESCE_MS     50
+#define LOADGEN_FRAME_BUFFER_SIZE   1400
+
+// A simulated device, sending through the same code the firmware uses
+typedef struct {
+    int sock;                   // LOADGEN_UDP
+    UdpTelemetry* pTelemetry;   // LOADGEN_TELEMETRY
+    TcpChannel* pChannel;       // LOADGEN_TCP, LOADGEN_TCP_BULK
+    int64_t boot_us;            // devices stamp events with the time since their boot
+    int64_t next_us;
+    uint16_t sequence;
+    uint8_t buttonState;
+} sim_device_t;
+
+typedef struct {
+    uint64_t frames;
+    uint64_t events;
+    uint64_t dropped;
+} loadgen_stats_t;
+
+static volatile sig_atomic_t gStop = 0;
+
+static void on_signal(int signal);
+static bool open_device(sim_device_t* pDevice, const loadgen_config_t* pConfig);
+static void close_device(sim_device_t* pDevice);
+static void send_frame(sim_device_t* pDevice, const loadgen_config_t* pConfig, int64_t period_us, int64_t now_us, loadgen_stats_t* pStats);
+static int64_t poll_device(sim_device_t* pDevice, int64_t now_ms);
+
+// ----- implementation -----
+
+void on_signal(int signal) {
+    (void)signal;
+    gStop = 1;
+}
+
+bool open_device(sim_device_t* pDevice, const loadgen_config_t* pConfig) {
+    memset(pDevice, 0, sizeof(*pDevice));
+    pDevice->sock = -1;
+    pDevice->boot_us = (int64_t)(rand() % 3600) * 1000000;
+    pDevice->sequence = (uint16_t)rand();
+
+    switch (pConfig->transport) {
+        case LOADGEN_UDP: {
+            struct sockaddr_in addr = { 0 };
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(pConfig->port);
+            if (inet_pton(AF_INET, pConfig->hostIP, &addr.sin_addr) != 1) {
+                return false;
+            }
+            pDevice->sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+            return pDevice->sock >= 0 && connect(pDevice->sock, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+        }
+        case LOADGEN_TELEMETRY: {
+            const udp_telemetry_config_t config = {
+                .hostIP = pConfig->hostIP,
+                .port = pConfig->port,
+                .mtu = LOADGEN_UDP_MTU,
+                .flushMs = LOADGEN_UDP_FLUSH_MS,
+                .poolSize = LOADGEN_UDP_POOL_SIZE,
+            };
+            pDevice->pTelemetry = udp_telemetry_create(&config);
+            return pDevice->pTelemetry != NULL;
+        }
+        case LOADGEN_TCP:
+        case LOADGEN_TCP_BULK: {
+            const tcp_channel_config_t config = {
+                .hostIP = pConfig->hostIP,
+                .port = pConfig->port,
+                .mode = (pConfig->transport == LOADGEN_TCP) ? TCP_CHANNEL_LOW_LATENCY : TCP_CHANNEL_BULK,
+                .bufferSize = LOADGEN_TCP_BUFFER_SIZE,
+                .coalesceMs = LOADGEN_TCP_COALESCE_MS,
+                .connectTimeoutMs = 5000,
+                .backoffBaseMs = 500,
+                .backoffMaxMs = 30000,
+            };
+            pDevice->pChannel = tcp_channel_create(&config);
+            return pDevice->pChannel != NULL;
+        }
+    }
+    return false;
+}
+
+void close_device(sim_device_t* pDevice) {
+    if (pDevice->sock >= 0) {
+        close(pDevice->sock);
+    }
+    udp_telemetry_destroy(pDevice->pTelemetry);
+    tcp_channel_destroy(pDevice->pChannel);
+}
+
+// Button events spread over the last period, as a batching device would collect them
+void send_frame(sim_device_t* pDevice, const loadgen_config_t* pConfig, int64_t period_us, int64_t now_us, loadgen_stats_t* pStats) {
+    uint8_t frame[LOADGEN_FRAME_BUFFER_SIZE];
+    size_t size = (pConfig->transport == LOADGEN_TELEMETRY) ? UDP_TELEMETRY_MAX_EVENT_SIZE : sizeof(frame);
+    event_encoder_t encoder;
+    event_encoder_begin(&encoder, frame, size, pDevice->sequence++);
+    for (uint8_t i = 0; i < pConfig->eventsPerFrame; i++) {
+        pDevice->buttonState ^= 1;
+        const uint8_t payload[] = { 1 + (i & 1), pDevice->buttonState };
+        int64_t timestamp_us = now_us - pDevice->boot_us - period_us * (pConfig->eventsPerFrame - 1 - i) / pConfig->eventsPerFrame;
+        if (event_encoder_add(&encoder, EVENT_TYPE_BUTTON, (uint64_t)timestamp_us, payload, sizeof(payload)) != EVENT_PROTOCOL_SUCCESS) {
+            break;
+        }
+    }
+    size_t frameSize;
+    event_encoder_finish(&encoder, &frameSize);
+
+    int ret = 0;
+    int64_t now_ms = now_us / 1000;
+    switch (pConfig->transport) {
+        case LOADGEN_UDP:
+            ret = (send(pDevice->sock, frame, frameSize, 0) < 0) ? -1 : 0;
+            break;
+        case LOADGEN_TELEMETRY:
+            ret = udp_telemetry_send(pDevice->pTelemetry, frame, frameSize, now_ms);
+            break;
+        case LOADGEN_TCP:
+        case LOADGEN_TCP_BULK:
+            ret = tcp_channel_send(pDevice->pChannel, frame, frameSize, now_ms);
+            break;
+    }
+    if (ret != 0) {
+        pStats->dropped++;
+    } else {
+        pStats->frames++;
+        pStats->events += encoder.count;
+    }
+}
+
+int64_t poll_device(sim_device_t* pDevice, int64_t now_ms) {
+    if (pDevice->pTelemetry != NULL) {
+        return udp_telemetry_poll(pDevice->pTelemetry, now_ms);
+    }
+    if (pDevice->pChannel != NULL) {
+        return tcp_channel_poll(pDevice->pChannel, now_ms);
+    }
+    return INT64_MAX;
+}
+
+/*
+ * @brief Simulates many devices sending button events at a fixed rate
+ *
+ *  All devices share one thread, which sleeps until the next frame or channel deadline is due.
+ */
+int loadgen_run(const loadgen_config_t* pConfig) {
+    sim_device_t* pDevices = calloc(pConfig->devices, sizeof(sim_device_t));
+    if (pDevices == NULL || pConfig->framesPerSecond <= 0 || pConfig->eventsPerFrame == 0) {
+        free(pDevices);
+        fprintf(stderr, "Invalid load generator configuration\n");
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    int64_t period_us = (int64_t)(1000000 / pConfig->framesPerSecond);
+    int64_t start_us = monotonic_us();
+    for (uint32_t i = 0; i < pConfig->devices; i++) {
+        if (!open_device(&pDevices[i], pConfig)) {
+            fprintf(stderr, "Unable to open device %" PRIu32 ": %s\n", i, strerror(errno));
+            for (uint32_t j = 0; j <= i; j++) {
+                close_device(&pDevices[j]);
+            }
+            free(pDevices);
+            return 1;
+        }
+        pDevices[i].next_us = start_us + period_us * i / pConfig->devices; // spread the devices over one period
+    }
+    printf("Simulating %" PRIu32 " devices, %.1f frames/s each with %u events, to %s:%u\n",
+        pConfig->devices, pConfig->framesPerSecond, pConfig->eventsPerFrame, pConfig->hostIP, pConfig->port);
+    fflush(stdout);
+
+    loadgen_stats_t stats = { 0 };
+    loadgen_stats_t last = { 0 };
+    int64_t end_us = (pConfig->duration_s != 0) ? start_us + (int64_t)pConfig->duration_s * 1000000 : INT64_MAX;
+    int64_t report_us = start_us + 1000000;
+    while (!gStop) {
+        int64_t now_us = monotonic_us();
+        if (now_us >= end_us) {
+            break;
+        }
+        int64_t wake_us = end_us;
+        for (uint32_t i = 0; i < pConfig->devices; i++) {
+            sim_device_t* pDevice = &pDevices[i];
+            while (pDevice->next_us <= now_us) {
+                send_frame(pDevice, pConfig, period_us, now_us, &stats);
+                pDevice->next_us += period_us;
+            }
+            int64_t poll_ms = poll_device(pDevice, now_us / 1000);
+            if (poll_ms != INT64_MAX && now_us + poll_ms * 1000 < wake_us) {
+                wake_us = now_us + poll_ms * 1000;
+            }
+            if (pDevice->next_us < wake_us) {
+                wake_us = pDevice->next_us;
+            }
+        }
+        if (now_us >= report_us) {
+            printf("frames/s %" PRIu64 "  events/s %" PRIu64 "  dropped %" PRIu64 "\n",
+                stats.frames - last.frames, stats.events - last.events, stats.dropped - last.dropped);
+            fflush(stdout);
+            last = stats;
+            report_us += 1000000;
+        }
+        if (report_us < wake_us) {
+            wake_us = report_us;
+        }
+        int64_t sleep_us = wake_us - monotonic_us();
+        if (sleep_us > 0) {
+            struct timespec ts = { sleep_us / 1000000, (sleep_us % 1000000) * 1000 };
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    // Whatever is still batched or buffered gets up to a second to leave
+    int64_t drainEnd_us = monotonic_us() + 1000000;
+    bool pending = true;
+    while (pending && monotonic_us() < drainEnd_us) {
+        pending = false;
+        int64_t now_ms = monotonic_us() / 1000 + LOADGEN_TCP_COALESCE_MS; // no more waiting for coalescing
+        for (uint32_t i = 0; i < pConfig->devices; i++) {
+            if (pDevices[i].pTelemetry != NULL) {
+                udp_telemetry_flush(pDevices[i].pTelemetry);
+            }
+            if (pDevices[i].pChannel != NULL) {
+                tcp_channel_stats_t tcpStats;
+                tcp_channel_poll(pDevices[i].pChannel, now_ms);
+                tcp_channel_get_stats(pDevices[i].pChannel, &tcpStats);
+                pending = pending || (tcpStats.buffered > 0);
+            }
+        }
+        if (pending) {
+            usleep(1000);
+        }
+    }
+
+    uint64_t sendErrors = 0;
+    uint64_t reconnects = 0;
+    for (uint32_t i = 0; i < pConfig->devices; i++) {
+        if (pDevices[i].pTelemetry != NULL) {
+            udp_telemetry_stats_t udpStats;
+            udp_telemetry_get_stats(pDevices[i].pTelemetry, &udpStats);
+            sendErrors += udpStats.sendErrors;
+            stats.dropped += udpStats.dropped;
+        }
+        if (pDevices[i].pChannel != NULL) {
+            tcp_channel_stats_t tcpStats;
+            tcp_channel_get_stats(pDevices[i].pChannel, &tcpStats);
+            reconnects += (tcpStats.connects > 0) ? tcpStats.connects - 1 : 0;
+        }
+        close_device(&pDevices[i]);
+    }
+    free(pDevices);
+
+    double seconds = (double)(monotonic_us() - start_us) / 1000000;
+    printf("total: frames %" PRIu64 "  events %" PRIu64 "  dropped %" PRIu64 "  send errors %" PRIu64 "  reconnects %" PRIu64 "  %.0f events/s\n",
+        stats.frames, stats.events, stats.dropped, sendErrors, reconnects, stats.events / seconds);
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "collector.h"
+#include "column_log.h"
+
+static void usage(const char* name);
+
+// ----- implementation -----
+
+void usage(const char* name) {
+    fprintf(stderr,
+        "Usage: %s [options]                 receive and decode device frames\n"
+        "       %s --generate [options]      simulate devices sending to a collector or firmware host\n"
+        "       %s --dump <log>              print a columnar log as CSV\n"
+        "\n"
+        "Collector:\n"
+        "  -u, --udp <port>          UDP port, 0 = off (default %d)\n"
+        "  -t, --tcp <port>          TCP port, 0 = off (default %d)\n"
+        "  -o, --log <path>          write all events to a columnar log\n"
+        "  -i, --interval <s>        report interval (default 1)\n"
+        "  -v, --devices             per device report on exit\n"
+        "\n"
+        "Load generator:\n"
+        "  -H, --host <ip>           collector address (default 127.0.0.1)\n"
+        "  -p, --port <port>         collector port (default %d)\n"
+        "  -T, --transport <name>    udp, telemetry, tcp or tcp-bulk (default udp)\n"
+        "  -n, --count <n>           simulated devices (default 100)\n"
+        "  -r, --rate <hz>           frames per second per device (default 10)\n"
+        "  -e, --events <n>          events per frame (default 1)\n"
+        "\n"
+        "  -d, --duration <s>        stop after this time, 0 = until interrupted (default 0)\n",
+        name, name, name, COLLECTOR_DEFAULT_PORT, COLLECTOR_DEFAULT_PORT, COLLECTOR_DEFAULT_PORT);
+}
+
+int main(int argc, char** argv) {
+    collector_config_t collector = {
+        .udpPort = COLLECTOR_DEFAULT_PORT,
+        .tcpPort = COLLECTOR_DEFAULT_PORT,
+        .reportInterval_s = 1,
+    };
+    loadgen_config_t loadgen = {
+        .hostIP = "127.0.0.1",
+        .port = COLLECTOR_DEFAULT_PORT,
+        .transport = LOADGEN_UDP,
+        .devices = 100,
+        .framesPerSecond = 10,
+        .eventsPerFrame = 1,
+    };
+    bool generate = false;
+    const char* dumpPath = NULL;
+
+    const struct option options[] = {
+        { "udp", required_argument, NULL, 'u' },
+        { "tcp", required_argument, NULL, 't' },
+        { "log", required_argument, NULL, 'o' },
+        { "interval", required_argument, NULL, 'i' },
+        { "devices", no_argument, NULL, 'v' },
+        { "generate", no_argument, NULL, 'g' },
+        { "host", required_argument, NULL, 'H' },
+        { "port", required_argument, NULL, 'p' },
+        { "transport", required_argument, NULL, 'T' },
+        { "count", required_argument, NULL, 'n' },
+        { "rate", required_argument, NULL, 'r' },
+        { "events", required_argument, NULL, 'e' },
+        { "duration", required_argument, NULL, 'd' },
+        { "dump", required_argument, NULL, 'D' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "u:t:o:i:vgH:p:T:n:r:e:d:D:h", options, NULL)) != -1) {
+        switch (opt) {
+            case 'u': collector.udpPort = (uint16_t)atoi(optarg); break;
+            case 't': collector.tcpPort = (uint16_t)atoi(optarg); break;
+            case 'o': collector.logPath = optarg; break;
+            case 'i': collector.reportInterval_s = (uint32_t)atoi(optarg); break;
+            case 'v': collector.perDeviceReport = true; break;
+            case 'g': generate = true; break;
+            case 'H': loadgen.hostIP = optarg; break;
+            case 'p': loadgen.port = (uint16_t)atoi(optarg); break;
+            case 'n': loadgen.devices = (uint32_t)atoi(optarg); break;
+            case 'r': loadgen.framesPerSecond = atof(optarg); break;
+            case 'e': loadgen.eventsPerFrame = (uint8_t)atoi(optarg); break;
+            case 'D': dumpPath = optarg; break;
+            case 'd':
+                collector.duration_s = (uint32_t)atoi(optarg);
+                loadgen.duration_s = collector.duration_s;
+                break;
+            case 'T':
+                if (strcmp(optarg, "udp") == 0) {
+                    loadgen.transport = LOADGEN_UDP;
+                } else if (strcmp(optarg, "telemetry") == 0) {
+                    loadgen.transport = LOADGEN_TELEMETRY;
+                } else if (strcmp(optarg, "tcp") == 0) {
+                    loadgen.transport = LOADGEN_TCP;
+                } else if (strcmp(optarg, "tcp-bulk") == 0) {
+                    loadgen.transport = LOADGEN_TCP_BULK;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+    if (collector.reportInterval_s == 0) {
+        collector.reportInterval_s = 1;
+    }
+
+    if (dumpPath != NULL) {
+        if (column_log_dump(dumpPath, stdout) != 0) {
+            fprintf(stderr, "Unable to read log %s\n", dumpPath);
+            return 1;
+        }
+        return 0;
+    }
+    return generate ? loadgen_run(&loadgen) : collector_run(&collector);
+}
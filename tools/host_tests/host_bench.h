@@ -0,0 +1,59 @@
+#ifndef HOST_BENCH_H
+#define HOST_BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Timing and heap accounting for the host benchmarks. The benchmarks link with
+// -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc, so every allocation of the code under test is
+// counted. Include from one file per benchmark only.
+
+typedef struct {
+    uint64_t count;
+    uint64_t bytes;
+} bench_allocs_t;
+
+static bench_allocs_t gBenchAllocs;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    gBenchAllocs.count++;
+    gBenchAllocs.bytes += size;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    gBenchAllocs.count++;
+    gBenchAllocs.bytes += count * size;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    gBenchAllocs.count++;
+    gBenchAllocs.bytes += size;
+    return __real_realloc(ptr, size);
+}
+
+static inline double bench_now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline bench_allocs_t bench_allocs_since(bench_allocs_t start) {
+    bench_allocs_t allocs = {
+        .count = gBenchAllocs.count - start.count,
+        .bytes = gBenchAllocs.bytes - start.bytes,
+    };
+    return allocs;
+}
+
+// Keeps the compiler from dropping results that are never read
+static volatile uint32_t gBenchSink;
+
+#endif // HOST_BENCH_H
@@ -0,0 +1,41 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Minimal checks for the host tests, a failed check is reported and the test goes on
+
+static int gHostTestFailures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            gHostTestFailures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) do { \
+        long long a_ = (long long)(actual); \
+        long long e_ = (long long)(expected); \
+        if (a_ != e_) { \
+            fprintf(stderr, "%s:%d: CHECK_EQ failed: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, a_, e_); \
+            gHostTestFailures++; \
+        } \
+    } while (0)
+
+#define RUN_TEST(test) do { \
+        fprintf(stderr, "%s\n", #test); \
+        test(); \
+    } while (0)
+
+static inline int host_test_result(void) {
+    if (gHostTestFailures != 0) {
+        fprintf(stderr, "%d check(s) failed\n", gHostTestFailures);
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "all checks passed\n");
+    return EXIT_SUCCESS;
+}
+
+#endif // HOST_TEST_H
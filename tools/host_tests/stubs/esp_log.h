@@ -0,0 +1,26 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+// Host stand-in for the ESP-IDF log, warnings and errors go to stderr
+
+#define ESP_LOGE(tag, format, ...)  fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...)  fprintf(stderr, "W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...)  do { (void)(tag); } while (0)
+#define ESP_LOGD(tag, format, ...)  do { (void)(tag); } while (0)
+#define ESP_LOGV(tag, format, ...)  do { (void)(tag); } while (0)
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+#define ESP_LOG_BUFFER_HEX_LEVEL(tag, buffer, length, level)    do { (void)(tag); } while (0)
+
+#endif // ESP_LOG_H
@@ -0,0 +1,16 @@
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <stdint.h>
+
+// Host stand-in for the FreeRTOS types and macros, with a 1 ms tick. The test provides the functions.
+
+typedef uint32_t TickType_t;
+
+#define portMAX_DELAY           ((TickType_t)0xffffffff)
+#define portTICK_PERIOD_MS      1
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(ms))
+#define pdTRUE                  1
+#define pdFALSE                 0
+
+#endif // FREERTOS_H
@@ -0,0 +1,10 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef void* TaskHandle_t;
+
+void vTaskDelay(TickType_t ticks);
+
+#endif // TASK_H
@@ -0,0 +1,6 @@
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+// The host tests set the options they need as compile definitions
+
+#endif // SDKCONFIG_H